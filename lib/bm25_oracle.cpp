@@ -0,0 +1,741 @@
+// Copyright Vespa.ai. All rights reserved.
+//
+// Computes the exact BM25 top-k hits for a set of queries over a JSON feed, so ranking
+// performance tests can check result quality at corpus sizes where lib/bm25_scorer.rb is too slow.
+//
+// The feed (JSON array or JSONL of put operations, e.g. from the C++ generators) is streamed from
+// a file or stdin into an in-memory inverted index of the given string fields. Queries are read
+// one per line, either as plain text or as fbench URLs with a 'query=' parameter. Each query is an
+// OR of its terms, and a document's score is the sum of bm25(field) over the indexed fields, using
+// the formula from bm25_feature.cpp with k1 = 1.2, b = 0.75 and corpus wide document frequencies,
+// i.e. as a single content node would compute it. A term with a field prefix (e.g. 'body:foo', or
+// 'body:"foo bar"' for all words of a phrase) only matches that field, other terms match all
+// indexed fields. Queries with a prefix naming a field that is not indexed are rejected.
+//
+// Tokenization splits on everything but ASCII letters and digits (bytes >= 0x80 are kept as part
+// of words) and lowercases ASCII, which matches Vespa for fields with 'stemming: none'.
+//
+// Queries are evaluated in parallel, each with block-max MaxScore over posting lists split in
+// blocks of 128 documents. Output is one JSON object per query line:
+//   {"query":"...","totalCount":N,"hits":[{"id":"id:...","relevance":1.23},...]}
+//
+// Compile: g++ -std=c++17 -O3 -pthread -o bm25_oracle bm25_oracle.cpp
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr double k1 = 1.2;
+constexpr double b = 0.75;
+constexpr uint32_t block_size = 128;
+
+/**
+ * Buffered character input over a FILE.
+ */
+class Input {
+    FILE *_file;
+    std::vector<char> _buf;
+    size_t _pos;
+    size_t _len;
+
+    bool fill() {
+        _len = fread(_buf.data(), 1, _buf.size(), _file);
+        _pos = 0;
+        return _len > 0;
+    }
+
+public:
+    explicit Input(FILE *file) : _file(file), _buf(1 << 20), _pos(0), _len(0) {}
+    int peek() {
+        if (_pos == _len && !fill()) {
+            return EOF;
+        }
+        return (unsigned char)_buf[_pos];
+    }
+    int get() {
+        int c = peek();
+        if (c != EOF) {
+            ++_pos;
+        }
+        return c;
+    }
+    int skip_ws() {
+        int c;
+        while ((c = peek()) == ' ' || c == '\n' || c == '\r' || c == '\t') {
+            ++_pos;
+        }
+        return c;
+    }
+    void expect(char expected) {
+        if (skip_ws() != expected) {
+            throw std::runtime_error(std::string("Malformed feed, expected '") + expected + "'");
+        }
+        get();
+    }
+};
+
+void append_utf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back(char(cp));
+    } else if (cp < 0x800) {
+        out.push_back(char(0xc0 | (cp >> 6)));
+        out.push_back(char(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+        out.push_back(char(0xe0 | (cp >> 12)));
+        out.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back(char(0x80 | (cp & 0x3f)));
+    } else {
+        out.push_back(char(0xf0 | (cp >> 18)));
+        out.push_back(char(0x80 | ((cp >> 12) & 0x3f)));
+        out.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back(char(0x80 | (cp & 0x3f)));
+    }
+}
+
+uint32_t read_hex4(Input &in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        int c = in.get();
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        } else {
+            throw std::runtime_error("Malformed \\u escape in feed");
+        }
+    }
+    return value;
+}
+
+// Reads a JSON string (after skipping whitespace) into 'out', decoding escapes.
+void read_string(Input &in, std::string &out) {
+    in.expect('"');
+    out.clear();
+    for (;;) {
+        int c = in.get();
+        if (c == EOF) {
+            throw std::runtime_error("Unterminated string in feed");
+        }
+        if (c == '"') {
+            return;
+        }
+        if (c != '\\') {
+            out.push_back(char(c));
+            continue;
+        }
+        c = in.get();
+        switch (c) {
+        case 'n': out.push_back('\n'); break;
+        case 't': out.push_back('\t'); break;
+        case 'r': out.push_back('\r'); break;
+        case 'b': out.push_back('\b'); break;
+        case 'f': out.push_back('\f'); break;
+        case 'u': {
+            uint32_t cp = read_hex4(in);
+            if (cp >= 0xd800 && cp < 0xdc00 && in.peek() == '\\') {
+                in.get();
+                in.get();
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (read_hex4(in) - 0xdc00);
+            }
+            append_utf8(out, cp);
+            break;
+        }
+        default: out.push_back(char(c));
+        }
+    }
+}
+
+void skip_value(Input &in) {
+    std::string scratch;
+    int c = in.skip_ws();
+    if (c == '"') {
+        read_string(in, scratch);
+    } else if (c == '{' || c == '[') {
+        char close = (c == '{') ? '}' : ']';
+        in.get();
+        if (in.skip_ws() == close) {
+            in.get();
+            return;
+        }
+        for (;;) {
+            if (close == '}') {
+                read_string(in, scratch);
+                in.expect(':');
+            }
+            skip_value(in);
+            c = in.skip_ws();
+            in.get();
+            if (c == close) {
+                return;
+            }
+            if (c != ',') {
+                throw std::runtime_error("Malformed feed, expected ',' or end of container");
+            }
+        }
+    } else {
+        while ((c = in.peek()) != EOF && c != ',' && c != '}' && c != ']' && c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+            in.get();
+        }
+    }
+}
+
+bool is_word_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+template <typename Fn>
+void for_each_token(std::string_view text, std::string &token, Fn fn) {
+    size_t i = 0;
+    while (i < text.size()) {
+        while (i < text.size() && !is_word_char(text[i])) {
+            ++i;
+        }
+        token.clear();
+        while (i < text.size() && is_word_char(text[i])) {
+            char c = text[i++];
+            token.push_back((c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c);
+        }
+        if (!token.empty()) {
+            fn(token);
+        }
+    }
+}
+
+struct Posting {
+    uint32_t doc;
+    uint32_t tf;
+};
+
+struct PostingList {
+    std::vector<Posting> postings;
+    std::vector<uint32_t> block_last_doc;
+    std::vector<double> block_max;
+    double idf = 0.0;
+    double max_score = 0.0;
+};
+
+class FieldIndex {
+    std::string _name;
+    std::unordered_map<std::string, uint32_t> _dictionary;
+    std::vector<PostingList> _lists;
+    std::vector<uint32_t> _field_length;
+    uint64_t _total_length = 0;
+    uint64_t _docs_with_field = 0;
+    double _avg_length = 0.0;
+    std::vector<uint32_t> _doc_terms;
+
+public:
+    explicit FieldIndex(std::string name) : _name(std::move(name)) {}
+    const std::string &name() const { return _name; }
+    double avg_length() const { return _avg_length; }
+
+    void add(uint32_t doc, std::string_view text) {
+        std::string token;
+        _doc_terms.clear();
+        for_each_token(text, token, [&](const std::string &t) {
+            auto it = _dictionary.find(t);
+            if (it == _dictionary.end()) {
+                it = _dictionary.emplace(t, _lists.size()).first;
+                _lists.emplace_back();
+            }
+            _doc_terms.push_back(it->second);
+        });
+        if (_field_length.size() <= doc) {
+            _field_length.resize(doc + 1, 0);
+        }
+        _field_length[doc] += _doc_terms.size();
+        if (_doc_terms.empty()) {
+            return;
+        }
+        _total_length += _doc_terms.size();
+        std::sort(_doc_terms.begin(), _doc_terms.end());
+        for (size_t i = 0; i < _doc_terms.size();) {
+            size_t j = i;
+            while (j < _doc_terms.size() && _doc_terms[j] == _doc_terms[i]) {
+                ++j;
+            }
+            auto &postings = _lists[_doc_terms[i]].postings;
+            if (!postings.empty() && postings.back().doc == doc) {
+                postings.back().tf += j - i;
+            } else {
+                postings.push_back({doc, uint32_t(j - i)});
+            }
+            i = j;
+        }
+    }
+
+    double score(const PostingList &list, const Posting &p) const {
+        double norm = k1 * ((1.0 - b) + b * _field_length[p.doc] / _avg_length);
+        return list.idf * (p.tf * (k1 + 1.0)) / (p.tf + norm);
+    }
+
+    void finish(uint32_t num_docs, double avg_length_override) {
+        _field_length.resize(num_docs, 0);
+        _docs_with_field = std::count_if(_field_length.begin(), _field_length.end(), [](uint32_t l) { return l > 0; });
+        _avg_length = (avg_length_override > 0.0) ? avg_length_override
+                      : (_docs_with_field > 0) ? double(_total_length) / _docs_with_field : 1.0;
+        for (auto &list : _lists) {
+            double df = list.postings.size();
+            list.idf = std::log(1.0 + (num_docs - df + 0.5) / (df + 0.5));
+            for (size_t begin = 0; begin < list.postings.size(); begin += block_size) {
+                size_t end = std::min(list.postings.size(), begin + block_size);
+                double block_max = 0.0;
+                for (size_t i = begin; i < end; ++i) {
+                    block_max = std::max(block_max, score(list, list.postings[i]));
+                }
+                list.block_last_doc.push_back(list.postings[end - 1].doc);
+                list.block_max.push_back(block_max);
+                list.max_score = std::max(list.max_score, block_max);
+            }
+        }
+    }
+
+    const PostingList *lookup(const std::string &term) const {
+        auto it = _dictionary.find(term);
+        return (it == _dictionary.end()) ? nullptr : &_lists[it->second];
+    }
+};
+
+struct Index {
+    std::vector<FieldIndex> fields;
+    std::vector<std::string> ids;
+};
+
+/**
+ * Streams put operations from the feed, indexing the configured fields.
+ */
+void load_feed(FILE *file, Index &index) {
+    Input in(file);
+    std::string key;
+    std::string value;
+    bool array = (in.skip_ws() == '[');
+    if (array) {
+        in.get();
+    }
+    for (;;) {
+        int c = in.skip_ws();
+        if (c == EOF || c == ']') {
+            break;
+        }
+        if (c == ',') {
+            in.get();
+            continue;
+        }
+        in.expect('{');
+        uint32_t doc = index.ids.size();
+        std::string id;
+        bool has_fields = false;
+        while (in.skip_ws() != '}') {
+            read_string(in, key);
+            in.expect(':');
+            if ((key == "put" || key == "id") && in.skip_ws() == '"') {
+                read_string(in, id);
+            } else if (key == "fields" && in.skip_ws() == '{') {
+                has_fields = true;
+                in.get();
+                while (in.skip_ws() != '}') {
+                    read_string(in, key);
+                    in.expect(':');
+                    auto field = std::find_if(index.fields.begin(), index.fields.end(),
+                                              [&](const FieldIndex &f) { return f.name() == key; });
+                    if (field != index.fields.end() && in.skip_ws() == '"') {
+                        read_string(in, value);
+                        field->add(doc, value);
+                    } else {
+                        skip_value(in);
+                    }
+                    if (in.skip_ws() == ',') {
+                        in.get();
+                    }
+                }
+                in.get();
+            } else {
+                skip_value(in);
+            }
+            if (in.skip_ws() == ',') {
+                in.get();
+            }
+        }
+        in.get();
+        if (has_fields) {
+            index.ids.push_back(std::move(id));
+        }
+    }
+}
+
+struct Hit {
+    uint32_t doc;
+    double score;
+};
+
+struct QueryResult {
+    uint64_t total_count = 0;
+    std::vector<Hit> hits;
+};
+
+struct ListIterator {
+    const FieldIndex *field;
+    const PostingList *list;
+    double weight;   // number of occurrences of the term in the query
+    double upper;    // weight * max score
+    size_t pos = 0;
+
+    uint32_t doc() const { return (pos < list->postings.size()) ? list->postings[pos].doc : UINT32_MAX; }
+    // Moves to the first posting with doc >= target, skipping whole blocks.
+    void seek(uint32_t target) {
+        size_t block = pos / block_size;
+        while (block < list->block_last_doc.size() && list->block_last_doc[block] < target) {
+            ++block;
+        }
+        pos = std::max(pos, block * block_size);
+        while (pos < list->postings.size() && list->postings[pos].doc < target) {
+            ++pos;
+        }
+    }
+    // Upper bound of the score for 'target' given the block it would be in.
+    double block_bound(uint32_t target) const {
+        size_t block = pos / block_size;
+        while (block < list->block_last_doc.size() && list->block_last_doc[block] < target) {
+            ++block;
+        }
+        return (block < list->block_max.size()) ? weight * list->block_max[block] : 0.0;
+    }
+    double score() const { return weight * field->score(*list, list->postings[pos]); }
+};
+
+uint64_t count_matches(const std::vector<ListIterator> &lists, std::vector<uint8_t> &seen, size_t num_docs) {
+    seen.assign(num_docs, 0);
+    uint64_t count = 0;
+    for (const auto &it : lists) {
+        for (const auto &p : it.list->postings) {
+            if (!seen[p.doc]) {
+                seen[p.doc] = 1;
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * Exact top-k with block-max MaxScore. Lists are ordered by ascending upper bound; the lists whose
+ * upper bounds sum to at most the current threshold are non-essential, i.e. cannot produce a top-k
+ * document alone, so candidates are only generated from the essential lists.
+ */
+QueryResult evaluate(std::vector<ListIterator> lists, size_t k, bool count_total, size_t num_docs, std::vector<uint8_t> &seen) {
+    QueryResult result;
+    if (count_total) {
+        result.total_count = count_matches(lists, seen, num_docs);
+    }
+    std::sort(lists.begin(), lists.end(), [](const auto &a, const auto &c) { return a.upper < c.upper; });
+    std::vector<double> prefix(lists.size() + 1, 0.0);
+    for (size_t i = 0; i < lists.size(); ++i) {
+        prefix[i + 1] = prefix[i] + lists[i].upper;
+    }
+    auto worse = [](const Hit &a, const Hit &c) { return (a.score != c.score) ? a.score > c.score : a.doc < c.doc; };
+    std::priority_queue<Hit, std::vector<Hit>, decltype(worse)> heap(worse);
+    double threshold = 0.0;
+    size_t essential = 0;
+    while (k > 0) {
+        uint32_t doc = UINT32_MAX;
+        for (size_t i = essential; i < lists.size(); ++i) {
+            doc = std::min(doc, lists[i].doc());
+        }
+        if (doc == UINT32_MAX) {
+            break;
+        }
+        double score = 0.0;
+        for (size_t i = essential; i < lists.size(); ++i) {
+            if (lists[i].doc() == doc) {
+                score += lists[i].score();
+                ++lists[i].pos;
+            }
+        }
+        bool full = (heap.size() == k);
+        if (essential > 0 && full) {
+            double bound = score;
+            for (size_t i = 0; i < essential; ++i) {
+                bound += lists[i].block_bound(doc);
+            }
+            if (bound <= threshold) {
+                continue;
+            }
+        }
+        for (size_t i = essential; i-- > 0;) {
+            if (full && score + prefix[i + 1] <= threshold) {
+                break;
+            }
+            lists[i].seek(doc);
+            if (lists[i].doc() == doc) {
+                score += lists[i].score();
+            }
+        }
+        if (!full || score > threshold) {
+            heap.push({doc, score});
+            if (heap.size() > k) {
+                heap.pop();
+            }
+            if (heap.size() == k) {
+                threshold = heap.top().score;
+                while (essential < lists.size() && prefix[essential + 1] <= threshold) {
+                    ++essential;
+                }
+            }
+        }
+    }
+    while (!heap.empty()) {
+        result.hits.push_back(heap.top());
+        heap.pop();
+    }
+    std::reverse(result.hits.begin(), result.hits.end());
+    return result;
+}
+
+std::string url_decode(std::string_view str) {
+    std::string result;
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] == '+') {
+            result.push_back(' ');
+        } else if (str[i] == '%' && i + 2 < str.size() && isxdigit((unsigned char)str[i + 1]) && isxdigit((unsigned char)str[i + 2])) {
+            result.push_back(char(std::stoi(std::string(str.substr(i + 1, 2)), nullptr, 16)));
+            i += 2;
+        } else {
+            result.push_back(str[i]);
+        }
+    }
+    return result;
+}
+
+// Returns the query text of a line: the 'query' parameter of an fbench URL, or the line itself.
+std::string query_text(const std::string &line) {
+    if (line.empty() || line[0] != '/') {
+        return line;
+    }
+    size_t pos = line.find("query=");
+    while (pos != std::string::npos && pos > 0 && line[pos - 1] != '?' && line[pos - 1] != '&') {
+        pos = line.find("query=", pos + 1);
+    }
+    if (pos == std::string::npos) {
+        return "";
+    }
+    size_t end = line.find('&', pos);
+    return url_decode(std::string_view(line).substr(pos + 6, end == std::string::npos ? std::string::npos : end - pos - 6));
+}
+
+struct QueryTerm {
+    const FieldIndex *field; // nullptr: all indexed fields
+    std::string term;
+    double weight;           // number of occurrences of the term (in the field) in the query
+};
+
+/**
+ * Splits a query in terms, each restricted to the field of its prefix, if any. Throws if a prefix
+ * names a field that is not indexed, as the engine would match terms the oracle cannot score.
+ */
+std::vector<QueryTerm> parse_query(const Index &index, std::string_view text) {
+    std::vector<QueryTerm> terms;
+    std::string token;
+    auto add = [&](const FieldIndex *field, std::string_view words) {
+        for_each_token(words, token, [&](const std::string &t) {
+            auto it = std::find_if(terms.begin(), terms.end(), [&](const QueryTerm &q) { return q.field == field && q.term == t; });
+            if (it == terms.end()) {
+                terms.push_back({field, t, 1.0});
+            } else {
+                it->weight += 1.0;
+            }
+        });
+    };
+    size_t i = 0;
+    while (i < text.size()) {
+        size_t begin = i;
+        while (i < text.size() && text[i] != ' ' && text[i] != ':') {
+            ++i;
+        }
+        if (i == text.size() || text[i] != ':' || i == begin) {
+            add(nullptr, text.substr(begin, i - begin));
+            i += (i < text.size()) ? 1 : 0;
+            continue;
+        }
+        std::string name(text.substr(begin, i - begin));
+        while (!name.empty() && !is_word_char(name.front()) && name.front() != '_') {
+            name.erase(0, 1); // e.g. '+body:foo'
+        }
+        auto field = std::find_if(index.fields.begin(), index.fields.end(), [&](const FieldIndex &f) { return f.name() == name; });
+        if (field == index.fields.end()) {
+            throw std::invalid_argument("field '" + name + "' is not indexed, add -f " + name);
+        }
+        begin = ++i;
+        if (i < text.size() && text[i] == '"') {
+            begin = ++i;
+            while (i < text.size() && text[i] != '"') {
+                ++i;
+            }
+        } else {
+            while (i < text.size() && text[i] != ' ') {
+                ++i;
+            }
+        }
+        add(&*field, text.substr(begin, i - begin));
+        i += (i < text.size()) ? 1 : 0;
+    }
+    return terms;
+}
+
+std::vector<ListIterator> make_lists(const Index &index, const std::vector<QueryTerm> &terms) {
+    std::vector<ListIterator> lists;
+    for (const auto &field : index.fields) {
+        for (const auto &term : terms) {
+            if (term.field != nullptr && term.field != &field) {
+                continue;
+            }
+            const PostingList *list = field.lookup(term.term);
+            if (list != nullptr) {
+                lists.push_back({&field, list, term.weight, term.weight * list->max_score});
+            }
+        }
+    }
+    return lists;
+}
+
+void append_json_string(std::string &out, std::string_view str) {
+    out.push_back('"');
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(char(c));
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out.append(buf);
+        } else {
+            out.push_back(char(c));
+        }
+    }
+    out.push_back('"');
+}
+
+void usage(const char *prog) {
+    std::cerr << prog << " -f <field> [-f <field>...] -q <query file> [options] [feed file, default stdin]" << std::endl
+              << "  -k <hits>         hits per query (default 10)" << std::endl
+              << "  -a <avg length>   average field length to use instead of the one from the feed" << std::endl
+              << "  -c                also compute totalCount (documents matching any query term)" << std::endl
+              << "  -t <threads>      threads evaluating queries (default: hardware concurrency)" << std::endl;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    Index index;
+    std::string query_file;
+    size_t k = 10;
+    double avg_length = 0.0;
+    bool count_total = false;
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    int option;
+    while ((option = getopt(argc, argv, "f:q:k:a:ct:h")) != -1) {
+        switch (option) {
+        case 'f': index.fields.emplace_back(optarg); break;
+        case 'q': query_file = optarg; break;
+        case 'k': k = std::stoul(optarg); break;
+        case 'a': avg_length = std::stod(optarg); break;
+        case 'c': count_total = true; break;
+        case 't': num_threads = std::max(1, std::stoi(optarg)); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (index.fields.empty() || query_file.empty() || argc - optind > 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    FILE *feed = (optind < argc) ? fopen(argv[optind], "r") : stdin;
+    FILE *queries = fopen(query_file.c_str(), "r");
+    if (feed == nullptr || queries == nullptr) {
+        perror("fopen");
+        return 1;
+    }
+    try {
+        load_feed(feed, index);
+    } catch (const std::exception &e) {
+        std::cerr << "Failed reading feed after " << index.ids.size() << " documents: " << e.what() << std::endl;
+        return 1;
+    }
+    for (auto &field : index.fields) {
+        field.finish(index.ids.size(), avg_length);
+        std::cerr << "Indexed field '" << field.name() << "' for " << index.ids.size()
+                  << " documents, average length " << field.avg_length() << std::endl;
+    }
+
+    std::vector<std::string> lines;
+    char *line = nullptr;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, queries)) > 0) {
+        lines.emplace_back(line, (line[len - 1] == '\n') ? len - 1 : len);
+    }
+    free(line);
+    std::vector<std::string> texts;
+    std::vector<std::vector<QueryTerm>> queries_terms;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        texts.push_back(query_text(lines[i]));
+        try {
+            queries_terms.push_back(parse_query(index, texts.back()));
+        } catch (const std::exception &e) {
+            std::cerr << "Query " << (i + 1) << " '" << texts.back() << "': " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::string> output(lines.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&]() {
+            std::vector<uint8_t> seen;
+            for (size_t i = next++; i < lines.size(); i = next++) {
+                QueryResult result = evaluate(make_lists(index, queries_terms[i]), k, count_total, index.ids.size(), seen);
+                std::string &out = output[i];
+                out = "{\"query\":";
+                append_json_string(out, texts[i]);
+                if (count_total) {
+                    out += ",\"totalCount\":" + std::to_string(result.total_count);
+                }
+                out += ",\"hits\":[";
+                for (size_t h = 0; h < result.hits.size(); ++h) {
+                    char buf[64];
+                    out += (h > 0) ? ",{\"id\":" : "{\"id\":";
+                    append_json_string(out, index.ids[result.hits[h].doc]);
+                    out.append(buf, snprintf(buf, sizeof(buf), ",\"relevance\":%.17g}", result.hits[h].score));
+                }
+                out += "]}\n";
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const auto &out : output) {
+        fwrite(out.data(), 1, out.size(), stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+require 'json'
+
+# Expected BM25 top hits for a generated feed, computed by lib/bm25_oracle.cpp on a node.
+# Use this to verify result quality of ranking performance tests at full corpus size;
+# Bm25Scorer covers the small in-memory cases.
+class Bm25Oracle
+
+  def initialize(node)
+    @node = node
+    @binary = DataGenerator.compile_tool(node, 'bm25_oracle.cpp', flags: '-std=c++17 -O3 -pthread')
+  end
+
+  # Runs the oracle and returns the name of the file with expected hits, one JSON object per query line.
+  # 'feed' is either a feed file or a command writing the feed to stdout (e.g. a generator).
+  def compute(feed:, query_file:, fields:, output:, hits: 10, total_count: false, threads: nil, feed_is_command: false)
+    args = fields.map { |f| "-f #{f}" }
+    args << "-q #{query_file}" << "-k #{hits}"
+    args << "-c" if total_count
+    args << "-t #{threads}" if threads
+    command = feed_is_command ? "#{feed} | #{@binary} #{args.join(' ')}" : "#{@binary} #{args.join(' ')} #{feed}"
+    @node.execute("#{command} > #{output}")
+    output
+  end
+
+  # Parses the oracle output into one { 'query', 'totalCount', 'hits' => [{ 'id', 'relevance' }] } per query.
+  def self.parse(text)
+    text.each_line.map { |line| JSON.parse(line) }
+  end
+
+  # Fraction of the expected hit ids that are present among the actual hit ids.
+  def self.recall(expected, actual_ids)
+    expected_ids = expected['hits'].map { |hit| hit['id'] }
+    return 1.0 if expected_ids.empty?
+    (expected_ids & actual_ids).size.to_f / expected_ids.size
+  end
+
+end
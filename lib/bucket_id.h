@@ -0,0 +1,278 @@
+// Copyright Vespa.ai. All rights reserved.
+// Document id to bucket id mapping for C++ feed generators, header only.
+//
+// Mirrors document::BucketIdFactory: the location is the number of an n= id, the md5 of the
+// group of a g= id, or the md5 of the whole id otherwise. The 58 bit raw bucket id holds the
+// lower 32 location bits below bits taken from the global id (md5 of the whole id). A bucket
+// using 'bits' bits is the raw id masked to its lower 'bits' bits.
+//
+// BucketSkew and find_group/find_location let generators place an exact share of the feed in a
+// chosen number of buckets at a given split level (up to the 32 location bits).
+//
+// Compile generators using this with: g++ -std=c++17 -O3 -I<system-test>/lib ...
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace bucketid {
+
+constexpr uint32_t max_used_bits = 58;
+constexpr uint32_t location_bits = 32;
+
+struct Md5 {
+    uint8_t digest[16];
+};
+
+inline Md5 md5(std::string_view data) {
+    static constexpr uint32_t k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+    static constexpr uint8_t r[64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+    uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    auto block = [&](const uint8_t *p) {
+        uint32_t w[16];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = uint32_t(p[i * 4]) | (uint32_t(p[i * 4 + 1]) << 8) |
+                   (uint32_t(p[i * 4 + 2]) << 16) | (uint32_t(p[i * 4 + 3]) << 24);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t f;
+            int g;
+            if (i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            } else if (i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) & 15;
+            } else if (i < 48) {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) & 15;
+            } else {
+                f = c ^ (b | ~d);
+                g = (7 * i) & 15;
+            }
+            uint32_t tmp = d;
+            d = c;
+            c = b;
+            uint32_t x = a + f + k[i] + w[g];
+            b = b + ((x << r[i]) | (x >> (32 - r[i])));
+            a = tmp;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    };
+    const auto *p = reinterpret_cast<const uint8_t *>(data.data());
+    size_t n = data.size();
+    for (; n >= 64; n -= 64, p += 64) {
+        block(p);
+    }
+    uint8_t tail[128] = {};
+    memcpy(tail, p, n);
+    tail[n] = 0x80;
+    size_t tail_size = (n < 56) ? 64 : 128;
+    uint64_t bit_len = uint64_t(data.size()) * 8;
+    for (int i = 0; i < 8; ++i) {
+        tail[tail_size - 8 + i] = uint8_t(bit_len >> (8 * i));
+    }
+    block(tail);
+    if (tail_size == 128) {
+        block(tail + 64);
+    }
+    Md5 result;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            result.digest[i * 4 + j] = uint8_t(h[i] >> (8 * j));
+        }
+    }
+    return result;
+}
+
+inline uint64_t first_word(const Md5 &hash) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | hash.digest[i];
+    }
+    return value;
+}
+
+/**
+ * Location of a document id of the form id:<namespace>:<type>:<key/value-pairs>:<user specified>.
+ */
+inline uint64_t location(std::string_view id) {
+    size_t pos = 0;
+    for (int i = 0; i < 3 && pos != std::string_view::npos; ++i) {
+        pos = id.find(':', pos);
+        pos = (pos == std::string_view::npos) ? pos : pos + 1;
+    }
+    if (pos != std::string_view::npos) {
+        std::string_view pairs = id.substr(pos, id.find(':', pos) - pos);
+        if (pairs.substr(0, 2) == "n=") {
+            uint64_t number = 0;
+            for (char c : pairs.substr(2)) {
+                number = number * 10 + (c - '0');
+            }
+            return number;
+        }
+        if (pairs.substr(0, 2) == "g=") {
+            return first_word(md5(pairs.substr(2)));
+        }
+    }
+    return first_word(md5(id));
+}
+
+/**
+ * Raw bucket id using all 58 bits, without the used bits count.
+ */
+inline uint64_t raw_bucket(std::string_view id) {
+    constexpr uint64_t location_mask = (uint64_t(1) << location_bits) - 1;
+    constexpr uint64_t gid_mask = ((uint64_t(1) << max_used_bits) - 1) & ~location_mask;
+    return (first_word(md5(id)) & gid_mask) | (location(id) & location_mask);
+}
+
+/**
+ * The bucket holding the document id when buckets use 'used_bits' bits,
+ * e.g. the distribution bit count for the top level (super) buckets.
+ */
+inline uint64_t bucket(std::string_view id, uint32_t used_bits) {
+    return raw_bucket(id) & ((uint64_t(1) << used_bits) - 1);
+}
+
+inline uint64_t mask(uint32_t used_bits) {
+    return (used_bits >= 64) ? ~uint64_t(0) : (uint64_t(1) << used_bits) - 1;
+}
+
+inline uint64_t mix(uint64_t x) {
+    // splitmix64
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * An n= location in 'bucket' (using 'used_bits' <= 32 bits); 'salt' chooses among them.
+ */
+inline uint64_t find_location(uint64_t bucket, uint32_t used_bits, uint64_t salt) {
+    return ((salt << used_bits) | bucket) & mask(location_bits);
+}
+
+/**
+ * A g= group name '<prefix><n>' whose location is in 'bucket' (using 'used_bits' <= 32 bits),
+ * found by trying n = start, start + 1, ... Expect about 2^used_bits md5 computations.
+ */
+inline std::string find_group(uint64_t bucket, uint32_t used_bits, const std::string &prefix, uint64_t start = 0) {
+    for (uint64_t n = start;; ++n) {
+        std::string group = prefix + std::to_string(n);
+        if ((first_word(md5(group)) & mask(used_bits)) == bucket) {
+            return group;
+        }
+    }
+}
+
+/**
+ * Chooses which documents go to 'num_hot' hot buckets at 'used_bits' bits, so that exactly
+ * 'hot_share' of the documents (spread evenly over the feed) are hot. Hot documents are given
+ * the hot buckets round robin, and other documents buckets drawn uniformly from the rest.
+ */
+class BucketSkew {
+    uint32_t _used_bits;
+    double _hot_share;
+    std::vector<uint64_t> _hot;
+    uint64_t _seed;
+    uint64_t _next_hot;
+
+public:
+    BucketSkew(uint32_t used_bits, uint64_t num_hot, double hot_share, uint64_t seed)
+        : _used_bits(std::min(used_bits, location_bits)),
+          _hot_share(hot_share),
+          _hot(),
+          _seed(seed),
+          _next_hot(0)
+    {
+        num_hot = std::min(num_hot, mask(_used_bits));
+        for (uint64_t i = 0; _hot.size() < num_hot; ++i) {
+            uint64_t bucket = mix(seed ^ i) & mask(_used_bits);
+            if (!is_hot(bucket)) {
+                _hot.push_back(bucket);
+            }
+        }
+    }
+    uint32_t used_bits() const { return _used_bits; }
+    const std::vector<uint64_t> &hot_buckets() const { return _hot; }
+    bool is_hot(uint64_t bucket) const { return std::find(_hot.begin(), _hot.end(), bucket) != _hot.end(); }
+    bool is_hot_location(uint64_t location) const { return is_hot(location & mask(_used_bits)); }
+
+    /**
+     * Whether document number 'doc' (0, 1, ...) is hot.
+     */
+    bool hot(uint64_t doc) const {
+        return !_hot.empty() && (uint64_t((doc + 1) * _hot_share) > uint64_t(doc * _hot_share));
+    }
+    /**
+     * Index in hot_buckets() of the next hot document.
+     */
+    size_t next_hot() { return _next_hot++ % _hot.size(); }
+    /**
+     * A bucket that is not hot for document number 'doc'.
+     */
+    uint64_t cold(uint64_t doc) const {
+        for (uint64_t i = 0;; ++i) {
+            uint64_t bucket = mix(_seed ^ mix(doc) ^ i) & mask(_used_bits);
+            if (!is_hot(bucket)) {
+                return bucket;
+            }
+        }
+    }
+};
+
+/**
+ * Number of documents per bucket at a given split level, for reporting the realized skew.
+ */
+class BucketHistogram {
+    uint32_t _used_bits;
+    std::unordered_map<uint64_t, uint64_t> _counts;
+    uint64_t _total;
+
+public:
+    explicit BucketHistogram(uint32_t used_bits) : _used_bits(used_bits), _counts(), _total(0) {}
+    void add(std::string_view id) {
+        ++_counts[bucket(id, _used_bits)];
+        ++_total;
+    }
+    /**
+     * Writes the number of documents and buckets, and the share of documents in the 'top' largest buckets.
+     */
+    void report(FILE *out, size_t top = 10) const {
+        std::vector<uint64_t> sizes;
+        for (const auto &entry : _counts) {
+            sizes.push_back(entry.second);
+        }
+        std::sort(sizes.begin(), sizes.end(), std::greater<>());
+        fprintf(out, "bits %u: %lu documents in %zu buckets\n", _used_bits, _total, sizes.size());
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < std::min(top, sizes.size()); ++i) {
+            cumulative += sizes[i];
+            fprintf(out, "  top %zu buckets: %lu documents (%.2f%%)\n", i + 1, cumulative, 100.0 * cumulative / _total);
+        }
+    }
+};
+
+}
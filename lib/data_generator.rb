@@ -5,11 +5,35 @@ require 'erb'
 class DataGenerator
 
   def initialize
-    lib_dir = File.dirname(__FILE__)
-    @cat = "cat #{lib_dir}/gpt-2-webtext-tally.txt"
+    lib_dir = DataGenerator.lib_dir
+    @cat = "cat #{DataGenerator.tally_file}"
     @run = "java #{lib_dir}/DataGenerator.java"
   end
 
+  # Directory with DataGenerator.java and text_generator.h, for use as include path when compiling C++ generators.
+  def self.lib_dir
+    File.dirname(__FILE__)
+  end
+
+  # Compiles a C++ tool in this directory (e.g. 'latency_histogram.cpp') into the tmp bin dir of a node, with
+  # this directory as include path, and returns the path of the binary. A binary compiled earlier by this
+  # process is reused as long as it is still there, so tool wrappers can call this for every instance.
+  def self.compile_tool(node, source, flags: '-std=c++17 -O3', libs: '')
+    path = "#{node.create_tmp_bin_dir}/#{File.basename(source, '.cpp')}"
+    @compiled_tools ||= {}
+    key = "#{node.name}:#{path}"
+    unless @compiled_tools[key] && node.file?(path)
+      node.execute("g++ #{flags} -I#{lib_dir} -o #{path} #{lib_dir}/#{source} #{libs}".strip)
+      @compiled_tools[key] = true
+    end
+    path
+  end
+
+  # Word frequencies from gpt-2 webtext, one '<count> <word>' per line.
+  def self.tally_file
+    "#{lib_dir}/gpt-2-webtext-tally.txt"
+  end
+
   # A command which digests the output of a prior command, computing word frequencies.
   def digest_command(command:, cutoff: nil)
     "#{command} | #{@run} digest#{" cutoff #{cutoff}" if cutoff}"
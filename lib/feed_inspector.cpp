@@ -0,0 +1,864 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// Statistics of a feed file: what a multi-GB feed written by one of the generators actually contains.
+//
+// The file is memory mapped and may be a JSON array of operations (as written by make_docs, mixed_tensors/data_gen,
+// tensor_update/data_generator and most other generators, also when pretty printed over several lines) or JSONL.
+// Operations are puts ('put' or legacy 'id' with 'fields'), updates and removes in the document JSON format.
+//
+// Operations are found with the parallel structural scan of feed_scanner.h, and then parsed by the threads (-t)
+// in batches, with large arrays, maps and dense tensor values skipped or counted by the same scan rather than
+// parsed element by element. Per thread statistics are merged at the end.
+//
+// Reported are the number of operations of each kind with size distributions, document types, conditions
+// and create-if-nonexistent, and per field: how many operations set it, value types, value size, string
+// length, array/map/weighted set size, estimated cardinality (HyperLogLog), update operations, and for tensors
+// the JSON forms used (cells, short form cells, dense values, hex values, blocks), cells per value, dimension
+// names and estimated label cardinality. Distributions have about 6% precision.
+//
+// The text summary goes to stdout, and with -o the same as JSON, for embedding in perf reports (see Perf::FeedInspector).
+//
+// Compile with: g++ -std=c++17 -O3 -pthread -o feed_inspector feed_inspector.cpp
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "feed_scanner.h"
+
+namespace {
+
+using feedscan::Parser;
+
+/**
+ * Log-linear histogram of non-negative integers with 16 sub-buckets per power of two.
+ */
+class Histogram {
+public:
+    void add(uint64_t v) {
+        size_t i = index(v);
+        if (i >= _counts.size()) {
+            _counts.resize(i + 1);
+        }
+        ++_counts[i];
+        _min = (_count == 0) ? v : std::min(_min, v);
+        _max = std::max(_max, v);
+        _sum += v;
+        ++_count;
+    }
+
+    void merge(const Histogram &other) {
+        if (other._count == 0) {
+            return;
+        }
+        if (other._counts.size() > _counts.size()) {
+            _counts.resize(other._counts.size());
+        }
+        for (size_t i = 0; i < other._counts.size(); ++i) {
+            _counts[i] += other._counts[i];
+        }
+        _min = (_count == 0) ? other._min : std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+        _sum += other._sum;
+        _count += other._count;
+    }
+
+    uint64_t count() const { return _count; }
+    uint64_t min() const { return _min; }
+    uint64_t max() const { return _max; }
+    double mean() const { return _count > 0 ? double(_sum) / _count : 0.0; }
+
+    // Middle of the bucket holding the value at percentile p, clamped to the exact min and max.
+    uint64_t percentile(double p) const {
+        if (_count == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100.0 * _count)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < _counts.size(); ++i) {
+            seen += _counts[i];
+            if (seen >= rank) {
+                uint64_t mid = lower(i) + (lower(i + 1) - lower(i)) / 2;
+                return std::clamp(mid, _min, _max);
+            }
+        }
+        return _max;
+    }
+
+    // Counts per power of two: [(upper bound exclusive, count)].
+    std::vector<std::pair<uint64_t, uint64_t>> powers() const {
+        std::vector<std::pair<uint64_t, uint64_t>> result;
+        for (size_t i = 0; i < _counts.size(); ++i) {
+            if (_counts[i] == 0) {
+                continue;
+            }
+            uint64_t v = lower(i);
+            uint64_t upper = (v == 0) ? 1 : (v >= (uint64_t(1) << 63)) ? UINT64_MAX : uint64_t(1) << (64 - __builtin_clzll(v));
+            if (result.empty() || result.back().first != upper) {
+                result.emplace_back(upper, 0);
+            }
+            result.back().second += _counts[i];
+        }
+        return result;
+    }
+
+private:
+    std::vector<uint64_t> _counts;
+    uint64_t _count = 0;
+    uint64_t _min = 0;
+    uint64_t _max = 0;
+    uint64_t _sum = 0;
+
+    static size_t index(uint64_t v) {
+        if (v < 16) {
+            return v;
+        }
+        int k = 63 - __builtin_clzll(v);
+        return 16 + size_t(k - 4) * 16 + ((v >> (k - 4)) & 15);
+    }
+    static uint64_t lower(size_t i) {
+        if (i < 16) {
+            return i;
+        }
+        size_t k = (i - 16) / 16 + 4;
+        if (k >= 64) {
+            return UINT64_MAX;
+        }
+        return (uint64_t(16 + (i - 16) % 16)) << (k - 4);
+    }
+};
+
+uint64_t hash_bytes(std::string_view s) {
+    const uint64_t m = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = s.size() * m;
+    size_t i = 0;
+    for (; i + 8 <= s.size(); i += 8) {
+        uint64_t w;
+        memcpy(&w, s.data() + i, 8);
+        h = (h ^ (w * 0xbf58476d1ce4e5b9ULL)) * m;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, s.data() + i, s.size() - i);
+    h = (h ^ (tail * 0xbf58476d1ce4e5b9ULL)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/**
+ * HyperLogLog distinct count estimate with 2^12 registers (about 1.6% standard error).
+ */
+class Cardinality {
+public:
+    void add(std::string_view value) {
+        if (_registers.empty()) {
+            _registers.resize(REGISTERS);
+        }
+        uint64_t h = hash_bytes(value);
+        size_t reg = h >> (64 - BITS);
+        uint8_t rank = uint8_t(std::min(__builtin_clzll((h << BITS) | (uint64_t(1) << (BITS - 1))) + 1, 64 - BITS + 1));
+        _registers[reg] = std::max(_registers[reg], rank);
+    }
+
+    void merge(const Cardinality &other) {
+        if (other._registers.empty()) {
+            return;
+        }
+        if (_registers.empty()) {
+            _registers.resize(REGISTERS);
+        }
+        for (size_t i = 0; i < REGISTERS; ++i) {
+            _registers[i] = std::max(_registers[i], other._registers[i]);
+        }
+    }
+
+    uint64_t estimate() const {
+        if (_registers.empty()) {
+            return 0;
+        }
+        double sum = 0.0;
+        size_t zeros = 0;
+        for (uint8_t r : _registers) {
+            sum += std::ldexp(1.0, -r);
+            zeros += (r == 0);
+        }
+        double m = REGISTERS;
+        double e = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+        if (e <= 2.5 * m && zeros > 0) {
+            e = m * std::log(m / zeros);
+        }
+        return uint64_t(e + 0.5);
+    }
+
+private:
+    static constexpr int BITS = 12;
+    static constexpr size_t REGISTERS = size_t(1) << BITS;
+    std::vector<uint8_t> _registers;
+};
+
+template <typename K>
+void merge_counts(std::map<K, uint64_t> &into, const std::map<K, uint64_t> &from) {
+    for (const auto &[key, count] : from) {
+        into[key] += count;
+    }
+}
+
+struct TensorStats {
+    std::map<std::string, uint64_t> forms;
+    Histogram cells;
+    Histogram hex_bytes;
+    std::set<std::string_view> dimensions;
+    Cardinality labels;
+
+    void merge(const TensorStats &other) {
+        merge_counts(forms, other.forms);
+        cells.merge(other.cells);
+        hex_bytes.merge(other.hex_bytes);
+        dimensions.insert(other.dimensions.begin(), other.dimensions.end());
+        labels.merge(other.labels);
+    }
+};
+
+enum Type { STRING, NUMBER, BOOL, NUL, ARRAY, OBJECT, TENSOR, NUM_TYPES };
+const char *type_names[NUM_TYPES] = {"string", "number", "bool", "null", "array", "object", "tensor"};
+
+Type type_of(char first) {
+    switch (first) {
+    case '"': return STRING;
+    case 't': case 'f': return BOOL;
+    case 'n': return NUL;
+    case '[': return ARRAY;
+    case '{': return OBJECT;
+    default: return NUMBER;
+    }
+}
+
+struct FieldStats {
+    uint64_t count = 0;
+    uint64_t types[NUM_TYPES] = {};
+    Histogram bytes;
+    Histogram string_length;
+    Histogram elements;
+    Cardinality values;
+    std::map<std::string_view, uint64_t> update_ops;
+    TensorStats tensor;
+    bool has_tensor = false;
+
+    void merge(const FieldStats &other) {
+        count += other.count;
+        for (int t = 0; t < NUM_TYPES; ++t) {
+            types[t] += other.types[t];
+        }
+        bytes.merge(other.bytes);
+        string_length.merge(other.string_length);
+        elements.merge(other.elements);
+        values.merge(other.values);
+        merge_counts(update_ops, other.update_ops);
+        if (other.has_tensor) {
+            tensor.merge(other.tensor);
+            has_tensor = true;
+        }
+    }
+};
+
+struct OpStats {
+    uint64_t count = 0;
+    Histogram bytes;
+    Histogram fields;
+};
+
+/**
+ * Statistics of the operations parsed by one thread, merged at the end. Names are views into the mapped file.
+ */
+struct Stats {
+    std::map<std::string, OpStats> ops;
+    std::map<std::string_view, uint64_t> doc_types;
+    Cardinality ids;
+    uint64_t conditions = 0;
+    uint64_t creates = 0;
+    uint64_t errors = 0;
+    std::unordered_map<std::string_view, FieldStats> fields;
+
+    void merge(const Stats &other) {
+        for (const auto &[name, op] : other.ops) {
+            OpStats &into = ops[name];
+            into.count += op.count;
+            into.bytes.merge(op.bytes);
+            into.fields.merge(op.fields);
+        }
+        merge_counts(doc_types, other.doc_types);
+        ids.merge(other.ids);
+        conditions += other.conditions;
+        creates += other.creates;
+        errors += other.errors;
+        for (const auto &[name, field] : other.fields) {
+            fields[name].merge(field);
+        }
+    }
+};
+
+class Inspector {
+public:
+    explicit Inspector(Stats &s) : stats(s) {}
+
+    // Parses the operation at [begin, end), where end is the start of the next one.
+    void operation(const char *begin, const char *end) {
+        _end = end;
+        Parser parser(begin, end);
+        std::string_view op = "unknown";
+        std::string_view id;
+        const char *fields_at = nullptr;
+        uint64_t num_fields = 0;
+        bool ok = parser.expect('{');
+        if (ok && !parser.expect('}')) {
+            do {
+                std::string_view key;
+                if (!parser.string(key) || !parser.expect(':')) {
+                    ok = false;
+                    break;
+                }
+                uint64_t elements;
+                if (key == "put" || key == "update" || key == "remove" || key == "id") {
+                    if (!parser.string(id)) {
+                        ok = false;
+                        break;
+                    }
+                    op = (key == "id") ? std::string_view("put") : key;
+                    continue;
+                }
+                if (key == "fields" && !id.empty()) {
+                    // The operation normally comes first, so the fields are parsed right away.
+                    if (!fields(parser, op == "update", num_fields)) {
+                        ok = false;
+                        break;
+                    }
+                    continue;
+                }
+                if (key == "fields") {
+                    parser.ws();
+                    fields_at = parser.pos();
+                } else if (key == "condition") {
+                    ++stats.conditions;
+                } else if (key == "create") {
+                    parser.ws();
+                    stats.creates += (parser.pos() < end && *parser.pos() == 't');
+                }
+                if (!parser.skip(elements)) {
+                    ok = false;
+                    break;
+                }
+            } while (parser.expect(','));
+            ok = ok && parser.expect('}');
+        }
+        if (!ok || id.empty()) {
+            ++stats.errors;
+            return;
+        }
+        OpStats &op_stats = stats.ops[std::string(op)];
+        ++op_stats.count;
+        op_stats.bytes.add(parser.pos() - begin);
+        stats.ids.add(id);
+        // id:<namespace>:<type>:<key/value>:<local id>
+        size_t first = id.find(':');
+        size_t second = (first == std::string_view::npos) ? first : id.find(':', first + 1);
+        size_t third = (second == std::string_view::npos) ? second : id.find(':', second + 1);
+        if (third != std::string_view::npos) {
+            ++stats.doc_types[id.substr(second + 1, third - second - 1)];
+        }
+        if (fields_at != nullptr) {
+            Parser later(fields_at, end);
+            if (!fields(later, op == "update", num_fields)) {
+                ++stats.errors;
+            }
+        }
+        op_stats.fields.add(num_fields);
+    }
+
+private:
+    Stats &stats;
+    const char *_end = nullptr;
+
+    bool fields(Parser &parser, bool update, uint64_t &count) {
+        if (!parser.expect('{')) {
+            return false;
+        }
+        if (parser.expect('}')) {
+            return true;
+        }
+        do {
+            std::string_view name;
+            if (!parser.string(name) || !parser.expect(':')) {
+                return false;
+            }
+            FieldStats &field = stats.fields[name];
+            ++field.count;
+            ++count;
+            if (!(update ? update_field(parser, field) : value(parser, field))) {
+                return false;
+            }
+        } while (parser.expect(','));
+        return parser.expect('}');
+    }
+
+    static bool is_tensor_key(std::string_view key) {
+        return key == "cells" || key == "values" || key == "blocks" || key == "addresses";
+    }
+
+    // A field value of a put or an assign: type, size and cardinality, and tensor forms.
+    bool value(Parser &parser, FieldStats &field) {
+        parser.ws();
+        const char *start = parser.pos();
+        if (parser.peek('{') && tensor(parser, field)) {
+            field.values.add(std::string_view(start, parser.pos() - start));
+            field.bytes.add(parser.pos() - start);
+            return true;
+        }
+        parser = Parser(start, _end);
+        uint64_t elements;
+        if (!parser.skip(elements)) {
+            return false;
+        }
+        std::string_view raw(start, parser.pos() - start);
+        Type type = type_of(*start);
+        ++field.types[type];
+        field.bytes.add(raw.size());
+        field.values.add(raw);
+        if (type == STRING) {
+            field.string_length.add(raw.size() - 2);
+        } else if (type == ARRAY || type == OBJECT) {
+            field.elements.add(elements);
+        }
+        return true;
+    }
+
+    // Tensor JSON forms, returns false (with the parser anywhere) if the object is not a tensor.
+    bool tensor(Parser &parser, FieldStats &field) {
+        Parser probe = parser;
+        probe.expect('{');
+        std::string_view key;
+        if (!probe.string(key) || !is_tensor_key(key)) {
+            if (key != "type" && key != "operation") {
+                return false;
+            }
+        }
+        parser.expect('{');
+        uint64_t cells = 0;
+        std::string form;
+        do {
+            if (!parser.string(key) || !parser.expect(':')) {
+                return false;
+            }
+            if (key == "cells" && parser.peek('[')) {
+                form = "cells";
+                if (!address_list(parser, field, cells)) {
+                    return false;
+                }
+            } else if ((key == "cells" || key == "blocks") && parser.peek('{')) {
+                // Short forms: {"label": value} for mapped, {"label": [values]} for mixed.
+                form = (key == "cells") ? "cells-short" : "blocks-short";
+                parser.expect('{');
+                if (!parser.expect('}')) {
+                    do {
+                        std::string_view label;
+                        if (!parser.string(label) || !parser.expect(':')) {
+                            return false;
+                        }
+                        field.tensor.labels.add(label);
+                        if (!parser.count_numbers(cells)) {
+                            return false;
+                        }
+                    } while (parser.expect(','));
+                    if (!parser.expect('}')) {
+                        return false;
+                    }
+                }
+            } else if (key == "blocks" && parser.peek('[')) {
+                form = "blocks";
+                if (!address_list(parser, field, cells)) {
+                    return false;
+                }
+            } else if (key == "values" && parser.peek('"')) {
+                form = "values-hex";
+                std::string_view hex;
+                if (!parser.string(hex)) {
+                    return false;
+                }
+                field.tensor.hex_bytes.add(hex.size() / 2);
+            } else if (key == "values") {
+                form = "values";
+                if (!parser.count_numbers(cells)) {
+                    return false;
+                }
+            } else if (key == "addresses" && parser.peek('[')) {
+                form = "addresses";
+                if (!address_list(parser, field, cells)) {
+                    return false;
+                }
+            } else {
+                uint64_t elements;
+                if (!parser.skip(elements)) {
+                    return false;
+                }
+            }
+        } while (parser.expect(','));
+        if (!parser.expect('}') || form.empty()) {
+            return false;
+        }
+        ++field.types[TENSOR];
+        field.has_tensor = true;
+        ++field.tensor.forms[form];
+        if (form != "values-hex") {
+            field.tensor.cells.add(cells);
+        }
+        return true;
+    }
+
+    // [{"address": {"dim": "label", ...}, "value(s)": ...}, ...] or a list of bare addresses.
+    bool address_list(Parser &parser, FieldStats &field, uint64_t &cells) {
+        parser.expect('[');
+        if (parser.expect(']')) {
+            return true;
+        }
+        do {
+            if (!parser.expect('{')) {
+                return false;
+            }
+            bool bare = true;
+            do {
+                std::string_view key;
+                if (!parser.string(key) || !parser.expect(':')) {
+                    return false;
+                }
+                if (key == "address" && parser.peek('{')) {
+                    bare = false;
+                    if (!address(parser, field)) {
+                        return false;
+                    }
+                } else if (key == "values") {
+                    bare = false;
+                    if (!parser.count_numbers(cells)) {
+                        return false;
+                    }
+                } else if (key == "value") {
+                    bare = false;
+                    ++cells;
+                    uint64_t elements;
+                    if (!parser.skip(elements)) {
+                        return false;
+                    }
+                } else {
+                    // A bare address: {"dim": "label"}
+                    field.tensor.dimensions.insert(key);
+                    std::string_view label;
+                    if (!parser.string(label)) {
+                        return false;
+                    }
+                    field.tensor.labels.add(label);
+                }
+            } while (parser.expect(','));
+            if (!parser.expect('}')) {
+                return false;
+            }
+            cells += bare ? 1 : 0;
+        } while (parser.expect(','));
+        return parser.expect(']');
+    }
+
+    bool address(Parser &parser, FieldStats &field) {
+        parser.expect('{');
+        if (parser.expect('}')) {
+            return true;
+        }
+        do {
+            std::string_view dim;
+            std::string_view label;
+            if (!parser.string(dim) || !parser.expect(':') || !parser.string(label)) {
+                return false;
+            }
+            field.tensor.dimensions.insert(dim);
+            field.tensor.labels.add(label);
+        } while (parser.expect(','));
+        return parser.expect('}');
+    }
+
+    // {"assign": value} and the other update operations, also several in one object.
+    bool update_field(Parser &parser, FieldStats &field) {
+        if (!parser.expect('{')) {
+            return false;
+        }
+        if (parser.expect('}')) {
+            return true;
+        }
+        do {
+            std::string_view op;
+            if (!parser.string(op) || !parser.expect(':')) {
+                return false;
+            }
+            ++field.update_ops[op];
+            parser.ws();
+            const char *start = parser.pos();
+            if (op == "assign") {
+                if (!value(parser, field)) {
+                    return false;
+                }
+                continue;
+            }
+            if (parser.peek('{') && tensor(parser, field)) {
+                continue;
+            }
+            parser = Parser(start, _end);
+            uint64_t elements;
+            if (!parser.skip(elements)) {
+                return false;
+            }
+            if (*start == '[' || *start == '{') {
+                field.elements.add(elements);
+            }
+        } while (parser.expect(','));
+        return parser.expect('}');
+    }
+};
+
+struct Config {
+    std::string file;
+    std::string json_file;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t top = 20;
+};
+
+std::string json_string(std::string_view s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (uint8_t(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+std::string json_histogram(const Histogram &h) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"count\":%lu,\"min\":%lu,\"mean\":%.2f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu,\"powers\":[",
+             h.count(), h.min(), h.mean(), h.percentile(50), h.percentile(90), h.percentile(99), h.max());
+    std::string out = buf;
+    bool first = true;
+    for (const auto &[upper, count] : h.powers()) {
+        out += (first ? "[" : ",[") + std::to_string(upper) + "," + std::to_string(count) + "]";
+        first = false;
+    }
+    return out + "]}";
+}
+
+std::string text_histogram(const Histogram &h) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%lu/%lu/%lu/%lu", h.percentile(50), h.percentile(90), h.percentile(99), h.max());
+    return buf;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-o json file] [-k fields] <feed file>\n"
+            "  Statistics of a JSON array or JSONL feed of document operations.\n"
+            "  -t <threads>  threads for scanning and parsing (default: cores)\n"
+            "  -o <file>     also write the statistics as JSON\n"
+            "  -k <fields>   fields in the text summary, by operations setting them (default 20, JSON has all)\n",
+            prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Config config;
+    int option;
+    while ((option = getopt(argc, argv, "t:o:k:h")) != -1) {
+        switch (option) {
+        case 't': config.threads = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+        case 'o': config.json_file = optarg; break;
+        case 'k': config.top = strtoul(optarg, nullptr, 0); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    config.file = argv[optind];
+    auto start_time = std::chrono::steady_clock::now();
+    feedscan::MappedFile file(config.file);
+    const char *data = file.data();
+    size_t size = file.size();
+
+    feedscan::Operations ops = feedscan::find_operations(data, size, config.threads);
+    const std::vector<size_t> &starts = ops.starts;
+    bool array = ops.array;
+
+    std::vector<Stats> stats(config.threads);
+    std::atomic<size_t> next_op(0);
+    const size_t batch = 1024;
+    feedscan::parallel(config.threads, [&](size_t t) {
+        Inspector inspector(stats[t]);
+        for (size_t b; (b = next_op.fetch_add(batch)) < starts.size();) {
+            for (size_t i = b; i < std::min(b + batch, starts.size()); ++i) {
+                inspector.operation(data + starts[i], data + ops.end(i, size));
+            }
+        }
+    });
+    Stats &total = stats[0];
+    for (size_t t = 1; t < stats.size(); ++t) {
+        total.merge(stats[t]);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    uint64_t operations = 0;
+    for (const auto &[name, op] : total.ops) {
+        operations += op.count;
+    }
+    std::vector<std::pair<std::string_view, const FieldStats *>> fields;
+    for (const auto &[name, field] : total.fields) {
+        fields.emplace_back(name, &field);
+    }
+    std::sort(fields.begin(), fields.end(), [](const auto &a, const auto &b) {
+        return a.second->count != b.second->count ? a.second->count > b.second->count : a.first < b.first;
+    });
+
+    printf("file:                %s\n", config.file.c_str());
+    printf("format:              %s\n", array ? "array" : "jsonl");
+    printf("bytes:               %zu\n", size);
+    printf("operations:          %lu\n", operations);
+    printf("distinct ids:        %lu\n", total.ids.estimate());
+    printf("conditions:          %lu\n", total.conditions);
+    printf("creates:             %lu\n", total.creates);
+    printf("errors:              %lu\n", total.errors);
+    printf("seconds:             %.3f\n", seconds);
+    printf("MB/s:                %.1f\n", seconds > 0 ? size / seconds / 1e6 : 0.0);
+    printf("\n%-10s %12s %8s  %-28s %s\n", "operation", "count", "share", "bytes p50/p90/p99/max", "fields p50/max");
+    for (const auto &[name, op] : total.ops) {
+        printf("%-10s %12lu %7.2f%%  %-28s %lu/%lu\n", name.c_str(), op.count, 100.0 * op.count / std::max<uint64_t>(1, operations),
+               text_histogram(op.bytes).c_str(), op.fields.percentile(50), op.fields.max());
+    }
+    printf("\n%-20s %12s\n", "document type", "count");
+    for (const auto &[type, count] : total.doc_types) {
+        printf("%-20.*s %12lu\n", int(type.size()), type.data(), count);
+    }
+    printf("\n%-24s %12s %-16s %-24s %-20s %12s  %s\n", "field", "operations", "types", "bytes p50/p90/p99/max",
+           "elements p50/p99/max", "cardinality", "tensor");
+    for (size_t i = 0; i < fields.size() && i < config.top; ++i) {
+        const FieldStats &f = *fields[i].second;
+        std::string types;
+        for (int t = 0; t < NUM_TYPES; ++t) {
+            if (f.types[t] > 0) {
+                types += (types.empty() ? "" : ",") + std::string(type_names[t]);
+            }
+        }
+        for (const auto &[op, count] : f.update_ops) {
+            types += (types.empty() ? "" : ",") + std::string(op);
+        }
+        std::string elements = f.elements.count() > 0
+            ? std::to_string(f.elements.percentile(50)) + "/" + std::to_string(f.elements.percentile(99)) + "/" + std::to_string(f.elements.max())
+            : "-";
+        std::string tensor = "-";
+        if (f.has_tensor) {
+            tensor.clear();
+            for (const auto &[form, count] : f.tensor.forms) {
+                tensor += (tensor.empty() ? "" : ",") + form;
+            }
+            if (f.tensor.cells.count() > 0) {
+                tensor += " " + std::to_string(f.tensor.cells.percentile(50)) + "/" + std::to_string(f.tensor.cells.max()) + " cells";
+            }
+            if (f.tensor.hex_bytes.count() > 0) {
+                tensor += " " + std::to_string(f.tensor.hex_bytes.percentile(50)) + "/" + std::to_string(f.tensor.hex_bytes.max()) + " hex bytes";
+            }
+            if (!f.tensor.dimensions.empty()) {
+                tensor += " dims";
+                for (const auto &dim : f.tensor.dimensions) {
+                    tensor += " " + std::string(dim);
+                }
+                tensor += " labels " + std::to_string(f.tensor.labels.estimate());
+            }
+        }
+        printf("%-24.*s %12lu %-16s %-24s %-20s %12lu  %s\n", int(fields[i].first.size()), fields[i].first.data(), f.count,
+               types.c_str(), f.bytes.count() > 0 ? text_histogram(f.bytes).c_str() : "-", elements.c_str(),
+               f.values.estimate(), tensor.c_str());
+    }
+
+    if (!config.json_file.empty()) {
+        FILE *out = fopen(config.json_file.c_str(), "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Could not write '%s': %s\n", config.json_file.c_str(), strerror(errno));
+            return 1;
+        }
+        fprintf(out, "{\"file\":%s,\"format\":\"%s\",\"bytes\":%zu,\"operations\":%lu,\"distinct_ids\":%lu,"
+                "\"conditions\":%lu,\"creates\":%lu,\"errors\":%lu,\"seconds\":%.3f,\"ops\":{",
+                json_string(config.file).c_str(), array ? "array" : "jsonl", size, operations, total.ids.estimate(),
+                total.conditions, total.creates, total.errors, seconds);
+        bool first_entry = true;
+        for (const auto &[name, op] : total.ops) {
+            fprintf(out, "%s%s:{\"count\":%lu,\"bytes\":%s,\"fields\":%s}", first_entry ? "" : ",", json_string(name).c_str(),
+                    op.count, json_histogram(op.bytes).c_str(), json_histogram(op.fields).c_str());
+            first_entry = false;
+        }
+        fprintf(out, "},\"document_types\":{");
+        first_entry = true;
+        for (const auto &[type, count] : total.doc_types) {
+            fprintf(out, "%s%s:%lu", first_entry ? "" : ",", json_string(type).c_str(), count);
+            first_entry = false;
+        }
+        fprintf(out, "},\"fields\":{");
+        first_entry = true;
+        for (const auto &[name, f] : fields) {
+            std::string types;
+            for (int t = 0; t < NUM_TYPES; ++t) {
+                if (f->types[t] > 0) {
+                    types += (types.empty() ? "\"" : ",\"") + std::string(type_names[t]) + "\":" + std::to_string(f->types[t]);
+                }
+            }
+            std::string update_ops;
+            for (const auto &[op, count] : f->update_ops) {
+                update_ops += (update_ops.empty() ? "" : ",") + json_string(op) + ":" + std::to_string(count);
+            }
+            fprintf(out, "%s%s:{\"operations\":%lu,\"types\":{%s},\"update_ops\":{%s},\"bytes\":%s,\"string_length\":%s,"
+                    "\"elements\":%s,\"cardinality\":%lu",
+                    first_entry ? "" : ",", json_string(name).c_str(), f->count, types.c_str(), update_ops.c_str(),
+                    json_histogram(f->bytes).c_str(), json_histogram(f->string_length).c_str(),
+                    json_histogram(f->elements).c_str(), f->values.estimate());
+            if (f->has_tensor) {
+                std::string forms;
+                for (const auto &[form, count] : f->tensor.forms) {
+                    forms += (forms.empty() ? "" : ",") + json_string(form) + ":" + std::to_string(count);
+                }
+                std::string dims;
+                for (const auto &dim : f->tensor.dimensions) {
+                    dims += (dims.empty() ? "" : ",") + json_string(dim);
+                }
+                fprintf(out, ",\"tensor\":{\"forms\":{%s},\"cells\":%s,\"hex_bytes\":%s,\"dimensions\":[%s],\"labels\":%lu}",
+                        forms.c_str(), json_histogram(f->tensor.cells).c_str(), json_histogram(f->tensor.hex_bytes).c_str(),
+                        dims.c_str(), f->tensor.labels.estimate());
+            }
+            fprintf(out, "}");
+            first_entry = false;
+        }
+        fprintf(out, "}}\n");
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,492 @@
+// Copyright Vespa.ai. All rights reserved.
+// Parallel structural scan of JSON feed files for C++ feed tools, header only.
+//
+// A feed is a JSON array of document operations, as written by most generators, possibly pretty printed
+// over several lines, or JSONL. The file is memory mapped and scanned 64 bytes at a time with SSE2 (scalar
+// elsewhere), giving masks of quotes, brackets, commas and whitespace outside strings. To split the scan
+// over threads, each chunk first computes the parity of its unescaped quotes and its change in nesting
+// depth both when starting outside and inside a string; chaining these gives the exact state at each chunk
+// start, and a second scan of each chunk finds the start of every operation.
+//
+// Compile tools using this with: g++ -std=c++17 -O3 -pthread ...
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace feedscan {
+
+struct Masks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t open;
+    uint64_t close;
+    uint64_t comma;
+    uint64_t space;
+};
+
+inline Masks classify(const char *p) {
+#ifdef __SSE2__
+    Masks m{0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+        int shift = 16 * i;
+        m.quote |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))))) << shift;
+        m.backslash |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))))) << shift;
+        // '{' and '[' (0x7b, 0x5b) and '}' and ']' (0x7d, 0x5d) only differ in bit 5, so clear it and compare once.
+        m.comma |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(','))))) << shift;
+        // Whitespace is ' ', '\n', '\r' and '\t', the only bytes <= 0x20 in JSON outside strings.
+        __m128i space = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x20)), v);
+        m.space |= uint64_t(uint32_t(_mm_movemask_epi8(space))) << shift;
+        __m128i folded = _mm_and_si128(v, _mm_set1_epi8(char(0xdf)));
+        m.open |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(folded, _mm_set1_epi8('[' & 0xdf))))) << shift;
+        m.close |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(folded, _mm_set1_epi8(']' & 0xdf))))) << shift;
+    }
+    return m;
+#else
+    Masks m{0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 64; ++i) {
+        uint64_t bit = uint64_t(1) << i;
+        char c = p[i];
+        m.quote |= (c == '"') ? bit : 0;
+        m.backslash |= (c == '\\') ? bit : 0;
+        m.open |= (c == '{' || c == '[') ? bit : 0;
+        m.close |= (c == '}' || c == ']') ? bit : 0;
+        m.comma |= (c == ',') ? bit : 0;
+        m.space |= (uint8_t(c) <= 0x20) ? bit : 0;
+    }
+    return m;
+#endif
+}
+
+inline uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/**
+ * Walks 64 byte blocks of [begin, end), tracking escapes and string state, and calls
+ * block(offset, in_string mask, masks) for each until it returns false. Backslashes are rare in feeds,
+ * so escapes are resolved bit by bit only in blocks that have them.
+ */
+template <typename F>
+bool scan(const char *begin, const char *end, bool in_string, F block) {
+    bool escape_next = false;
+    uint64_t in_string_carry = in_string ? ~uint64_t(0) : 0;
+    char tail[64];
+    for (const char *p = begin; p < end; p += 64) {
+        const char *data = p;
+        size_t len = std::min<size_t>(64, end - p);
+        if (len < 64) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, p, len);
+            data = tail;
+        }
+        Masks m = classify(data);
+        uint64_t escaped = escape_next ? 1 : 0;
+        escape_next = false;
+        for (uint64_t bs = m.backslash & ~escaped; bs != 0;) {
+            int i = __builtin_ctzll(bs);
+            bs &= bs - 1;
+            if (i == 63) {
+                escape_next = true;
+            } else {
+                escaped |= uint64_t(1) << (i + 1);
+                bs &= ~(uint64_t(1) << (i + 1));
+            }
+        }
+        uint64_t quotes = m.quote & ~escaped;
+        uint64_t strings = prefix_xor(quotes) ^ in_string_carry;
+        in_string_carry = uint64_t(int64_t(strings) >> 63);
+        if (!block(size_t(p - begin), strings, m)) {
+            break;
+        }
+    }
+    return in_string_carry != 0;
+}
+
+struct ChunkSummary {
+    bool quote_parity = false;
+    int64_t depth_outside = 0; // depth change if the chunk starts outside a string
+    int64_t depth_inside = 0;  // and inside
+};
+
+inline ChunkSummary summarize(const char *begin, const char *end) {
+    ChunkSummary s;
+    // The parity of unescaped quotes is the string state at the end when starting outside.
+    s.quote_parity = scan(begin, end, false, [&s](size_t, uint64_t strings, const Masks &m) {
+        s.depth_outside += __builtin_popcountll(m.open & ~strings) - __builtin_popcountll(m.close & ~strings);
+        s.depth_inside += __builtin_popcountll(m.open & strings) - __builtin_popcountll(m.close & strings);
+        return true;
+    });
+    return s;
+}
+
+// Offsets of the '{' of each operation in [begin, end) at nesting depth 'level', given the state at 'begin'.
+inline void find_starts(const char *base, size_t begin, size_t end, bool in_string, int64_t depth, int64_t level,
+                        std::vector<size_t> &starts)
+{
+    scan(base + begin, base + end, in_string, [&](size_t offset, uint64_t strings, const Masks &m) {
+        uint64_t structural = (m.open | m.close) & ~strings;
+        while (structural != 0) {
+            int i = __builtin_ctzll(structural);
+            structural &= structural - 1;
+            if ((m.open >> i) & 1) {
+                if (depth == level && base[begin + offset + i] == '{') {
+                    starts.push_back(begin + offset + i);
+                }
+                ++depth;
+            } else {
+                --depth;
+            }
+        }
+        return true;
+    });
+}
+
+
+/**
+ * Read-only memory mapping of a whole file.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &name) {
+        int fd = open(name.c_str(), O_RDONLY);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "Could not open '%s': %s\n", name.c_str(), strerror(errno));
+            exit(1);
+        }
+        _size = st.st_size;
+        if (_size > 0) {
+            void *p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                fprintf(stderr, "Could not map '%s': %s\n", name.c_str(), strerror(errno));
+                exit(1);
+            }
+            madvise(p, _size, MADV_SEQUENTIAL);
+            _data = static_cast<const char *>(p);
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (_data != nullptr) {
+            munmap(const_cast<char *>(_data), _size);
+        }
+    }
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const char *_data = nullptr;
+    size_t _size = 0;
+};
+
+template <typename F>
+void parallel(size_t n, F f) {
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < n; ++t) {
+        threads.emplace_back(f, t);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+/**
+ * The operations of a feed: whether it is a JSON array (or JSONL), and the offset of the '{' of each operation.
+ */
+struct Operations {
+    bool array = false;
+    std::vector<size_t> starts;
+
+    // End of operation i: the start of the next one, or the end of the file.
+    size_t end(size_t i, size_t size) const { return i + 1 < starts.size() ? starts[i + 1] : size; }
+};
+
+inline Operations find_operations(const char *data, size_t size, size_t threads) {
+    Operations ops;
+    size_t first = 0;
+    while (first < size && isspace(uint8_t(data[first]))) {
+        ++first;
+    }
+    ops.array = first < size && data[first] == '[';
+    int64_t level = ops.array ? 1 : 0;
+
+    // Chunk boundaries, moved past backslashes so no chunk starts with an escaped character.
+    size_t num_chunks = std::min(std::max<size_t>(1, size / (1 << 20)), threads * 4);
+    std::vector<size_t> bounds(num_chunks + 1);
+    for (size_t c = 0; c <= num_chunks; ++c) {
+        size_t b = (c == num_chunks) ? size : size / num_chunks * c;
+        while (b > 0 && b < size && data[b - 1] == '\\') {
+            ++b;
+        }
+        bounds[c] = std::max(b, c > 0 ? bounds[c - 1] : 0);
+    }
+    std::vector<ChunkSummary> summaries(num_chunks);
+    std::atomic<size_t> next_chunk(0);
+    parallel(std::min(threads, num_chunks), [&](size_t) {
+        for (size_t c; (c = next_chunk++) < num_chunks;) {
+            summaries[c] = summarize(data + bounds[c], data + bounds[c + 1]);
+        }
+    });
+    std::vector<bool> chunk_in_string(num_chunks);
+    std::vector<int64_t> chunk_depth(num_chunks);
+    bool in_string = false;
+    int64_t depth = 0;
+    for (size_t c = 0; c < num_chunks; ++c) {
+        chunk_in_string[c] = in_string;
+        chunk_depth[c] = depth;
+        depth += in_string ? summaries[c].depth_inside : summaries[c].depth_outside;
+        in_string = in_string != summaries[c].quote_parity;
+    }
+    if (in_string || depth != 0) {
+        fprintf(stderr, "Warning: the feed ends inside a %s\n", in_string ? "string" : "nested value");
+    }
+    std::vector<std::vector<size_t>> chunk_starts(num_chunks);
+    next_chunk = 0;
+    parallel(std::min(threads, num_chunks), [&](size_t) {
+        for (size_t c; (c = next_chunk++) < num_chunks;) {
+            find_starts(data, bounds[c], bounds[c + 1], chunk_in_string[c], chunk_depth[c], level, chunk_starts[c]);
+        }
+    });
+    for (auto &s : chunk_starts) {
+        ops.starts.insert(ops.starts.end(), s.begin(), s.end());
+        std::vector<size_t>().swap(s);
+    }
+    return ops;
+}
+
+/**
+ * Minimal pull parser over one operation, for what the structural scan does not give directly.
+ */
+class Parser {
+public:
+    Parser(const char *begin, const char *end) : p(begin), end(end) {}
+
+    const char *pos() const { return p; }
+
+    void ws() {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+            ++p;
+        }
+    }
+
+    bool peek(char c) {
+        ws();
+        return p < end && *p == c;
+    }
+
+    bool expect(char c) {
+        ws();
+        if (p < end && *p == c) {
+            ++p;
+            return true;
+        }
+        return false;
+    }
+
+    // The raw contents of a string, escapes kept.
+    bool string(std::string_view &out) {
+        ws();
+        if (p >= end || *p != '"') {
+            return false;
+        }
+        const char *start = ++p;
+        while (true) {
+            const char *q = static_cast<const char *>(memchr(p, '"', end - p));
+            if (q == nullptr) {
+                return false;
+            }
+            size_t backslashes = 0;
+            while (q - backslashes > start && *(q - 1 - backslashes) == '\\') {
+                ++backslashes;
+            }
+            p = q + 1;
+            if (backslashes % 2 == 0) {
+                out = std::string_view(start, q - start);
+                return true;
+            }
+        }
+    }
+
+    // Skips a value, counting the elements or members of arrays and objects. The type is given by the first byte.
+    bool skip(uint64_t &elements) {
+        ws();
+        elements = 0;
+        if (p >= end) {
+            return false;
+        }
+        std::string_view s;
+        switch (*p) {
+        case '"':
+            return string(s);
+        case '{':
+        case '[':
+            return container(elements);
+        default:
+            {
+                const char *start = p;
+                while (p < end && ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z') || *p == '-' || *p == '+' || *p == '.' || *p == 'E')) {
+                    ++p;
+                }
+                return p > start;
+            }
+        }
+    }
+
+    // Skips an array or object with the structural scan, counting top level elements as commas, as
+    // parsing the elements of large arrays and maps one by one would dominate the run time.
+    bool container(uint64_t &elements) {
+        char close = (*p == '{') ? '}' : ']';
+        ++p;
+        if (expect(close)) {
+            return true;
+        }
+        int64_t depth = 1;
+        uint64_t commas = 0;
+        const char *begin = p;
+        const char *found = nullptr;
+        scan(begin, end, false, [&](size_t offset, uint64_t strings, const Masks &m) {
+            uint64_t structural = (m.open | m.close) & ~strings;
+            uint64_t separators = m.comma & ~strings;
+            uint64_t from = ~uint64_t(0);
+            while (structural != 0) {
+                int i = __builtin_ctzll(structural);
+                structural &= structural - 1;
+                uint64_t before = (uint64_t(1) << i) - 1;
+                commas += (depth == 1) ? __builtin_popcountll(separators & from & before) : 0;
+                from = ~before << 1;
+                depth += ((m.open >> i) & 1) ? 1 : -1;
+                if (depth == 0) {
+                    found = begin + offset + i + 1;
+                    return false;
+                }
+            }
+            commas += (depth == 1) ? __builtin_popcountll(separators & from) : 0;
+            return true;
+        });
+        if (found == nullptr) {
+            return false;
+        }
+        p = found;
+        elements = commas + 1;
+        return true;
+    }
+
+    // Appends the next value to 'out' without the whitespace outside strings, copying the runs between
+    // whitespace of each 64 byte block of arrays and objects.
+    bool minify(std::string &out) {
+        ws();
+        const char *start = p;
+        if (p >= end || (*p != '{' && *p != '[')) {
+            uint64_t ignored;
+            if (!skip(ignored)) {
+                return false;
+            }
+            out.append(start, p - start);
+            return true;
+        }
+        int64_t depth = 0;
+        const char *found = nullptr;
+        scan(start, end, false, [&](size_t offset, uint64_t strings, const Masks &m) {
+            uint64_t keep = ~(m.space & ~strings);
+            uint64_t structural = (m.open | m.close) & ~strings;
+            while (structural != 0) {
+                int i = __builtin_ctzll(structural);
+                structural &= structural - 1;
+                depth += ((m.open >> i) & 1) ? 1 : -1;
+                if (depth == 0) {
+                    keep &= (i == 63) ? ~uint64_t(0) : (uint64_t(2) << i) - 1;
+                    found = start + offset + i + 1;
+                    break;
+                }
+            }
+            const char *block = start + offset;
+            if (end - block < 64) {
+                keep &= (uint64_t(1) << (end - block)) - 1;
+            }
+            while (keep != 0) {
+                int i = __builtin_ctzll(keep);
+                uint64_t run = ~(keep >> i);
+                int n = (run == 0) ? 64 - i : __builtin_ctzll(run);
+                out.append(block + i, n);
+                keep = (i + n >= 64) ? 0 : keep & ~(((uint64_t(1) << n) - 1) << i);
+            }
+            return found == nullptr;
+        });
+        if (found == nullptr) {
+            return false;
+        }
+        p = found;
+        return true;
+    }
+
+    // Counts numbers in (nested) arrays, e.g. dense tensor values, as the runs of bytes between
+    // brackets, commas and whitespace.
+    bool count_numbers(uint64_t &count) {
+        ws();
+        if (p >= end || *p != '[') {
+            uint64_t ignored;
+            ++count;
+            return skip(ignored);
+        }
+        int64_t depth = 0;
+        uint64_t previous_token = 0;
+        const char *begin = p;
+        const char *found = nullptr;
+        scan(begin, end, false, [&](size_t offset, uint64_t strings, const Masks &m) {
+            uint64_t tokens = ~(m.open | m.close | m.comma | m.space) | strings;
+            uint64_t starts = tokens & ~((tokens << 1) | previous_token);
+            previous_token = tokens >> 63;
+            uint64_t structural = (m.open | m.close) & ~strings;
+            while (structural != 0) {
+                int i = __builtin_ctzll(structural);
+                structural &= structural - 1;
+                depth += ((m.open >> i) & 1) ? 1 : -1;
+                if (depth == 0) {
+                    count += __builtin_popcountll(starts & ((uint64_t(1) << i) - 1));
+                    found = begin + offset + i + 1;
+                    return false;
+                }
+            }
+            count += __builtin_popcountll(starts);
+            return true;
+        });
+        if (found == nullptr) {
+            return false;
+        }
+        p = found;
+        return true;
+    }
+
+private:
+    const char *p;
+    const char *end;
+};
+
+} // namespace feedscan
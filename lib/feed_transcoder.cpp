@@ -0,0 +1,523 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// Transcodes an existing feed file to a form that is cheaper to parse and feed, without regenerating it.
+//
+// Input is a JSON array or JSONL feed of document operations, as written by the generators, also when
+// pretty printed over several lines. Output is written one operation per line, with the whitespace outside
+// strings removed, either as JSONL (default) or as a JSON array (-f array), to stdout or the -o file.
+//
+// Dense tensor values of the fields given with -x <field>:<cell type> are re-encoded as hex strings, which
+// are several times smaller than decimal numbers and parsed without number conversion:
+//   "embedding": {"values": [0.5, -1.0, ...]}  ->  "embedding": {"values": "3F000000BF800000..."}
+// Nested arrays are flattened in order, a bare array becomes {"values": "..."}, and update assigns are
+// re-encoded as well. Cell types are float, double, bfloat16 (truncated, as in Vespa) and int8.
+//
+// With -n <shards>, the operations are split in order into that many files of equally many operations,
+// <output>.0 to <output>.<n-1>.
+//
+// Operations are found with the parallel structural scan of feed_scanner.h, then transcoded by the threads
+// (-t) in batches that are written in order, so it runs at disk speed on a few cores. A summary is printed
+// to stderr.
+//
+// Compile with: g++ -std=c++17 -O3 -pthread -o feed_transcoder feed_transcoder.cpp
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "feed_scanner.h"
+
+namespace {
+
+using feedscan::Parser;
+
+enum class CellType { FLOAT, DOUBLE, BFLOAT16, INT8 };
+
+struct Config {
+    std::string file;
+    std::string output;
+    bool array = false;
+    size_t shards = 1;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::map<std::string, CellType, std::less<>> hex_fields;
+};
+
+bool parse_cell_type(std::string_view name, CellType &type) {
+    if (name == "float") {
+        type = CellType::FLOAT;
+    } else if (name == "double") {
+        type = CellType::DOUBLE;
+    } else if (name == "bfloat16") {
+        type = CellType::BFLOAT16;
+    } else if (name == "int8") {
+        type = CellType::INT8;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void append_hex(std::string &out, uint64_t bits, int bytes) {
+    static const char digits[] = "0123456789ABCDEF";
+    for (int i = 2 * bytes - 1; i >= 0; --i) {
+        out += digits[(bits >> (4 * i)) & 15];
+    }
+}
+
+/**
+ * Transcodes operations into a buffer, counting what was done.
+ */
+class Transcoder {
+public:
+    uint64_t tensors = 0;
+    uint64_t kept = 0;
+    uint64_t errors = 0;
+
+    explicit Transcoder(const Config &config) : _config(config) {}
+
+    // Appends the operation starting at 'begin', before 'end'.
+    void operation(const char *begin, const char *end, std::string &out) {
+        size_t size = out.size();
+        Parser parser(begin, end);
+        bool ok = _config.hex_fields.empty() ? parser.minify(out) : fields_operation(parser, out);
+        if (!ok) {
+            // Keep what there is, so a damaged operation shows up where the feed client reports it.
+            ++errors;
+            out.resize(size);
+            Parser raw(begin, end);
+            raw.ws();
+            const char *last = end;
+            while (last > raw.pos() && (uint8_t(last[-1]) <= ' ' || last[-1] == ',' || last[-1] == ']')) {
+                --last;
+            }
+            out.append(raw.pos(), last - raw.pos());
+        }
+    }
+
+private:
+    const Config &_config;
+    std::string _cells;
+
+    // {"put": ..., "fields": {...}, ...}, re-encoding the fields given, and minifying the rest.
+    bool fields_operation(Parser &parser, std::string &out) {
+        if (!parser.expect('{')) {
+            return false;
+        }
+        out += '{';
+        if (parser.expect('}')) {
+            out += '}';
+            return true;
+        }
+        bool update = false;
+        do {
+            std::string_view key;
+            if (!parser.string(key) || !parser.expect(':')) {
+                return false;
+            }
+            if (out.back() != '{') {
+                out += ',';
+            }
+            append_key(out, key);
+            update = update || key == "update";
+            if (key == "fields" && parser.peek('{')) {
+                if (!fields(parser, update, out)) {
+                    return false;
+                }
+            } else if (!parser.minify(out)) {
+                return false;
+            }
+        } while (parser.expect(','));
+        if (!parser.expect('}')) {
+            return false;
+        }
+        out += '}';
+        return true;
+    }
+
+    static void append_key(std::string &out, std::string_view key) {
+        out += '"';
+        out.append(key);
+        out += "\":";
+    }
+
+    bool fields(Parser &parser, bool update, std::string &out) {
+        parser.expect('{');
+        out += '{';
+        if (parser.expect('}')) {
+            out += '}';
+            return true;
+        }
+        do {
+            std::string_view name;
+            if (!parser.string(name) || !parser.expect(':')) {
+                return false;
+            }
+            if (out.back() != '{') {
+                out += ',';
+            }
+            append_key(out, name);
+            auto hex = _config.hex_fields.find(name);
+            bool ok = true;
+            if (hex == _config.hex_fields.end()) {
+                ok = parser.minify(out);
+            } else if (update) {
+                ok = update_ops(parser, hex->second, out);
+            } else {
+                ok = tensor(parser, hex->second, out);
+            }
+            if (!ok) {
+                return false;
+            }
+        } while (parser.expect(','));
+        if (!parser.expect('}')) {
+            return false;
+        }
+        out += '}';
+        return true;
+    }
+
+    // {"assign": <tensor>, ...}: the assigned values are re-encoded, other update operations minified.
+    bool update_ops(Parser &parser, CellType type, std::string &out) {
+        if (!parser.peek('{')) {
+            return parser.minify(out);
+        }
+        parser.expect('{');
+        out += '{';
+        if (parser.expect('}')) {
+            out += '}';
+            return true;
+        }
+        do {
+            std::string_view op;
+            if (!parser.string(op) || !parser.expect(':')) {
+                return false;
+            }
+            if (out.back() != '{') {
+                out += ',';
+            }
+            append_key(out, op);
+            if (!(op == "assign" ? tensor(parser, type, out) : parser.minify(out))) {
+                return false;
+            }
+        } while (parser.expect(','));
+        if (!parser.expect('}')) {
+            return false;
+        }
+        out += '}';
+        return true;
+    }
+
+    // A dense tensor as {"values": [...]} or a bare array, written as {"values": "<hex>"}. Other forms,
+    // and values that are not numbers, are minified as they are.
+    bool tensor(Parser &parser, CellType type, std::string &out) {
+        parser.ws();
+        if (parser.peek('[')) {
+            Parser copy = parser;
+            size_t size = out.size();
+            out += "{\"values\":";
+            if (hex_values(parser, type, out)) {
+                out += '}';
+                ++tensors;
+                return true;
+            }
+            out.resize(size);
+            parser = copy;
+            ++kept;
+            return parser.minify(out);
+        }
+        if (!parser.peek('{')) {
+            ++kept;
+            return parser.minify(out);
+        }
+        parser.expect('{');
+        out += '{';
+        if (parser.expect('}')) {
+            out += '}';
+            return true;
+        }
+        bool encoded = false;
+        do {
+            std::string_view key;
+            if (!parser.string(key) || !parser.expect(':')) {
+                return false;
+            }
+            if (out.back() != '{') {
+                out += ',';
+            }
+            append_key(out, key);
+            if (key == "values" && parser.peek('[')) {
+                Parser copy = parser;
+                size_t size = out.size();
+                if (hex_values(parser, type, out)) {
+                    encoded = true;
+                    continue;
+                }
+                out.resize(size);
+                parser = copy;
+            }
+            if (!parser.minify(out)) {
+                return false;
+            }
+        } while (parser.expect(','));
+        if (!parser.expect('}')) {
+            return false;
+        }
+        out += '}';
+        ++(encoded ? tensors : kept);
+        return true;
+    }
+
+    // Writes the numbers of a (nested) array as a hex string, returning false if there is anything else.
+    bool hex_values(Parser &parser, CellType type, std::string &out) {
+        _cells.clear();
+        if (!parser.minify(_cells)) {
+            return false;
+        }
+        out += '"';
+        const char *p = _cells.data();
+        const char *end = p + _cells.size();
+        while (p < end) {
+            char c = *p;
+            if (c == '[' || c == ']' || c == ',') {
+                ++p;
+                continue;
+            }
+            double value;
+            auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc() || (result.ptr < end && *result.ptr != ',' && *result.ptr != ']')) {
+                return false;
+            }
+            p = result.ptr;
+            switch (type) {
+            case CellType::FLOAT: {
+                float f = float(value);
+                uint32_t bits;
+                memcpy(&bits, &f, sizeof(bits));
+                append_hex(out, bits, 4);
+                break;
+            }
+            case CellType::DOUBLE: {
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                append_hex(out, bits, 8);
+                break;
+            }
+            case CellType::BFLOAT16: {
+                float f = float(value);
+                uint32_t bits;
+                memcpy(&bits, &f, sizeof(bits));
+                append_hex(out, bits >> 16, 2);
+                break;
+            }
+            case CellType::INT8:
+                append_hex(out, uint8_t(int8_t(value)), 1);
+                break;
+            }
+        }
+        out += '"';
+        return true;
+    }
+};
+
+/**
+ * Output files, one per shard, written in order by whichever thread's batch is next.
+ */
+class Output {
+public:
+    explicit Output(const Config &config) : _config(config), _fds(config.shards, -1), _started(config.shards, false) {
+        for (size_t s = 0; s < config.shards; ++s) {
+            if (config.output.empty()) {
+                _fds[s] = STDOUT_FILENO;
+                continue;
+            }
+            std::string name = (config.shards > 1) ? config.output + "." + std::to_string(s) : config.output;
+            _fds[s] = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (_fds[s] < 0) {
+                fprintf(stderr, "Could not open '%s': %s\n", name.c_str(), strerror(errno));
+                exit(1);
+            }
+        }
+    }
+
+    // Writes batch 'index' of 'shard' when all batches before it are written.
+    void write(size_t index, size_t shard, std::string &buffer) {
+        std::unique_lock<std::mutex> guard(_lock);
+        _turn.wait(guard, [&] { return _next == index; });
+        guard.unlock();
+        if (!_started[shard]) {
+            _started[shard] = true;
+            write_all(_fds[shard], _config.array ? "[\n" : "");
+        } else if (_config.array) {
+            write_all(_fds[shard], ",\n");
+        }
+        write_all(_fds[shard], buffer);
+        _bytes += buffer.size();
+        guard.lock();
+        ++_next;
+        _turn.notify_all();
+    }
+
+    void close_all() {
+        for (size_t s = 0; s < _fds.size(); ++s) {
+            if (_config.array) {
+                write_all(_fds[s], _started[s] ? "\n]\n" : "[\n]\n");
+            }
+            if (_fds[s] != STDOUT_FILENO && close(_fds[s]) != 0) {
+                fprintf(stderr, "Could not close output: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+    }
+
+    uint64_t bytes() const { return _bytes; }
+
+private:
+    const Config &_config;
+    std::vector<int> _fds;
+    std::vector<bool> _started;
+    std::mutex _lock;
+    std::condition_variable _turn;
+    size_t _next = 0;
+    uint64_t _bytes = 0;
+
+    void write_all(int fd, std::string_view data) {
+        while (!data.empty()) {
+            ssize_t n = ::write(fd, data.data(), data.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                fprintf(stderr, "Could not write output: %s\n", strerror(errno));
+                exit(1);
+            }
+            data.remove_prefix(n);
+        }
+    }
+};
+
+struct Batch {
+    size_t shard;
+    size_t first;
+    size_t last;
+};
+
+void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-f jsonl|array] [-o output] [-n shards] [-x field:cell type ...] [-t threads] <feed file>\n"
+            "  Transcodes a JSON array or JSONL feed to compact JSONL or JSON array, one operation per line.\n"
+            "  -f <format>      jsonl (default) or array\n"
+            "  -o <file>        output file (default stdout), or prefix of <file>.0 ... with -n\n"
+            "  -n <shards>      split the operations in order into this many files\n"
+            "  -x <field:type>  write dense tensor values of the field as hex, with cell type float, double,\n"
+            "                   bfloat16 or int8 (repeat for more fields)\n"
+            "  -t <threads>     threads (default: cores)\n",
+            prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Config config;
+    int option;
+    while ((option = getopt(argc, argv, "f:o:n:x:t:h")) != -1) {
+        switch (option) {
+        case 'f':
+            if (strcmp(optarg, "array") != 0 && strcmp(optarg, "jsonl") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            config.array = strcmp(optarg, "array") == 0;
+            break;
+        case 'o': config.output = optarg; break;
+        case 'n': config.shards = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+        case 't': config.threads = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+        case 'x': {
+            std::string_view spec(optarg);
+            size_t colon = spec.rfind(':');
+            CellType type;
+            if (colon == std::string_view::npos || !parse_cell_type(spec.substr(colon + 1), type)) {
+                fprintf(stderr, "Expected <field>:<float|double|bfloat16|int8>, got '%s'\n", optarg);
+                return 1;
+            }
+            config.hex_fields[std::string(spec.substr(0, colon))] = type;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 1 || (config.shards > 1 && config.output.empty())) {
+        usage(argv[0]);
+        return 1;
+    }
+    config.file = argv[optind];
+    auto start_time = std::chrono::steady_clock::now();
+    feedscan::MappedFile file(config.file);
+    const char *data = file.data();
+    size_t size = file.size();
+    feedscan::Operations ops = feedscan::find_operations(data, size, config.threads);
+    size_t count = ops.starts.size();
+
+    // Batches of about 4 MB of input, within one shard.
+    std::vector<Batch> batches;
+    for (size_t shard = 0; shard < config.shards; ++shard) {
+        size_t first = count * shard / config.shards;
+        size_t last = count * (shard + 1) / config.shards;
+        for (size_t i = first; i < last;) {
+            size_t j = i + 1;
+            while (j < last && ops.starts[j] - ops.starts[i] < (4 << 20)) {
+                ++j;
+            }
+            batches.push_back({shard, i, j});
+            i = j;
+        }
+    }
+
+    Output output(config);
+    std::atomic<size_t> next_batch(0);
+    std::atomic<uint64_t> tensors(0), kept(0), errors(0);
+    feedscan::parallel(std::min(config.threads, std::max<size_t>(1, batches.size())), [&](size_t) {
+        Transcoder transcoder(config);
+        std::string buffer;
+        for (size_t b; (b = next_batch++) < batches.size();) {
+            buffer.clear();
+            for (size_t i = batches[b].first; i < batches[b].last; ++i) {
+                if (i > batches[b].first) {
+                    buffer += config.array ? ",\n" : "";
+                }
+                transcoder.operation(data + ops.starts[i], data + ops.end(i, size), buffer);
+                buffer += config.array ? "" : "\n";
+            }
+            output.write(b, batches[b].shard, buffer);
+        }
+        tensors += transcoder.tensors;
+        kept += transcoder.kept;
+        errors += transcoder.errors;
+    });
+    output.close_all();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    fprintf(stderr, "operations:          %zu\n", count);
+    fprintf(stderr, "shards:              %zu\n", config.shards);
+    fprintf(stderr, "bytes in:            %zu\n", size);
+    fprintf(stderr, "bytes out:           %lu\n", output.bytes());
+    fprintf(stderr, "hex tensors:         %lu\n", tensors.load());
+    fprintf(stderr, "tensors kept:        %lu\n", kept.load());
+    fprintf(stderr, "errors:              %lu\n", errors.load());
+    fprintf(stderr, "seconds:             %.3f\n", seconds);
+    fprintf(stderr, "MB/s:                %.1f\n", seconds > 0 ? size / seconds / 1e6 : 0.0);
+    return 0;
+}
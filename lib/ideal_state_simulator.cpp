@@ -0,0 +1,623 @@
+// Copyright Vespa.ai. All rights reserved.
+//
+// Offline simulation of where a feed ends up in a content cluster, for sizing clusters and
+// predicting the data moved when nodes are added or removed, without deploying anything.
+//
+// Document ids are read from a feed (JSON array or JSONL of put operations, e.g. from the C++
+// generators) or from a file of ids, one per line, from a file or stdin. Ids are found by scanning
+// for "put", "id", "remove" or "update" keys with a value starting with "id:", and the size of a
+// document is the number of feed bytes up to the next document. Scanning and the md5 of each id
+// (see bucket_id.h) are done by several threads, counting documents and bytes per superbucket.
+//
+// Placement follows the ideal state algorithm of vdslib/distribution (Distribution.cpp): the seed
+// of a bucket is its lower distribution bits, a node's score is the (index + 1)'th nextDouble() of
+// a java.util.Random with that seed (raised to 1 / capacity), and the nodes with the highest scores
+// get the replicas, the first being the primary. With groups, subgroups are scored the same way
+// with the seed xor'ed with the group's distribution hash, and redundancy is split between the best
+// groups by the partition spec. Distributors own a bucket by the same scoring with redundancy 1.
+// Buckets split below 33 bits are placed as their superbucket, so superbucket counts suffice.
+// Each content node has one disk, so per node counts are also the per disk counts.
+//
+// Usage: ideal_state_simulator [options] [feed file]
+//   -n <nodes>         flat cluster with nodes 0..n-1 (default 4)
+//   -g <g>x<n>         g leaf groups of n nodes each, numbered group by group
+//   -p <partitions>    redundancy partitions over groups, e.g. '1|*' (default '*|*|...')
+//   -r <redundancy>    total redundancy (default 2)
+//   -b <bits>          distribution bits (default 16, at most 24)
+//   -c <node>:<cap>    capacity of a node (repeatable)
+//   -a <group>         simulate adding a node (to the given group, 0 for flat clusters)
+//   -x <node>          simulate taking down a node (repeatable)
+//   -i                 input has one document id per line
+//   -t <threads>       scanning threads (default hardware concurrency)
+//
+// Compile: g++ -std=c++17 -O3 -pthread -I<system-test>/lib -o ideal_state_simulator ideal_state_simulator.cpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "bucket_id.h"
+
+namespace {
+
+/**
+ * java.util.Random, as ported to vespalib::Random and used by the distribution code.
+ */
+class JavaRandom {
+    uint64_t _seed;
+
+    int32_t next(int bits) {
+        _seed = (_seed * 0x5DEECE66DULL + 0xBULL) & ((uint64_t(1) << 48) - 1);
+        return int32_t(_seed >> (48 - bits));
+    }
+
+public:
+    explicit JavaRandom(int32_t seed) : _seed((uint64_t(int64_t(seed)) ^ 0x5DEECE66DULL) & ((uint64_t(1) << 48) - 1)) {}
+    double next_double() {
+        return double((uint64_t(next(26)) << 27) + uint64_t(next(27))) * 0x1.0p-53;
+    }
+};
+
+struct Node {
+    uint16_t index;
+    double capacity = 1.0;
+    bool up = true;
+};
+
+struct Group {
+    uint16_t index;
+    uint32_t hash;
+    std::vector<Node> nodes;
+};
+
+/**
+ * A root group of leaf groups, or a single leaf group for flat clusters.
+ */
+struct Topology {
+    std::vector<Group> groups;
+    std::string partitions;
+    uint32_t redundancy = 2;
+    uint32_t bits = 16;
+    uint32_t root_hash = 0;
+
+    bool flat() const { return groups.size() == 1 && partitions.empty(); }
+    uint16_t max_node_index() const {
+        uint16_t result = 0;
+        for (const auto &group : groups) {
+            for (const auto &node : group.nodes) {
+                result = std::max(result, node.index);
+            }
+        }
+        return result;
+    }
+    Node *find(uint16_t index) {
+        for (auto &group : groups) {
+            for (auto &node : group.nodes) {
+                if (node.index == index) {
+                    return &node;
+                }
+            }
+        }
+        return nullptr;
+    }
+    void compute_hashes() {
+        // Group::calculateDistributionHashValues, with the root group having index 0.
+        root_hash = uint32_t(0 ^ (1664525ULL * 0 + 1013904223ULL));
+        for (auto &group : groups) {
+            group.hash = uint32_t(root_hash ^ (1664525ULL * group.index + 1013904223ULL));
+        }
+    }
+
+    /**
+     * Redundancy per group, highest first, from the partition spec (e.g. '1|*' or '*|*').
+     */
+    std::vector<uint32_t> redundancy_array() const {
+        std::vector<uint32_t> result;
+        std::vector<std::string> parts;
+        size_t start = 0;
+        while (start <= partitions.size()) {
+            size_t end = partitions.find('|', start);
+            end = (end == std::string::npos) ? partitions.size() : end;
+            parts.push_back(partitions.substr(start, end - start));
+            start = end + 1;
+        }
+        uint32_t fixed = 0;
+        uint32_t asterisks = 0;
+        for (const auto &part : parts) {
+            if (part == "*") {
+                ++asterisks;
+            } else {
+                fixed += std::stoul(part);
+            }
+        }
+        uint32_t left = redundancy;
+        for (const auto &part : parts) {
+            if (part != "*") {
+                uint32_t value = std::min<uint32_t>(left, std::stoul(part));
+                result.push_back(value);
+                left -= value;
+            }
+        }
+        uint32_t remaining = (redundancy > fixed) ? redundancy - fixed : 0;
+        for (uint32_t i = 0; i < asterisks; ++i) {
+            result.push_back(remaining / asterisks + ((i < remaining % asterisks) ? 1 : 0));
+        }
+        std::sort(result.begin(), result.end(), std::greater<>());
+        while (!result.empty() && result.back() == 0) {
+            result.pop_back();
+        }
+        return result;
+    }
+};
+
+struct Placement {
+    std::vector<uint16_t> storage;  // primary first
+    uint16_t distributor;
+};
+
+/**
+ * Scores of all node indexes for a seed; the score of node i is the (i + 1)'th random number.
+ */
+void node_scores(uint32_t seed, uint16_t max_index, std::vector<double> &scores) {
+    JavaRandom random{int32_t(seed)};
+    scores.resize(max_index + 1);
+    for (auto &score : scores) {
+        score = random.next_double();
+    }
+}
+
+double adjusted(double score, double capacity) {
+    return (capacity != 1.0) ? std::pow(score, 1.0 / capacity) : score;
+}
+
+/**
+ * Indexes of the groups sorted by score for the bucket, best first.
+ */
+std::vector<size_t> ranked_groups(const Topology &topology, uint64_t bucket) {
+    std::vector<std::pair<double, size_t>> scored;
+    JavaRandom random{int32_t(uint32_t(bucket) ^ topology.root_hash)};
+    uint32_t current = 0;
+    // Group indexes are sorted, and missing indexes still consume a random number.
+    std::vector<size_t> order(topology.groups.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return topology.groups[a].index < topology.groups[b].index; });
+    for (size_t g : order) {
+        while (topology.groups[g].index > current++) {
+            random.next_double();
+        }
+        scored.emplace_back(random.next_double(), g);
+    }
+    std::stable_sort(scored.begin(), scored.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+    std::vector<size_t> result;
+    for (const auto &entry : scored) {
+        result.push_back(entry.second);
+    }
+    return result;
+}
+
+/**
+ * Ideal storage nodes and distributor for a superbucket.
+ */
+Placement place(const Topology &topology, uint64_t bucket, std::vector<double> &scores) {
+    Placement result;
+    node_scores(uint32_t(bucket), topology.max_node_index(), scores);
+    std::vector<std::pair<const Group *, uint32_t>> targets;
+    if (topology.flat()) {
+        targets.emplace_back(&topology.groups[0], topology.redundancy);
+    } else {
+        std::vector<size_t> ranked = ranked_groups(topology, bucket);
+        std::vector<uint32_t> redundancies = topology.redundancy_array();
+        for (size_t i = 0; i < redundancies.size() && i < ranked.size(); ++i) {
+            targets.emplace_back(&topology.groups[ranked[i]], redundancies[i]);
+        }
+    }
+    std::vector<std::pair<double, uint16_t>> candidates;
+    for (const auto &target : targets) {
+        candidates.clear();
+        for (const auto &node : target.first->nodes) {
+            if (node.up) {
+                candidates.emplace_back(adjusted(scores[node.index], node.capacity), node.index);
+            }
+        }
+        std::stable_sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+        for (size_t i = 0; i < target.second && i < candidates.size(); ++i) {
+            result.storage.push_back(candidates[i].second);
+        }
+    }
+    // Distributors: the best group at each level, then the best node within it.
+    const Group *group = topology.flat() ? &topology.groups[0] : &topology.groups[ranked_groups(topology, bucket)[0]];
+    double best = -1.0;
+    result.distributor = 0;
+    for (const auto &node : group->nodes) {
+        double score = adjusted(scores[node.index], node.capacity);
+        if (node.up && score > best) {
+            best = score;
+            result.distributor = node.index;
+        }
+    }
+    return result;
+}
+
+struct BucketCounts {
+    std::vector<uint64_t> docs;
+    std::vector<uint64_t> bytes;
+};
+
+/**
+ * Finds document ids in the feed and counts documents and bytes per superbucket.
+ */
+class FeedScanner {
+    uint32_t _bits;
+    int _num_threads;
+    bool _id_lines;
+    BucketCounts _counts;
+    uint64_t _num_docs;
+    // Last id found so far, whose size is known when the next id (or the end) is found.
+    std::string _pending_id;
+    uint64_t _pending_offset;
+    bool _has_pending;
+
+    struct Match {
+        uint64_t offset;
+        std::string_view id;
+    };
+
+    static bool is_id_key(std::string_view data, size_t quote) {
+        // 'quote' is the opening quote of a value starting with "id:"; look back over ':' and spaces for the key.
+        size_t i = quote;
+        while (i > 0 && (data[i - 1] == ' ' || data[i - 1] == '\t')) {
+            --i;
+        }
+        if (i == 0 || data[i - 1] != ':') {
+            return false;
+        }
+        --i;
+        while (i > 0 && (data[i - 1] == ' ' || data[i - 1] == '\t')) {
+            --i;
+        }
+        for (std::string_view key : {"\"put\"", "\"id\"", "\"remove\"", "\"update\""}) {
+            if (i >= key.size() && data.substr(i - key.size(), key.size()) == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void find(std::string_view data, size_t begin, size_t end, uint64_t base, std::vector<Match> &matches) const {
+        if (_id_lines) {
+            size_t pos = begin;
+            if (pos > 0 && data[pos - 1] != '\n') {
+                pos = data.find('\n', pos);
+                pos = (pos == std::string_view::npos) ? data.size() : pos + 1;
+            }
+            while (pos < end) {
+                size_t nl = data.find('\n', pos);
+                size_t line_end = (nl == std::string_view::npos) ? data.size() : nl;
+                if (data.substr(pos, 3) == "id:") {
+                    matches.push_back({base + pos, data.substr(pos, line_end - pos)});
+                }
+                pos = line_end + 1;
+            }
+            return;
+        }
+        for (size_t pos = data.find("\"id:", begin); pos < end; pos = data.find("\"id:", pos + 1)) {
+            size_t close = data.find('"', pos + 1);
+            if (close != std::string_view::npos && is_id_key(data, pos)) {
+                matches.push_back({base + pos, data.substr(pos + 1, close - pos - 1)});
+            }
+        }
+    }
+
+    void add(std::string_view id, uint64_t bytes, BucketCounts &counts) const {
+        uint64_t bucket = bucketid::location(id) & bucketid::mask(_bits);
+        counts.docs[bucket] += 1;
+        counts.bytes[bucket] += bytes;
+    }
+
+public:
+    FeedScanner(uint32_t bits, int num_threads, bool id_lines)
+        : _bits(bits), _num_threads(num_threads), _id_lines(id_lines), _counts(),
+          _num_docs(0), _pending_id(), _pending_offset(0), _has_pending(false)
+    {
+        _counts.docs.assign(size_t(1) << bits, 0);
+        _counts.bytes.assign(size_t(1) << bits, 0);
+    }
+
+    /**
+     * Scans 'data', which starts at 'base' in the feed. Ids must be complete; the caller
+     * keeps a possibly incomplete tail for the next call.
+     */
+    void scan(std::string_view data, uint64_t base) {
+        std::vector<std::vector<Match>> matches(_num_threads);
+        std::vector<BucketCounts> counts(_num_threads);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < _num_threads; ++t) {
+            threads.emplace_back([&, t]() {
+                size_t begin = data.size() * t / _num_threads;
+                size_t end = data.size() * (t + 1) / _num_threads;
+                find(data, begin, end, base, matches[t]);
+                counts[t].docs.assign(_counts.docs.size(), 0);
+                counts[t].bytes.assign(_counts.bytes.size(), 0);
+                // The size of a document reaches to the next match, possibly found by the next thread.
+                for (size_t i = 0; i + 1 < matches[t].size(); ++i) {
+                    add(matches[t][i].id, matches[t][i + 1].offset - matches[t][i].offset, counts[t]);
+                }
+            });
+        }
+        for (int t = 0; t < _num_threads; ++t) {
+            threads[t].join();
+        }
+        for (int t = 0; t < _num_threads; ++t) {
+            for (size_t b = 0; b < _counts.docs.size(); ++b) {
+                _counts.docs[b] += counts[t].docs[b];
+                _counts.bytes[b] += counts[t].bytes[b];
+            }
+            if (matches[t].empty()) {
+                continue;
+            }
+            if (_has_pending) {
+                add(_pending_id, matches[t].front().offset - _pending_offset, _counts);
+            }
+            _num_docs += matches[t].size();
+            _pending_id = std::string(matches[t].back().id);
+            _pending_offset = matches[t].back().offset;
+            _has_pending = true;
+        }
+    }
+    void finish(uint64_t end_offset) {
+        if (_has_pending) {
+            add(_pending_id, end_offset - _pending_offset, _counts);
+            _has_pending = false;
+        }
+    }
+    uint64_t num_docs() const { return _num_docs; }
+    const BucketCounts &counts() const { return _counts; }
+};
+
+void
+scan_feed(FILE *in, FeedScanner &scanner) {
+    constexpr size_t block_size = 64 << 20;
+    constexpr size_t max_id_length = 4096;
+    std::vector<char> buffer(block_size + max_id_length);
+    size_t carry = 0;
+    uint64_t base = 0;
+    while (true) {
+        size_t n = fread(buffer.data() + carry, 1, block_size, in);
+        size_t size = carry + n;
+        if (n == 0) {
+            scanner.scan(std::string_view(buffer.data(), size), base);
+            scanner.finish(base + size);
+            return;
+        }
+        // Keep the tail after the last newline (or the last max_id_length bytes) for the next block,
+        // so no id is split. Matches are only taken from the scanned part.
+        size_t cut = size;
+        size_t nl = std::string_view(buffer.data(), size).rfind('\n');
+        if (nl != std::string_view::npos && size - nl <= max_id_length) {
+            cut = nl + 1;
+        } else if (size > max_id_length) {
+            cut = size - max_id_length;
+        }
+        scanner.scan(std::string_view(buffer.data(), cut), base);
+        memmove(buffer.data(), buffer.data() + cut, size - cut);
+        carry = size - cut;
+        base += cut;
+    }
+}
+
+struct NodeStats {
+    uint64_t docs = 0;
+    uint64_t bytes = 0;
+    uint64_t primary_docs = 0;
+    uint64_t buckets = 0;
+    uint64_t distributor_buckets = 0;
+    uint64_t distributor_docs = 0;
+};
+
+std::map<uint16_t, NodeStats>
+node_stats(const Topology &topology, const BucketCounts &counts, int num_threads, std::vector<Placement> &placements) {
+    std::map<uint16_t, NodeStats> stats;
+    for (const auto &group : topology.groups) {
+        for (const auto &node : group.nodes) {
+            stats[node.index];
+        }
+    }
+    placements.resize(counts.docs.size());
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::vector<double> scores;
+            for (uint64_t b = t; b < placements.size(); b += num_threads) {
+                placements[b] = place(topology, b, scores);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (uint64_t b = 0; b < counts.docs.size(); ++b) {
+        for (size_t i = 0; i < placements[b].storage.size(); ++i) {
+            NodeStats &node = stats[placements[b].storage[i]];
+            node.docs += counts.docs[b];
+            node.bytes += counts.bytes[b];
+            node.buckets += 1;
+            if (i == 0) {
+                node.primary_docs += counts.docs[b];
+            }
+        }
+        stats[placements[b].distributor].distributor_buckets += 1;
+        stats[placements[b].distributor].distributor_docs += counts.docs[b];
+    }
+    return stats;
+}
+
+void
+report(const char *title, const Topology &topology, const std::map<uint16_t, NodeStats> &stats) {
+    printf("# %s\n", title);
+    printf("node\tgroup\tup\tbuckets\tdocs\tbytes\tprimary_docs\tdistributor_buckets\tdistributor_docs\n");
+    uint64_t max_docs = 0;
+    uint64_t total_docs = 0;
+    uint64_t max_bytes = 0;
+    uint64_t total_bytes = 0;
+    size_t num_up = 0;
+    for (const auto &group : topology.groups) {
+        for (const auto &node : group.nodes) {
+            const NodeStats &s = stats.at(node.index);
+            printf("%u\t%u\t%d\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", node.index, group.index, node.up ? 1 : 0, s.buckets,
+                   s.docs, s.bytes, s.primary_docs, s.distributor_buckets, s.distributor_docs);
+            if (node.up) {
+                ++num_up;
+                max_docs = std::max(max_docs, s.docs);
+                max_bytes = std::max(max_bytes, s.bytes);
+                total_docs += s.docs;
+                total_bytes += s.bytes;
+            }
+        }
+    }
+    double mean_docs = num_up ? double(total_docs) / num_up : 0.0;
+    double mean_bytes = num_up ? double(total_bytes) / num_up : 0.0;
+    printf("# replicas %lu, bytes %lu, skew (max / mean over up nodes) docs %.4f bytes %.4f\n", total_docs, total_bytes,
+           mean_docs > 0 ? max_docs / mean_docs : 0.0, mean_bytes > 0 ? max_bytes / mean_bytes : 0.0);
+}
+
+/**
+ * Replicas that must be copied to reach the new ideal state: those on nodes that did not have them before.
+ */
+void
+report_movement(const BucketCounts &counts, const std::vector<Placement> &before, const std::vector<Placement> &after) {
+    uint64_t moved_docs = 0;
+    uint64_t moved_bytes = 0;
+    uint64_t moved_buckets = 0;
+    uint64_t total_docs = 0;
+    uint64_t total_bytes = 0;
+    uint64_t distributor_changes = 0;
+    for (size_t b = 0; b < counts.docs.size(); ++b) {
+        for (uint16_t node : after[b].storage) {
+            total_docs += counts.docs[b];
+            total_bytes += counts.bytes[b];
+            if (std::find(before[b].storage.begin(), before[b].storage.end(), node) == before[b].storage.end()) {
+                moved_docs += counts.docs[b];
+                moved_bytes += counts.bytes[b];
+                moved_buckets += 1;
+            }
+        }
+        distributor_changes += (before[b].distributor != after[b].distributor) ? 1 : 0;
+    }
+    printf("# movement: %lu bucket replicas, %lu document replicas (%.2f%%), %lu bytes (%.2f%%), %lu buckets change distributor\n",
+           moved_buckets, moved_docs, total_docs ? 100.0 * moved_docs / total_docs : 0.0,
+           moved_bytes, total_bytes ? 100.0 * moved_bytes / total_bytes : 0.0, distributor_changes);
+}
+
+void
+usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n nodes | -g <groups>x<nodes>] [-p partitions] [-r redundancy] [-b bits] "
+            "[-c node:capacity]... [-a group] [-x node]... [-i] [-t threads] [feed file]\n", prog);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    Topology topology;
+    uint32_t num_nodes = 4;
+    uint32_t num_groups = 0;
+    std::vector<std::pair<uint16_t, double>> capacities;
+    int add_to_group = -1;
+    std::vector<uint16_t> remove_nodes;
+    bool id_lines = false;
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    int option;
+    while ((option = getopt(argc, argv, "n:g:p:r:b:c:a:x:it:h")) != -1) {
+        switch (option) {
+        case 'n': num_nodes = std::stoul(optarg); break;
+        case 'g':
+            if (sscanf(optarg, "%ux%u", &num_groups, &num_nodes) != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p': topology.partitions = optarg; break;
+        case 'r': topology.redundancy = std::stoul(optarg); break;
+        case 'b': topology.bits = std::min(24ul, std::stoul(optarg)); break;
+        case 'c': {
+            unsigned int node;
+            double capacity;
+            if (sscanf(optarg, "%u:%lf", &node, &capacity) != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+            capacities.emplace_back(node, capacity);
+            break;
+        }
+        case 'a': add_to_group = std::stoi(optarg); break;
+        case 'x': remove_nodes.push_back(std::stoul(optarg)); break;
+        case 'i': id_lines = true; break;
+        case 't': num_threads = std::max(1, std::stoi(optarg)); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind > 1 || num_nodes == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    uint16_t next_index = 0;
+    for (uint32_t g = 0; g < std::max(1u, num_groups); ++g) {
+        Group group{uint16_t(g), 0, {}};
+        for (uint32_t n = 0; n < num_nodes; ++n) {
+            group.nodes.push_back(Node{next_index++});
+        }
+        topology.groups.push_back(group);
+    }
+    if (num_groups > 0 && topology.partitions.empty()) {
+        for (uint32_t g = 0; g < num_groups; ++g) {
+            topology.partitions += (g > 0) ? "|*" : "*";
+        }
+    }
+    topology.compute_hashes();
+    for (const auto &capacity : capacities) {
+        if (Node *node = topology.find(capacity.first)) {
+            node->capacity = capacity.second;
+        }
+    }
+
+    FILE *in = (optind < argc) ? fopen(argv[optind], "r") : stdin;
+    if (in == nullptr) {
+        perror(argv[optind]);
+        return 1;
+    }
+    FeedScanner scanner(topology.bits, num_threads, id_lines);
+    scan_feed(in, scanner);
+    fprintf(stderr, "Found %lu documents\n", scanner.num_docs());
+
+    std::vector<Placement> before;
+    report("current", topology, node_stats(topology, scanner.counts(), num_threads, before));
+    if (add_to_group < 0 && remove_nodes.empty()) {
+        return 0;
+    }
+    Topology changed = topology;
+    if (add_to_group >= 0 && add_to_group < int(changed.groups.size())) {
+        changed.groups[add_to_group].nodes.push_back(Node{uint16_t(changed.max_node_index() + 1)});
+    }
+    for (uint16_t index : remove_nodes) {
+        if (Node *node = changed.find(index)) {
+            node->up = false;
+        }
+    }
+    std::vector<Placement> after;
+    report("changed", changed, node_stats(changed, scanner.counts(), num_threads, after));
+    report_movement(scanner.counts(), before, after);
+    return 0;
+}
@@ -0,0 +1,49 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+
+# Offline ideal state placement of a generated feed, computed by lib/ideal_state_simulator.cpp on a node.
+# Use this to predict per node document and byte counts, and the data moved when a node is added
+# or taken down, before deploying a cluster.
+class IdealStateSimulator
+
+  def initialize(node)
+    @node = node
+    @binary = DataGenerator.compile_tool(node, 'ideal_state_simulator.cpp', flags: '-std=c++17 -O3 -pthread')
+  end
+
+  # Runs the simulator and returns its report. 'groups' is nil for a flat cluster of 'nodes' nodes,
+  # otherwise the number of leaf groups with 'nodes' nodes each. 'feed' is either a feed file or a
+  # command writing the feed to stdin (e.g. a generator).
+  def simulate(feed:, nodes:, groups: nil, redundancy: 2, distribution_bits: 16, partitions: nil,
+               add_to_group: nil, take_down: [], threads: nil, feed_is_command: false)
+    args = [groups ? "-g #{groups}x#{nodes}" : "-n #{nodes}", "-r #{redundancy}", "-b #{distribution_bits}"]
+    args << "-p '#{partitions}'" if partitions
+    args << "-a #{add_to_group}" if add_to_group
+    take_down.each { |index| args << "-x #{index}" }
+    args << "-t #{threads}" if threads
+    command = feed_is_command ? "#{feed} | #{@binary} #{args.join(' ')}" : "#{@binary} #{args.join(' ')} #{feed}"
+    @node.execute(command)
+  end
+
+  # Parses a report into { 'current' => [per node hash], 'changed' => [...], 'movement' => line }.
+  def self.parse(text)
+    result = {}
+    section = nil
+    columns = nil
+    text.each_line do |line|
+      line = line.chomp
+      if line =~ /^# (current|changed)$/
+        section = result[$1] = []
+      elsif line.start_with?('# movement:')
+        result['movement'] = line.sub('# movement: ', '')
+      elsif line.start_with?('node')
+        columns = line.split("\t")
+      elsif section && columns && line =~ /^\d/
+        section << Hash[columns.zip(line.split("\t").map(&:to_i))]
+      end
+    end
+    result
+  end
+
+end
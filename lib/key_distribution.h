@@ -0,0 +1,71 @@
+// Copyright Vespa.ai. All rights reserved.
+// Skewed key popularity for C++ query generators, header only.
+//
+// Zipf draws popularity ranks in [1, n] by rejection-inversion (Hörmann and Derflinger), which needs
+// O(1) memory and works for key spaces of several hundred million. Scatter is a bijection over [0, n)
+// that maps ranks to keys, so hot keys are spread over the key space instead of clustering in the
+// first documents.
+//
+// Compile generators using this with: g++ -std=c++17 -O3 -I<system-test>/lib ...
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <random>
+
+namespace keydist {
+
+class Zipf {
+    double _s;
+    double _h_x1;
+    double _h_n;
+    double _c;
+    uint64_t _n;
+
+    double h(double x) const { return helper2((1.0 - _s) * std::log(x)) * std::log(x); }
+    double h_inv(double x) const {
+        double t = std::max(-1.0, x * (1.0 - _s));
+        return std::exp(helper1(t) * x);
+    }
+    // log(1 + x) / x, stable around 0
+    static double helper1(double x) { return (std::abs(x) > 1e-8) ? std::log1p(x) / x : 1.0 - x * (0.5 - x / 3.0); }
+    // (exp(x) - 1) / x, stable around 0
+    static double helper2(double x) { return (std::abs(x) > 1e-8) ? std::expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x / 3.0); }
+
+public:
+    Zipf(uint64_t n, double s)
+        : _s(s), _h_x1(h(1.5) - 1.0), _h_n(h(n + 0.5)), _c(2.0 - h_inv(h(2.5) - std::pow(2.0, -s))), _n(n)
+    {}
+    template <typename Rng>
+    uint64_t operator()(Rng &rng) {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        while (true) {
+            double u = _h_n + uniform(rng) * (_h_x1 - _h_n);
+            double x = h_inv(u);
+            uint64_t k = std::clamp<uint64_t>(uint64_t(x + 0.5), 1, _n);
+            if ((k - x <= _c) || (u >= h(k + 0.5) - std::exp(-_s * std::log(double(k))))) {
+                return k;
+            }
+        }
+    }
+};
+
+class Scatter {
+    uint64_t _n;
+    uint64_t _mul;
+
+public:
+    explicit Scatter(uint64_t n) : _n(n), _mul(0x9e3779b97f4a7c15ULL % n) {
+        while (_mul == 0 || std::gcd(_mul, _n) != 1) {
+            ++_mul;
+        }
+    }
+    uint64_t operator()(uint64_t rank) const {
+        return uint64_t((unsigned __int128)(rank) * _mul % _n);
+    }
+};
+
+}
@@ -0,0 +1,485 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// Latency histograms from per-request records, with HDR (high dynamic range) precision.
+//
+// Reads per-request latencies into a histogram with a fixed number of significant digits over the whole range,
+// so any percentile (p99.9, p99.99) is exact within that precision, and histograms from several load giver
+// processes and hosts can be merged by adding counts, which averaging their percentiles cannot do.
+// With -i, a histogram is also kept per time interval, aligned to the epoch so intervals from different hosts
+// line up when merged.
+//
+// Input formats (-f):
+//   raw     one request per line: '<latency>' or '<timestamp seconds> <latency>', latency in -u units (default ms)
+//   h2load  lines of h2load --log-file: '<start us since epoch>\t<status>\t<latency us>';
+//           requests without a 2xx status are counted as errors and not recorded unless -a is given
+//   hdr     histogram files written by -o, which are merged (they must use the same interval)
+//
+// Output is the summary as '<name> <value>' lines (count, errors, clamped, min_ms, mean_ms, max_ms and
+// '<p> percentile' for each of -p), then with -i a '# series interval_s=<s>' line, a header line and one
+// tab separated line per interval.
+//
+// Histogram file format (-o), little endian:
+//   "HDRL" u32:version(1) u32:digits u64:highest u64:interval_us u64:errors u32:num_histograms
+//   then num_histograms histograms, the total first and then one per interval, each
+//   u64:start_us (interval start, 0 for the total) u64:count u64:clamped u64:min u64:max f64:sum
+//   u32:num_entries (varint zigzag)*
+// where entries are counts in index order, and a negative entry -n skips n empty indexes.
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+/**
+ * HDR histogram of values in [1, highest] (microseconds), with 'digits' significant decimal digits.
+ * Values above highest are clamped to highest.
+ */
+class Histogram {
+    uint32_t _digits;
+    uint64_t _highest;
+    uint32_t _sub_bucket_half_count_magnitude;
+    uint64_t _sub_bucket_half_count;
+    uint64_t _sub_bucket_mask;
+    uint32_t _bucket_count;
+    std::vector<uint64_t> _counts;
+    uint64_t _total;
+    uint64_t _clamped;
+    uint64_t _min;
+    uint64_t _max;
+    double _sum;
+
+    uint32_t bucket_index(uint64_t v) const {
+        uint32_t pow2ceiling = 64 - __builtin_clzll(v | _sub_bucket_mask);
+        return pow2ceiling - (_sub_bucket_half_count_magnitude + 1);
+    }
+    size_t counts_index(uint64_t v) const {
+        uint32_t b = bucket_index(v);
+        uint64_t sub = v >> b;
+        return (size_t(b + 1) << _sub_bucket_half_count_magnitude) + (sub - _sub_bucket_half_count);
+    }
+    // Lowest value and size of the range of values counted at index i.
+    std::pair<uint64_t, uint64_t> range(size_t i) const {
+        int64_t b = int64_t(i >> _sub_bucket_half_count_magnitude) - 1;
+        uint64_t sub = (i & (_sub_bucket_half_count - 1)) + _sub_bucket_half_count;
+        if (b < 0) {
+            sub -= _sub_bucket_half_count;
+            b = 0;
+        }
+        return {sub << b, uint64_t(1) << b};
+    }
+
+public:
+    Histogram(uint32_t digits, uint64_t highest)
+        : _digits(digits), _highest(highest), _sub_bucket_half_count_magnitude(0), _sub_bucket_half_count(0),
+          _sub_bucket_mask(0), _bucket_count(1), _counts(), _total(0), _clamped(0), _min(UINT64_MAX), _max(0), _sum(0.0)
+    {
+        uint64_t largest_single_unit = 2 * uint64_t(std::pow(10.0, digits));
+        uint32_t sub_bucket_count_magnitude = uint32_t(std::ceil(std::log2(double(largest_single_unit))));
+        _sub_bucket_half_count_magnitude = sub_bucket_count_magnitude - 1;
+        uint64_t sub_bucket_count = uint64_t(1) << sub_bucket_count_magnitude;
+        _sub_bucket_half_count = sub_bucket_count / 2;
+        _sub_bucket_mask = sub_bucket_count - 1;
+        for (uint64_t smallest = sub_bucket_count; smallest <= highest && smallest < (uint64_t(1) << 62); smallest <<= 1) {
+            ++_bucket_count;
+        }
+        _counts.resize(size_t(_bucket_count + 1) * _sub_bucket_half_count, 0);
+    }
+    uint32_t digits() const { return _digits; }
+    uint64_t highest() const { return _highest; }
+    uint64_t total() const { return _total; }
+    uint64_t clamped() const { return _clamped; }
+    uint64_t min() const { return _total > 0 ? _min : 0; }
+    uint64_t max() const { return _max; }
+    double mean() const { return _total > 0 ? _sum / _total : 0.0; }
+
+    void record(uint64_t v, uint64_t count = 1) {
+        if (v > _highest) {
+            v = _highest;
+            _clamped += count;
+        }
+        v = std::max<uint64_t>(v, 1);
+        _counts[counts_index(v)] += count;
+        _total += count;
+        _min = std::min(_min, v);
+        _max = std::max(_max, v);
+        _sum += double(v) * count;
+    }
+    // Adds the counts of another histogram, re-recording its values if the precision differs.
+    void add(const Histogram &other) {
+        if (other._total == 0) {
+            return;
+        }
+        if (other._digits == _digits && other._highest == _highest) {
+            for (size_t i = 0; i < _counts.size(); ++i) {
+                _counts[i] += other._counts[i];
+            }
+            _total += other._total;
+        } else {
+            for (size_t i = 0; i < other._counts.size(); ++i) {
+                if (other._counts[i] > 0) {
+                    auto [low, size] = other.range(i);
+                    uint64_t v = std::min(low + size / 2, _highest);
+                    _counts[counts_index(std::max<uint64_t>(v, 1))] += other._counts[i];
+                }
+            }
+            _total += other._total;
+        }
+        _clamped += other._clamped;
+        _min = std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+        _sum += other._sum;
+    }
+    // Highest value equivalent (within the precision) to the value at percentile p.
+    uint64_t percentile(double p) const {
+        if (_total == 0) {
+            return 0;
+        }
+        uint64_t target = std::max<uint64_t>(1, uint64_t(std::ceil(std::min(p, 100.0) / 100.0 * _total)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < _counts.size(); ++i) {
+            seen += _counts[i];
+            if (seen >= target) {
+                auto [low, size] = range(i);
+                return std::min(low + size - 1, _max);
+            }
+        }
+        return _max;
+    }
+
+    void write(FILE *file, uint64_t start) const {
+        auto put = [file](const void *p, size_t n) { fwrite(p, 1, n, file); };
+        std::vector<uint8_t> entries;
+        uint32_t num_entries = 0;
+        auto varint = [&entries, &num_entries](int64_t v) {
+            uint64_t z = (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+            while (z >= 0x80) {
+                entries.push_back(uint8_t(z) | 0x80);
+                z >>= 7;
+            }
+            entries.push_back(uint8_t(z));
+            ++num_entries;
+        };
+        size_t last = _counts.size();
+        while (last > 0 && _counts[last - 1] == 0) {
+            --last;
+        }
+        for (size_t i = 0; i < last;) {
+            if (_counts[i] == 0) {
+                size_t run = 0;
+                while (_counts[i + run] == 0) {
+                    ++run;
+                }
+                varint(-int64_t(run));
+                i += run;
+            } else {
+                varint(int64_t(_counts[i++]));
+            }
+        }
+        uint64_t min = this->min();
+        put(&start, 8);
+        put(&_total, 8);
+        put(&_clamped, 8);
+        put(&min, 8);
+        put(&_max, 8);
+        put(&_sum, 8);
+        put(&num_entries, 4);
+        put(entries.data(), entries.size());
+    }
+
+    // Reads a histogram written by write(), returning its start.
+    uint64_t read(FILE *file, const char *name) {
+        auto get = [file, name](void *p, size_t n) {
+            if (fread(p, 1, n, file) != n) {
+                fprintf(stderr, "Truncated histogram file %s\n", name);
+                exit(1);
+            }
+        };
+        uint64_t start;
+        uint32_t num_entries;
+        get(&start, 8);
+        get(&_total, 8);
+        get(&_clamped, 8);
+        get(&_min, 8);
+        get(&_max, 8);
+        get(&_sum, 8);
+        get(&num_entries, 4);
+        if (_total == 0) {
+            _min = UINT64_MAX;
+        }
+        size_t i = 0;
+        for (uint32_t e = 0; e < num_entries; ++e) {
+            uint64_t z = 0;
+            for (int shift = 0;; shift += 7) {
+                uint8_t byte;
+                get(&byte, 1);
+                z |= uint64_t(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    break;
+                }
+            }
+            int64_t v = int64_t(z >> 1) ^ -int64_t(z & 1);
+            if (v < 0) {
+                i += size_t(-v);
+            } else if (i < _counts.size()) {
+                _counts[i++] = uint64_t(v);
+            } else {
+                fprintf(stderr, "Corrupt histogram file %s\n", name);
+                exit(1);
+            }
+        }
+        return start;
+    }
+};
+
+struct Config {
+    uint32_t digits = 3;
+    uint64_t highest = 3600ull * 1000 * 1000;
+    uint64_t interval_us = 0;
+    std::string format = "raw";
+    double unit_us = 1000.0;
+    bool all = false;
+    std::vector<double> percentiles = {50, 90, 95, 99, 99.9, 99.99};
+};
+
+/**
+ * The total histogram and, with an interval, one histogram per interval keyed by its start.
+ */
+struct Histograms {
+    const Config &config;
+    Histogram total;
+    std::map<uint64_t, Histogram> series;
+    uint64_t errors;
+
+    explicit Histograms(const Config &c) : config(c), total(c.digits, c.highest), series(), errors(0) {}
+
+    Histogram &interval(uint64_t start) {
+        auto it = series.find(start);
+        if (it == series.end()) {
+            it = series.emplace(start, Histogram(config.digits, config.highest)).first;
+        }
+        return it->second;
+    }
+    void record(uint64_t timestamp_us, uint64_t latency_us) {
+        total.record(latency_us);
+        if (config.interval_us > 0) {
+            interval(timestamp_us - timestamp_us % config.interval_us).record(latency_us);
+        }
+    }
+
+    void read_text(FILE *file, const char *name) {
+        char line[1024];
+        uint64_t line_no = 0;
+        while (fgets(line, sizeof(line), file) != nullptr) {
+            ++line_no;
+            char *p = line;
+            char *end;
+            double fields[3];
+            int n = 0;
+            while (n < 3) {
+                double v = strtod(p, &end);
+                if (end == p) {
+                    break;
+                }
+                fields[n++] = v;
+                p = end;
+            }
+            if (n == 0) {
+                continue;
+            }
+            if (config.format == "h2load") {
+                if (n != 3) {
+                    fprintf(stderr, "%s:%lu: expected '<start us> <status> <latency us>'\n", name, line_no);
+                    exit(1);
+                }
+                if ((fields[1] < 200 || fields[1] >= 300) && !config.all) {
+                    ++errors;
+                    continue;
+                }
+                record(uint64_t(fields[0]), uint64_t(std::llround(fields[2])));
+            } else if (n == 1) {
+                record(0, uint64_t(std::llround(fields[0] * config.unit_us)));
+            } else {
+                record(uint64_t(fields[0] * 1e6), uint64_t(std::llround(fields[1] * config.unit_us)));
+            }
+        }
+    }
+
+    void read_hdr(FILE *file, const char *name) {
+        char magic[4];
+        uint32_t version, digits, count;
+        uint64_t highest, interval_us, file_errors;
+        if (fread(magic, 1, 4, file) != 4 || memcmp(magic, "HDRL", 4) != 0 ||
+            fread(&version, 4, 1, file) != 1 || version != 1 ||
+            fread(&digits, 4, 1, file) != 1 || fread(&highest, 8, 1, file) != 1 ||
+            fread(&interval_us, 8, 1, file) != 1 || fread(&file_errors, 8, 1, file) != 1 ||
+            fread(&count, 4, 1, file) != 1)
+        {
+            fprintf(stderr, "Not a histogram file: %s\n", name);
+            exit(1);
+        }
+        if (config.interval_us > 0 && count > 1 && interval_us != config.interval_us) {
+            fprintf(stderr, "%s has interval %lu us, expected %lu us\n", name, interval_us, config.interval_us);
+            exit(1);
+        }
+        errors += file_errors;
+        for (uint32_t i = 0; i < count; ++i) {
+            Histogram h(digits, highest);
+            uint64_t start = h.read(file, name);
+            if (i == 0) {
+                total.add(h);
+            } else if (config.interval_us > 0) {
+                interval(start).add(h);
+            }
+        }
+    }
+
+    void read(FILE *file, const char *name) {
+        if (config.format == "hdr") {
+            read_hdr(file, name);
+        } else {
+            read_text(file, name);
+        }
+    }
+
+    void write(const char *file_name) const {
+        FILE *file = fopen(file_name, "wb");
+        if (file == nullptr) {
+            perror(file_name);
+            exit(1);
+        }
+        uint32_t version = 1;
+        uint32_t digits = config.digits;
+        uint32_t count = 1 + series.size();
+        fwrite("HDRL", 1, 4, file);
+        fwrite(&version, 4, 1, file);
+        fwrite(&digits, 4, 1, file);
+        fwrite(&config.highest, 8, 1, file);
+        fwrite(&config.interval_us, 8, 1, file);
+        fwrite(&errors, 8, 1, file);
+        fwrite(&count, 4, 1, file);
+        total.write(file, 0);
+        for (const auto &[start, h] : series) {
+            h.write(file, start);
+        }
+        fclose(file);
+    }
+
+    void report(FILE *out) const {
+        fprintf(out, "count %lu\n", total.total());
+        fprintf(out, "errors %lu\n", errors);
+        fprintf(out, "clamped %lu\n", total.clamped());
+        fprintf(out, "min_ms %.3f\n", total.min() / 1000.0);
+        fprintf(out, "mean_ms %.3f\n", total.mean() / 1000.0);
+        fprintf(out, "max_ms %.3f\n", total.max() / 1000.0);
+        for (double p : config.percentiles) {
+            fprintf(out, "%g percentile %.3f\n", p, total.percentile(p) / 1000.0);
+        }
+        if (config.interval_us > 0) {
+            fprintf(out, "# series interval_s=%g\n", config.interval_us / 1e6);
+            fprintf(out, "time_s\tcount\tqps\tmean_ms\tmax_ms");
+            for (double p : config.percentiles) {
+                fprintf(out, "\tp%g_ms", p);
+            }
+            fprintf(out, "\n");
+            for (const auto &[start, h] : series) {
+                fprintf(out, "%.3f\t%lu\t%.1f\t%.3f\t%.3f", start / 1e6, h.total(), h.total() * 1e6 / config.interval_us,
+                        h.mean() / 1000.0, h.max() / 1000.0);
+                for (double p : config.percentiles) {
+                    fprintf(out, "\t%.3f", h.percentile(p) / 1000.0);
+                }
+                fprintf(out, "\n");
+            }
+        }
+    }
+};
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f raw|h2load|hdr] [-u ns|us|ms|s] [-d digits] [-m max ms] [-i interval s]\n"
+                    "       [-p percentiles] [-o histogram file] [-a] [files]\n"
+                    "  -f: input format (default raw), see lib/latency_histogram.cpp\n"
+                    "  -u: unit of raw latencies (default ms)\n"
+                    "  -d: significant digits, 1-5 (default 3)\n"
+                    "  -m: highest latency tracked in ms, higher latencies are clamped (default 3600000)\n"
+                    "  -i: also keep a histogram per interval of this many seconds\n"
+                    "  -p: comma separated percentiles to report (default 50,90,95,99,99.9,99.99)\n"
+                    "  -o: write the (merged) histograms to this file\n"
+                    "  -a: also record h2load requests without a 2xx status\n"
+                    "Reads stdin when no files are given.\n", prog);
+}
+
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    const char *output = nullptr;
+    int option;
+    while ((option = getopt(argc, argv, "f:u:d:m:i:p:o:ah")) != -1) {
+        switch (option) {
+        case 'f': config.format = optarg; break;
+        case 'u': {
+            std::string unit = optarg;
+            if (unit == "ns") config.unit_us = 0.001;
+            else if (unit == "us") config.unit_us = 1.0;
+            else if (unit == "ms") config.unit_us = 1000.0;
+            else if (unit == "s") config.unit_us = 1e6;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        }
+        case 'd': config.digits = std::clamp(atoi(optarg), 1, 5); break;
+        case 'm': config.highest = uint64_t(atof(optarg) * 1000.0); break;
+        case 'i': config.interval_us = uint64_t(atof(optarg) * 1e6); break;
+        case 'p': {
+            config.percentiles.clear();
+            for (char *p = optarg; *p != '\0'; p += (*p == ',') ? 1 : 0) {
+                char *end;
+                config.percentiles.push_back(strtod(p, &end));
+                if (end == p || (*end != ',' && *end != '\0')) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                p = end;
+            }
+            break;
+        }
+        case 'o': output = optarg; break;
+        case 'a': config.all = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.format != "raw" && config.format != "h2load" && config.format != "hdr") {
+        usage(argv[0]);
+        return 1;
+    }
+    Histograms histograms(config);
+    if (optind == argc) {
+        histograms.read(stdin, "stdin");
+    }
+    for (int i = optind; i < argc; ++i) {
+        FILE *file = fopen(argv[i], config.format == "hdr" ? "rb" : "r");
+        if (file == nullptr) {
+            perror(argv[i]);
+            return 1;
+        }
+        histograms.read(file, argv[i]);
+        fclose(file);
+    }
+    if (output != nullptr) {
+        histograms.write(output);
+    }
+    histograms.report(stdout);
+    return 0;
+}
@@ -0,0 +1,1764 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// Local stand-in for the /document/v1 and /search APIs of a Vespa container, for measuring how fast the load
+// side (vespa-feed-client, vespa-fbench, h2load, lib/open_loop_bench.cpp and the feed generators) can go
+// without a deployed Vespa, and for checking that it is never the bottleneck of a benchmark.
+//
+// Document operations are answered like /document/v1 does: POST is a put, PUT an update, DELETE a remove and
+// GET a get (or a visit, without a document id), with the pathId and document id in the response. Queries to
+// /search/ (GET, or POST with a JSON body) get a fixed result with -n hits. /state/v1/health answers 'up'.
+// With -j, put and update bodies must be JSON objects with 'fields', and POST query bodies must be JSON, or
+// the response is 400 as from the container.
+//
+// Responses are delayed by a latency distribution, separately for feed (-f) and search (-s), or both (-l):
+//   fixed:<ms>, uniform:<min ms>:<max ms>, exp:<mean ms>, lognormal:<median ms>:<sigma> or pareto:<min ms>:<alpha>,
+// optionally a mix of them with weights, e.g. 'lognormal:2:0.5,fixed:200@0.001' for a rare 200 ms stall.
+// A fraction (-e) of feed and search requests fail with status -E (default 503), after the same latency.
+//
+// Each thread (-t) has its own listening socket (SO_REUSEPORT) and an edge triggered epoll loop, and delayed
+// responses wait in a timer heap, so no state is shared between threads. Connections speak HTTP/1.1 (with
+// keep-alive and pipelining, responses in request order) or HTTP/2 (prior knowledge, or ALPN over TLS).
+// TLS is used with -D, with certificates from -C/-K/-T or else VESPA_TLS_CONFIG_FILE.
+//
+// Runs until SIGINT or SIGTERM, or for -r seconds, then prints a summary of the requests served. With -i,
+// the request rate of each interval is written to stderr while running.
+//
+// Compile with: g++ -std=c++17 -O3 -pthread -o mock_endpoint mock_endpoint.cpp -lssl -lcrypto
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace {
+
+std::atomic<bool> stopped(false);
+
+void on_signal(int) {
+    stopped = true;
+}
+
+int64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * A mix of latency distributions, each chosen with its weight. Components without a weight share what
+ * the others leave.
+ */
+class Latency {
+public:
+    bool parse(const std::string &spec) {
+        components.clear();
+        double weighted = 0.0;
+        size_t unweighted = 0;
+        std::stringstream ss(spec);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            Component c;
+            size_t at = item.find('@');
+            if (at != std::string::npos) {
+                c.weight = atof(item.c_str() + at + 1);
+                weighted += c.weight;
+                item.resize(at);
+            } else {
+                ++unweighted;
+            }
+            std::vector<std::string> parts;
+            std::stringstream is(item);
+            for (std::string part; std::getline(is, part, ':');) {
+                parts.push_back(part);
+            }
+            if (parts.empty()) {
+                return false;
+            }
+            c.kind = parts[0];
+            c.a = parts.size() > 1 ? atof(parts[1].c_str()) : 0.0;
+            c.b = parts.size() > 2 ? atof(parts[2].c_str()) : 0.0;
+            size_t args = (c.kind == "none") ? 1 : (c.kind == "fixed" || c.kind == "exp") ? 2 : 3;
+            if (parts.size() != args ||
+                (c.kind != "none" && c.kind != "fixed" && c.kind != "exp" && c.kind != "uniform" &&
+                 c.kind != "lognormal" && c.kind != "pareto"))
+            {
+                return false;
+            }
+            components.push_back(c);
+        }
+        if (weighted > 1.0 + 1e-9) {
+            return false;
+        }
+        double cumulative = 0.0;
+        for (auto &c : components) {
+            if (c.weight < 0.0) {
+                c.weight = unweighted > 0 ? (1.0 - weighted) / unweighted : 0.0;
+            }
+            cumulative += c.weight;
+            c.cumulative = cumulative;
+        }
+        return true;
+    }
+
+    bool none() const {
+        return components.empty() || (components.size() == 1 && components[0].kind == "none");
+    }
+
+    int64_t sample_ns(std::mt19937_64 &rng) const {
+        if (none()) {
+            return 0;
+        }
+        double u = std::uniform_real_distribution<double>(0.0, components.back().cumulative)(rng);
+        const Component *c = &components.back();
+        for (const auto &candidate : components) {
+            if (u < candidate.cumulative) {
+                c = &candidate;
+                break;
+            }
+        }
+        double ms = 0.0;
+        if (c->kind == "fixed") {
+            ms = c->a;
+        } else if (c->kind == "uniform") {
+            ms = std::uniform_real_distribution<double>(c->a, c->b)(rng);
+        } else if (c->kind == "exp") {
+            ms = std::exponential_distribution<double>(1.0 / c->a)(rng);
+        } else if (c->kind == "lognormal") {
+            ms = std::lognormal_distribution<double>(std::log(c->a), c->b)(rng);
+        } else if (c->kind == "pareto") {
+            double v = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            ms = c->a / std::pow(1.0 - v, 1.0 / c->b);
+        }
+        return int64_t(std::max(0.0, ms) * 1e6);
+    }
+
+private:
+    struct Component {
+        std::string kind;
+        double a = 0.0;
+        double b = 0.0;
+        double weight = -1.0;
+        double cumulative = 0.0;
+    };
+    std::vector<Component> components;
+};
+
+struct Config {
+    int port = 8080;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    bool validate = false;
+    Latency feed_latency;
+    Latency search_latency;
+    double error_rate = 0.0;
+    int error_status = 503;
+    size_t hits = 10;
+    size_t max_streams = 1000;
+    double runtime_s = 0.0;
+    double interval_s = 0.0;
+    bool tls = false;
+    std::string cert_file;
+    std::string key_file;
+    std::string ca_file;
+};
+
+std::string json_field(const std::string &json, const std::string &name) {
+    std::smatch m;
+    if (std::regex_search(json, m, std::regex("\"" + name + "\"\\s*:\\s*\"([^\"]*)\""))) {
+        return m[1];
+    }
+    return "";
+}
+
+int select_alpn(SSL *, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *) {
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    unsigned char *selected = nullptr;
+    if (SSL_select_next_proto(&selected, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+SSL_CTX *make_ssl_context(Config &config) {
+    if (config.cert_file.empty() && config.key_file.empty() && config.ca_file.empty()) {
+        const char *file = getenv("VESPA_TLS_CONFIG_FILE");
+        if (file != nullptr) {
+            std::ifstream in(file);
+            std::stringstream ss;
+            ss << in.rdbuf();
+            config.cert_file = json_field(ss.str(), "certificates");
+            config.key_file = json_field(ss.str(), "private-key");
+            config.ca_file = json_field(ss.str(), "ca-certificates");
+        }
+    }
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (SSL_CTX_use_certificate_chain_file(ctx, config.cert_file.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, config.key_file.c_str(), SSL_FILETYPE_PEM) != 1)
+    {
+        fprintf(stderr, "Could not load certificate '%s' and key '%s'\n", config.cert_file.c_str(), config.key_file.c_str());
+        exit(1);
+    }
+    if (!config.ca_file.empty()) {
+        if (SSL_CTX_load_verify_locations(ctx, config.ca_file.c_str(), nullptr) != 1) {
+            fprintf(stderr, "Could not load CA certificates '%s'\n", config.ca_file.c_str());
+            exit(1);
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+    }
+    SSL_CTX_set_alpn_select_cb(ctx, select_alpn, nullptr);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return ctx;
+}
+
+/**
+ * Checks that a body is JSON, and whether a top level object has the given key.
+ */
+class JsonValidator {
+public:
+    JsonValidator(std::string_view json, std::string_view key) : p(json.data()), end(json.data() + json.size()), key(key) {}
+
+    bool valid() {
+        ws();
+        if (!value(0)) {
+            return false;
+        }
+        ws();
+        return p == end;
+    }
+
+    bool has_key = false;
+
+private:
+    const char *p;
+    const char *end;
+    std::string_view key;
+
+    void ws() {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+            ++p;
+        }
+    }
+
+    bool string(std::string_view *out) {
+        const char *start = ++p;
+        while (p < end) {
+            char c = *p;
+            if (c == '"') {
+                if (out != nullptr) {
+                    *out = std::string_view(start, p - start);
+                }
+                ++p;
+                return true;
+            }
+            if (uint8_t(c) < 0x20) {
+                return false;
+            }
+            if (c == '\\') {
+                if (++p >= end) {
+                    return false;
+                }
+                if (*p == 'u') {
+                    for (int i = 0; i < 4; ++i) {
+                        if (++p >= end || !isxdigit(uint8_t(*p))) {
+                            return false;
+                        }
+                    }
+                } else if (strchr("\"\\/bfnrt", *p) == nullptr) {
+                    return false;
+                }
+            }
+            ++p;
+        }
+        return false;
+    }
+
+    bool digits() {
+        const char *start = p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            ++p;
+        }
+        return p > start;
+    }
+
+    bool number() {
+        if (*p == '-') {
+            ++p;
+        }
+        if (p < end && *p == '0') {
+            ++p;
+        } else if (!digits()) {
+            return false;
+        }
+        if (p < end && *p == '.' && (++p, !digits())) {
+            return false;
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            if (p < end && (*p == '+' || *p == '-')) {
+                ++p;
+            }
+            return digits();
+        }
+        return true;
+    }
+
+    bool literal(const char *word) {
+        size_t len = strlen(word);
+        if (size_t(end - p) < len || memcmp(p, word, len) != 0) {
+            return false;
+        }
+        p += len;
+        return true;
+    }
+
+    bool value(int depth) {
+        if (p >= end || depth > 512) {
+            return false;
+        }
+        switch (*p) {
+        case '{': {
+            ++p;
+            ws();
+            if (p < end && *p == '}') {
+                ++p;
+                return true;
+            }
+            while (true) {
+                std::string_view name;
+                if (p >= end || *p != '"' || !string(&name)) {
+                    return false;
+                }
+                if (depth == 0 && name == key) {
+                    has_key = true;
+                }
+                ws();
+                if (p >= end || *p++ != ':') {
+                    return false;
+                }
+                ws();
+                if (!value(depth + 1)) {
+                    return false;
+                }
+                ws();
+                if (p >= end) {
+                    return false;
+                }
+                if (*p == '}') {
+                    ++p;
+                    return true;
+                }
+                if (*p++ != ',') {
+                    return false;
+                }
+                ws();
+            }
+        }
+        case '[':
+            ++p;
+            ws();
+            if (p < end && *p == ']') {
+                ++p;
+                return true;
+            }
+            while (true) {
+                if (!value(depth + 1)) {
+                    return false;
+                }
+                ws();
+                if (p >= end) {
+                    return false;
+                }
+                if (*p == ']') {
+                    ++p;
+                    return true;
+                }
+                if (*p++ != ',') {
+                    return false;
+                }
+                ws();
+            }
+        case '"':
+            return string(nullptr);
+        case 't':
+            return literal("true");
+        case 'f':
+            return literal("false");
+        case 'n':
+            return literal("null");
+        default:
+            return number();
+        }
+    }
+};
+
+/**
+ * Counters of a thread, written only by it and read by the main thread for the interval and final reports.
+ */
+struct Stats {
+    std::atomic<uint64_t> puts{0};
+    std::atomic<uint64_t> updates{0};
+    std::atomic<uint64_t> removes{0};
+    std::atomic<uint64_t> gets{0};
+    std::atomic<uint64_t> visits{0};
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> other{0};
+    std::atomic<uint64_t> invalid{0};
+    std::atomic<uint64_t> injected{0};
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> http2_connections{0};
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<uint64_t> bytes_sent{0};
+
+    // Single writer, so a plain load and store suffices.
+    static void add(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    uint64_t requests() const {
+        return puts + updates + removes + gets + visits + queries + other;
+    }
+};
+
+struct Response {
+    int status = 200;
+    std::string body;
+    int64_t due = 0;
+    uint32_t stream = 0;
+    bool head = false;
+    bool operator>(const Response &other) const { return due > other.due; }
+};
+
+// %XX and '+' decoding of a path segment.
+std::string url_decode(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '%' && i + 2 < s.size() && isxdigit(uint8_t(s[i + 1])) && isxdigit(uint8_t(s[i + 2]))) {
+            out += char(std::stoi(std::string(s.substr(i + 1, 2)), nullptr, 16));
+            i += 2;
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+void json_escape(std::string &out, std::string_view s) {
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (uint8_t(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+}
+
+const char *reason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    case 507: return "Insufficient Storage";
+    default: return "Status";
+    }
+}
+
+// RFC 7541 Appendix B: Huffman code and length of each symbol, EOS last.
+const std::pair<uint32_t, uint8_t> huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+    {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+    {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+    {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+    {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+    {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+    {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+    {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+    {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+    {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+    {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+    {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+    {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+    {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+    {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},
+};
+
+/**
+ * Huffman decoder walking a binary tree of the codes a bit at a time.
+ */
+class HuffmanDecoder {
+public:
+    HuffmanDecoder() : nodes(1) {
+        for (int sym = 0; sym < 256; ++sym) {
+            auto [code, len] = huffman_codes[sym];
+            size_t node = 0;
+            for (int bit = len - 1; bit >= 0; --bit) {
+                int b = (code >> bit) & 1;
+                if (nodes[node].child[b] == 0) {
+                    nodes[node].child[b] = int16_t(nodes.size());
+                    nodes.emplace_back();
+                }
+                node = nodes[node].child[b];
+            }
+            nodes[node].symbol = int16_t(sym);
+        }
+    }
+
+    bool decode(const uint8_t *p, size_t len, std::string &out) const {
+        size_t node = 0;
+        int depth = 0;
+        bool ones = true;
+        for (size_t i = 0; i < len; ++i) {
+            for (int bit = 7; bit >= 0; --bit) {
+                int b = (p[i] >> bit) & 1;
+                node = nodes[node].child[b];
+                ones = ones && b == 1;
+                ++depth;
+                if (node == 0) {
+                    return false;
+                }
+                if (nodes[node].symbol >= 0) {
+                    out += char(nodes[node].symbol);
+                    node = 0;
+                    depth = 0;
+                    ones = true;
+                }
+            }
+        }
+        // Padding is a prefix of EOS (all ones) shorter than a byte.
+        return depth < 8 && ones;
+    }
+
+private:
+    struct Node {
+        int16_t child[2] = {0, 0};
+        int16_t symbol = -1;
+    };
+    std::vector<Node> nodes;
+};
+
+const HuffmanDecoder huffman;
+
+// RFC 7541 Appendix A.
+const std::pair<const char *, const char *> hpack_static_table[61] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"},
+    {":scheme", "http"}, {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"},
+    {":status", "304"}, {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""},
+    {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""}, {"date", ""},
+    {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""}, {"if-match", ""},
+    {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""},
+    {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+    {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+    {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""},
+};
+
+/**
+ * HPACK header block decoder with the dynamic table of a connection.
+ */
+class HpackDecoder {
+public:
+    explicit HpackDecoder(size_t max) : max_size(max) {}
+
+    // Calls 'header(name, value)' for each header, returns false on a decoding error.
+    template <typename F>
+    bool decode(const uint8_t *p, const uint8_t *end, F header) {
+        std::string name;
+        std::string value;
+        while (p < end) {
+            uint8_t b = *p;
+            uint64_t index = 0;
+            if (b & 0x80) {
+                if (!integer(p, end, 7, index) || !lookup(index, name, value)) {
+                    return false;
+                }
+                header(name, value);
+                continue;
+            }
+            if ((b & 0xe0) == 0x20) {
+                if (!integer(p, end, 5, index) || index > max_size) {
+                    return false;
+                }
+                size = index;
+                evict();
+                continue;
+            }
+            bool indexing = (b & 0x40) != 0;
+            if (!integer(p, end, indexing ? 6 : 4, index)) {
+                return false;
+            }
+            name.clear();
+            value.clear();
+            if (index == 0 ? !string(p, end, name) : !lookup(index, name, value)) {
+                return false;
+            }
+            value.clear();
+            if (!string(p, end, value)) {
+                return false;
+            }
+            header(name, value);
+            if (indexing) {
+                table.emplace_front(name, value);
+                used += name.size() + value.size() + 32;
+                evict();
+            }
+        }
+        return true;
+    }
+
+private:
+    size_t max_size;
+    size_t size = 4096;
+    size_t used = 0;
+    std::deque<std::pair<std::string, std::string>> table;
+
+    void evict() {
+        while (used > size && !table.empty()) {
+            used -= table.back().first.size() + table.back().second.size() + 32;
+            table.pop_back();
+        }
+    }
+
+    bool lookup(uint64_t index, std::string &name, std::string &value) const {
+        if (index == 0) {
+            return false;
+        }
+        if (index <= 61) {
+            name = hpack_static_table[index - 1].first;
+            value = hpack_static_table[index - 1].second;
+            return true;
+        }
+        if (index - 62 >= table.size()) {
+            return false;
+        }
+        name = table[index - 62].first;
+        value = table[index - 62].second;
+        return true;
+    }
+
+    static bool integer(const uint8_t *&p, const uint8_t *end, int prefix_bits, uint64_t &v) {
+        uint64_t max = (1u << prefix_bits) - 1;
+        v = *p++ & max;
+        if (v < max) {
+            return true;
+        }
+        for (int shift = 0; p < end && shift < 56; shift += 7) {
+            uint8_t b = *p++;
+            v += uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool string(const uint8_t *&p, const uint8_t *end, std::string &out) {
+        if (p >= end) {
+            return false;
+        }
+        bool huffman_coded = (*p & 0x80) != 0;
+        uint64_t len = 0;
+        if (!integer(p, end, 7, len) || len > uint64_t(end - p)) {
+            return false;
+        }
+        bool ok = huffman_coded ? huffman.decode(p, len, out) : (out.assign(reinterpret_cast<const char *>(p), len), true);
+        p += len;
+        return ok;
+    }
+};
+
+class Worker;
+
+/**
+ * A client connection, HTTP/1.1 or HTTP/2 (decided by the ALPN protocol or the client preface), over TCP or TLS.
+ */
+class Connection {
+public:
+    enum class Protocol { UNKNOWN, HTTP1, HTTP2 };
+
+    Worker &worker;
+    int fd;
+    uint64_t id;
+    SSL *ssl = nullptr;
+    bool handshaking = false;
+    Protocol protocol = Protocol::UNKNOWN;
+    bool preface_done = false;
+    bool closing = false; // close when the responses are written
+    std::string in;
+    size_t in_pos = 0;
+    std::string out;
+    size_t out_pos = 0;
+    // HTTP/1.1: responses are sent in request order, so a delayed one holds back those after it.
+    std::deque<Response> pending;
+    // HTTP/2: delayed responses by due time, streams receiving requests, and responses waiting for flow control.
+    std::priority_queue<Response, std::vector<Response>, std::greater<Response>> delayed;
+    struct Stream {
+        std::string method;
+        std::string path;
+        std::string body;
+        uint64_t received = 0;
+    };
+    std::unordered_map<uint32_t, Stream> streams;
+    struct Blocked {
+        std::string body;
+        size_t pos = 0;
+        int64_t window = 0;
+    };
+    std::unordered_map<uint32_t, Blocked> blocked;
+    HpackDecoder hpack{4096};
+    std::string header_block;
+    uint32_t header_stream = 0;
+    bool header_end_stream = false;
+    int64_t send_window = 65535;
+    int64_t initial_stream_window = 65535;
+    uint32_t max_frame_size = 16384;
+    uint64_t received_data = 0;
+    bool goaway = false;
+
+    Connection(Worker &w, int f, uint64_t i);
+    ~Connection();
+    // Returns false when the connection is closed and should be removed.
+    bool on_event(uint32_t events);
+    bool release(int64_t now);
+
+private:
+    bool handshake();
+    ssize_t io_read(char *buf, size_t len);
+    bool flush();
+    bool done() const;
+    bool parse();
+    bool parse_http1();
+    bool parse_http2();
+    void respond(Response &&response, const std::string &method);
+    void write_http1(const Response &response);
+    void write_http2(Response &&response);
+    void send_data(uint32_t stream, Blocked &b);
+    void frame(uint8_t type, uint8_t flags, uint32_t stream, std::string_view payload);
+    void window_update(uint32_t stream, uint32_t increment);
+    bool on_headers();
+    bool end_stream(uint32_t stream);
+};
+
+class Worker {
+public:
+    const Config &config;
+    SSL_CTX *ssl_ctx;
+    int listen_fd;
+    int epoll_fd;
+    int timer_fd;
+    int64_t timer_armed = INT64_MAX;
+    std::vector<std::unique_ptr<Connection>> connections; // by fd
+    uint64_t next_id = 1;
+    // Due times of delayed responses, with the fd and id of their connection.
+    struct Timer {
+        int64_t due;
+        int fd;
+        uint64_t id;
+        bool operator>(const Timer &other) const { return due > other.due; }
+    };
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::mt19937_64 rng;
+    std::string search_result;
+    Stats stats;
+
+    Worker(const Config &c, SSL_CTX *ctx, int listen, size_t thread)
+        : config(c), ssl_ctx(ctx), listen_fd(listen), epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+          timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)), rng(4711 + thread)
+    {
+        search_result = "{\"root\":{\"id\":\"toplevel\",\"relevance\":1.0,\"fields\":{\"totalCount\":" +
+                        std::to_string(config.hits * 100) + "},\"coverage\":{\"coverage\":100,\"documents\":" +
+                        std::to_string(config.hits * 100) + ",\"full\":true,\"nodes\":1,\"results\":1,\"resultsFull\":1}";
+        if (config.hits > 0) {
+            search_result += ",\"children\":[";
+            for (size_t i = 0; i < config.hits; ++i) {
+                search_result += (i > 0 ? "," : "");
+                search_result += "{\"id\":\"id:mock:mock::" + std::to_string(i) + "\",\"relevance\":" +
+                                 std::to_string(1.0 / (i + 1)) + ",\"source\":\"mock\",\"fields\":{\"sddocname\":\"mock\"," +
+                                 "\"documentid\":\"id:mock:mock::" + std::to_string(i) + "\"}}";
+            }
+            search_result += "]";
+        }
+        search_result += "}}";
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = listen_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+        ev.data.fd = timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+    }
+    ~Worker() {
+        connections.clear();
+        ::close(timer_fd);
+        ::close(epoll_fd);
+        ::close(listen_fd);
+    }
+
+    void schedule(int64_t due, const Connection &conn) {
+        timers.push({due, conn.fd, conn.id});
+        arm();
+    }
+
+    void arm() {
+        int64_t due = timers.empty() ? INT64_MAX : timers.top().due;
+        if (due == timer_armed) {
+            return;
+        }
+        timer_armed = due;
+        itimerspec spec{};
+        if (due != INT64_MAX) {
+            due = std::max<int64_t>(due, 1);
+            spec.it_value.tv_sec = due / 1000000000;
+            spec.it_value.tv_nsec = due % 1000000000;
+        }
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    /**
+     * Routes a request and returns the response, with its due time from the latency distribution.
+     */
+    Response handle(std::string_view method, std::string_view target, std::string_view body) {
+        Response r;
+        std::string_view path = target.substr(0, target.find('?'));
+        if (path.rfind("/document/v1/", 0) == 0) {
+            document(method, path, body, r);
+            r.due = now_ns() + config.feed_latency.sample_ns(rng);
+        } else if (path == "/search/" || path == "/search") {
+            if (method == "POST" && config.validate && !JsonValidator(body, "").valid()) {
+                r.status = 400;
+                r.body = "{\"root\":{\"id\":\"toplevel\",\"relevance\":1.0,\"fields\":{\"totalCount\":0},"
+                         "\"errors\":[{\"code\":3,\"summary\":\"Illegal query\",\"message\":\"Invalid JSON in request body\"}]}}";
+                Stats::add(stats.invalid);
+            } else {
+                r.body = search_result;
+            }
+            Stats::add(stats.queries);
+            r.due = now_ns() + config.search_latency.sample_ns(rng);
+        } else {
+            Stats::add(stats.other);
+            if (path == "/state/v1/health") {
+                r.body = "{\"status\":{\"code\":\"up\"}}";
+            } else {
+                r.status = 404;
+                r.body = "{\"message\":\"No handler for " + std::string(path) + "\"}";
+            }
+            r.due = now_ns();
+            return r;
+        }
+        if (r.status == 200 && config.error_rate > 0.0 &&
+            std::uniform_real_distribution<double>(0.0, 1.0)(rng) < config.error_rate)
+        {
+            r.status = config.error_status;
+            r.body = "{\"message\":\"Injected error from mock endpoint\"}";
+            Stats::add(stats.injected);
+        }
+        return r;
+    }
+
+    // /document/v1/<namespace>/<type>/{docid,group/<group>,number/<number>}[/<id>]
+    void document(std::string_view method, std::string_view path, std::string_view body, Response &r) {
+        std::vector<std::string_view> parts;
+        for (size_t pos = 13; pos <= path.size();) {
+            size_t slash = std::min(path.find('/', pos), path.size());
+            parts.push_back(path.substr(pos, slash - pos));
+            pos = slash + 1;
+        }
+        if (!parts.empty() && parts.back().empty()) {
+            parts.pop_back();
+        }
+        std::string path_id(path);
+        auto invalid = [&](const std::string &message) {
+            r.status = 400;
+            r.body = "{\"pathId\":\"";
+            json_escape(r.body, path_id);
+            r.body += "\",\"message\":\"" + message + "\"}";
+            Stats::add(stats.invalid);
+        };
+        size_t id_at = 0;
+        std::string modifier;
+        if (parts.size() >= 3 && parts[2] == "docid") {
+            id_at = 3;
+        } else if (parts.size() >= 4 && (parts[2] == "group" || parts[2] == "number")) {
+            id_at = 4;
+            modifier = (parts[2] == "group" ? "g=" : "n=") + url_decode(parts[3]);
+        } else {
+            invalid("Expected /document/v1/<namespace>/<documentType>/docid/<documentId>");
+            return;
+        }
+        if (parts.size() == id_at) {
+            if (method != "GET") {
+                invalid("Must specify a document id for " + std::string(method));
+                return;
+            }
+            Stats::add(stats.visits);
+            r.body = "{\"pathId\":\"";
+            json_escape(r.body, path_id);
+            r.body += "\",\"documents\":[],\"documentCount\":0}";
+            return;
+        }
+        std::string id = "id:" + url_decode(parts[0]) + ":" + url_decode(parts[1]) + ":" + modifier + ":";
+        for (size_t i = id_at; i < parts.size(); ++i) {
+            id += (i > id_at ? "/" : "") + url_decode(parts[i]);
+        }
+        if (method == "POST" || method == "PUT") {
+            if (config.validate) {
+                JsonValidator json(body, "fields");
+                if (!json.valid()) {
+                    invalid("Could not parse document JSON");
+                    return;
+                }
+                if (!json.has_key) {
+                    invalid("No 'fields' in document " + std::string(method == "POST" ? "put" : "update"));
+                    return;
+                }
+            }
+            Stats::add(method == "POST" ? stats.puts : stats.updates);
+        } else if (method == "DELETE") {
+            Stats::add(stats.removes);
+        } else if (method == "GET" || method == "HEAD") {
+            Stats::add(stats.gets);
+        } else {
+            r.status = 405;
+            r.body = "{\"message\":\"Method not allowed\"}";
+            Stats::add(stats.invalid);
+            return;
+        }
+        r.body = "{\"pathId\":\"";
+        json_escape(r.body, path_id);
+        r.body += "\",\"id\":\"";
+        json_escape(r.body, id);
+        r.body += (method == "GET" || method == "HEAD") ? "\",\"fields\":{}}" : "\"}";
+    }
+
+    void accept_all() {
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (size_t(fd) >= connections.size()) {
+                connections.resize(fd + 1);
+            }
+            connections[fd] = std::make_unique<Connection>(*this, fd, next_id++);
+            Stats::add(stats.connections);
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+
+    void close(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        connections[fd].reset();
+    }
+
+    void run() {
+        epoll_event events[256];
+        while (!stopped) {
+            int n = epoll_wait(epoll_fd, events, 256, 100);
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd) {
+                    accept_all();
+                } else if (fd == timer_fd) {
+                    uint64_t expirations;
+                    if (::read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+                        // Spurious wakeup, the heap is checked below anyway.
+                    }
+                    timer_armed = INT64_MAX;
+                } else if (connections[fd] && !connections[fd]->on_event(events[i].events)) {
+                    close(fd);
+                }
+            }
+            int64_t now = now_ns();
+            while (!timers.empty() && timers.top().due <= now) {
+                Timer t = timers.top();
+                timers.pop();
+                if (size_t(t.fd) < connections.size() && connections[t.fd] && connections[t.fd]->id == t.id &&
+                    !connections[t.fd]->release(now))
+                {
+                    close(t.fd);
+                }
+            }
+            arm();
+        }
+    }
+};
+
+Connection::Connection(Worker &w, int f, uint64_t i) : worker(w), fd(f), id(i) {
+    if (worker.ssl_ctx != nullptr) {
+        ssl = SSL_new(worker.ssl_ctx);
+        SSL_set_fd(ssl, fd);
+        handshaking = true;
+    }
+}
+
+Connection::~Connection() {
+    if (ssl != nullptr) {
+        SSL_free(ssl);
+    }
+    ::close(fd);
+}
+
+bool Connection::handshake() {
+    int r = SSL_accept(ssl);
+    if (r == 1) {
+        handshaking = false;
+        const unsigned char *proto = nullptr;
+        unsigned int len = 0;
+        SSL_get0_alpn_selected(ssl, &proto, &len);
+        if (len == 2 && memcmp(proto, "h2", 2) == 0) {
+            protocol = Protocol::HTTP2;
+        } else if (len > 0) {
+            protocol = Protocol::HTTP1;
+        }
+        return true;
+    }
+    int err = SSL_get_error(ssl, r);
+    ERR_clear_error();
+    return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+}
+
+ssize_t Connection::io_read(char *buf, size_t len) {
+    if (ssl == nullptr) {
+        ssize_t n = ::read(fd, buf, len);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return -2;
+        }
+        return n;
+    }
+    int n = SSL_read(ssl, buf, int(len));
+    if (n > 0) {
+        return n;
+    }
+    int err = SSL_get_error(ssl, n);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        return -2;
+    }
+    ERR_clear_error();
+    return (err == SSL_ERROR_ZERO_RETURN) ? 0 : -1;
+}
+
+bool Connection::flush() {
+    while (out_pos < out.size()) {
+        ssize_t n;
+        if (ssl == nullptr) {
+            n = ::write(fd, out.data() + out_pos, out.size() - out_pos);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;
+            }
+        } else {
+            n = SSL_write(ssl, out.data() + out_pos, int(std::min<size_t>(out.size() - out_pos, INT32_MAX)));
+            if (n <= 0) {
+                int err = SSL_get_error(ssl, int(n));
+                ERR_clear_error();
+                if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                    return true;
+                }
+            }
+        }
+        if (n <= 0) {
+            return false;
+        }
+        Stats::add(worker.stats.bytes_sent, n);
+        out_pos += n;
+    }
+    out.clear();
+    out_pos = 0;
+    return true;
+}
+
+bool Connection::done() const {
+    return closing && pending.empty() && delayed.empty() && blocked.empty() && out.empty();
+}
+
+bool Connection::on_event(uint32_t events) {
+    if (handshaking && !handshake()) {
+        return false;
+    }
+    if (handshaking) {
+        return true;
+    }
+    if ((events & EPOLLOUT) && !flush()) {
+        return false;
+    }
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+        static thread_local char buf[65536];
+        while (true) {
+            ssize_t n = io_read(buf, sizeof(buf));
+            if (n == -2) {
+                break;
+            }
+            if (n < 0) {
+                return false;
+            }
+            if (n == 0) {
+                closing = true; // answer what was received before the client closed
+                break;
+            }
+            Stats::add(worker.stats.bytes_received, n);
+            in.append(buf, n);
+            if (!parse()) {
+                return false;
+            }
+        }
+    }
+    return flush() && !done();
+}
+
+bool Connection::parse() {
+    if (!preface_done && protocol != Protocol::HTTP1) {
+        static const std::string_view preface("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+        size_t n = std::min(in.size(), preface.size());
+        if (preface.compare(0, n, std::string_view(in).substr(0, n)) != 0) {
+            if (protocol == Protocol::HTTP2) {
+                return false;
+            }
+            protocol = Protocol::HTTP1;
+        } else if (n < preface.size()) {
+            return true;
+        }
+    }
+    if (!preface_done && protocol != Protocol::HTTP1) {
+        // Client preface (also after ALPN), then our SETTINGS: MAX_CONCURRENT_STREAMS, INITIAL_WINDOW_SIZE 2^24,
+        // and a connection window of 2^30.
+        if (in.size() < 24) {
+            return true;
+        }
+        in_pos = 24;
+        protocol = Protocol::HTTP2;
+        preface_done = true;
+        Stats::add(worker.stats.http2_connections);
+        std::string settings;
+        auto setting = [&settings](uint16_t id, uint32_t value) {
+            char b[6] = {char(id >> 8), char(id), char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+            settings.append(b, 6);
+        };
+        setting(3, uint32_t(worker.config.max_streams));
+        setting(4, 1u << 24);
+        frame(0x4, 0, 0, settings);
+        window_update(0, (1u << 30) - 65535);
+    }
+    return protocol == Protocol::HTTP1 ? parse_http1() : parse_http2();
+}
+
+bool Connection::parse_http1() {
+    while (!closing) {
+        size_t end = in.find("\r\n\r\n", in_pos);
+        if (end == std::string::npos) {
+            break;
+        }
+        std::string_view header(in.data() + in_pos, end - in_pos);
+        size_t sp1 = header.find(' ');
+        size_t sp2 = header.find(' ', sp1 + 1);
+        size_t eol = header.find("\r\n");
+        if (sp1 == std::string_view::npos || sp2 == std::string_view::npos || sp2 > eol) {
+            Response bad;
+            bad.status = 400;
+            bad.body = "{\"message\":\"Bad request line\"}";
+            bad.due = now_ns();
+            closing = true;
+            respond(std::move(bad), "");
+            break;
+        }
+        std::string_view method = header.substr(0, sp1);
+        std::string_view target = header.substr(sp1 + 1, sp2 - sp1 - 1);
+        bool keep_alive = header.substr(sp2 + 1, 8) == "HTTP/1.1";
+        uint64_t content_length = 0;
+        bool chunked = false;
+        bool expect_continue = false;
+        for (size_t pos = eol; pos != std::string_view::npos && pos < header.size();) {
+            size_t next = header.find("\r\n", pos + 2);
+            std::string_view line = header.substr(pos + 2, (next == std::string_view::npos ? header.size() : next) - pos - 2);
+            pos = next;
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            std::string name(line.substr(0, colon));
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            std::string value(line.substr(line.find_first_not_of(' ', colon + 1) == std::string_view::npos
+                                          ? line.size() : line.find_first_not_of(' ', colon + 1)));
+            std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+            if (name == "content-length") {
+                content_length = strtoull(value.c_str(), nullptr, 10);
+            } else if (name == "transfer-encoding") {
+                chunked = value.find("chunked") != std::string::npos;
+            } else if (name == "connection") {
+                keep_alive = (value.find("close") == std::string::npos) && (keep_alive || value.find("keep-alive") != std::string::npos);
+            } else if (name == "expect") {
+                expect_continue = (value == "100-continue");
+            }
+        }
+        size_t body_start = end + 4;
+        std::string body;
+        size_t request_end = body_start;
+        if (chunked) {
+            // Only decoded once complete, chunked bodies are rare from load givers.
+            bool complete = false;
+            for (size_t pos = body_start;;) {
+                size_t line_end = in.find("\r\n", pos);
+                if (line_end == std::string::npos) {
+                    break;
+                }
+                uint64_t size = strtoull(in.c_str() + pos, nullptr, 16);
+                if (size == 0) {
+                    size_t trailer_end = in.find("\r\n\r\n", line_end);
+                    if (in.compare(line_end, 4, "\r\n\r\n") == 0) {
+                        trailer_end = line_end;
+                    }
+                    if (trailer_end != std::string::npos) {
+                        request_end = trailer_end + 4;
+                        complete = true;
+                    }
+                    break;
+                }
+                if (in.size() < line_end + 2 + size + 2) {
+                    break;
+                }
+                body.append(in, line_end + 2, size);
+                pos = line_end + 2 + size + 2;
+            }
+            if (!complete) {
+                if (expect_continue && pending.empty() && out.empty()) {
+                    out += "HTTP/1.1 100 Continue\r\n\r\n";
+                }
+                break;
+            }
+        } else {
+            if (in.size() - body_start < content_length) {
+                if (expect_continue && pending.empty() && out.empty() && in.size() == body_start) {
+                    out += "HTTP/1.1 100 Continue\r\n\r\n";
+                }
+                break;
+            }
+            request_end = body_start + content_length;
+        }
+        std::string method_str(method);
+        std::string_view body_view = chunked ? std::string_view(body) : std::string_view(in.data() + body_start, content_length);
+        Response response = worker.handle(method, target, body_view);
+        in_pos = request_end;
+        if (!keep_alive) {
+            closing = true;
+        }
+        respond(std::move(response), method_str);
+    }
+    if (in_pos == in.size()) {
+        in.clear();
+        in_pos = 0;
+    } else if (in_pos > 65536) {
+        in.erase(0, in_pos);
+        in_pos = 0;
+    }
+    return true;
+}
+
+void Connection::respond(Response &&response, const std::string &method) {
+    response.head = response.head || method == "HEAD";
+    int64_t now = now_ns();
+    if (protocol == Protocol::HTTP2) {
+        if (response.due <= now) {
+            write_http2(std::move(response));
+        } else {
+            worker.schedule(response.due, *this);
+            delayed.push(std::move(response));
+        }
+        return;
+    }
+    if (pending.empty() && response.due <= now) {
+        write_http1(response);
+        return;
+    }
+    if (response.due > now) {
+        worker.schedule(response.due, *this);
+    }
+    pending.push_back(std::move(response));
+}
+
+void Connection::write_http1(const Response &response) {
+    char header[160];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %d %s\r\nContent-Type: application/json;charset=utf-8\r\nContent-Length: %zu\r\n%s\r\n",
+                     response.status, reason(response.status), response.body.size(), closing && pending.size() <= 1 ? "Connection: close\r\n" : "");
+    out.append(header, n);
+    if (!response.head) {
+        out += response.body;
+    }
+}
+
+bool Connection::release(int64_t now) {
+    if (protocol == Protocol::HTTP2) {
+        while (!delayed.empty() && delayed.top().due <= now) {
+            Response r = delayed.top();
+            delayed.pop();
+            write_http2(std::move(r));
+        }
+    } else {
+        while (!pending.empty() && pending.front().due <= now) {
+            write_http1(pending.front());
+            pending.pop_front();
+        }
+    }
+    return flush() && !done();
+}
+
+void Connection::frame(uint8_t type, uint8_t flags, uint32_t stream, std::string_view payload) {
+    uint32_t len = payload.size();
+    char header[9] = {char(len >> 16), char(len >> 8), char(len), char(type), char(flags),
+                      char((stream >> 24) & 0x7f), char(stream >> 16), char(stream >> 8), char(stream)};
+    out.append(header, 9);
+    out.append(payload.data(), payload.size());
+}
+
+void Connection::window_update(uint32_t stream, uint32_t increment) {
+    char b[4] = {char((increment >> 24) & 0x7f), char(increment >> 16), char(increment >> 8), char(increment)};
+    frame(0x8, 0, stream, std::string_view(b, 4));
+}
+
+void Connection::write_http2(Response &&response) {
+    // HPACK: an indexed :status where the static table has it, then literals without indexing.
+    std::string block;
+    auto integer = [&block](uint8_t first, int prefix_bits, uint64_t v) {
+        uint64_t max = (1u << prefix_bits) - 1;
+        if (v < max) {
+            block += char(first | v);
+            return;
+        }
+        block += char(first | max);
+        for (v -= max; v >= 128; v >>= 7) {
+            block += char((v & 0x7f) | 0x80);
+        }
+        block += char(v);
+    };
+    auto literal = [&](uint64_t name_index, const std::string &value) {
+        integer(0x00, 4, name_index);
+        integer(0x00, 7, value.size());
+        block += value;
+    };
+    static const int indexed[] = {200, 204, 206, 304, 400, 404, 500};
+    const int *found = std::find(std::begin(indexed), std::end(indexed), response.status);
+    if (found != std::end(indexed)) {
+        block += char(0x80 | (8 + (found - indexed)));
+    } else {
+        literal(8, std::to_string(response.status));
+    }
+    literal(31, "application/json;charset=utf-8"); // content-type
+    literal(28, std::to_string(response.body.size())); // content-length
+    bool no_body = response.head || response.body.empty();
+    frame(0x1, 0x4 | (no_body ? 0x1 : 0), response.stream, block); // HEADERS, END_HEADERS (and END_STREAM)
+    if (no_body) {
+        return;
+    }
+    Blocked b{std::move(response.body), 0, initial_stream_window};
+    send_data(response.stream, b);
+    if (b.pos < b.body.size()) {
+        blocked.emplace(response.stream, std::move(b));
+    }
+}
+
+void Connection::send_data(uint32_t stream, Blocked &b) {
+    while (b.pos < b.body.size()) {
+        int64_t len = std::min<int64_t>({int64_t(b.body.size() - b.pos), int64_t(max_frame_size), send_window, b.window});
+        if (len <= 0) {
+            return;
+        }
+        frame(0x0, b.pos + len == b.body.size() ? 0x1 : 0, stream, std::string_view(b.body).substr(b.pos, len));
+        b.pos += len;
+        send_window -= len;
+        b.window -= len;
+    }
+}
+
+bool Connection::end_stream(uint32_t stream) {
+    auto it = streams.find(stream);
+    if (it == streams.end()) {
+        return true;
+    }
+    Stream s = std::move(it->second);
+    streams.erase(it);
+    Response response = worker.handle(s.method, s.path, s.body);
+    response.stream = stream;
+    respond(std::move(response), s.method);
+    return true;
+}
+
+bool Connection::on_headers() {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(header_block.data());
+    Stream s;
+    bool ok = hpack.decode(p, p + header_block.size(), [&s](const std::string &name, const std::string &value) {
+        if (name == ":method") {
+            s.method = value;
+        } else if (name == ":path") {
+            s.path = value;
+        }
+    });
+    header_block.clear();
+    if (!ok) {
+        return false; // COMPRESSION_ERROR, the connection can not continue
+    }
+    if (streams.count(header_stream) || s.method.empty()) {
+        return true; // trailers, or a stream we do not handle
+    }
+    streams.emplace(header_stream, std::move(s));
+    return !header_end_stream || end_stream(header_stream);
+}
+
+bool Connection::parse_http2() {
+    while (in.size() - in_pos >= 9 && !goaway) {
+        const uint8_t *h = reinterpret_cast<const uint8_t *>(in.data() + in_pos);
+        uint32_t len = (uint32_t(h[0]) << 16) | (uint32_t(h[1]) << 8) | h[2];
+        if (len > (1u << 24)) {
+            return false;
+        }
+        if (in.size() - in_pos < 9 + len) {
+            break;
+        }
+        uint8_t type = h[3];
+        uint8_t flags = h[4];
+        uint32_t stream = ((uint32_t(h[5]) & 0x7f) << 24) | (uint32_t(h[6]) << 16) | (uint32_t(h[7]) << 8) | h[8];
+        std::string_view payload(in.data() + in_pos + 9, len);
+        in_pos += 9 + len;
+        // Strip padding (and priority) from DATA and HEADERS.
+        size_t skip = 0;
+        size_t pad = 0;
+        if ((type == 0x0 || type == 0x1) && (flags & 0x8) && !payload.empty()) {
+            pad = uint8_t(payload[0]);
+            skip = 1;
+        }
+        if (type == 0x1 && (flags & 0x20)) {
+            skip += 5;
+        }
+        if (skip + pad > payload.size()) {
+            return false;
+        }
+        std::string_view body = payload.substr(skip, payload.size() - skip - pad);
+        switch (type) {
+        case 0x0: { // DATA
+            received_data += len;
+            auto it = streams.find(stream);
+            if (it != streams.end()) {
+                it->second.body.append(body.data(), body.size());
+                it->second.received += len;
+                if (it->second.received >= (1u << 23) && !(flags & 0x1)) {
+                    window_update(stream, uint32_t(it->second.received));
+                    it->second.received = 0;
+                }
+            }
+            if ((flags & 0x1) && !end_stream(stream)) {
+                return false;
+            }
+            break;
+        }
+        case 0x1: // HEADERS
+        case 0x9: // CONTINUATION
+            if (type == 0x1) {
+                header_block.assign(body.data(), body.size());
+                header_stream = stream;
+                header_end_stream = (flags & 0x1) != 0;
+            } else {
+                header_block.append(payload.data(), payload.size());
+            }
+            if ((flags & 0x4) && !on_headers()) {
+                return false;
+            }
+            break;
+        case 0x3: // RST_STREAM
+            streams.erase(stream);
+            blocked.erase(stream);
+            break;
+        case 0x4: // SETTINGS
+            if (!(flags & 0x1)) {
+                for (size_t i = 0; i + 6 <= payload.size(); i += 6) {
+                    const uint8_t *s = reinterpret_cast<const uint8_t *>(payload.data() + i);
+                    uint16_t setting = (uint16_t(s[0]) << 8) | s[1];
+                    uint32_t value = (uint32_t(s[2]) << 24) | (uint32_t(s[3]) << 16) | (uint32_t(s[4]) << 8) | s[5];
+                    if (setting == 4) {
+                        for (auto &[id, b] : blocked) {
+                            b.window += int64_t(value) - initial_stream_window;
+                        }
+                        initial_stream_window = value;
+                    } else if (setting == 5) {
+                        max_frame_size = value;
+                    }
+                }
+                frame(0x4, 0x1, 0, "");
+            }
+            break;
+        case 0x6: // PING
+            if (!(flags & 0x1)) {
+                frame(0x6, 0x1, 0, payload);
+            }
+            break;
+        case 0x7: // GOAWAY: answer what was received, then close
+            goaway = true;
+            break;
+        case 0x8: { // WINDOW_UPDATE
+            if (payload.size() < 4) {
+                return false;
+            }
+            const uint8_t *w = reinterpret_cast<const uint8_t *>(payload.data());
+            uint32_t increment = ((uint32_t(w[0]) & 0x7f) << 24) | (uint32_t(w[1]) << 16) | (uint32_t(w[2]) << 8) | w[3];
+            if (stream == 0) {
+                send_window += increment;
+            } else {
+                auto it = blocked.find(stream);
+                if (it != blocked.end()) {
+                    it->second.window += increment;
+                }
+            }
+            for (auto it = blocked.begin(); it != blocked.end();) {
+                send_data(it->first, it->second);
+                it = (it->second.pos == it->second.body.size()) ? blocked.erase(it) : std::next(it);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    if (received_data >= (1u << 29)) {
+        window_update(0, uint32_t(received_data));
+        received_data = 0;
+    }
+    if (in_pos == in.size()) {
+        in.clear();
+        in_pos = 0;
+    } else if (in_pos > 65536) {
+        in.erase(0, in_pos);
+        in_pos = 0;
+    }
+    if (goaway && streams.empty() && delayed.empty() && blocked.empty()) {
+        closing = true;
+    }
+    return true;
+}
+
+int listen_on(int port) {
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    int zero = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    sockaddr_in6 addr{};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 4096) != 0) {
+        fprintf(stderr, "Could not listen on port %d: %s\n", port, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p <port>      port to listen on (default 8080, 0 picks a free one)\n"
+            "  -t <threads>   number of threads, each with its own listening socket (default: cores)\n"
+            "  -j             validate request JSON: put and update bodies need 'fields', query bodies must parse\n"
+            "  -l <latency>   latency distribution of all responses, e.g. 'fixed:1' or 'lognormal:2:0.5,fixed:200@0.001'\n"
+            "  -f <latency>   latency distribution of /document/v1 responses\n"
+            "  -s <latency>   latency distribution of /search responses\n"
+            "                 distributions: none, fixed:<ms>, uniform:<min>:<max>, exp:<mean>, lognormal:<median>:<sigma>,\n"
+            "                 pareto:<min>:<alpha>, optionally comma separated with @<weight>\n"
+            "  -e <fraction>  fraction of feed and search requests to fail (default 0)\n"
+            "  -E <status>    status of failed requests (default 503)\n"
+            "  -n <hits>      hits in each search result (default 10)\n"
+            "  -m <streams>   maximum concurrent HTTP/2 streams per connection (default 1000)\n"
+            "  -r <seconds>   run for this long (default: until SIGINT or SIGTERM)\n"
+            "  -i <seconds>   write the request rate of each interval to stderr\n"
+            "  -D             use TLS, with -C/-K/-T or else VESPA_TLS_CONFIG_FILE\n"
+            "  -C <file>      certificate chain file\n"
+            "  -K <file>      private key file\n"
+            "  -T <file>      CA certificates file, requires client certificates\n",
+            prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Config config;
+    int option;
+    while ((option = getopt(argc, argv, "p:t:jl:f:s:e:E:n:m:r:i:DC:K:T:h")) != -1) {
+        switch (option) {
+        case 'p': config.port = atoi(optarg); break;
+        case 't': config.threads = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+        case 'j': config.validate = true; break;
+        case 'l':
+        case 'f':
+        case 's':
+            if ((option != 's' && !config.feed_latency.parse(optarg)) || (option != 'f' && !config.search_latency.parse(optarg))) {
+                fprintf(stderr, "Invalid latency distribution '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'e': config.error_rate = atof(optarg); break;
+        case 'E': config.error_status = atoi(optarg); break;
+        case 'n': config.hits = strtoul(optarg, nullptr, 0); break;
+        case 'm': config.max_streams = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+        case 'r': config.runtime_s = atof(optarg); break;
+        case 'i': config.interval_s = atof(optarg); break;
+        case 'D': config.tls = true; break;
+        case 'C': config.cert_file = optarg; break;
+        case 'K': config.key_file = optarg; break;
+        case 'T': config.ca_file = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    SSL_CTX *ssl_ctx = config.tls ? make_ssl_context(config) : nullptr;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t t = 0; t < config.threads; ++t) {
+        int fd = listen_on(config.port);
+        if (config.port == 0) {
+            sockaddr_in6 addr{};
+            socklen_t len = sizeof(addr);
+            getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+            config.port = ntohs(addr.sin6_port);
+        }
+        workers.push_back(std::make_unique<Worker>(config, ssl_ctx, fd, t));
+    }
+    printf("listening on port %d with %zu threads\n", config.port, config.threads);
+    fflush(stdout);
+    std::vector<std::thread> threads;
+    for (auto &w : workers) {
+        threads.emplace_back([&w] { w->run(); });
+    }
+
+    auto total = [&workers](uint64_t (*field)(const Stats &)) {
+        uint64_t sum = 0;
+        for (const auto &w : workers) {
+            sum += field(w->stats);
+        }
+        return sum;
+    };
+    auto requests = [](const Stats &s) { return s.requests(); };
+    int64_t start = now_ns();
+    int64_t end = config.runtime_s > 0 ? start + int64_t(config.runtime_s * 1e9) : INT64_MAX;
+    int64_t next_report = config.interval_s > 0 ? start + int64_t(config.interval_s * 1e9) : INT64_MAX;
+    uint64_t last_requests = 0;
+    int64_t last_report = start;
+    while (!stopped && now_ns() < end) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        int64_t now = now_ns();
+        if (now >= next_report) {
+            uint64_t r = total(requests);
+            fprintf(stderr, "%.1f s: %.0f req/s\n", (now - start) / 1e9, (r - last_requests) / ((now - last_report) / 1e9));
+            last_requests = r;
+            last_report = now;
+            next_report += int64_t(config.interval_s * 1e9);
+        }
+    }
+    stopped = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+    double elapsed_s = (now_ns() - start) / 1e9;
+
+    uint64_t all = total(requests);
+    printf("***************** Mock Endpoint Summary *****************\n");
+    printf("ran for:                     %.2f seconds\n", elapsed_s);
+    printf("threads:                     %zu\n", config.threads);
+    printf("connections:                 %lu\n", total([](const Stats &s) { return s.connections.load(); }));
+    printf("http2 connections:           %lu\n", total([](const Stats &s) { return s.http2_connections.load(); }));
+    printf("requests:                    %lu\n", all);
+    printf("puts:                        %lu\n", total([](const Stats &s) { return s.puts.load(); }));
+    printf("updates:                     %lu\n", total([](const Stats &s) { return s.updates.load(); }));
+    printf("removes:                     %lu\n", total([](const Stats &s) { return s.removes.load(); }));
+    printf("gets:                        %lu\n", total([](const Stats &s) { return s.gets.load(); }));
+    printf("visits:                      %lu\n", total([](const Stats &s) { return s.visits.load(); }));
+    printf("queries:                     %lu\n", total([](const Stats &s) { return s.queries.load(); }));
+    printf("other requests:              %lu\n", total([](const Stats &s) { return s.other.load(); }));
+    printf("invalid requests:            %lu\n", total([](const Stats &s) { return s.invalid.load(); }));
+    printf("injected errors:             %lu\n", total([](const Stats &s) { return s.injected.load(); }));
+    printf("bytes received:              %lu\n", total([](const Stats &s) { return s.bytes_received.load(); }));
+    printf("bytes sent:                  %lu\n", total([](const Stats &s) { return s.bytes_sent.load(); }));
+    printf("request rate:                %.2f req/s\n", elapsed_s > 0 ? all / elapsed_s : 0.0);
+    workers.clear();
+    if (ssl_ctx != nullptr) {
+        SSL_CTX_free(ssl_ctx);
+    }
+    return 0;
+}
@@ -0,0 +1,1356 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// Sampling CPU profiler for native processes (e.g. vespa-proton-bin), using perf_event_open directly, so no
+// perf binary is needed on the node. Attaches to every thread of a process (threads started later are picked
+// up within a second), samples at a frequency for a number of seconds or until SIGINT/SIGTERM, and writes:
+//
+//   -o file  collapsed stacks, 'root;caller;...;callee <samples>' per line (the flamegraph.pl input format)
+//   -f file  a flame graph as a self-contained SVG
+//   stdout   a summary with the functions with the most samples, self and total
+//
+// Stacks are unwound with frame pointers by the kernel (-g fp, the default, cheap but losing frames in code
+// built without frame pointers), or from a copy of the user stack using the DWARF unwind tables in .eh_frame of
+// the mapped ELF files (-g dwarf, x86_64 and aarch64), falling back to frame pointers where there are none.
+// Symbols are taken from .symtab or .dynsym of the mapped files, or from debug files found by build id or
+// debug link under /usr/lib/debug, and demangled. Kernel frames are included with -k, which may need
+// perf_event_paranoid <= 1.
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <cxxabi.h>
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+volatile sig_atomic_t stop_requested = 0;
+
+void on_signal(int) { stop_requested = 1; }
+
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+std::string read_file(const std::string &path) {
+    std::string data;
+    FILE *file = fopen(path.c_str(), "r");
+    if (file != nullptr) {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+            data.append(buf, n);
+        }
+        fclose(file);
+    }
+    return data;
+}
+
+// Registers as numbered by DWARF, and how perf_event_open delivers them (bit in sample_regs_user).
+#if defined(__x86_64__)
+constexpr int num_dwarf_regs = 17;
+constexpr int dwarf_fp = 6;
+constexpr int dwarf_sp = 7;
+constexpr int dwarf_ra = 16;
+constexpr int perf_regs[][2] = {{6, 6}, {7, 7}, {16, 8}}; // {dwarf reg, perf reg}: rbp, rsp, rip
+constexpr uint64_t pc_mask = ~uint64_t(0);
+#elif defined(__aarch64__)
+constexpr int num_dwarf_regs = 33;
+constexpr int dwarf_fp = 29;
+constexpr int dwarf_sp = 31;
+constexpr int dwarf_ra = 32; // pc, not a DWARF register, while the return address column is x30
+constexpr int perf_regs[][2] = {{29, 29}, {30, 30}, {31, 31}, {32, 32}};
+constexpr uint64_t pc_mask = 0x0000ffffffffffffUL; // strips pointer authentication codes from return addresses
+#else
+#error "Unsupported architecture"
+#endif
+
+uint64_t perf_regs_mask() {
+    uint64_t mask = 0;
+    for (const auto &reg : perf_regs) {
+        mask |= uint64_t(1) << reg[1];
+    }
+    return mask;
+}
+
+struct Regs {
+    uint64_t value[num_dwarf_regs];
+    bool valid[num_dwarf_regs];
+};
+
+/**
+ * The user stack copied with a sample; the only memory the unwinder can read.
+ */
+struct Stack {
+    uint64_t start;
+    const uint8_t *data;
+    uint64_t size;
+    bool read(uint64_t addr, uint64_t &value) const {
+        if (addr < start || addr + 8 > start + size || addr + 8 < addr) {
+            return false;
+        }
+        memcpy(&value, data + (addr - start), 8);
+        return true;
+    }
+};
+
+class Reader {
+    const uint8_t *_p;
+    const uint8_t *_end;
+public:
+    Reader(const uint8_t *p, const uint8_t *end) : _p(p), _end(end) {}
+    bool ok() const { return _p != nullptr && _p <= _end; }
+    bool more() const { return _p != nullptr && _p < _end; }
+    const uint8_t *pos() const { return _p; }
+    void fail() { _p = nullptr; }
+    template <typename T> T fixed() {
+        T v{};
+        if (_p == nullptr || _p + sizeof(T) > _end) {
+            fail();
+            return v;
+        }
+        memcpy(&v, _p, sizeof(T));
+        _p += sizeof(T);
+        return v;
+    }
+    uint64_t uleb() {
+        uint64_t v = 0;
+        for (int shift = 0; _p != nullptr && _p < _end; shift += 7) {
+            uint8_t b = *_p++;
+            if (shift < 64) {
+                v |= uint64_t(b & 0x7f) << shift;
+            }
+            if ((b & 0x80) == 0) {
+                return v;
+            }
+        }
+        fail();
+        return v;
+    }
+    int64_t sleb() {
+        int64_t v = 0;
+        int shift = 0;
+        uint8_t b = 0x80;
+        while (_p != nullptr && _p < _end && (b & 0x80)) {
+            b = *_p++;
+            if (shift < 64) {
+                v |= int64_t(b & 0x7f) << shift;
+            }
+            shift += 7;
+        }
+        if (b & 0x80) {
+            fail();
+        } else if (shift < 64 && (b & 0x40)) {
+            v |= -(int64_t(1) << shift);
+        }
+        return v;
+    }
+    void skip(uint64_t n) {
+        if (_p == nullptr || n > uint64_t(_end - _p)) {
+            fail();
+        } else {
+            _p += n;
+        }
+    }
+    const char *cstr() {
+        const char *s = reinterpret_cast<const char *>(_p);
+        while (_p != nullptr && _p < _end && *_p != 0) {
+            ++_p;
+        }
+        skip(1);
+        return s;
+    }
+};
+
+struct Symbol {
+    uint64_t addr;
+    uint64_t size;
+    const char *name;
+};
+
+/**
+ * The parts of an ELF file needed to symbolize and unwind: symbols, and .eh_frame with its lookup table.
+ * Addresses are link time virtual addresses.
+ */
+class ElfFile {
+    void *_map;
+    size_t _size;
+    std::vector<Symbol> _symbols;
+    std::vector<std::unique_ptr<ElfFile>> _debug; // separate debug file holding the symbols, if any
+    std::vector<std::pair<uint64_t, uint64_t>> _loads; // PT_LOAD (offset - vaddr, offset) for address translation
+    const uint8_t *_eh_frame_hdr;
+    uint64_t _eh_frame_hdr_addr;
+    size_t _eh_frame_hdr_size;
+    const uint8_t *_eh_frame;
+    uint64_t _eh_frame_addr;
+    size_t _eh_frame_size;
+    std::string _build_id;
+    std::string _debuglink;
+    std::vector<std::pair<uint64_t, uint64_t>> _plt; // procedure linkage table sections, which have no symbols
+
+    const uint8_t *data() const { return static_cast<const uint8_t *>(_map); }
+
+    void load_symbols(const Elf64_Shdr &symtab, const Elf64_Shdr &strtab) {
+        if (symtab.sh_offset + symtab.sh_size > _size || strtab.sh_offset + strtab.sh_size > _size ||
+            symtab.sh_entsize != sizeof(Elf64_Sym))
+        {
+            return;
+        }
+        const Elf64_Sym *syms = reinterpret_cast<const Elf64_Sym *>(data() + symtab.sh_offset);
+        const char *strings = reinterpret_cast<const char *>(data() + strtab.sh_offset);
+        for (size_t i = 0; i < symtab.sh_size / sizeof(Elf64_Sym); ++i) {
+            const Elf64_Sym &sym = syms[i];
+            if (ELF64_ST_TYPE(sym.st_info) == STT_FUNC && sym.st_value != 0 && sym.st_name < strtab.sh_size) {
+                _symbols.push_back({sym.st_value, sym.st_size, strings + sym.st_name});
+            }
+        }
+    }
+
+public:
+    explicit ElfFile(const std::string &path)
+        : _map(MAP_FAILED), _size(0), _symbols(), _debug(), _loads(), _eh_frame_hdr(nullptr), _eh_frame_hdr_addr(0),
+          _eh_frame_hdr_size(0), _eh_frame(nullptr), _eh_frame_addr(0), _eh_frame_size(0), _build_id(), _debuglink(), _plt()
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Elf64_Ehdr)) {
+            if (fd >= 0) close(fd);
+            return;
+        }
+        _size = st.st_size;
+        _map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (_map == MAP_FAILED) {
+            return;
+        }
+        const Elf64_Ehdr &ehdr = *reinterpret_cast<const Elf64_Ehdr *>(data());
+        if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+            ehdr.e_phoff + ehdr.e_phnum * sizeof(Elf64_Phdr) > _size ||
+            ehdr.e_shoff + ehdr.e_shnum * sizeof(Elf64_Shdr) > _size || ehdr.e_shstrndx >= ehdr.e_shnum)
+        {
+            munmap(_map, _size);
+            _map = MAP_FAILED;
+            return;
+        }
+        const Elf64_Phdr *phdrs = reinterpret_cast<const Elf64_Phdr *>(data() + ehdr.e_phoff);
+        for (int i = 0; i < ehdr.e_phnum; ++i) {
+            if (phdrs[i].p_type == PT_LOAD) {
+                _loads.emplace_back(phdrs[i].p_offset - phdrs[i].p_vaddr, phdrs[i].p_offset);
+            }
+        }
+        const Elf64_Shdr *shdrs = reinterpret_cast<const Elf64_Shdr *>(data() + ehdr.e_shoff);
+        const char *names = reinterpret_cast<const char *>(data() + shdrs[ehdr.e_shstrndx].sh_offset);
+        const Elf64_Shdr *symtab = nullptr;
+        const Elf64_Shdr *dynsym = nullptr;
+        for (int i = 0; i < ehdr.e_shnum; ++i) {
+            const Elf64_Shdr &sh = shdrs[i];
+            std::string name = names + sh.sh_name;
+            bool in_file = sh.sh_type != SHT_NOBITS && sh.sh_offset + sh.sh_size <= _size;
+            if (name == ".eh_frame_hdr" && in_file) {
+                _eh_frame_hdr = data() + sh.sh_offset;
+                _eh_frame_hdr_addr = sh.sh_addr;
+                _eh_frame_hdr_size = sh.sh_size;
+            } else if (name == ".eh_frame" && in_file) {
+                _eh_frame = data() + sh.sh_offset;
+                _eh_frame_addr = sh.sh_addr;
+                _eh_frame_size = sh.sh_size;
+            } else if (name.compare(0, 4, ".plt") == 0) {
+                _plt.emplace_back(sh.sh_addr, sh.sh_addr + sh.sh_size);
+            } else if (sh.sh_type == SHT_SYMTAB && in_file) {
+                symtab = &sh;
+            } else if (sh.sh_type == SHT_DYNSYM && in_file) {
+                dynsym = &sh;
+            } else if (name == ".note.gnu.build-id" && in_file && sh.sh_size > 16) {
+                const uint8_t *note = data() + sh.sh_offset;
+                uint32_t namesz, descsz;
+                memcpy(&namesz, note, 4);
+                memcpy(&descsz, note + 4, 4);
+                size_t desc = 12 + ((namesz + 3) & ~3u);
+                for (size_t b = 0; b < descsz && desc + b < sh.sh_size; ++b) {
+                    char hex[3];
+                    snprintf(hex, sizeof(hex), "%02x", note[desc + b]);
+                    _build_id += hex;
+                }
+            } else if (name == ".gnu_debuglink" && in_file) {
+                _debuglink.assign(reinterpret_cast<const char *>(data() + sh.sh_offset), strnlen(
+                    reinterpret_cast<const char *>(data() + sh.sh_offset), sh.sh_size));
+            }
+        }
+        for (const auto *table : {symtab, dynsym}) {
+            if (table != nullptr && table->sh_link < ehdr.e_shnum) {
+                load_symbols(*table, shdrs[table->sh_link]);
+            }
+        }
+        std::sort(_symbols.begin(), _symbols.end(), [](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+    }
+    ElfFile(const ElfFile &) = delete;
+    ElfFile &operator=(const ElfFile &) = delete;
+    ~ElfFile() {
+        if (_map != MAP_FAILED) {
+            munmap(_map, _size);
+        }
+    }
+    bool valid() const { return _map != MAP_FAILED; }
+    bool has_symtab() const { return !_symbols.empty(); }
+    const std::string &build_id() const { return _build_id; }
+    const std::string &debuglink() const { return _debuglink; }
+    void add_debug_file(std::unique_ptr<ElfFile> file) { _debug.push_back(std::move(file)); }
+
+    // Link time address of a file offset, from the program headers.
+    uint64_t vaddr(uint64_t offset) const {
+        for (auto it = _loads.rbegin(); it != _loads.rend(); ++it) {
+            if (offset >= it->second) {
+                return offset - it->first;
+            }
+        }
+        return offset;
+    }
+
+    const Symbol *symbol(uint64_t addr) const {
+        static const Symbol plt{0, 0, "plt"};
+        for (const auto &range : _plt) {
+            if (addr >= range.first && addr < range.second) {
+                return &plt;
+            }
+        }
+        for (const auto &debug : _debug) {
+            if (const Symbol *sym = debug->symbol(addr)) {
+                return sym;
+            }
+        }
+        auto it = std::upper_bound(_symbols.begin(), _symbols.end(), addr,
+                                   [](uint64_t a, const Symbol &s) { return a < s.addr; });
+        if (it == _symbols.begin()) {
+            return nullptr;
+        }
+        --it;
+        // Symbols without size (e.g. from assembly) cover addresses up to the next symbol.
+        if (it->size != 0 && addr >= it->addr + it->size) {
+            return nullptr;
+        }
+        return &*it;
+    }
+
+    /**
+     * Decodes a DW_EH_PE encoded pointer at r, where 'addr' is the link time address of r.pos().
+     */
+    uint64_t pointer(Reader &r, uint8_t encoding, uint64_t addr) const {
+        uint64_t base = 0;
+        switch (encoding & 0x70) {
+        case 0x00: break;
+        case 0x10: base = addr; break;                 // pcrel
+        case 0x30: base = _eh_frame_hdr_addr; break;   // datarel
+        default: r.fail(); return 0;
+        }
+        uint64_t v = 0;
+        switch (encoding & 0x0f) {
+        case 0x00: v = r.fixed<uint64_t>(); break;
+        case 0x01: v = r.uleb(); break;
+        case 0x02: v = r.fixed<uint16_t>(); break;
+        case 0x03: v = r.fixed<uint32_t>(); break;
+        case 0x04: v = r.fixed<uint64_t>(); break;
+        case 0x09: v = r.sleb(); break;
+        case 0x0a: v = int64_t(r.fixed<int16_t>()); break;
+        case 0x0b: v = int64_t(r.fixed<int32_t>()); break;
+        case 0x0c: v = r.fixed<int64_t>(); break;
+        default: r.fail(); return 0;
+        }
+        return base + v;
+    }
+
+    uint64_t eh_addr(const uint8_t *p) const { return _eh_frame_addr + (p - _eh_frame); }
+
+    // The FDE covering pc, found with the binary search table of .eh_frame_hdr.
+    const uint8_t *find_fde(uint64_t pc) const {
+        if (_eh_frame_hdr == nullptr || _eh_frame == nullptr || _eh_frame_hdr_size < 4 || _eh_frame_hdr[0] != 1) {
+            return nullptr;
+        }
+        Reader r(_eh_frame_hdr + 4, _eh_frame_hdr + _eh_frame_hdr_size);
+        pointer(r, _eh_frame_hdr[1], _eh_frame_hdr_addr + 4);
+        uint64_t count = pointer(r, _eh_frame_hdr[2], _eh_frame_hdr_addr + (r.pos() - _eh_frame_hdr));
+        if (!r.ok() || _eh_frame_hdr[3] != 0x3b) { // the table is datarel sdata4 pairs in practice
+            return nullptr;
+        }
+        const int32_t *table = reinterpret_cast<const int32_t *>(r.pos());
+        if (reinterpret_cast<const uint8_t *>(table + 2 * count) > _eh_frame_hdr + _eh_frame_hdr_size || count == 0) {
+            return nullptr;
+        }
+        int64_t rel = int64_t(pc) - int64_t(_eh_frame_hdr_addr);
+        size_t lo = 0;
+        size_t hi = count;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (table[2 * mid] <= rel) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        if (table[2 * lo] > rel) {
+            return nullptr;
+        }
+        uint64_t fde = _eh_frame_hdr_addr + table[2 * lo + 1];
+        if (fde < _eh_frame_addr || fde >= _eh_frame_addr + _eh_frame_size) {
+            return nullptr;
+        }
+        return _eh_frame + (fde - _eh_frame_addr);
+    }
+
+    const uint8_t *eh_frame_begin() const { return _eh_frame; }
+    const uint8_t *eh_frame_end() const { return _eh_frame + _eh_frame_size; }
+};
+
+/**
+ * Register rules from running the CFA instructions of a CIE and FDE up to a pc.
+ */
+struct Cfi {
+    enum Rule : uint8_t { Same, Undefined, Offset, ValOffset, Register };
+    struct RegRule {
+        Rule rule;
+        int64_t value;
+    };
+    int cfa_reg;
+    int64_t cfa_offset;
+    bool cfa_expression;
+    int ra_reg;
+    RegRule regs[num_dwarf_regs];
+};
+
+class Unwinder {
+    struct Cie {
+        uint64_t code_align;
+        int64_t data_align;
+        int ra_reg;
+        uint8_t fde_encoding;
+        bool has_augmentation_data;
+        const uint8_t *instructions;
+        const uint8_t *end;
+    };
+
+    static bool parse_cie(const ElfFile &elf, const uint8_t *p, const uint8_t *limit, Cie &cie) {
+        Reader r(p, limit);
+        uint64_t length = r.fixed<uint32_t>();
+        if (length == 0xffffffff) {
+            length = r.fixed<uint64_t>();
+        }
+        const uint8_t *end = r.pos() + length;
+        if (!r.ok() || end > limit || r.fixed<uint32_t>() != 0) {
+            return false;
+        }
+        r = Reader(r.pos(), end);
+        uint8_t version = r.fixed<uint8_t>();
+        std::string augmentation = r.cstr();
+        if (augmentation.find("eh") != std::string::npos) {
+            r.skip(8);
+        }
+        cie.code_align = r.uleb();
+        cie.data_align = r.sleb();
+        cie.ra_reg = (version == 1) ? r.fixed<uint8_t>() : int(r.uleb());
+        cie.fde_encoding = 0;
+        cie.has_augmentation_data = !augmentation.empty() && augmentation[0] == 'z';
+        if (cie.has_augmentation_data) {
+            uint64_t len = r.uleb();
+            Reader aug(r.pos(), r.pos() + len);
+            r.skip(len);
+            for (size_t i = 1; i < augmentation.size() && aug.ok(); ++i) {
+                switch (augmentation[i]) {
+                case 'R': cie.fde_encoding = aug.fixed<uint8_t>(); break;
+                case 'L': aug.fixed<uint8_t>(); break;
+                case 'P': {
+                    uint8_t enc = aug.fixed<uint8_t>();
+                    elf.pointer(aug, enc & 0x7f, elf.eh_addr(aug.pos()));
+                    break;
+                }
+                default: break; // 'S' (signal frame), 'B' (branch target identification) carry no data
+                }
+            }
+        }
+        cie.instructions = r.pos();
+        cie.end = end;
+        return r.ok();
+    }
+
+    static bool run(const Cie &cie, Reader r, uint64_t loc, uint64_t pc, Cfi &cfi, const Cfi &initial,
+                    const ElfFile &elf) {
+        std::vector<Cfi> stack;
+        auto set = [&](uint64_t reg, Cfi::Rule rule, int64_t value) {
+            if (reg < uint64_t(num_dwarf_regs)) {
+                cfi.regs[reg] = {rule, value};
+            }
+        };
+        auto restore = [&](uint64_t reg) {
+            if (reg < uint64_t(num_dwarf_regs)) {
+                cfi.regs[reg] = initial.regs[reg];
+            }
+        };
+        while (r.more()) {
+            uint8_t op = r.fixed<uint8_t>();
+            uint8_t arg = op & 0x3f;
+            switch (op & 0xc0) {
+            case 0x40:
+                loc += arg * cie.code_align;
+                if (loc > pc) return true;
+                continue;
+            case 0x80: set(arg, Cfi::Offset, int64_t(r.uleb()) * cie.data_align); continue;
+            case 0xc0: restore(arg); continue;
+            default: break;
+            }
+            switch (op) {
+            case 0x00: break;
+            case 0x01: loc = elf.pointer(r, cie.fde_encoding, elf.eh_addr(r.pos())); if (loc > pc) return true; break;
+            case 0x02: loc += r.fixed<uint8_t>() * cie.code_align; if (loc > pc) return true; break;
+            case 0x03: loc += r.fixed<uint16_t>() * cie.code_align; if (loc > pc) return true; break;
+            case 0x04: loc += r.fixed<uint32_t>() * cie.code_align; if (loc > pc) return true; break;
+            case 0x05: { uint64_t reg = r.uleb(); set(reg, Cfi::Offset, int64_t(r.uleb()) * cie.data_align); break; }
+            case 0x06: restore(r.uleb()); break;
+            case 0x07: set(r.uleb(), Cfi::Undefined, 0); break;
+            case 0x08: set(r.uleb(), Cfi::Same, 0); break;
+            case 0x09: { uint64_t reg = r.uleb(); set(reg, Cfi::Register, r.uleb()); break; }
+            case 0x0a: stack.push_back(cfi); break;
+            case 0x0b:
+                if (!stack.empty()) {
+                    cfi = stack.back();
+                    stack.pop_back();
+                }
+                break;
+            case 0x0c: cfi.cfa_reg = r.uleb(); cfi.cfa_offset = r.uleb(); cfi.cfa_expression = false; break;
+            case 0x0d: cfi.cfa_reg = r.uleb(); cfi.cfa_expression = false; break;
+            case 0x0e: cfi.cfa_offset = r.uleb(); break;
+            case 0x0f: r.skip(r.uleb()); cfi.cfa_expression = true; break;
+            case 0x10: { uint64_t reg = r.uleb(); r.skip(r.uleb()); set(reg, Cfi::Undefined, 0); break; }
+            case 0x11: { uint64_t reg = r.uleb(); set(reg, Cfi::Offset, r.sleb() * cie.data_align); break; }
+            case 0x12: cfi.cfa_reg = r.uleb(); cfi.cfa_offset = r.sleb() * cie.data_align; cfi.cfa_expression = false; break;
+            case 0x13: cfi.cfa_offset = r.sleb() * cie.data_align; break;
+            case 0x14: { uint64_t reg = r.uleb(); set(reg, Cfi::ValOffset, int64_t(r.uleb()) * cie.data_align); break; }
+            case 0x15: { uint64_t reg = r.uleb(); set(reg, Cfi::ValOffset, r.sleb() * cie.data_align); break; }
+            case 0x16: { uint64_t reg = r.uleb(); r.skip(r.uleb()); set(reg, Cfi::Undefined, 0); break; }
+            case 0x2d: break; // DW_CFA_AARCH64_negate_ra_state, return addresses are masked with pc_mask instead
+            case 0x2e: r.uleb(); break;
+            case 0x2f: { uint64_t reg = r.uleb(); set(reg, Cfi::Offset, -int64_t(r.uleb()) * cie.data_align); break; }
+            default: return false;
+            }
+        }
+        return r.ok();
+    }
+
+public:
+    // Rules for pc (link time address) from .eh_frame, or false if there is no FDE for it.
+    static bool find(const ElfFile &elf, uint64_t pc, Cfi &cfi) {
+        const uint8_t *fde = elf.find_fde(pc);
+        if (fde == nullptr) {
+            return false;
+        }
+        const uint8_t *limit = elf.eh_frame_end();
+        Reader r(fde, limit);
+        uint64_t length = r.fixed<uint32_t>();
+        if (length == 0xffffffff) {
+            length = r.fixed<uint64_t>();
+        }
+        const uint8_t *end = r.pos() + length;
+        // The CIE pointer is an offset back from the field itself.
+        const uint8_t *cie_pointer = r.pos();
+        uint32_t cie_offset = r.fixed<uint32_t>();
+        Cie cie;
+        if (!r.ok() || end > limit || cie_offset == 0 || cie_offset > uint64_t(cie_pointer - elf.eh_frame_begin()) ||
+            !parse_cie(elf, cie_pointer - cie_offset, limit, cie))
+        {
+            return false;
+        }
+        r = Reader(r.pos(), end);
+        uint64_t begin = elf.pointer(r, cie.fde_encoding, elf.eh_addr(r.pos()));
+        uint64_t range = elf.pointer(r, cie.fde_encoding & 0x0f, 0);
+        if (!r.ok() || pc < begin || pc >= begin + range) {
+            return false;
+        }
+        if (cie.has_augmentation_data) {
+            r.skip(r.uleb());
+        }
+        Cfi initial;
+        initial.cfa_reg = dwarf_sp;
+        initial.cfa_offset = 0;
+        initial.cfa_expression = false;
+        initial.ra_reg = cie.ra_reg;
+        for (auto &rule : initial.regs) {
+            rule = {Cfi::Same, 0};
+        }
+        if (!run(cie, Reader(cie.instructions, cie.end), 0, UINT64_MAX, initial, initial, elf)) {
+            return false;
+        }
+        cfi = initial;
+        return run(cie, r, begin, pc, cfi, initial, elf);
+    }
+};
+
+struct Mapping {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    std::string path;
+    ElfFile *elf;
+};
+
+/**
+ * Executable mappings of the profiled process, with their ELF files loaded on first use.
+ */
+class AddressSpace {
+    pid_t _pid;
+    std::vector<Mapping> _mappings;
+    std::map<std::string, std::unique_ptr<ElfFile>> _files;
+    uint64_t _last_load;
+
+    ElfFile *file(const std::string &path) {
+        auto it = _files.find(path);
+        if (it != _files.end()) {
+            return it->second.get();
+        }
+        // Read through the process root, which also works for files deleted or replaced since they were mapped.
+        auto elf = std::make_unique<ElfFile>("/proc/" + std::to_string(_pid) + "/root" + path);
+        if (!elf->valid()) {
+            elf = std::make_unique<ElfFile>(path);
+        }
+        if (elf->valid() && !elf->has_symtab()) {
+            std::vector<std::string> candidates;
+            if (elf->build_id().size() > 2) {
+                candidates.push_back("/usr/lib/debug/.build-id/" + elf->build_id().substr(0, 2) + "/" +
+                                     elf->build_id().substr(2) + ".debug");
+            }
+            if (!elf->debuglink().empty()) {
+                std::string dir = path.substr(0, path.rfind('/'));
+                candidates.push_back("/usr/lib/debug" + dir + "/" + elf->debuglink());
+                candidates.push_back(dir + "/.debug/" + elf->debuglink());
+            }
+            for (const auto &candidate : candidates) {
+                auto debug = std::make_unique<ElfFile>(candidate);
+                if (debug->valid() && debug->has_symtab()) {
+                    elf->add_debug_file(std::move(debug));
+                    break;
+                }
+            }
+        }
+        return _files.emplace(path, elf->valid() ? std::move(elf) : nullptr).first->second.get();
+    }
+
+public:
+    explicit AddressSpace(pid_t pid) : _pid(pid), _mappings(), _files(), _last_load(0) { load(); }
+
+    void load() {
+        _last_load = now_ns();
+        std::string maps = read_file("/proc/" + std::to_string(_pid) + "/maps");
+        std::vector<Mapping> mappings;
+        size_t pos = 0;
+        while (pos < maps.size()) {
+            size_t end = maps.find('\n', pos);
+            if (end == std::string::npos) {
+                end = maps.size();
+            }
+            std::string line = maps.substr(pos, end - pos);
+            pos = end + 1;
+            unsigned long start, stop, offset;
+            char perms[8];
+            int path_pos = 0;
+            if (sscanf(line.c_str(), "%lx-%lx %7s %lx %*s %*s %n", &start, &stop, perms, &offset, &path_pos) < 4 ||
+                perms[2] != 'x')
+            {
+                continue;
+            }
+            std::string path = (path_pos > 0) ? line.substr(path_pos) : "";
+            if (path.size() > 10 && path.compare(path.size() - 10, 10, " (deleted)") == 0) {
+                path.resize(path.size() - 10);
+            }
+            mappings.push_back({start, stop, offset, path, nullptr});
+        }
+        _mappings = std::move(mappings);
+    }
+
+    // Reloads the mappings for an address outside all of them, e.g. in a library loaded after the start,
+    // at most once a second.
+    const Mapping *find(uint64_t addr) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            auto it = std::upper_bound(_mappings.begin(), _mappings.end(), addr,
+                                       [](uint64_t a, const Mapping &m) { return a < m.start; });
+            if (it != _mappings.begin() && addr < (--it)->end) {
+                if (it->elf == nullptr && !it->path.empty() && it->path[0] == '/') {
+                    it->elf = file(it->path);
+                }
+                return &*it;
+            }
+            if (attempt == 0 && now_ns() > _last_load + 1000000000) {
+                load();
+            } else {
+                break;
+            }
+        }
+        return nullptr;
+    }
+
+    uint64_t vaddr(const Mapping &m, uint64_t addr) const {
+        return m.elf ? m.elf->vaddr(addr - m.start + m.offset) : addr - m.start + m.offset;
+    }
+};
+
+class Kernel {
+    std::vector<std::pair<uint64_t, std::string>> _symbols;
+public:
+    void load() {
+        FILE *file = fopen("/proc/kallsyms", "r");
+        if (file == nullptr) {
+            return;
+        }
+        char line[512];
+        while (fgets(line, sizeof(line), file) != nullptr) {
+            unsigned long addr;
+            char type;
+            char name[256];
+            if (sscanf(line, "%lx %c %255s", &addr, &type, name) == 3 && addr != 0 &&
+                (type == 't' || type == 'T' || type == 'w' || type == 'W'))
+            {
+                _symbols.emplace_back(addr, std::string(name) + "_[k]");
+            }
+        }
+        fclose(file);
+        std::sort(_symbols.begin(), _symbols.end());
+    }
+    std::string name(uint64_t addr) const {
+        auto it = std::upper_bound(_symbols.begin(), _symbols.end(), std::make_pair(addr, std::string("\xff")));
+        return (it == _symbols.begin()) ? std::string("[kernel]") : (--it)->second;
+    }
+};
+
+/**
+ * Walks the user stack from the registers and stack copy of a sample, pushing return addresses onto 'ips'.
+ */
+void unwind(AddressSpace &space, Regs regs, const Stack &stack, size_t max_frames, std::vector<uint64_t> &ips) {
+    for (size_t frame = 0; frame < max_frames; ++frame) {
+        uint64_t pc = regs.value[dwarf_ra] & pc_mask;
+        if (!regs.valid[dwarf_ra] || pc < 4096) {
+            return;
+        }
+        ips.push_back(pc);
+        // Return addresses point after the call, look up the call itself.
+        uint64_t lookup = (frame == 0) ? pc : pc - 1;
+        const Mapping *mapping = space.find(lookup);
+        Cfi cfi;
+        Regs next = regs;
+        if (mapping != nullptr && mapping->elf != nullptr &&
+            Unwinder::find(*mapping->elf, space.vaddr(*mapping, lookup), cfi) && !cfi.cfa_expression &&
+            cfi.cfa_reg < num_dwarf_regs && regs.valid[cfi.cfa_reg])
+        {
+            uint64_t cfa = regs.value[cfi.cfa_reg] + cfi.cfa_offset;
+            for (int reg = 0; reg < num_dwarf_regs; ++reg) {
+                const Cfi::RegRule &rule = cfi.regs[reg];
+                switch (rule.rule) {
+                case Cfi::Same: break;
+                case Cfi::Undefined: next.valid[reg] = false; break;
+                case Cfi::Offset: next.valid[reg] = stack.read(cfa + rule.value, next.value[reg]); break;
+                case Cfi::ValOffset: next.value[reg] = cfa + rule.value; next.valid[reg] = true; break;
+                case Cfi::Register:
+                    next.valid[reg] = rule.value < num_dwarf_regs && regs.valid[rule.value];
+                    next.value[reg] = next.valid[reg] ? regs.value[rule.value] : 0;
+                    break;
+                }
+            }
+            next.value[dwarf_sp] = cfa;
+            next.valid[dwarf_sp] = true;
+            if (cfi.ra_reg != dwarf_ra) {
+                // On aarch64, the caller continues at the return address held in x30.
+                bool valid = cfi.ra_reg < num_dwarf_regs && next.valid[cfi.ra_reg];
+                next.value[dwarf_ra] = valid ? next.value[cfi.ra_reg] : 0;
+                next.valid[dwarf_ra] = valid;
+            } else if (cfi.regs[dwarf_ra].rule == Cfi::Same) {
+                next.valid[dwarf_ra] = false;
+            }
+        } else {
+            // No unwind information: assume a frame pointer chain (saved frame pointer, then return address).
+            uint64_t fp = regs.value[dwarf_fp];
+            uint64_t caller_fp, ra;
+            if (!regs.valid[dwarf_fp] || !stack.read(fp, caller_fp) || !stack.read(fp + 8, ra) ||
+                (regs.valid[dwarf_sp] && fp < regs.value[dwarf_sp]))
+            {
+                return;
+            }
+            next.value[dwarf_fp] = caller_fp;
+            next.value[dwarf_sp] = fp + 16;
+            next.value[dwarf_ra] = ra;
+            next.valid[dwarf_sp] = true;
+            next.valid[dwarf_ra] = true;
+        }
+        if (next.valid[dwarf_sp] && regs.valid[dwarf_sp] && next.value[dwarf_sp] <= regs.value[dwarf_sp] && frame > 0) {
+            return; // the stack must grow towards the caller, or we are looping
+        }
+        regs = next;
+    }
+}
+
+long perf_event_open(perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+struct Options {
+    pid_t pid = 0;
+    double duration = 0.0;
+    uint64_t frequency = 999;
+    bool dwarf = false;
+    bool kernel = false;
+    bool cycles = false;
+    bool thread_roots = false;
+    uint32_t stack_size = 16384;
+    size_t max_frames = 128;
+    const char *collapsed = nullptr;
+    const char *flamegraph = nullptr;
+    std::string title;
+    size_t top = 25;
+};
+
+/**
+ * A sampling event on one thread, with its ring buffer.
+ */
+class ThreadEvent {
+    int _fd;
+    void *_ring;
+    size_t _ring_size;
+    std::string _record;
+public:
+    pid_t tid;
+    std::string name;
+
+    ThreadEvent(pid_t tid_in, const std::string &name_in, const Options &options, std::string &error)
+        : _fd(-1), _ring(MAP_FAILED), _ring_size(0), _record(), tid(tid_in), name(name_in)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = options.cycles ? PERF_TYPE_HARDWARE : PERF_TYPE_SOFTWARE;
+        attr.config = options.cycles ? uint64_t(PERF_COUNT_HW_CPU_CYCLES) : uint64_t(PERF_COUNT_SW_CPU_CLOCK);
+        attr.freq = 1;
+        attr.sample_freq = options.frequency;
+        attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+        attr.exclude_kernel = options.kernel ? 0 : 1;
+        attr.exclude_hv = 1;
+        attr.exclude_callchain_kernel = options.kernel ? 0 : 1;
+        if (options.dwarf) {
+            attr.sample_type |= PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+            attr.sample_regs_user = perf_regs_mask();
+            attr.sample_stack_user = options.stack_size;
+            attr.exclude_callchain_user = 1;
+        }
+        attr.wakeup_events = 1;
+        _fd = perf_event_open(&attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (_fd < 0) {
+            error = strerror(errno);
+            return;
+        }
+        size_t page = sysconf(_SC_PAGESIZE);
+        // 2^n data pages: enough for the samples of a busy thread between two reads.
+        size_t pages = options.dwarf ? 64 : 8;
+        _ring_size = (pages + 1) * page;
+        _ring = mmap(nullptr, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (_ring == MAP_FAILED) {
+            error = std::string("mmap: ") + strerror(errno);
+            close(_fd);
+            _fd = -1;
+        }
+    }
+    ThreadEvent(const ThreadEvent &) = delete;
+    ThreadEvent &operator=(const ThreadEvent &) = delete;
+    ~ThreadEvent() {
+        if (_ring != MAP_FAILED) munmap(_ring, _ring_size);
+        if (_fd >= 0) close(_fd);
+    }
+    bool valid() const { return _fd >= 0; }
+
+    // Calls 'handle(header, record)' for each record in the ring buffer, and frees their space.
+    template <typename Handler>
+    void drain(Handler &&handle) {
+        auto *meta = static_cast<perf_event_mmap_page *>(_ring);
+        const uint8_t *data = static_cast<const uint8_t *>(_ring) + meta->data_offset;
+        uint64_t size = meta->data_size;
+        uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = meta->data_tail;
+        while (tail + sizeof(perf_event_header) <= head) {
+            perf_event_header header;
+            uint64_t at = tail % size;
+            // Records may wrap around the end of the buffer.
+            if (at + sizeof(header) <= size) {
+                memcpy(&header, data + at, sizeof(header));
+            } else {
+                _record.resize(sizeof(header));
+                memcpy(_record.data(), data + at, size - at);
+                memcpy(_record.data() + (size - at), data, sizeof(header) - (size - at));
+                memcpy(&header, _record.data(), sizeof(header));
+            }
+            if (header.size < sizeof(header) || tail + header.size > head) {
+                break;
+            }
+            const uint8_t *record;
+            if (at + header.size <= size) {
+                record = data + at;
+            } else {
+                _record.resize(header.size);
+                memcpy(_record.data(), data + at, size - at);
+                memcpy(_record.data() + (size - at), data, header.size - (size - at));
+                record = reinterpret_cast<const uint8_t *>(_record.data());
+            }
+            handle(header, record);
+            tail += header.size;
+        }
+        __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+};
+
+std::string thread_name(pid_t pid, pid_t tid) {
+    std::string comm = read_file("/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid) + "/comm");
+    while (!comm.empty() && (comm.back() == '\n' || comm.back() == ' ')) {
+        comm.pop_back();
+    }
+    return comm.empty() ? std::to_string(tid) : comm;
+}
+
+class Profiler {
+    const Options &_options;
+    AddressSpace _space;
+    Kernel _kernel;
+    std::map<pid_t, std::unique_ptr<ThreadEvent>> _threads;
+    std::set<pid_t> _failed;
+    std::vector<std::string> _roots;                  // thread names, or the process name
+    std::map<std::vector<uint64_t>, uint64_t> _stacks; // root index followed by ips, leaf first
+    std::vector<uint64_t> _ips;
+    uint64_t _samples;
+    uint64_t _lost;
+    uint64_t _truncated;
+
+    size_t root(const std::string &name) {
+        auto it = std::find(_roots.begin(), _roots.end(), name);
+        if (it != _roots.end()) {
+            return it - _roots.begin();
+        }
+        _roots.push_back(name);
+        return _roots.size() - 1;
+    }
+
+    void sample(const ThreadEvent &thread, const uint8_t *p, const uint8_t *end) {
+        Reader r(p, end);
+        uint64_t ip = r.fixed<uint64_t>();
+        r.fixed<uint64_t>(); // pid, tid
+        uint64_t nr = r.fixed<uint64_t>();
+        _ips.clear();
+        _ips.push_back(_options.thread_roots ? root(thread.name) : 0);
+        for (uint64_t i = 0; i < nr && r.ok(); ++i) {
+            uint64_t addr = r.fixed<uint64_t>();
+            if (addr < uint64_t(PERF_CONTEXT_MAX)) { // not a context marker
+                _ips.push_back(addr);
+            }
+        }
+        if (nr == 0 && !_options.dwarf) {
+            _ips.push_back(ip);
+        }
+        if (_options.dwarf && r.ok()) {
+            uint64_t abi = r.fixed<uint64_t>();
+            Regs regs;
+            memset(&regs, 0, sizeof(regs));
+            if (abi != PERF_SAMPLE_REGS_ABI_NONE) {
+                // Registers come in order of their perf register numbers.
+                std::vector<std::pair<int, int>> order;
+                for (const auto &reg : perf_regs) {
+                    order.emplace_back(reg[1], reg[0]);
+                }
+                std::sort(order.begin(), order.end());
+                for (const auto &reg : order) {
+                    regs.value[reg.second] = r.fixed<uint64_t>();
+                    regs.valid[reg.second] = true;
+                }
+            }
+            uint64_t size = r.fixed<uint64_t>();
+            const uint8_t *stack_data = r.pos();
+            r.skip(size);
+            uint64_t dyn_size = (size > 0) ? r.fixed<uint64_t>() : 0;
+            if (r.ok() && abi != PERF_SAMPLE_REGS_ABI_NONE) {
+                Stack stack{regs.value[dwarf_sp], stack_data, std::min(size, dyn_size)};
+                size_t before = _ips.size();
+                unwind(_space, regs, stack, _options.max_frames, _ips);
+                if (dyn_size >= size && _ips.size() > before) {
+                    ++_truncated; // the stack copy was full, so the outermost frames may be missing
+                }
+            }
+        }
+        if (_ips.size() > 1) {
+            ++_stacks[_ips];
+        }
+        ++_samples;
+    }
+
+public:
+    explicit Profiler(const Options &options)
+        : _options(options), _space(options.pid), _kernel(), _threads(), _failed(), _roots(), _stacks(), _ips(),
+          _samples(0), _lost(0), _truncated(0)
+    {
+        _roots.push_back(thread_name(options.pid, options.pid));
+        if (options.kernel) {
+            _kernel.load();
+        }
+    }
+
+    // Attaches to new threads, and detaches from exited ones. Returns false when the process is gone.
+    bool scan() {
+        std::string dir = "/proc/" + std::to_string(_options.pid) + "/task";
+        DIR *tasks = opendir(dir.c_str());
+        if (tasks == nullptr) {
+            return false;
+        }
+        std::set<pid_t> alive;
+        while (dirent *entry = readdir(tasks)) {
+            pid_t tid = atoi(entry->d_name);
+            if (tid <= 0) {
+                continue;
+            }
+            alive.insert(tid);
+            if (_threads.count(tid) != 0 || _failed.count(tid) != 0) {
+                continue;
+            }
+            std::string error;
+            auto event = std::make_unique<ThreadEvent>(tid, thread_name(_options.pid, tid), _options, error);
+            if (event->valid()) {
+                _threads.emplace(tid, std::move(event));
+            } else {
+                if (_failed.empty()) {
+                    fprintf(stderr, "Could not profile thread %d: %s\n", tid, error.c_str());
+                }
+                _failed.insert(tid);
+            }
+        }
+        closedir(tasks);
+        for (auto it = _threads.begin(); it != _threads.end();) {
+            if (alive.count(it->first) == 0) {
+                drain(*it->second);
+                it = _threads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return true;
+    }
+
+    size_t num_threads() const { return _threads.size(); }
+
+    void drain(ThreadEvent &thread) {
+        thread.drain([&](const perf_event_header &header, const uint8_t *record) {
+            const uint8_t *body = record + sizeof(header);
+            const uint8_t *end = record + header.size;
+            if (header.type == PERF_RECORD_SAMPLE) {
+                sample(thread, body, end);
+            } else if (header.type == PERF_RECORD_LOST && header.size >= sizeof(header) + 16) {
+                uint64_t lost;
+                memcpy(&lost, body + 8, sizeof(lost));
+                _lost += lost;
+            }
+        });
+    }
+
+    void drain_all() {
+        for (auto &entry : _threads) {
+            drain(*entry.second);
+        }
+    }
+
+    /**
+     * Symbolized stacks, root first, with sample counts.
+     */
+    std::vector<std::pair<std::vector<std::string>, uint64_t>> symbolize(uint64_t &unresolved, uint64_t &frames) {
+        std::unordered_map<uint64_t, std::string> names;
+        auto name = [&](uint64_t addr) -> const std::string & {
+            auto it = names.find(addr);
+            if (it != names.end()) {
+                return it->second;
+            }
+            std::string result;
+            if (addr >= 0xffff000000000000UL) {
+                result = _kernel.name(addr);
+            } else if (const Mapping *m = _space.find(addr)) {
+                const Symbol *sym = m->elf ? m->elf->symbol(_space.vaddr(*m, addr)) : nullptr;
+                if (sym != nullptr) {
+                    int status = 0;
+                    char *demangled = abi::__cxa_demangle(sym->name, nullptr, nullptr, &status);
+                    result = (status == 0 && demangled != nullptr) ? demangled : sym->name;
+                    free(demangled);
+                } else {
+                    // Unresolved addresses are merged per file, like perf does.
+                    result = "[" + (m->path.empty() ? "anon" : m->path.substr(m->path.rfind('/') + 1)) + "]";
+                }
+            } else {
+                result = "[unknown]";
+            }
+            return names.emplace(addr, std::move(result)).first->second;
+        };
+        std::map<std::vector<std::string>, uint64_t> merged;
+        unresolved = 0;
+        frames = 0;
+        for (const auto &[ips, count] : _stacks) {
+            std::vector<std::string> stack{_roots[ips[0]]};
+            for (size_t i = ips.size() - 1; i >= 1; --i) {
+                const std::string &frame = name(ips[i]);
+                // Frames are ';' separated in the collapsed format.
+                std::string clean = frame;
+                std::replace(clean.begin(), clean.end(), ';', ':');
+                if (clean[0] == '[') {
+                    unresolved += count;
+                }
+                frames += count;
+                stack.push_back(std::move(clean));
+            }
+            merged[std::move(stack)] += count;
+        }
+        return {merged.begin(), merged.end()};
+    }
+
+    uint64_t samples() const { return _samples; }
+    uint64_t lost() const { return _lost; }
+    uint64_t truncated() const { return _truncated; }
+};
+
+std::string xml_escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+        switch (c) {
+        case '<': out += "&lt;"; break;
+        case '>': out += "&gt;"; break;
+        case '&': out += "&amp;"; break;
+        case '"': out += "&quot;"; break;
+        default: out += c;
+        }
+    }
+    return out;
+}
+
+/**
+ * Writes a flame graph like flamegraph.pl: callers at the bottom, frame widths proportional to samples,
+ * and the name and samples of a frame in its tooltip.
+ */
+void write_flamegraph(const char *file_name, const std::string &title,
+                      const std::vector<std::pair<std::vector<std::string>, uint64_t>> &stacks)
+{
+    struct Node {
+        std::map<std::string, Node> children;
+        uint64_t count = 0;
+    };
+    Node tree;
+    size_t depth = 0;
+    for (const auto &[stack, count] : stacks) {
+        Node *node = &tree;
+        node->count += count;
+        for (const auto &frame : stack) {
+            node = &node->children[frame];
+            node->count += count;
+        }
+        depth = std::max(depth, stack.size());
+    }
+    const double width = 1200.0;
+    const double pad = 10.0;
+    const double frame_height = 16.0;
+    const double top = 40.0;
+    double height = top + (depth + 1) * frame_height + pad;
+    FILE *file = fopen(file_name, "w");
+    if (file == nullptr) {
+        perror(file_name);
+        return;
+    }
+    fprintf(file, "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+                  "<svg version=\"1.1\" width=\"%.0f\" height=\"%.0f\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+                  "<style>text { font-family: Verdana, sans-serif; font-size: 12px; fill: #000; }</style>\n"
+                  "<rect x=\"0\" y=\"0\" width=\"100%%\" height=\"100%%\" fill=\"#f8f8f8\"/>\n"
+                  "<text x=\"%.0f\" y=\"24\" text-anchor=\"middle\" style=\"font-size: 17px\">%s</text>\n",
+            width, height, width / 2, xml_escape(title).c_str());
+    double scale = (tree.count > 0) ? (width - 2 * pad) / tree.count : 0.0;
+    std::vector<std::tuple<const std::string *, const Node *, double, size_t>> work;
+    for (const auto &[name, child] : tree.children) {
+        work.emplace_back(&name, &child, 0.0, 0);
+    }
+    std::sort(work.begin(), work.end(), [](const auto &a, const auto &b) { return *std::get<0>(a) > *std::get<0>(b); });
+    double x_offset = 0.0;
+    for (auto &item : work) { // roots, laid out left to right in name order
+        std::get<2>(item) = x_offset;
+        x_offset += std::get<1>(item)->count;
+    }
+    while (!work.empty()) {
+        auto [name, node, x, level] = work.back();
+        work.pop_back();
+        double w = node->count * scale;
+        if (w < 0.1) {
+            continue;
+        }
+        double rx = pad + x * scale;
+        double ry = height - pad - (level + 1) * frame_height;
+        uint32_t hash = 2166136261u;
+        for (char c : *name) {
+            hash = (hash ^ uint8_t(c)) * 16777619u;
+        }
+        int red = 205 + hash % 50;
+        int green = (hash >> 8) % 230;
+        int blue = (hash >> 16) % 55;
+        std::string escaped = xml_escape(*name);
+        fprintf(file, "<g><title>%s (%lu samples, %.2f%%)</title>"
+                      "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%.1f\" fill=\"rgb(%d,%d,%d)\" rx=\"2\"/>",
+                escaped.c_str(), node->count, 100.0 * node->count / tree.count, rx, ry, w, frame_height - 1,
+                red, green, blue);
+        size_t chars = size_t((w - 6) / 7);
+        if (chars >= 3) {
+            std::string label = (name->size() <= chars) ? *name : name->substr(0, chars - 2) + "..";
+            fprintf(file, "<text x=\"%.1f\" y=\"%.1f\">%s</text>", rx + 3, ry + frame_height - 4,
+                    xml_escape(label).c_str());
+        }
+        fprintf(file, "</g>\n");
+        double child_x = x;
+        for (const auto &[child_name, child] : node->children) {
+            work.emplace_back(&child_name, &child, child_x, level + 1);
+            child_x += child.count;
+        }
+    }
+    fprintf(file, "</svg>\n");
+    fclose(file);
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -p pid [-d seconds] [-F hz] [-g fp|dwarf] [-k] [-c] [-T] [-o collapsed] [-f svg] [-t title]\n"
+                    "  -p: process to profile, all its threads\n"
+                    "  -d: seconds to profile (default until SIGINT or SIGTERM, or the process exits)\n"
+                    "  -F: samples per second per thread (default 999)\n"
+                    "  -g: unwind with frame pointers (fp, default) or DWARF unwind tables (dwarf)\n"
+                    "  -s: bytes of user stack copied per sample for -g dwarf (default 16384)\n"
+                    "  -k: include kernel frames\n"
+                    "  -c: sample on CPU cycles instead of the CPU clock (needs hardware counters)\n"
+                    "  -T: use thread names as the root frames, instead of the process name\n"
+                    "  -o: write collapsed stacks to this file\n"
+                    "  -f: write a flame graph (SVG) to this file\n"
+                    "  -t: title of the flame graph\n"
+                    "  -n: number of functions in the summary (default 25)\n", prog);
+}
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    int option;
+    while ((option = getopt(argc, argv, "p:d:F:g:s:kcTo:f:t:n:h")) != -1) {
+        switch (option) {
+        case 'p': options.pid = atoi(optarg); break;
+        case 'd': options.duration = atof(optarg); break;
+        case 'F': options.frequency = std::max(1UL, strtoul(optarg, nullptr, 0)); break;
+        case 'g': options.dwarf = (strcmp(optarg, "dwarf") == 0); break;
+        case 's': options.stack_size = (strtoul(optarg, nullptr, 0) + 7) & ~7UL; break;
+        case 'k': options.kernel = true; break;
+        case 'c': options.cycles = true; break;
+        case 'T': options.thread_roots = true; break;
+        case 'o': options.collapsed = optarg; break;
+        case 'f': options.flamegraph = optarg; break;
+        case 't': options.title = optarg; break;
+        case 'n': options.top = strtoul(optarg, nullptr, 0); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.pid <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    Profiler profiler(options);
+    if (!profiler.scan() || profiler.num_threads() == 0) {
+        fprintf(stderr, "Could not profile process %d\n", options.pid);
+        return 1;
+    }
+    fprintf(stderr, "Profiling %zu threads of process %d\n", profiler.num_threads(), options.pid);
+    uint64_t start = now_ns();
+    uint64_t last_scan = start;
+    bool alive = true;
+    while (!stop_requested && alive && (options.duration <= 0 || now_ns() - start < options.duration * 1e9)) {
+        usleep(options.dwarf ? 5000 : 20000);
+        profiler.drain_all();
+        if (now_ns() - last_scan >= 1000000000) {
+            alive = profiler.scan();
+            last_scan = now_ns();
+        }
+    }
+    profiler.drain_all();
+    double seconds = (now_ns() - start) / 1e9;
+
+    uint64_t unresolved = 0;
+    uint64_t frames = 0;
+    auto stacks = profiler.symbolize(unresolved, frames);
+    if (options.collapsed != nullptr) {
+        FILE *file = fopen(options.collapsed, "w");
+        if (file == nullptr) {
+            perror(options.collapsed);
+            return 1;
+        }
+        for (const auto &[stack, count] : stacks) {
+            for (size_t i = 0; i < stack.size(); ++i) {
+                fprintf(file, "%s%s", (i > 0) ? ";" : "", stack[i].c_str());
+            }
+            fprintf(file, " %lu\n", count);
+        }
+        fclose(file);
+    }
+    if (options.flamegraph != nullptr) {
+        std::string title = options.title.empty() ? "CPU profile of process " + std::to_string(options.pid) : options.title;
+        write_flamegraph(options.flamegraph, title, stacks);
+    }
+
+    // Summary: self samples are those with the function as the leaf, total samples those with it anywhere.
+    std::map<std::string, std::pair<uint64_t, uint64_t>> functions;
+    uint64_t total = 0;
+    for (const auto &[stack, count] : stacks) {
+        total += count;
+        std::set<std::string> seen;
+        for (size_t i = 1; i < stack.size(); ++i) {
+            if (seen.insert(stack[i]).second) {
+                functions[stack[i]].second += count;
+            }
+        }
+        if (stack.size() > 1) {
+            functions[stack.back()].first += count;
+        }
+    }
+    printf("seconds: %.3f\n", seconds);
+    printf("samples: %lu\n", profiler.samples());
+    printf("lost samples: %lu\n", profiler.lost());
+    if (options.dwarf) {
+        printf("truncated stacks: %lu\n", profiler.truncated());
+    }
+    printf("unresolved frames: %.2f%%\n", frames > 0 ? 100.0 * unresolved / frames : 0.0);
+    for (int kind = 0; kind < 2; ++kind) {
+        std::vector<std::pair<uint64_t, std::string>> top;
+        for (const auto &[name, counts] : functions) {
+            top.emplace_back(kind == 0 ? counts.first : counts.second, name);
+        }
+        std::sort(top.begin(), top.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+        printf("# %s\n", kind == 0 ? "self" : "total");
+        for (size_t i = 0; i < std::min(options.top, top.size()) && top[i].first > 0; ++i) {
+            printf("%6.2f%%\t%lu\t%s\n", 100.0 * top[i].first / std::max<uint64_t>(total, 1), top[i].first,
+                   top[i].second.c_str());
+        }
+    }
+    return 0;
+}
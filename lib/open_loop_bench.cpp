@@ -0,0 +1,1232 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// Open loop HTTP load generator.
+//
+// Unlike vespa-fbench and h2load, which send the next request when a client gets a response (closed loop),
+// requests are sent on a fixed or Poisson arrival schedule regardless of how fast responses come back.
+// Latency is measured from the intended send time, so a stall in the server shows up as latency for every
+// request that should have been sent during the stall (no coordinated omission). Requests that cannot be
+// sent because all connections are busy wait in a backlog, and the delay from intended to actual send time
+// is reported separately. Requests still unanswered when the run has drained (-x) count as timed out, and
+// their latency so far is included in the percentiles.
+//
+// Each thread runs an epoll loop over its share of the connections, with its share of the rate.
+// Connections use HTTP/1.1 with keep-alive (one request at a time), or HTTP/2 (-2) with up to -m
+// concurrent streams. With -D, TLS is used when certificates are given with -C/-K/-T or VESPA_TLS_CONFIG_FILE,
+// and plain HTTP otherwise, as for vespa-fbench.
+// The HTTP/2 client is minimal: it sets the HPACK table size to 0 so only the response status needs
+// decoding, and sends request bodies without waiting for flow control (bodies must be below 64 KiB).
+//
+// A query trace (lib/query_trace.cpp) with a send time per request can be replayed instead (-R).
+// Query files are as for vespa-fbench: one url path per line, or with -P, url and POST body on alternate lines.
+// The summary uses the labels of the vespa-fbench summary where they exist, see Perf::OpenLoopBench.
+//
+// Compile with: g++ -std=c++17 -O3 -pthread -o open_loop_bench open_loop_bench.cpp -lssl -lcrypto
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace {
+
+int64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+struct Query {
+    std::string url;
+    std::string body;
+};
+
+struct Config {
+    std::string host;
+    int port = 0;
+    double rate = 0.0;
+    bool poisson = true;
+    size_t connections = 16;
+    size_t threads = 1;
+    double runtime_s = 60.0;
+    double warmup_s = 0.0;
+    double drain_s = 10.0;
+    std::string query_file;
+    std::string append;
+    std::vector<std::string> headers;
+    bool post = false;
+    bool http2 = false;
+    size_t max_streams = 100;
+    bool tls = false;
+    std::string cert_file;
+    std::string key_file;
+    std::string ca_file;
+    std::string latency_log;
+    std::string trace_file;
+    std::vector<int64_t> trace_ns; // send times of the requests in the trace, from its start
+};
+
+std::vector<Query> load_queries(const Config &config) {
+    std::ifstream in(config.query_file);
+    if (!in) {
+        fprintf(stderr, "Could not open query file '%s'\n", config.query_file.c_str());
+        exit(1);
+    }
+    std::vector<Query> queries;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        Query q{line + config.append, ""};
+        if (config.post && !std::getline(in, q.body)) {
+            break;
+        }
+        queries.push_back(std::move(q));
+    }
+    if (queries.empty()) {
+        fprintf(stderr, "No queries in '%s'\n", config.query_file.c_str());
+        exit(1);
+    }
+    return queries;
+}
+
+// Reads a query trace (see lib/query_trace.cpp) of '<send time s>\t<url>[\t<body>]' lines.
+std::vector<Query> load_trace(Config &config) {
+    std::ifstream in(config.trace_file);
+    if (!in) {
+        fprintf(stderr, "Could not open trace file '%s'\n", config.trace_file.c_str());
+        exit(1);
+    }
+    std::vector<Query> queries;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            continue;
+        }
+        size_t body = line.find('\t', tab + 1);
+        std::string url = line.substr(tab + 1, body == std::string::npos ? std::string::npos : body - tab - 1);
+        queries.push_back({url + config.append, body == std::string::npos ? "" : line.substr(body + 1)});
+        config.trace_ns.push_back(int64_t(atof(line.c_str()) * 1e9));
+    }
+    if (queries.empty() || !std::is_sorted(config.trace_ns.begin(), config.trace_ns.end())) {
+        fprintf(stderr, "Trace '%s' is empty or not sorted by time\n", config.trace_file.c_str());
+        exit(1);
+    }
+    return queries;
+}
+
+std::string json_field(const std::string &json, const std::string &name) {
+    std::smatch m;
+    if (std::regex_search(json, m, std::regex("\"" + name + "\"\\s*:\\s*\"([^\"]*)\""))) {
+        return m[1];
+    }
+    return "";
+}
+
+SSL_CTX *make_ssl_context(Config &config) {
+    if (config.cert_file.empty() && config.key_file.empty() && config.ca_file.empty()) {
+        const char *file = getenv("VESPA_TLS_CONFIG_FILE");
+        if (file != nullptr) {
+            std::ifstream in(file);
+            std::stringstream ss;
+            ss << in.rdbuf();
+            config.cert_file = json_field(ss.str(), "certificates");
+            config.key_file = json_field(ss.str(), "private-key");
+            config.ca_file = json_field(ss.str(), "ca-certificates");
+        }
+    }
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (!config.ca_file.empty()) {
+        if (SSL_CTX_load_verify_locations(ctx, config.ca_file.c_str(), nullptr) != 1) {
+            fprintf(stderr, "Could not load CA certificates '%s'\n", config.ca_file.c_str());
+            exit(1);
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    }
+    if (!config.cert_file.empty() &&
+        (SSL_CTX_use_certificate_chain_file(ctx, config.cert_file.c_str()) != 1 ||
+         SSL_CTX_use_PrivateKey_file(ctx, config.key_file.c_str(), SSL_FILETYPE_PEM) != 1))
+    {
+        fprintf(stderr, "Could not load certificate '%s' and key '%s'\n", config.cert_file.c_str(), config.key_file.c_str());
+        exit(1);
+    }
+    static const unsigned char h2[] = "\x02h2";
+    static const unsigned char http11[] = "\x08http/1.1";
+    if (config.http2) {
+        SSL_CTX_set_alpn_protos(ctx, h2, sizeof(h2) - 1);
+    } else {
+        SSL_CTX_set_alpn_protos(ctx, http11, sizeof(http11) - 1);
+    }
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return ctx;
+}
+
+struct Request {
+    uint32_t query;
+    int64_t intended;
+    int64_t sent;
+};
+
+/**
+ * Per thread results. Requests intended before the end of warmup are not counted.
+ */
+struct Stats {
+    std::vector<double> latencies_ms;
+    std::vector<std::pair<double, double>> log; // (intended time since epoch in s, latency in ms)
+    std::map<int, uint64_t> status;
+    uint64_t failed = 0;
+    uint64_t timed_out = 0;
+    uint64_t connection_errors = 0;
+    double send_delay_sum_ms = 0.0;
+    double send_delay_max_ms = 0.0;
+    uint64_t sent = 0;
+};
+
+// HPACK static table indexes of :status values.
+int hpack_static_status(uint64_t index) {
+    static const int status[] = {200, 204, 206, 304, 400, 404, 500};
+    return (index >= 8 && index <= 14) ? status[index - 8] : 0;
+}
+
+// Decodes a Huffman coded string of digits (as used for :status), returns -1 for other strings.
+int huffman_digits(const uint8_t *p, size_t len) {
+    int value = 0;
+    uint64_t bits = 0;
+    int nbits = 0;
+    size_t i = 0;
+    while (true) {
+        while (nbits < 6 && i < len) {
+            bits = (bits << 8) | p[i++];
+            nbits += 8;
+        }
+        if (nbits < 5) {
+            break;
+        }
+        uint32_t five = (bits >> (nbits - 5)) & 0x1f;
+        if (five <= 2) {
+            value = value * 10 + int(five);
+            nbits -= 5;
+        } else if (nbits >= 6 && ((bits >> (nbits - 6)) & 0x3f) >= 0x19 && ((bits >> (nbits - 6)) & 0x3f) <= 0x1f) {
+            value = value * 10 + int(((bits >> (nbits - 6)) & 0x3f) - 0x19 + 3);
+            nbits -= 6;
+        } else {
+            break;
+        }
+        bits &= (uint64_t(1) << nbits) - 1;
+    }
+    // Remaining bits must be padding (all ones, less than a byte).
+    bool padding = nbits < 8 && (bits & ((uint64_t(1) << nbits) - 1)) == ((uint64_t(1) << nbits) - 1);
+    return (padding && i == len) ? value : -1;
+}
+
+class Worker;
+
+/**
+ * A connection with HTTP/1.1 (one request in flight) or HTTP/2 (several streams in flight) over TCP or TLS.
+ */
+class Connection {
+public:
+    enum class State { CLOSED, CONNECTING, HANDSHAKE, READY };
+
+    Worker &worker;
+    int fd = -1;
+    SSL *ssl = nullptr;
+    State state = State::CLOSED;
+    int64_t retry_at = 0;
+    bool want_write = false;
+    std::string out;
+    size_t out_pos = 0;
+    std::string in;
+    size_t in_pos = 0;
+    // HTTP/1.1
+    std::deque<Request> inflight;
+    enum class Http1 { HEADER, BODY, BODY_UNTIL_CLOSE, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER } http1 = Http1::HEADER;
+    int http1_status = 0;
+    bool http1_close = false;
+    uint64_t remaining = 0;
+    // HTTP/2
+    std::unordered_map<uint32_t, Request> streams;
+    std::unordered_map<uint32_t, int> stream_status;
+    uint32_t next_stream = 1;
+    size_t server_max_streams = SIZE_MAX;
+    bool goaway = false;
+    uint64_t unacked_data = 0;
+    std::string header_block;
+    uint32_t header_stream = 0;
+    bool header_end_stream = false;
+
+    explicit Connection(Worker &w) : worker(w) {}
+    size_t capacity() const;
+    void connect();
+    void close(bool failed);
+    void on_event(uint32_t events);
+    void send(const Request &request);
+    void check_timeouts(int64_t deadline);
+
+private:
+    void update_epoll();
+    bool handshake();
+    void on_ready();
+    ssize_t io_read(char *buf, size_t len);
+    bool flush();
+    bool read_all();
+    bool parse_http1();
+    bool parse_http2();
+    void frame(uint8_t type, uint8_t flags, uint32_t stream, const std::string &payload);
+    bool on_headers(uint32_t stream, const std::string &block, bool end_stream);
+    void complete(const Request &request, int status);
+};
+
+class Worker {
+public:
+    const Config &config;
+    const std::vector<Query> &queries;
+    SSL_CTX *ssl_ctx;
+    const addrinfo *address;
+    int epoll_fd;
+    size_t id;
+    double rate;
+    int64_t start;
+    int64_t warmup_end;
+    int64_t end;
+    double epoch_offset_s;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::deque<Request> backlog;
+    size_t next_query;
+    std::mt19937_64 rng;
+    Stats stats;
+
+    Worker(const Config &c, const std::vector<Query> &q, SSL_CTX *ctx, const addrinfo *addr, size_t thread,
+           size_t num_connections, int64_t start_ns, double epoch_offset)
+        : config(c), queries(q), ssl_ctx(ctx), address(addr), epoll_fd(epoll_create1(0)), id(thread),
+          rate(c.rate / c.threads), start(start_ns), warmup_end(start_ns + int64_t(c.warmup_s * 1e9)),
+          end(start_ns + int64_t((c.warmup_s + c.runtime_s) * 1e9)), epoch_offset_s(epoch_offset),
+          connections(), backlog(), next_query(c.trace_ns.empty() ? q.size() * thread / c.threads : thread),
+          rng(4711 + thread), stats()
+    {
+        for (size_t i = 0; i < num_connections; ++i) {
+            connections.push_back(std::make_unique<Connection>(*this));
+        }
+    }
+    ~Worker() { ::close(epoll_fd); }
+
+    bool counted(const Request &r) const { return r.intended >= warmup_end; }
+
+    void complete(const Request &r, int status) {
+        if (!counted(r)) {
+            return;
+        }
+        ++stats.status[status];
+        if (status >= 200 && status < 300) {
+            double latency_ms = (now_ns() - r.intended) / 1e6;
+            stats.latencies_ms.push_back(latency_ms);
+            if (!config.latency_log.empty()) {
+                stats.log.emplace_back(epoch_offset_s + r.intended / 1e9, latency_ms);
+            }
+        } else {
+            ++stats.failed;
+        }
+    }
+    void fail(const Request &r) {
+        if (counted(r)) {
+            ++stats.failed;
+        }
+    }
+
+    int64_t gap() {
+        if (config.poisson) {
+            std::exponential_distribution<double> exp(rate);
+            return int64_t(exp(rng) * 1e9);
+        }
+        return int64_t(1e9 / rate);
+    }
+
+    // Moves to the next request of this thread: the next arrival on the schedule, or the next of
+    // every 'threads' requests in the trace. The time is INT64_MAX when the trace is done.
+    void advance(int64_t &time, uint32_t &query) {
+        if (config.trace_ns.empty()) {
+            time += gap();
+            query = next_query++ % queries.size();
+        } else {
+            time = (next_query < config.trace_ns.size()) ? start + config.trace_ns[next_query] : INT64_MAX;
+            query = next_query;
+            next_query += config.threads;
+        }
+    }
+
+    void dispatch() {
+        for (auto &conn : connections) {
+            if (backlog.empty()) {
+                return;
+            }
+            if (conn->state == Connection::State::CLOSED && conn->retry_at <= now_ns()) {
+                conn->connect();
+            }
+            for (size_t n = conn->capacity(); n > 0 && !backlog.empty(); --n) {
+                Request r = backlog.front();
+                backlog.pop_front();
+                r.sent = now_ns();
+                if (counted(r)) {
+                    double delay_ms = (r.sent - r.intended) / 1e6;
+                    stats.send_delay_sum_ms += delay_ms;
+                    stats.send_delay_max_ms = std::max(stats.send_delay_max_ms, delay_ms);
+                    ++stats.sent;
+                }
+                conn->send(r);
+            }
+        }
+    }
+
+    bool idle() const {
+        if (!backlog.empty()) {
+            return false;
+        }
+        for (const auto &conn : connections) {
+            if (!conn->inflight.empty() || !conn->streams.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void run() {
+        for (auto &conn : connections) {
+            conn->connect();
+        }
+        // Spread fixed schedules of the threads evenly.
+        int64_t next_arrival = start + (config.poisson ? 0 : int64_t(1e9 / rate * id / config.threads) - int64_t(1e9 / rate));
+        uint32_t query = 0;
+        advance(next_arrival, query);
+        int64_t drain_end = end + int64_t(config.drain_s * 1e9);
+        epoll_event events[64];
+        while (true) {
+            int64_t now = now_ns();
+            while (next_arrival <= now && next_arrival < end) {
+                backlog.push_back({query, next_arrival, 0});
+                advance(next_arrival, query);
+            }
+            dispatch();
+            if (now >= end && idle()) {
+                break;
+            }
+            if (now >= drain_end) {
+                // Unanswered requests count as timed out, with their latency so far.
+                for (const auto &r : backlog) {
+                    if (counted(r)) {
+                        ++stats.timed_out;
+                        stats.latencies_ms.push_back((now - r.intended) / 1e6);
+                    }
+                }
+                for (auto &conn : connections) {
+                    conn->check_timeouts(now);
+                }
+                break;
+            }
+            int64_t wake = (next_arrival < end) ? next_arrival : drain_end;
+            for (const auto &conn : connections) {
+                if (conn->state == Connection::State::CLOSED && !backlog.empty()) {
+                    wake = std::min(wake, conn->retry_at);
+                }
+            }
+            int timeout_ms = int(std::max<int64_t>(0, (wake - now + 999999) / 1000000));
+            int n = epoll_wait(epoll_fd, events, 64, timeout_ms);
+            for (int i = 0; i < n; ++i) {
+                static_cast<Connection *>(events[i].data.ptr)->on_event(events[i].events);
+            }
+        }
+        for (auto &conn : connections) {
+            conn->close(false);
+        }
+    }
+};
+
+size_t Connection::capacity() const {
+    if (state != State::READY) {
+        return 0;
+    }
+    if (!worker.config.http2) {
+        return inflight.empty() ? 1 : 0;
+    }
+    size_t max = std::min(worker.config.max_streams, server_max_streams);
+    return (goaway || streams.size() >= max) ? 0 : max - streams.size();
+}
+
+void Connection::connect() {
+    const addrinfo *addr = worker.address;
+    fd = socket(addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(fd, addr->ai_addr, addr->ai_addrlen) != 0 && errno != EINPROGRESS) {
+        ::close(fd);
+        fd = -1;
+        ++worker.stats.connection_errors;
+        retry_at = now_ns() + 100000000;
+        return;
+    }
+    state = State::CONNECTING;
+    want_write = true;
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = this;
+    epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void Connection::close(bool failed) {
+    if (fd < 0) {
+        return;
+    }
+    if (failed) {
+        ++worker.stats.connection_errors;
+    }
+    for (const auto &r : inflight) {
+        worker.fail(r);
+    }
+    for (const auto &[id, r] : streams) {
+        worker.fail(r);
+    }
+    inflight.clear();
+    streams.clear();
+    stream_status.clear();
+    epoll_ctl(worker.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    if (ssl != nullptr) {
+        SSL_free(ssl);
+        ssl = nullptr;
+    }
+    ::close(fd);
+    fd = -1;
+    state = State::CLOSED;
+    retry_at = failed ? now_ns() + 100000000 : now_ns();
+    out.clear();
+    out_pos = 0;
+    in.clear();
+    in_pos = 0;
+    http1 = Http1::HEADER;
+    next_stream = 1;
+    server_max_streams = SIZE_MAX;
+    goaway = false;
+    unacked_data = 0;
+    header_block.clear();
+}
+
+void Connection::check_timeouts(int64_t now) {
+    for (const auto &r : inflight) {
+        if (worker.counted(r)) {
+            ++worker.stats.timed_out;
+            worker.stats.latencies_ms.push_back((now - r.intended) / 1e6);
+        }
+    }
+    for (const auto &[id, r] : streams) {
+        if (worker.counted(r)) {
+            ++worker.stats.timed_out;
+            worker.stats.latencies_ms.push_back((now - r.intended) / 1e6);
+        }
+    }
+    inflight.clear();
+    streams.clear();
+}
+
+void Connection::update_epoll() {
+    bool need = (state == State::CONNECTING) || (out_pos < out.size()) || want_write;
+    epoll_event ev{};
+    ev.events = EPOLLIN | (need ? uint32_t(EPOLLOUT) : 0u);
+    ev.data.ptr = this;
+    epoll_ctl(worker.epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+bool Connection::handshake() {
+    int r = SSL_connect(ssl);
+    if (r == 1) {
+        const unsigned char *proto = nullptr;
+        unsigned int len = 0;
+        SSL_get0_alpn_selected(ssl, &proto, &len);
+        if (worker.config.http2 && !(len == 2 && memcmp(proto, "h2", 2) == 0)) {
+            fprintf(stderr, "Server did not negotiate HTTP/2\n");
+            exit(1);
+        }
+        want_write = false;
+        on_ready();
+        return true;
+    }
+    int err = SSL_get_error(ssl, r);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        want_write = (err == SSL_ERROR_WANT_WRITE);
+        update_epoll();
+        return true;
+    }
+    ERR_clear_error();
+    return false;
+}
+
+void Connection::on_ready() {
+    state = State::READY;
+    if (worker.config.http2) {
+        // Preface, then SETTINGS: HEADER_TABLE_SIZE 0, ENABLE_PUSH 0, INITIAL_WINDOW_SIZE 2^30,
+        // and a connection window of 2^30.
+        out += "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        std::string settings;
+        auto setting = [&settings](uint16_t id, uint32_t value) {
+            char b[6] = {char(id >> 8), char(id), char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+            settings.append(b, 6);
+        };
+        setting(1, 0);
+        setting(2, 0);
+        setting(4, 1u << 30);
+        frame(0x4, 0, 0, settings);
+        uint32_t increment = (1u << 30) - 65535;
+        frame(0x8, 0, 0, std::string({char(increment >> 24), char(increment >> 16), char(increment >> 8), char(increment)}));
+    }
+    flush();
+}
+
+ssize_t Connection::io_read(char *buf, size_t len) {
+    if (ssl == nullptr) {
+        ssize_t n = ::read(fd, buf, len);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return -2;
+        }
+        return n;
+    }
+    int n = SSL_read(ssl, buf, int(len));
+    if (n > 0) {
+        return n;
+    }
+    int err = SSL_get_error(ssl, n);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        return -2;
+    }
+    ERR_clear_error();
+    return (err == SSL_ERROR_ZERO_RETURN) ? 0 : -1;
+}
+
+bool Connection::flush() {
+    while (out_pos < out.size()) {
+        ssize_t n;
+        if (ssl == nullptr) {
+            n = ::write(fd, out.data() + out_pos, out.size() - out_pos);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+        } else {
+            n = SSL_write(ssl, out.data() + out_pos, int(out.size() - out_pos));
+            if (n <= 0) {
+                int err = SSL_get_error(ssl, int(n));
+                if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                    break;
+                }
+                ERR_clear_error();
+            }
+        }
+        if (n <= 0) {
+            close(true);
+            return false;
+        }
+        out_pos += n;
+    }
+    if (out_pos == out.size()) {
+        out.clear();
+        out_pos = 0;
+    }
+    update_epoll();
+    return true;
+}
+
+bool Connection::read_all() {
+    char buf[65536];
+    while (true) {
+        ssize_t n = io_read(buf, sizeof(buf));
+        if (n == -2) {
+            return true;
+        }
+        if (n <= 0) {
+            if (http1 == Http1::BODY_UNTIL_CLOSE && !inflight.empty()) {
+                complete(inflight.front(), http1_status);
+                inflight.pop_front();
+            }
+            bool failed = !inflight.empty() || !streams.empty();
+            close(failed);
+            return false;
+        }
+        in.append(buf, n);
+        if (!(worker.config.http2 ? parse_http2() : parse_http1())) {
+            return false;
+        }
+    }
+}
+
+void Connection::on_event(uint32_t events) {
+    if (state == State::CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            close(true);
+            return;
+        }
+        if (worker.config.tls) {
+            state = State::HANDSHAKE;
+            ssl = SSL_new(worker.ssl_ctx);
+            SSL_set_fd(ssl, fd);
+            SSL_set_tlsext_host_name(ssl, worker.config.host.c_str());
+        } else {
+            want_write = false;
+            on_ready();
+            return;
+        }
+    }
+    if (state == State::HANDSHAKE) {
+        if (!handshake()) {
+            close(true);
+        }
+        return;
+    }
+    if (state != State::READY) {
+        return;
+    }
+    if ((events & EPOLLOUT) && !flush()) {
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        read_all();
+    }
+}
+
+void Connection::send(const Request &request) {
+    const Query &q = worker.queries[request.query];
+    const Config &config = worker.config;
+    if (!config.http2) {
+        out += config.post ? "POST " : "GET ";
+        out += q.url;
+        out += " HTTP/1.1\r\nHost: " + config.host + ":" + std::to_string(config.port) + "\r\nUser-Agent: open_loop_bench\r\n";
+        for (const auto &h : config.headers) {
+            out += h + "\r\n";
+        }
+        if (config.post) {
+            out += "Content-Type: application/json\r\nContent-Length: " + std::to_string(q.body.size()) + "\r\n\r\n" + q.body;
+        } else {
+            out += "\r\n";
+        }
+        inflight.push_back(request);
+        flush();
+        return;
+    }
+    // HPACK literals without indexing; names are static table indexes or literal lowercase names.
+    std::string block;
+    auto integer = [&block](uint8_t first, int prefix_bits, uint64_t v) {
+        uint64_t max = (1u << prefix_bits) - 1;
+        if (v < max) {
+            block += char(first | v);
+            return;
+        }
+        block += char(first | max);
+        for (v -= max; v >= 128; v >>= 7) {
+            block += char((v & 0x7f) | 0x80);
+        }
+        block += char(v);
+    };
+    auto string = [&](const std::string &s) {
+        integer(0x00, 7, s.size());
+        block += s;
+    };
+    auto literal = [&](uint64_t name_index, const std::string &value) {
+        integer(0x00, 4, name_index);
+        string(value);
+    };
+    block += char(config.post ? 0x83 : 0x82);   // :method POST / GET
+    block += char(config.tls ? 0x87 : 0x86);    // :scheme https / http
+    literal(1, config.host + ":" + std::to_string(config.port)); // :authority
+    literal(4, q.url);                          // :path
+    literal(58, "open_loop_bench");             // user-agent
+    for (const auto &h : config.headers) {
+        size_t colon = h.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = h.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        size_t value = h.find_first_not_of(' ', colon + 1);
+        block += char(0x00);
+        string(name);
+        string(value == std::string::npos ? "" : h.substr(value));
+    }
+    if (config.post) {
+        literal(31, "application/json");       // content-type
+    }
+    uint32_t stream = next_stream;
+    next_stream += 2;
+    frame(0x1, 0x4 | (config.post ? 0 : 0x1), stream, block); // HEADERS, END_HEADERS (and END_STREAM)
+    if (config.post) {
+        size_t pos = 0;
+        do {
+            size_t len = std::min<size_t>(16384, q.body.size() - pos);
+            pos += len;
+            frame(0x0, pos == q.body.size() ? 0x1 : 0, stream, q.body.substr(pos - len, len));
+        } while (pos < q.body.size());
+    }
+    streams.emplace(stream, request);
+    flush();
+}
+
+void Connection::frame(uint8_t type, uint8_t flags, uint32_t stream, const std::string &payload) {
+    uint32_t len = payload.size();
+    char header[9] = {char(len >> 16), char(len >> 8), char(len), char(type), char(flags),
+                      char((stream >> 24) & 0x7f), char(stream >> 16), char(stream >> 8), char(stream)};
+    out.append(header, 9);
+    out += payload;
+}
+
+void Connection::complete(const Request &request, int status) {
+    worker.complete(request, status);
+}
+
+bool Connection::parse_http1() {
+    while (true) {
+        const char *data = in.data() + in_pos;
+        size_t avail = in.size() - in_pos;
+        if (http1 == Http1::HEADER) {
+            size_t end = in.find("\r\n\r\n", in_pos);
+            if (end == std::string::npos) {
+                break;
+            }
+            std::string header(data, end - in_pos);
+            in_pos = end + 4;
+            http1_status = (header.size() > 12) ? atoi(header.c_str() + 9) : 0;
+            std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+            http1_close = header.find("\r\nconnection: close") != std::string::npos;
+            size_t cl = header.find("\r\ncontent-length:");
+            if (header.find("\r\ntransfer-encoding: chunked") != std::string::npos) {
+                http1 = Http1::CHUNK_SIZE;
+            } else if (cl != std::string::npos) {
+                remaining = strtoull(header.c_str() + cl + 17, nullptr, 10);
+                http1 = Http1::BODY;
+            } else if (http1_status == 204 || http1_status == 304 || (http1_status >= 100 && http1_status < 200)) {
+                remaining = 0;
+                http1 = Http1::BODY;
+            } else {
+                http1 = Http1::BODY_UNTIL_CLOSE;
+            }
+        } else if (http1 == Http1::BODY || http1 == Http1::CHUNK_DATA) {
+            size_t n = std::min<uint64_t>(remaining, avail);
+            in_pos += n;
+            remaining -= n;
+            if (remaining > 0) {
+                break;
+            }
+            http1 = (http1 == Http1::BODY) ? Http1::HEADER : Http1::CHUNK_END;
+            if (http1 == Http1::HEADER && !inflight.empty()) {
+                complete(inflight.front(), http1_status);
+                inflight.pop_front();
+                if (http1_close) {
+                    close(false);
+                    return false;
+                }
+            }
+        } else if (http1 == Http1::BODY_UNTIL_CLOSE) {
+            in_pos += avail;
+            break;
+        } else if (http1 == Http1::CHUNK_SIZE || http1 == Http1::CHUNK_END || http1 == Http1::TRAILER) {
+            size_t eol = in.find("\r\n", in_pos);
+            if (eol == std::string::npos) {
+                break;
+            }
+            size_t line_len = eol - in_pos;
+            std::string line(data, line_len);
+            in_pos = eol + 2;
+            if (http1 == Http1::CHUNK_SIZE) {
+                remaining = strtoull(line.c_str(), nullptr, 16);
+                http1 = (remaining == 0) ? Http1::TRAILER : Http1::CHUNK_DATA;
+            } else if (http1 == Http1::CHUNK_END) {
+                http1 = Http1::CHUNK_SIZE;
+            } else if (line_len == 0) {
+                http1 = Http1::HEADER;
+                if (!inflight.empty()) {
+                    complete(inflight.front(), http1_status);
+                    inflight.pop_front();
+                }
+                if (http1_close) {
+                    close(false);
+                    return false;
+                }
+            }
+        }
+    }
+    if (in_pos == in.size()) {
+        in.clear();
+        in_pos = 0;
+    } else if (in_pos > 65536) {
+        in.erase(0, in_pos);
+        in_pos = 0;
+    }
+    return true;
+}
+
+bool Connection::on_headers(uint32_t stream, const std::string &block, bool end_stream) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(block.data());
+    const uint8_t *end = p + block.size();
+    auto integer = [&p, end](int prefix_bits) -> uint64_t {
+        uint64_t max = (1u << prefix_bits) - 1;
+        uint64_t v = *p++ & max;
+        if (v < max) {
+            return v;
+        }
+        for (int shift = 0; p < end; shift += 7) {
+            uint8_t b = *p++;
+            v += uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                break;
+            }
+        }
+        return v;
+    };
+    int status = 0;
+    while (p < end) {
+        uint8_t b = *p;
+        if (b & 0x80) {
+            int s = hpack_static_status(integer(7));
+            status = (s != 0) ? s : status;
+        } else if ((b & 0xe0) == 0x20) {
+            integer(5); // dynamic table size update
+        } else {
+            uint64_t name_index = integer((b & 0x40) ? 6 : 4);
+            if (name_index == 0 && p < end) {
+                uint64_t len = integer(7); // literal name, never :status as servers use the static index
+                p += std::min<uint64_t>(len, end - p);
+            }
+            if (p >= end) {
+                break;
+            }
+            bool huffman = (*p & 0x80) != 0;
+            uint64_t len = std::min<uint64_t>(integer(7), end - p);
+            if (name_index >= 8 && name_index <= 14) {
+                status = huffman ? huffman_digits(p, len) : atoi(std::string(reinterpret_cast<const char *>(p), len).c_str());
+            }
+            p += len;
+        }
+    }
+    if (status >= 100 && status < 200) {
+        return true; // informational, the final response follows
+    }
+    stream_status[stream] = status;
+    if (end_stream) {
+        auto it = streams.find(stream);
+        if (it != streams.end()) {
+            complete(it->second, status);
+            streams.erase(it);
+        }
+        stream_status.erase(stream);
+    }
+    return true;
+}
+
+bool Connection::parse_http2() {
+    while (in.size() - in_pos >= 9) {
+        const uint8_t *h = reinterpret_cast<const uint8_t *>(in.data() + in_pos);
+        uint32_t len = (uint32_t(h[0]) << 16) | (uint32_t(h[1]) << 8) | h[2];
+        if (in.size() - in_pos < 9 + len) {
+            break;
+        }
+        uint8_t type = h[3];
+        uint8_t flags = h[4];
+        uint32_t stream = ((uint32_t(h[5]) & 0x7f) << 24) | (uint32_t(h[6]) << 16) | (uint32_t(h[7]) << 8) | h[8];
+        std::string payload(in.data() + in_pos + 9, len);
+        in_pos += 9 + len;
+        // Strip padding (and priority) from DATA and HEADERS.
+        size_t skip = 0;
+        size_t pad = 0;
+        if ((type == 0x0 || type == 0x1) && (flags & 0x8) && !payload.empty()) {
+            pad = uint8_t(payload[0]);
+            skip = 1;
+        }
+        if (type == 0x1 && (flags & 0x20)) {
+            skip += 5;
+        }
+        std::string body = (skip + pad <= payload.size()) ? payload.substr(skip, payload.size() - skip - pad) : "";
+        switch (type) {
+        case 0x0: // DATA
+            unacked_data += len;
+            if (flags & 0x1) {
+                auto it = streams.find(stream);
+                if (it != streams.end()) {
+                    auto status = stream_status.find(stream);
+                    complete(it->second, status != stream_status.end() ? status->second : 0);
+                    streams.erase(it);
+                }
+                stream_status.erase(stream);
+            }
+            break;
+        case 0x1: // HEADERS
+        case 0x9: // CONTINUATION
+            if (type == 0x1) {
+                header_block = body;
+                header_stream = stream;
+                header_end_stream = (flags & 0x1) != 0;
+            } else {
+                header_block += payload;
+            }
+            if (flags & 0x4) {
+                on_headers(header_stream, header_block, header_end_stream);
+                header_block.clear();
+            }
+            break;
+        case 0x3: { // RST_STREAM
+            auto it = streams.find(stream);
+            if (it != streams.end()) {
+                worker.fail(it->second);
+                streams.erase(it);
+            }
+            stream_status.erase(stream);
+            break;
+        }
+        case 0x4: // SETTINGS
+            if (!(flags & 0x1)) {
+                for (size_t i = 0; i + 6 <= payload.size(); i += 6) {
+                    const uint8_t *s = reinterpret_cast<const uint8_t *>(payload.data() + i);
+                    uint16_t id = (uint16_t(s[0]) << 8) | s[1];
+                    uint32_t value = (uint32_t(s[2]) << 24) | (uint32_t(s[3]) << 16) | (uint32_t(s[4]) << 8) | s[5];
+                    if (id == 3) {
+                        server_max_streams = value;
+                    }
+                }
+                frame(0x4, 0x1, 0, "");
+            }
+            break;
+        case 0x6: // PING
+            if (!(flags & 0x1)) {
+                frame(0x6, 0x1, 0, payload);
+            }
+            break;
+        case 0x7: { // GOAWAY: fail streams the server will not process
+            goaway = true;
+            uint32_t last = payload.size() >= 4 ? ((uint32_t(uint8_t(payload[0])) & 0x7f) << 24) | (uint32_t(uint8_t(payload[1])) << 16) |
+                                                   (uint32_t(uint8_t(payload[2])) << 8) | uint8_t(payload[3]) : 0;
+            for (auto it = streams.begin(); it != streams.end();) {
+                if (it->first > last) {
+                    worker.fail(it->second);
+                    it = streams.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    if (unacked_data >= (1u << 20)) {
+        uint32_t increment = unacked_data;
+        frame(0x8, 0, 0, std::string({char(increment >> 24), char(increment >> 16), char(increment >> 8), char(increment)}));
+        unacked_data = 0;
+    }
+    if (in_pos == in.size()) {
+        in.clear();
+        in_pos = 0;
+    } else if (in_pos > 65536) {
+        in.erase(0, in_pos);
+        in_pos = 0;
+    }
+    if (goaway && streams.empty()) {
+        close(false);
+        return false;
+    }
+    return out.empty() || flush();
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s (-r <qps> -q <query file> | -R <trace file>) [options] <host> <port>\n"
+                    "  -r: target request rate, requests per second over all threads\n"
+                    "  -p: arrival schedule, poisson (default) or fixed\n"
+                    "  -n: number of connections (default 16)\n"
+                    "  -t: number of threads (default 1)\n"
+                    "  -s: seconds to run, after warmup (default 60)\n"
+                    "  -w: seconds of warmup, not counted (default 0)\n"
+                    "  -x: seconds to wait for responses after the run, then count them as timed out (default 10)\n"
+                    "  -q: query file, one url path per line (url and body on alternate lines with -P)\n"
+                    "  -a: string appended to each url\n"
+                    "  -H: request header '<name>: <value>', may be repeated\n"
+                    "  -P: send POST requests with JSON bodies\n"
+                    "  -2: use HTTP/2 (prior knowledge, or ALPN with TLS)\n"
+                    "  -m: max concurrent streams per HTTP/2 connection (default 100)\n"
+                    "  -D: use TLS if configured: with -C certificate, -K private key and -T CA certificates,\n"
+                    "      or the files of VESPA_TLS_CONFIG_FILE when none are given; plain HTTP otherwise\n"
+                    "  -o: write '<intended send time s> <latency ms>' per successful request to this file\n"
+                    "  -R: replay a query trace (see lib/query_trace.cpp) instead of -r and -q; -s is the trace length\n", prog);
+}
+
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    int option;
+    while ((option = getopt(argc, argv, "r:p:n:t:s:w:x:q:a:H:P2m:DC:K:T:o:R:h")) != -1) {
+        switch (option) {
+        case 'r': config.rate = atof(optarg); break;
+        case 'p': config.poisson = (std::string(optarg) != "fixed"); break;
+        case 'n': config.connections = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+        case 't': config.threads = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+        case 's': config.runtime_s = atof(optarg); break;
+        case 'w': config.warmup_s = atof(optarg); break;
+        case 'x': config.drain_s = atof(optarg); break;
+        case 'q': config.query_file = optarg; break;
+        case 'a': config.append = optarg; break;
+        case 'H': config.headers.emplace_back(optarg); break;
+        case 'P': config.post = true; break;
+        case '2': config.http2 = true; break;
+        case 'm': config.max_streams = std::max(1ul, strtoul(optarg, nullptr, 0)); break;
+        case 'D': config.tls = true; break;
+        case 'C': config.cert_file = optarg; break;
+        case 'K': config.key_file = optarg; break;
+        case 'T': config.ca_file = optarg; break;
+        case 'o': config.latency_log = optarg; break;
+        case 'R': config.trace_file = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 2 != argc || (config.trace_file.empty() && (config.rate <= 0.0 || config.query_file.empty()))) {
+        usage(argv[0]);
+        return 1;
+    }
+    // As for vespa-fbench, -D only means TLS when certificates are given or configured in the environment.
+    if (config.tls && config.cert_file.empty() && config.key_file.empty() && config.ca_file.empty() &&
+        getenv("VESPA_TLS_CONFIG_FILE") == nullptr)
+    {
+        config.tls = false;
+    }
+    config.host = argv[optind];
+    config.port = atoi(argv[optind + 1]);
+    config.threads = std::min(config.threads, config.connections);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Query> queries = config.trace_file.empty() ? load_queries(config) : load_trace(config);
+    if (!config.trace_ns.empty()) {
+        double length_s = config.trace_ns.back() / 1e9;
+        config.runtime_s = std::max(0.0, length_s - config.warmup_s) + 1e-6;
+        config.rate = length_s > 0 ? config.trace_ns.size() / length_s : 0.0;
+    }
+    addrinfo hints{};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *address = nullptr;
+    if (getaddrinfo(config.host.c_str(), argv[optind + 1], &hints, &address) != 0 || address == nullptr) {
+        fprintf(stderr, "Could not resolve %s\n", config.host.c_str());
+        return 1;
+    }
+    SSL_CTX *ssl_ctx = config.tls ? make_ssl_context(config) : nullptr;
+
+    int64_t start = now_ns() + 100000000;
+    timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    double epoch_offset = wall.tv_sec + wall.tv_nsec / 1e9 - now_ns() / 1e9;
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t t = 0; t < config.threads; ++t) {
+        size_t conns = config.connections * (t + 1) / config.threads - config.connections * t / config.threads;
+        workers.push_back(std::make_unique<Worker>(config, queries, ssl_ctx, address, t, conns, start, epoch_offset));
+    }
+    std::vector<std::thread> threads;
+    for (auto &w : workers) {
+        threads.emplace_back([&w] { w->run(); });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    Stats total;
+    for (const auto &w : workers) {
+        const Stats &s = w->stats;
+        total.latencies_ms.insert(total.latencies_ms.end(), s.latencies_ms.begin(), s.latencies_ms.end());
+        total.log.insert(total.log.end(), s.log.begin(), s.log.end());
+        for (const auto &[status, count] : s.status) {
+            total.status[status] += count;
+        }
+        total.failed += s.failed;
+        total.timed_out += s.timed_out;
+        total.connection_errors += s.connection_errors;
+        total.send_delay_sum_ms += s.send_delay_sum_ms;
+        total.send_delay_max_ms = std::max(total.send_delay_max_ms, s.send_delay_max_ms);
+        total.sent += s.sent;
+    }
+    if (!config.latency_log.empty()) {
+        std::sort(total.log.begin(), total.log.end());
+        FILE *log = fopen(config.latency_log.c_str(), "w");
+        for (const auto &[time, latency] : total.log) {
+            fprintf(log, "%.6f\t%.3f\n", time, latency);
+        }
+        fclose(log);
+    }
+    std::vector<double> &lat = total.latencies_ms;
+    std::sort(lat.begin(), lat.end());
+    uint64_t successful = lat.size() - total.timed_out;
+    double sum = 0.0;
+    for (double l : lat) {
+        sum += l;
+    }
+    printf("***************** Open Loop Benchmark Summary *****************\n");
+    printf("connections:                 %zu\n", config.connections);
+    printf("threads:                     %zu\n", config.threads);
+    printf("protocol:                    %s\n", config.http2 ? "HTTP/2" : "HTTP/1.1");
+    printf("arrival schedule:            %s\n", !config.trace_ns.empty() ? "trace" : config.poisson ? "poisson" : "fixed");
+    printf("target query rate:           %.2f Q/s\n", config.rate);
+    printf("ran for:                     %.0f seconds\n", config.runtime_s);
+    printf("successful requests:         %lu\n", successful);
+    printf("failed requests:             %lu\n", total.failed);
+    printf("timed out requests:          %lu\n", total.timed_out);
+    printf("connection errors:           %lu\n", total.connection_errors);
+    printf("minimum response time:       %.2f ms\n", lat.empty() ? 0.0 : lat.front());
+    printf("maximum response time:       %.2f ms\n", lat.empty() ? 0.0 : lat.back());
+    printf("average response time:       %.2f ms\n", lat.empty() ? 0.0 : sum / lat.size());
+    for (double p : {25.0, 50.0, 75.0, 90.0, 95.0, 99.0, 99.9, 99.99}) {
+        char label[32];
+        snprintf(label, sizeof(label), "%g percentile:", p);
+        printf("%-29s%.2f ms\n", label, percentile(lat, p));
+    }
+    printf("actual query rate:           %.2f Q/s\n", successful / config.runtime_s);
+    printf("average send delay:          %.2f ms\n", total.sent > 0 ? total.send_delay_sum_ms / total.sent : 0.0);
+    printf("maximum send delay:          %.2f ms\n", total.send_delay_max_ms);
+    printf("http request status breakdown:\n");
+    for (const auto &[status, count] : total.status) {
+        printf("%10d : %8lu\n", status, count);
+    }
+    freeaddrinfo(address);
+    if (ssl_ctx != nullptr) {
+        SSL_CTX_free(ssl_ctx);
+    }
+    return 0;
+}
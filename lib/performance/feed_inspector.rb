@@ -0,0 +1,55 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+require 'json'
+
+module Perf
+
+  # Statistics of a feed file on a node (lib/feed_inspector.cpp): operation mix, document sizes, and per field
+  # types, sizes, cardinality and tensor forms and cells, so a feed benchmark can record what it fed next to how fast.
+  class FeedInspector
+    attr_reader :stats
+
+    def initialize(node)
+      @node = node
+      @hostname = node.hostname
+      @stats = {}
+    end
+
+    def binary
+      @binary ||= DataGenerator.compile_tool(@node, 'feed_inspector.cpp', flags: '-std=c++17 -O3 -pthread')
+    end
+
+    # Inspects a JSON array or JSONL feed, and returns the statistics as a hash (see lib/feed_inspector.cpp),
+    # e.g. stats['operations'], stats['ops']['put']['bytes']['p99'] or stats['fields']['embedding']['tensor'].
+    def inspect_feed(file, threads: nil)
+      @json_file = @node.execute('mktemp /tmp/feed_inspector.XXXXXX.json').strip
+      args = ["-o #{@json_file}"]
+      args << "-t #{threads}" if threads
+      @node.execute("#{binary} #{args.join(' ')} #{file}")
+      @stats = JSON.parse(@node.execute("cat #{@json_file}", :noecho => true))
+    end
+
+    # Copies the statistics as JSON to a local directory, e.g. the result output directory of the test.
+    def attach(directory)
+      @node.copy_remote_file_into_local_directory(@json_file, directory) if @json_file
+    end
+
+    # Filler with the operation counts and sizes, as 'feed.<name>' metrics, after 'inspect_feed'.
+    def fill
+      Proc.new do |result|
+        ['operations', 'bytes', 'distinct_ids', 'conditions', 'creates', 'errors'].each do |name|
+          result.add_metric("feed.#{name}", @stats[name], @hostname) if @stats[name]
+        end
+        (@stats['ops'] || {}).each do |op, values|
+          result.add_metric("feed.#{op}s", values['count'], @hostname)
+          ['mean', 'p50', 'p99', 'max'].each do |stat|
+            result.add_metric("feed.#{op}.bytes.#{stat}", values['bytes'][stat], @hostname)
+          end
+        end
+      end
+    end
+
+  end
+
+end
@@ -0,0 +1,41 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+
+module Perf
+
+  # Transcodes feed files on a node (lib/feed_transcoder.cpp) to compact JSONL or JSON arrays, with dense
+  # tensor values as hex and split into shards, so large generated feeds are cheaper to parse and feed
+  # without regenerating them.
+  class FeedTranscoder
+
+    def initialize(node)
+      @node = node
+    end
+
+    def binary
+      @binary ||= DataGenerator.compile_tool(@node, 'feed_transcoder.cpp', flags: '-std=c++17 -O3 -pthread')
+    end
+
+    # Writes 'input' to 'output', or to 'output'.0 ... 'output'.<shards - 1>, and returns the summary,
+    # e.g. { 'operations' => 1000, 'bytes out' => 123456, 'hex tensors' => 1000 }. 'hex' maps tensor fields
+    # to cell types, e.g. { 'embedding' => 'float', 'embedding_rq' => 'int8' }.
+    def transcode(input:, output:, format: 'jsonl', shards: 1, hex: {}, threads: nil)
+      args = ["-f #{format}", "-o #{output}", "-n #{shards}"]
+      args += hex.map { |field, cell_type| "-x #{field}:#{cell_type}" }
+      args << "-t #{threads}" if threads
+      summary = {}
+      @node.execute("#{binary} #{args.join(' ')} #{input} 2>&1").each_line do |line|
+        summary[$1] = $2.to_f if line =~ /^([a-z ]+):\s+([0-9.]+)/
+      end
+      summary
+    end
+
+    # Names of the files written by 'transcode'.
+    def self.files(output, shards)
+      shards > 1 ? (0...shards).map { |shard| "#{output}.#{shard}" } : [output]
+    end
+
+  end
+
+end
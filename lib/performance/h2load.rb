@@ -12,7 +12,7 @@ module Perf
 
     def run_benchmark(clients:, concurrent_streams:, warmup:, duration:,
                       uri_scheme: "https", uri_port: @node.http_port, uri_path: nil, input_file: nil,
-                      post_data_file: nil, protocols: ["h2", "http/1.1"], headers: {}, threads: nil)
+                      post_data_file: nil, protocols: ["h2", "http/1.1"], headers: {}, threads: nil, log_file: nil)
       if (uri_path == nil && input_file == nil) || (uri_path != nil && input_file != nil)
         raise "Either 'uripath' or 'input_file' must be specified"
       end
@@ -24,6 +24,8 @@ module Perf
 
       cmd += "--threads=#{threads} " if threads != nil
       cmd += "--data=#{post_data_file} " if post_data_file != nil
+      # Per-request records, for percentiles beyond min/max/mean (see Perf::LatencyHistogram)
+      cmd += "--log-file=#{log_file} " if log_file != nil
 
       if input_file != nil
         cmd += "--input-file=#{input_file} "
@@ -67,7 +69,7 @@ module Perf
           result.add_parameter('concurrentstreams', concurrent_streams)
           result.add_parameter('loadgiver', 'h2load')
         end
-      Result.new(qps, filler)
+      Result.new(qps, filler, log_file)
     end
 
     def get_line_items(lines, line_prefix, item_delimiter)
@@ -91,11 +93,12 @@ module Perf
     end
 
     class Result
-      attr_reader :filler, :qps
+      attr_reader :filler, :qps, :log_file
 
-      def initialize(qps, filler)
+      def initialize(qps, filler, log_file = nil)
         @qps = qps
         @filler = filler
+        @log_file = log_file
       end
     end
   end
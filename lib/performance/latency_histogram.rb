@@ -0,0 +1,83 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+
+module Perf
+
+  # HDR latency histograms from per-request records, computed by lib/latency_histogram.cpp on a node.
+  # Use this for high percentiles (p99.9, p99.99) and to combine several load giver processes or hosts,
+  # whose percentiles cannot be averaged: write a histogram file per process with 'record', combine them
+  # with 'merge', and report the merged percentiles with 'fill'.
+  class LatencyHistogram
+
+    PERCENTILES = [50, 90, 95, 99, 99.9, 99.99]
+
+    def initialize(node)
+      @node = node
+    end
+
+    def binary
+      @binary ||= DataGenerator.compile_tool(@node, 'latency_histogram.cpp')
+    end
+
+    # Records latency logs ('raw' or 'h2load' format, see lib/latency_histogram.cpp) into a histogram file
+    # 'output' (if given), and returns the parsed report. 'interval' (seconds) adds a time series.
+    def record(inputs:, output: nil, format: 'raw', unit: 'ms', digits: 3, interval: nil, percentiles: PERCENTILES)
+      run(Array(inputs), output, ["-f #{format}", "-u #{unit}", "-d #{digits}"], interval, percentiles)
+    end
+
+    # Merges histogram files written by 'record' (e.g. one per load giver, copied to this node),
+    # and returns the parsed report of the merged histogram.
+    def merge(inputs:, output: nil, interval: nil, percentiles: PERCENTILES)
+      run(Array(inputs), output, ['-f hdr'], interval, percentiles)
+    end
+
+    # Copies a histogram file to a local directory, e.g. the result output directory of the test.
+    def attach(histogram_file, directory)
+      @node.copy_remote_file_into_local_directory(histogram_file, directory)
+      File.join(directory, File.basename(histogram_file))
+    end
+
+    def run(inputs, output, args, interval, percentiles)
+      args << "-o #{output}" if output
+      args << "-i #{interval}" if interval
+      args << "-p #{percentiles.join(',')}"
+      LatencyHistogram.parse(@node.execute("#{binary} #{args.join(' ')} #{inputs.join(' ')}"))
+    end
+
+    # Parses a report into { 'count' => n, ..., '99.9 percentile' => ms, 'series' => [per interval hash] }.
+    def self.parse(text)
+      result = { 'series' => [] }
+      columns = nil
+      text.each_line do |line|
+        line = line.chomp
+        if line.start_with?('#')
+          next
+        elsif line.start_with?('time_s')
+          columns = line.split("\t")
+        elsif columns
+          result['series'] << Hash[columns.zip(line.split("\t").map(&:to_f))]
+        elsif line =~ /^(.*) (\S+)$/
+          result[$1] = $2.to_f
+        end
+      end
+      result
+    end
+
+    # Filler with the summary of a parsed report, using the metric names of the fbench filler.
+    def self.fill(report)
+      Proc.new do |result|
+        result.add_metric('successfulrequests', report['count'].to_i.to_s)
+        result.add_metric('failedrequests', report['errors'].to_i.to_s)
+        result.add_metric('minresponsetime', report['min_ms'].to_s)
+        result.add_metric('maxresponsetime', report['max_ms'].to_s)
+        result.add_metric('avgresponsetime', report['mean_ms'].to_s)
+        report.each do |name, value|
+          result.add_metric(name, value.to_s) if name.end_with?(' percentile')
+        end
+      end
+    end
+
+  end
+
+end
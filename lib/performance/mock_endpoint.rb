@@ -0,0 +1,88 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+
+module Perf
+
+  # Local stand-in for the /document/v1 and /search APIs (lib/mock_endpoint.cpp), for benchmarking feed clients,
+  # load givers and generators without a deployed Vespa, e.g. to find the maximum rate of vespa-feed-client or
+  # fbench on a node, or to check that the load side is not the bottleneck of a benchmark. Point the client at
+  # 'hostname' and 'port', e.g. run_fbench2(node, queries, :hostname_override => mock.hostname, :port_override => mock.port).
+  class MockEndpoint
+    attr_reader :hostname, :port, :summary
+
+    # Latencies are distributions as for lib/mock_endpoint.cpp, e.g. 'lognormal:2:0.5,fixed:200@0.001', and
+    # 'error_rate' is the fraction of feed and search requests that fail with 'error_status'.
+    def initialize(node, port: 19093, threads: nil, validate: false, latency: nil, feed_latency: nil,
+                   search_latency: nil, error_rate: 0, error_status: 503, hits: 10, tls: false)
+      @node = node
+      @hostname = node.hostname
+      @port = port
+      @threads = threads
+      @validate = validate
+      @latency = latency
+      @feed_latency = feed_latency
+      @search_latency = search_latency
+      @error_rate = error_rate
+      @error_status = error_status
+      @hits = hits
+      @tls = tls
+      @pid = nil
+      @summary = {}
+    end
+
+    def binary
+      @binary ||= DataGenerator.compile_tool(@node, 'mock_endpoint.cpp', flags: '-std=c++17 -O3 -pthread', libs: '-lssl -lcrypto')
+    end
+
+    # Starts the endpoint in the background, and waits until it listens.
+    def start
+      stop
+      dir = @node.execute('mktemp -d /tmp/mock_endpoint.XXXXXX').strip
+      @output_file = "#{dir}/summary"
+      args = ["-p #{@port}", "-n #{@hits}", "-e #{@error_rate}", "-E #{@error_status}"]
+      args << "-t #{@threads}" if @threads
+      args << '-j' if @validate
+      args << "-l '#{@latency}'" if @latency
+      args << "-f '#{@feed_latency}'" if @feed_latency
+      args << "-s '#{@search_latency}'" if @search_latency
+      args << '-D' if @tls
+      @pid = @node.execute_bg("exec #{binary} #{args.join(' ')} > #{@output_file} 2> #{dir}/log")
+      @node.execute("for i in $(seq 100); do grep -q '^listening' #{@output_file} && exit 0; sleep 0.1; done; cat #{dir}/log; exit 1")
+    end
+
+    # Stops the endpoint and returns its summary, { 'requests' => n, 'puts' => n, ..., 'request rate' => x }.
+    def stop
+      return @summary unless @pid
+      @node.kill_pid(@pid, 'INT')
+      @pid = nil
+      @summary = MockEndpoint.parse(@node.execute("cat #{@output_file}", :noecho => true))
+    end
+
+    def running?
+      @pid != nil
+    end
+
+    def self.parse(text)
+      summary = {}
+      text.each_line do |line|
+        if line =~ /^([a-z0-9 ]+):\s+([0-9.]+)/
+          summary[$~[1]] = $~[2].to_f
+        end
+      end
+      summary
+    end
+
+    # Filler with what the endpoint served, as 'mock.<name>' metrics, after 'stop'.
+    def fill
+      Proc.new do |result|
+        ['requests', 'puts', 'updates', 'removes', 'queries', 'invalid requests', 'injected errors',
+         'request rate'].each do |name|
+          result.add_metric("mock.#{name.tr(' ', '_')}", @summary[name], @hostname) if @summary[name]
+        end
+      end
+    end
+
+  end
+
+end
@@ -0,0 +1,79 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+require 'fileutils'
+
+module Perf
+
+  # CPU profiler for native processes (lib/native_profiler.cpp), e.g. proton while a benchmark runs, writing
+  # collapsed stacks, a flame graph (SVG) and a summary of the hottest functions. Needs no perf binary on the node.
+  class NativeProfiler
+    attr_reader :node, :pid, :collapsed_file, :flamegraph_file
+
+    # 'unwind' is 'fp' (frame pointers) or 'dwarf' (unwind tables, for code built without frame pointers).
+    def initialize(node, pid, unwind: 'fp', frequency: 999, kernel: false)
+      @node = node
+      @pid = pid
+      @unwind = unwind
+      @frequency = frequency
+      @kernel = kernel
+      @profiler_pid = nil
+    end
+
+    def binary
+      @binary ||= DataGenerator.compile_tool(@node, 'native_profiler.cpp')
+    end
+
+    # Profiles for 'duration' seconds in the background, or until 'stop'. Files are named after 'name'.
+    def start(duration, name, title = name)
+      dir = @node.execute('mktemp -d /tmp/native_profiler.XXXXXX').strip
+      @collapsed_file = "#{dir}/#{name}.collapsed"
+      @flamegraph_file = "#{dir}/#{name}.svg"
+      @summary_file = "#{dir}/#{name}.txt"
+      args = ["-p #{@pid}", "-d #{duration}", "-F #{@frequency}", "-g #{@unwind}", '-T',
+              "-o #{@collapsed_file}", "-f #{@flamegraph_file}", "-t '#{title}'"]
+      args << '-k' if @kernel
+      @profiler_pid = @node.execute_bg("exec #{binary} #{args.join(' ')} > #{@summary_file} 2> #{dir}/log")
+    end
+
+    def stop
+      return unless @profiler_pid
+      @node.kill_pid(@profiler_pid, 'INT')
+      @profiler_pid = nil
+    end
+
+    # Waits for the profiler to finish, copies its files to a local directory, and returns the parsed summary.
+    def collect(directory)
+      if @profiler_pid
+        @node.waitpid(@profiler_pid)
+        @profiler_pid = nil
+      end
+      FileUtils.mkdir_p(directory)
+      [@collapsed_file, @flamegraph_file, @summary_file].each do |file|
+        @node.copy_remote_file_into_local_directory(file, directory) if @node.file?(file)
+      end
+      summary_file = File.join(directory, File.basename(@summary_file))
+      File.exist?(summary_file) ? NativeProfiler.parse(File.read(summary_file)) : {}
+    end
+
+    # Parses a summary into { 'samples' => n, ..., 'self' => [[percent, samples, function], ...], 'total' => [...] }.
+    def self.parse(text)
+      result = { 'self' => [], 'total' => [] }
+      section = nil
+      text.each_line do |line|
+        line = line.chomp
+        if line =~ /^# (self|total)$/
+          section = $1
+        elsif section
+          percent, samples, function = line.split("\t", 3)
+          result[section] << [percent.to_f, samples.to_i, function] if function
+        elsif line =~ /^([a-z ]+): ([0-9.]+)/
+          result[$1] = $2.to_f
+        end
+      end
+      result
+    end
+
+  end
+
+end
@@ -0,0 +1,116 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+
+module Perf
+
+  # Open loop load giver (lib/open_loop_bench.cpp), a drop-in for Perf::Fbench in run_fbench2.
+  # Requests are sent at a target rate ('qps') on a Poisson or fixed schedule regardless of response times,
+  # and latency is measured from the intended send time, so server stalls are not hidden by the load giver
+  # backing off. The summary uses fbench labels, so 'fill' reports the same metrics as Perf::Fbench.
+  class OpenLoopBench
+    attr_writer :clients, :runtime, :headers, :append_str, :use_post, :disable_tls, :certificate_file,
+                :private_key_file, :ca_certificate_file, :qps, :arrival, :http2, :threads, :warmup, :latency_log,
+                :trace
+    # Fbench settings without an open loop counterpart, accepted and ignored.
+    attr_writer :ignore_first, :max_line_size, :single_query_file, :disable_http_keep_alive, :request_per_ms,
+                :times_reuse_query_files, :result_file, :include_handshake
+
+    def initialize(node, hostname, port)
+      @node = node
+      @hostname = hostname
+      @port = port
+      @clients = 1
+      @runtime = 60
+      @headers = nil
+      @append_str = nil
+      @use_post = false
+      @disable_tls = false
+      @certificate_file = nil
+      @private_key_file = nil
+      @ca_certificate_file = nil
+      @qps = nil
+      @arrival = 'poisson'
+      @http2 = false
+      @threads = nil
+      @warmup = nil
+      @latency_log = nil
+      @trace = nil
+      @summary = {}
+      @output_str = nil
+    end
+
+    def binary
+      @binary ||= DataGenerator.compile_tool(@node, 'open_loop_bench.cpp', flags: '-std=c++17 -O3 -pthread', libs: '-lssl -lcrypto')
+    end
+
+    def query(queryfile)
+      raise "Target rate (qps) or a trace must be set for open loop benchmarking" unless @qps || @trace
+      @output_str = @node.execute(open_loop_cmd(queryfile))
+      @summary = {}
+      @output_str.each_line do |line|
+        if line =~ /^([a-z0-9. ]+):\s+([0-9.]+)/
+          @summary[$~[1]] = $~[2]
+        end
+      end
+    end
+
+    def p95
+      @summary['95 percentile']
+    end
+
+    def qps(qps_scale_factor = 1)
+      @summary['actual query rate'].to_f * qps_scale_factor
+    end
+
+    def http_status_code_distribution
+      hist = {}
+      @output_str.each_line do |line|
+        if line =~ /\s+(\d+)\s+:\s+(\d+)/
+          hist[$~[1].to_i] = $~[2].to_i
+        end
+      end
+      hist
+    end
+
+    def fill(qps_scale_factor = 1)
+      Proc.new do |result|
+        result.add_metric('runtime', @summary['ran for'])
+        result.add_metric('successfulrequests', @summary['successful requests'])
+        result.add_metric('failedrequests', @summary['failed requests'])
+        result.add_metric('timedoutrequests', @summary['timed out requests'])
+        result.add_metric('minresponsetime', @summary['minimum response time'])
+        result.add_metric('maxresponsetime', @summary['maximum response time'])
+        result.add_metric('avgresponsetime', @summary['average response time'])
+        ['50', '90', '95', '99', '99.9', '99.99'].each do |p|
+          result.add_metric("#{p} percentile", @summary["#{p} percentile"])
+        end
+        result.add_metric('avgsenddelay', @summary['average send delay'])
+        result.add_metric('maxsenddelay', @summary['maximum send delay'])
+        result.add_metric('qps', qps(qps_scale_factor).to_s)
+        result.add_parameter('clients', @clients)
+        result.add_parameter('targetqps', @trace ? @summary['target query rate'] : @qps)
+        result.add_parameter('loadgiver', 'openloop')
+      end
+    end
+
+    def open_loop_cmd(queryfile)
+      cmd = "#{binary} -n #{@clients} "
+      # A trace (see Perf::QueryTrace) has its own send times and queries.
+      cmd += @trace ? "-R #{@trace} " : "-r #{@qps} -p #{@arrival} -s #{@runtime} -q #{queryfile} "
+      cmd += "-t #{@threads} " if @threads
+      cmd += "-w #{@warmup} " if @warmup
+      cmd += "-a \"#{@append_str}\" " if @append_str
+      cmd += "-H \"#{@headers}\" " if @headers
+      cmd += "-P " if @use_post
+      cmd += "-2 " if @http2
+      cmd += "-o #{@latency_log} " if @latency_log
+      cmd += "-D " unless @disable_tls
+      cmd += "-T #{@ca_certificate_file} " if @ca_certificate_file
+      cmd += "-C #{@certificate_file} " if @certificate_file
+      cmd += "-K #{@private_key_file} " if @private_key_file
+      cmd += "#{@hostname} #{@port} 2>&1"
+      cmd
+    end
+  end
+end
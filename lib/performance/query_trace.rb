@@ -0,0 +1,38 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+
+module Perf
+
+  # Query traces with per-request send times (lib/query_trace.cpp), made from the query files of the
+  # query generators, for replay with Perf::OpenLoopBench (trace=) or open_loop_bench -R.
+  class QueryTrace
+
+    def initialize(node)
+      @node = node
+    end
+
+    def binary
+      @binary ||= DataGenerator.compile_tool(@node, 'query_trace.cpp')
+    end
+
+    # Writes a trace to 'output' and returns its summary, e.g. { 'requests' => 1000, 'mean qps' => 100.0 }.
+    # 'query_files' maps query files to weights, and 'phases' lists arrival processes as '<process>@<seconds>',
+    # e.g. ['poisson:100@60', 'mmpp:100:1000:30:5@300'] (see lib/query_trace.cpp).
+    def generate(query_files:, phases:, output:, duration: nil, random_order: false, post: false, seed: 1)
+      args = query_files.map { |file, weight| "-q #{file}:#{weight}" }
+      args += phases.map { |phase| "-a #{phase}" }
+      args << "-d #{duration}" if duration
+      args << '-r' if random_order
+      args << '-P' if post
+      args << "-s #{seed}"
+      summary = {}
+      @node.execute("#{binary} #{args.join(' ')} 2>&1 > #{output}").each_line do |line|
+        summary[$1] = $2.to_f if line =~ /^(requests|seconds|mean qps|peak qps): (\S+)/
+      end
+      summary
+    end
+
+  end
+
+end
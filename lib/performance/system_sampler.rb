@@ -0,0 +1,102 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'data_generator'
+
+module Perf
+
+  # High frequency system sampler (lib/system_sampler.cpp) running in the background on a node. Unlike
+  # Perf::System, which only compares /proc snapshots at the start and end, this records CPU, context switches,
+  # page faults, disk and network every few milliseconds, so stalls within a run are visible as min and max values.
+  # Phases are marked with 'mark' while sampling, and 'summarize' reports each phase separately.
+  class SystemSampler
+    attr_reader :hostname, :samples_file, :marks_file
+
+    # 'processes' are extended regexes for the command lines of processes to sample (see Node#get_pids),
+    # e.g. ['sbin/vespa-proton-bin'], and 'threads' samples each of their threads as well.
+    def initialize(node, interval_ms: 50, processes: [], threads: false)
+      @node = node
+      @hostname = node.hostname
+      @interval_ms = interval_ms
+      @processes = processes
+      @threads = threads
+      @pid = nil
+      @summary = {}
+    end
+
+    def binary
+      @binary ||= DataGenerator.compile_tool(@node, 'system_sampler.cpp')
+    end
+
+    def start
+      stop
+      dir = @node.execute('mktemp -d /tmp/system_sampler.XXXXXX').strip
+      @samples_file = "#{dir}/samples"
+      @marks_file = "#{dir}/marks"
+      args = ["-o #{@samples_file}", "-i #{@interval_ms}"]
+      args += @processes.map { |pattern| "-n '#{pattern}'" }
+      args << '-t' if @threads
+      @pid = @node.execute_bg("exec #{binary} #{args.join(' ')} 2> #{dir}/log")
+    end
+
+    # Starts a phase, which lasts until the next mark. The phase 'end' only ends the previous one.
+    # The time is taken on the node, so it is aligned with the samples.
+    def mark(phase)
+      raise 'Phase names can not contain whitespace' if phase =~ /\s/
+      @node.execute("echo \"$(date +%s.%N) #{phase}\" >> #{@marks_file}")
+    end
+
+    def stop
+      return unless @pid
+      @node.kill_pid(@pid, 'INT')
+      @pid = nil
+    end
+
+    def running?
+      @pid != nil
+    end
+
+    # Returns { phase => { metric => { 'mean' => x, 'min' => y, 'max' => z } } }, with min and max over
+    # windows of 'window_ms', for the phases marked and 'all'. See lib/system_sampler.cpp for the metrics.
+    def summarize(window_ms: 100, top_threads: 10, per_cpu: false)
+      args = ["-s #{@samples_file}", "-w #{window_ms}", "-k #{top_threads}"]
+      args << "-m #{@marks_file}" if @node.file?(@marks_file)
+      args << '-c' if per_cpu
+      @summary = SystemSampler.parse(@node.execute("#{binary} #{args.join(' ')}", :noecho => true))
+    end
+
+    def self.parse(text)
+      summary = {}
+      text.each_line do |line|
+        next if line.start_with?('#')
+        phase, metric, mean, min, max = line.chomp.split("\t")
+        next unless max
+        summary[phase] ||= {}
+        summary[phase][metric] = { 'mean' => mean.to_f, 'min' => min.to_f, 'max' => max.to_f }
+      end
+      summary
+    end
+
+    # Copies the samples and marks to a local directory, e.g. the result output directory of the test.
+    def attach(directory)
+      [@samples_file, @marks_file].each do |file|
+        @node.copy_remote_file_into_local_directory(file, directory) if @node.file?(file)
+      end
+    end
+
+    # Filler with the given metrics of a phase from 'summarize', as '<metric>' (the mean), '<metric>.min'
+    # and '<metric>.max', e.g. fill('feed', ['cpu.util', 'page_faults']).
+    def fill(phase = 'all', metrics = ['cpu.util', 'cpu.iowait', 'context_switches', 'page_faults', 'major_faults'])
+      Proc.new do |result|
+        values = @summary[phase] || {}
+        metrics.each do |metric|
+          next unless values[metric]
+          result.add_metric(metric, values[metric]['mean'], @hostname)
+          result.add_metric("#{metric}.min", values[metric]['min'], @hostname)
+          result.add_metric("#{metric}.max", values[metric]['max'], @hostname)
+        end
+      end
+    end
+
+  end
+
+end
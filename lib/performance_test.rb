@@ -2,8 +2,15 @@
 
 require 'performance/configloadtester'
 require 'performance/fbench'
+require 'performance/feed_inspector'
+require 'performance/feed_transcoder'
+require 'performance/mock_endpoint'
+require 'performance/native_profiler'
+require 'performance/open_loop_bench'
+require 'performance/query_trace'
 require 'performance/resultmodel'
 require 'performance/stat'
+require 'performance/system_sampler'
 require 'environment'
 require 'json'
 
@@ -126,7 +133,21 @@ class PerformanceTest < TestCase
     system_fbench.start
     container_port = if params[:port_override] then params[:port_override] else container.http_port end
     container_hostname = if params[:hostname_override] then params[:hostname_override] else container.name end
-    fbench = Perf::Fbench.new(container, container_hostname, container_port)
+    # With :open_loop_qps, requests are sent at that rate regardless of response times (see Perf::OpenLoopBench),
+    # and with :trace, at the send times of a query trace (see Perf::QueryTrace).
+    open_loop = params[:open_loop_qps] || params[:trace]
+    fbench = if open_loop
+               Perf::OpenLoopBench.new(container, container_hostname, container_port)
+             else
+               Perf::Fbench.new(container, container_hostname, container_port)
+             end
+    if open_loop
+      fbench.qps = params[:open_loop_qps]
+      fbench.trace = params[:trace] if params[:trace]
+      fbench.arrival = params[:arrival] if params[:arrival]
+      fbench.http2 = params[:http2] if params[:http2]
+      fbench.latency_log = params[:latency_log] if params[:latency_log]
+    end
 
     fbench.runtime = params[:runtime] if params[:runtime]
     fbench.clients = params[:clients] if params[:clients]
@@ -145,12 +166,34 @@ class PerformanceTest < TestCase
     fbench.ca_certificate_file = params[:ca_certificate_file] if params[:ca_certificate_file]
     fbench.single_query_file = params[:single_query_file] if params[:single_query_file]
 
+    mark_phase(params[:phase] || 'fbench')
     fbench.query(queryfile)
+    mark_phase('end')
     system_fbench.end
     fillers = [fbench.fill, system_fbench.fill]
     write_report(fillers + custom_fillers)
   end
 
+  # Like run_fbench2, while profiling the search nodes (vespa-proton-bin) with Perf::NativeProfiler for the
+  # runtime, mirroring run_fbench2_with_async_profiler for the container. The flame graph, collapsed stacks and
+  # summary of each are written to native_profiler/<profile_name>_<host>_<pid>.* in the result output directory.
+  def run_fbench2_with_native_profiler(container, queryfile, params, custom_fillers=[], profile_name, unwind: 'fp')
+    profilers = vespa.search.values.flat_map { |cluster| cluster.searchnode.values }.map do |searchnode|
+      Perf::NativeProfiler.new(vespa.nodeproxies[searchnode.name], searchnode.get_pid, unwind: unwind)
+    end
+    puts "No search node processes found, running without native profiling" if profilers.empty?
+    profilers.each do |profiler|
+      profiler.start(params[:runtime] || 60, "#{profile_name}_#{profiler.node.name}_#{profiler.pid}",
+                     "#{profile_name}: proton #{profiler.pid} on #{profiler.node.name}")
+    end
+    run_fbench2(container, queryfile, params, custom_fillers)
+    profilers.each do |profiler|
+      summary = profiler.collect(dirs.resultoutput + 'native_profiler')
+      puts "Native profile of proton #{profiler.pid} on #{profiler.node.name}: #{summary['samples'].to_i} samples, top functions:"
+      summary['self'].first(10).each { |percent, samples, function| puts "  #{'%6.2f' % percent}% #{function}" }
+    end
+  end
+
   def fill_feeder(output)
     Proc.new do |result|
       result.add_metric('feeder.runtime', output[0])
@@ -274,6 +317,12 @@ class PerformanceTest < TestCase
   end
 
   def teardown
+    # Only stop and attach here, a failing sampler must not keep the rest of teardown from running.
+    begin
+      stop_system_sampler(summarize: false)
+    rescue ExecuteError, SystemCallError => e
+      puts "Unable to stop system sampler: #{e.message}"
+    end
     vespa_destination_stop
     profiler_stop
     profiler_report
@@ -299,6 +348,32 @@ class PerformanceTest < TestCase
     puts delta.printable_result
   end
 
+  # Start a high frequency system sampler (see Perf::SystemSampler) on the node, by default the first one,
+  # e.g. start_system_sampler(node, :processes => ['sbin/vespa-proton-bin'], :interval_ms => 20).
+  # Phases marked with mark_phase, and each run_fbench2 (as params[:phase], default 'fbench'), are summarized
+  # separately when it is stopped.
+  def start_system_sampler(node = vespa.nodeproxies.values.first, params = {})
+    stop_system_sampler(summarize: false)
+    @system_sampler = Perf::SystemSampler.new(node, **params)
+    @system_sampler.start
+  end
+
+  def mark_phase(phase)
+    @system_sampler.mark(phase) if @system_sampler
+  end
+
+  # Stops the system sampler, copies its recording to the perf result directory, and returns it with
+  # the summary of each phase (unless summarize is false), for fillers like sampler.fill('feed', ['cpu.util']).
+  def stop_system_sampler(summarize: true)
+    return nil unless @system_sampler
+    sampler = @system_sampler
+    @system_sampler = nil
+    sampler.stop
+    sampler.summarize if summarize
+    sampler.attach(@perfdir) if @perfdir
+    sampler
+  end
+
   # Start profiler. Calling this will stop any profilers started earlier and reset recordings.
   def profiler_start
     start_perf_profiler
@@ -0,0 +1,315 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// Query traces: query urls (as written by the query generators of the performance tests) with send times.
+//
+// Wraps one or more query files, mixed with weights, with per-request send times following an arrival
+// process, so benchmarks can be replayed with bursts, ramps and daily variation instead of a flat rate
+// (see lib/open_loop_bench.cpp -R). The arrival process is a sequence of phases, each lasting its given
+// number of seconds (the last one lasting until -d seconds if no length is given):
+//
+//   constant:<qps>                             evenly spaced requests
+//   poisson:<qps>                              Poisson arrivals
+//   ramp:<from qps>:<to qps>                   Poisson arrivals with the rate changing linearly over the phase
+//   diurnal:<mean qps>:<amplitude>:<period s>  Poisson arrivals with rate mean * (1 + amplitude * sin(2 pi t / period))
+//   mmpp:<low qps>:<high qps>:<low s>:<high s> Markov modulated Poisson process: Poisson arrivals at the low
+//                                              or high rate, switching after exponentially distributed times
+//                                              with the given means (bursts)
+//
+// e.g. -a poisson:100@60 -a mmpp:100:1000:30:5@300 -a ramp:100:0@60
+//
+// Output is one request per line: '<send time s>\t<url>', or with -P '<send time s>\t<url>\t<body>'
+// where query files have url and body on alternate lines (as for vespa-fbench -P).
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> split(const std::string &s, char separator) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (true) {
+        size_t end = s.find(separator, start);
+        parts.push_back(s.substr(start, end - start));
+        if (end == std::string::npos) {
+            return parts;
+        }
+        start = end + 1;
+    }
+}
+
+/**
+ * Arrival process of one phase. 'next(t, end)' returns the time of the first arrival after t,
+ * or a time past 'end' if there is none before it, in seconds from the start of the phase.
+ */
+class Arrivals {
+public:
+    virtual ~Arrivals() = default;
+    virtual double next(double t, double end, std::mt19937_64 &rng) = 0;
+};
+
+class Constant : public Arrivals {
+    double _qps;
+public:
+    explicit Constant(double qps) : _qps(qps) {}
+    double next(double t, double, std::mt19937_64 &) override { return t + 1.0 / _qps; }
+};
+
+/**
+ * Poisson arrivals with rate(t) <= max_rate, by thinning.
+ */
+class Varying : public Arrivals {
+    double _max_rate;
+protected:
+    virtual double rate(double t) const = 0;
+public:
+    explicit Varying(double max_rate) : _max_rate(max_rate) {}
+    double next(double t, double end, std::mt19937_64 &rng) override {
+        std::exponential_distribution<double> gap(_max_rate);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        do {
+            t += gap(rng);
+        } while (t < end && uniform(rng) * _max_rate > rate(t));
+        return t;
+    }
+};
+
+class Poisson : public Varying {
+    double _qps;
+    double rate(double) const override { return _qps; }
+public:
+    explicit Poisson(double qps) : Varying(qps), _qps(qps) {}
+};
+
+class Ramp : public Varying {
+    double _from;
+    double _to;
+    double _length;
+    double rate(double t) const override { return _from + (_to - _from) * std::min(1.0, t / _length); }
+public:
+    Ramp(double from, double to, double length) : Varying(std::max(from, to)), _from(from), _to(to), _length(length) {}
+};
+
+class Diurnal : public Varying {
+    double _mean;
+    double _amplitude;
+    double _period;
+    double rate(double t) const override { return _mean * (1.0 + _amplitude * std::sin(2 * M_PI * t / _period)); }
+public:
+    Diurnal(double mean, double amplitude, double period)
+        : Varying(mean * (1.0 + amplitude)), _mean(mean), _amplitude(amplitude), _period(period) {}
+};
+
+class Mmpp : public Arrivals {
+    double _rate[2];
+    double _mean_time[2];
+    int _state;
+    double _switch_at;
+public:
+    Mmpp(double low, double high, double low_s, double high_s)
+        : _rate{low, high}, _mean_time{low_s, high_s}, _state(0), _switch_at(-1.0) {}
+    double next(double t, double end, std::mt19937_64 &rng) override {
+        if (_switch_at < 0.0) {
+            _switch_at = std::exponential_distribution<double>(1.0 / _mean_time[0])(rng);
+        }
+        while (true) {
+            // Memoryless: an arrival drawn past the switch is redrawn from the switch at the new rate.
+            double arrival = (_rate[_state] > 0.0) ? t + std::exponential_distribution<double>(_rate[_state])(rng) : INFINITY;
+            if (arrival <= _switch_at || _switch_at >= end) {
+                return arrival;
+            }
+            t = _switch_at;
+            _state = 1 - _state;
+            _switch_at = t + std::exponential_distribution<double>(1.0 / _mean_time[_state])(rng);
+        }
+    }
+};
+
+struct Phase {
+    std::string spec;
+    double length;
+    std::unique_ptr<Arrivals> arrivals;
+};
+
+Phase parse_phase(const std::string &spec, double default_length) {
+    size_t at = spec.find('@');
+    Phase phase{spec, (at != std::string::npos) ? atof(spec.c_str() + at + 1) : default_length, nullptr};
+    std::vector<std::string> p = split(spec.substr(0, at), ':');
+    std::vector<double> v;
+    for (size_t i = 1; i < p.size(); ++i) {
+        v.push_back(atof(p[i].c_str()));
+    }
+    if (p[0] == "constant" && v.size() == 1 && v[0] > 0) {
+        phase.arrivals = std::make_unique<Constant>(v[0]);
+    } else if (p[0] == "poisson" && v.size() == 1 && v[0] > 0) {
+        phase.arrivals = std::make_unique<Poisson>(v[0]);
+    } else if (p[0] == "ramp" && v.size() == 2 && std::max(v[0], v[1]) > 0) {
+        phase.arrivals = std::make_unique<Ramp>(v[0], v[1], phase.length);
+    } else if (p[0] == "diurnal" && v.size() == 3 && v[0] > 0 && v[1] >= 0 && v[1] <= 1 && v[2] > 0) {
+        phase.arrivals = std::make_unique<Diurnal>(v[0], v[1], v[2]);
+    } else if (p[0] == "mmpp" && v.size() == 4 && std::max(v[0], v[1]) > 0 && v[2] > 0 && v[3] > 0) {
+        phase.arrivals = std::make_unique<Mmpp>(v[0], v[1], v[2], v[3]);
+    } else {
+        fprintf(stderr, "Invalid arrival process: %s\n", spec.c_str());
+        exit(1);
+    }
+    if (!(phase.length > 0)) {
+        fprintf(stderr, "Arrival process without length (give <process>@<seconds> or -d): %s\n", spec.c_str());
+        exit(1);
+    }
+    return phase;
+}
+
+struct QueryFile {
+    std::string name;
+    double weight;
+    std::vector<std::pair<std::string, std::string>> queries;
+    size_t next;
+};
+
+QueryFile load(const std::string &spec, bool post) {
+    // <file>[:<weight>], where the weight is after the last ':' if it parses as a number.
+    QueryFile file{spec, 1.0, {}, 0};
+    size_t colon = spec.rfind(':');
+    if (colon != std::string::npos) {
+        char *end;
+        double weight = strtod(spec.c_str() + colon + 1, &end);
+        if (*end == '\0' && end != spec.c_str() + colon + 1) {
+            file.name = spec.substr(0, colon);
+            file.weight = weight;
+        }
+    }
+    std::ifstream in(file.name);
+    if (!in) {
+        fprintf(stderr, "Could not open query file '%s'\n", file.name.c_str());
+        exit(1);
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::string body;
+        if (post && !std::getline(in, body)) {
+            break;
+        }
+        file.queries.emplace_back(std::move(line), std::move(body));
+    }
+    if (file.queries.empty()) {
+        fprintf(stderr, "No queries in '%s'\n", file.name.c_str());
+        exit(1);
+    }
+    return file;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -q <query file>[:<weight>] [-q ...] -a <process>[@<seconds>] [-a ...] [-d seconds] [-r] [-P] [-s seed]\n"
+                    "  -q: query file, may be repeated to mix files with the given weights (default 1)\n"
+                    "  -a: arrival process of a phase, see lib/query_trace.cpp; phases follow each other\n"
+                    "  -d: total length in seconds, the length of the last phase when not given with @\n"
+                    "  -r: pick random queries from each file instead of going through them in order\n"
+                    "  -P: query files have url and body on alternate lines, bodies are written as a third column\n"
+                    "  -s: random seed (default 1)\n"
+                    "Writes '<send time s>\\t<url>[\\t<body>]' lines to stdout and a summary to stderr.\n", prog);
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> query_specs;
+    std::vector<std::string> phase_specs;
+    double duration = 0.0;
+    bool random_order = false;
+    bool post = false;
+    uint64_t seed = 1;
+    int option;
+    while ((option = getopt(argc, argv, "q:a:d:rPs:h")) != -1) {
+        switch (option) {
+        case 'q': query_specs.emplace_back(optarg); break;
+        case 'a': phase_specs.emplace_back(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'r': random_order = true; break;
+        case 'P': post = true; break;
+        case 's': seed = strtoull(optarg, nullptr, 0); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (query_specs.empty() || phase_specs.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::vector<QueryFile> files;
+    std::vector<double> weights;
+    for (const auto &spec : query_specs) {
+        files.push_back(load(spec, post));
+        weights.push_back(files.back().weight);
+    }
+    std::vector<Phase> phases;
+    double fixed = 0.0;
+    for (size_t i = 0; i < phase_specs.size(); ++i) {
+        bool last = (i + 1 == phase_specs.size());
+        phases.push_back(parse_phase(phase_specs[i], last ? duration - fixed : 0.0));
+        fixed += phases.back().length;
+    }
+
+    std::mt19937_64 rng(seed);
+    std::discrete_distribution<size_t> pick_file(weights.begin(), weights.end());
+    std::vector<uint64_t> per_second;
+    std::vector<uint64_t> per_file(files.size(), 0);
+    uint64_t count = 0;
+    std::string out;
+    double phase_start = 0.0;
+    for (auto &phase : phases) {
+        for (double t = phase.arrivals->next(0.0, phase.length, rng); t < phase.length;
+             t = phase.arrivals->next(t, phase.length, rng))
+        {
+            double time = phase_start + t;
+            size_t f = pick_file(rng);
+            QueryFile &file = files[f];
+            size_t q = random_order ? std::uniform_int_distribution<size_t>(0, file.queries.size() - 1)(rng)
+                                    : file.next++ % file.queries.size();
+            char buf[32];
+            out.append(buf, snprintf(buf, sizeof(buf), "%.6f\t", time));
+            out += file.queries[q].first;
+            if (post) {
+                out += '\t';
+                out += file.queries[q].second;
+            }
+            out += '\n';
+            if (out.size() >= (1 << 20)) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                out.clear();
+            }
+            size_t second = size_t(time);
+            if (second >= per_second.size()) {
+                per_second.resize(second + 1, 0);
+            }
+            ++per_second[second];
+            ++per_file[f];
+            ++count;
+        }
+        phase_start += phase.length;
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+
+    fprintf(stderr, "requests: %lu\n", count);
+    fprintf(stderr, "seconds: %.3f\n", phase_start);
+    fprintf(stderr, "mean qps: %.2f\n", phase_start > 0 ? count / phase_start : 0.0);
+    fprintf(stderr, "peak qps: %lu\n", per_second.empty() ? 0 : *std::max_element(per_second.begin(), per_second.end()));
+    for (size_t f = 0; f < files.size(); ++f) {
+        fprintf(stderr, "file %s: %lu\n", files[f].name.c_str(), per_file[f]);
+    }
+    return 0;
+}
@@ -0,0 +1,1157 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// High frequency system sampler: records per-CPU, system, per-process and (with -t) per-thread CPU, context
+// switches and page faults, and disk and network counters every few milliseconds, so stalls within a run
+// (a GC pause, an I/O stall) show up instead of being averaged away by start and end snapshots of /proc
+// (see lib/performance/stat.rb). Software perf_event_open counters are used where available: per CPU
+// (context switches, migrations, page faults; needs perf_event_paranoid <= 0 or root) and per thread of the
+// sampled processes (context switches, migrations, page faults and task clock, summed per process).
+//
+//   system_sampler -o <file> [-i ms] [-d seconds] [-p pid] [-n pattern] [-t]      record until SIGINT/SIGTERM
+//   system_sampler -s <file> [-m marks] [-w ms] [-k threads] [-c]                 summarize
+//
+// Processes are given by pid (-p) or by an extended regular expression matched against the command line
+// (-n, like 'ps awwx | grep'), which is rescanned every second so restarted processes are picked up.
+//
+// The summary aligns samples with the phases in the marks file, lines of '<epoch seconds> <phase>' as written
+// by Perf::SystemSampler#mark (e.g. 'echo "$(date +%s.%N) feed" >> marks'), where a phase lasts until the
+// next mark and the phase 'end' only ends the previous one. It has one '<phase>\t<metric>\t<mean>\t<min>\t<max>'
+// line per metric and phase, plus the phase 'all', where min and max are over windows of -w ms (default 100)
+// and the mean is over the phase.
+//
+// File format (integers are LEB128 varints, deltas are zigzag encoded):
+//   "SYSS" u32:version(1) u32:interval_us u32:clock_ticks_per_second, then records:
+//   'D' id kind:str name:str num_fields (field:str gauge:u8)*     defines series id (str is length + bytes)
+//   'S' time_delta_ns num_entries (id delta*)*                    sample; the first time delta is from the epoch
+//   'E' id                                                        series ended (process or thread exited)
+// A sample only has entries for series where some value changed; values are deltas from the previous entry.
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <linux/perf_event.h>
+#include <map>
+#include <memory>
+#include <regex.h>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+volatile sig_atomic_t stop_requested = 0;
+
+void on_signal(int) { stop_requested = 1; }
+
+uint64_t now_ns(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+struct Kind {
+    const char *name;
+    std::vector<const char *> fields;
+    std::vector<bool> gauges;
+};
+
+const Kind cpu_kind{"cpu", {"user", "nice", "system", "idle", "iowait", "irq", "softirq", "steal"}, {}};
+const Kind system_kind{"system", {"context_switches", "forks", "procs_running", "procs_blocked",
+                                  "page_faults", "major_faults", "swap_in", "swap_out"},
+                       {false, false, true, true, false, false, false, false}};
+const Kind perf_cpu_kind{"perf_cpu", {"context_switches", "cpu_migrations", "page_faults", "major_faults"}, {}};
+const Kind process_kind{"process", {"utime", "stime", "page_faults", "major_faults", "threads", "rss_pages"},
+                        {false, false, false, false, true, true}};
+const Kind perf_process_kind{"perf_process", {"context_switches", "cpu_migrations", "page_faults", "task_clock_ns"}, {}};
+const Kind thread_kind{"thread", {"utime", "stime", "page_faults", "major_faults", "run_ns", "wait_ns", "timeslices"}, {}};
+const Kind disk_kind{"disk", {"reads", "sectors_read", "writes", "sectors_written", "io_ms", "in_progress"},
+                     {false, false, false, false, false, true}};
+const Kind net_kind{"net", {"rx_bytes", "rx_packets", "rx_drop", "tx_bytes", "tx_packets", "tx_drop"}, {}};
+
+class Writer {
+    FILE *_file;
+    std::string _buf;
+public:
+    explicit Writer(FILE *file) : _file(file), _buf() {}
+    void byte(uint8_t v) { _buf += char(v); }
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            _buf += char(0x80 | (v & 0x7f));
+            v >>= 7;
+        }
+        _buf += char(v);
+    }
+    void str(const std::string &s) { varint(s.size()); _buf += s; }
+    void raw(const void *p, size_t n) { _buf.append(static_cast<const char *>(p), n); }
+    void flush(bool force) {
+        if (force || _buf.size() >= (1 << 16)) {
+            fwrite(_buf.data(), 1, _buf.size(), _file);
+            fflush(_file);
+            _buf.clear();
+        }
+    }
+};
+
+// A /proc file kept open and re-read from the start, which is cheaper than opening it for every sample.
+class ProcFile {
+    int _fd;
+    std::string _buf;
+public:
+    explicit ProcFile(const std::string &path) : _fd(open(path.c_str(), O_RDONLY | O_CLOEXEC)), _buf() {}
+    ProcFile(const ProcFile &) = delete;
+    ProcFile &operator=(const ProcFile &) = delete;
+    ~ProcFile() { if (_fd >= 0) close(_fd); }
+    bool valid() const { return _fd >= 0; }
+    // Returns false if the file can no longer be read, e.g. when the process has exited.
+    bool read(std::string &out) {
+        if (_fd < 0) {
+            return false;
+        }
+        if (_buf.size() < 4096) {
+            _buf.resize(4096);
+        }
+        size_t len = 0;
+        while (true) {
+            ssize_t n = pread(_fd, _buf.data() + len, _buf.size() - len, len);
+            if (n < 0) {
+                return false;
+            }
+            if (n == 0) {
+                break;
+            }
+            len += n;
+            if (len == _buf.size()) {
+                _buf.resize(_buf.size() * 2);
+            }
+        }
+        out.assign(_buf.data(), len);
+        return len > 0;
+    }
+};
+
+std::vector<uint64_t> numbers(const char *p, const char *end) {
+    std::vector<uint64_t> v;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            break;
+        }
+        char *next;
+        v.push_back(strtoull(p, &next, 10));
+        p = next;
+    }
+    return v;
+}
+
+// Fields after the command name of /proc/<pid>/stat, starting with the state (field 3, index 0 here).
+bool parse_task_stat(const std::string &data, std::string &comm, std::vector<std::string> &fields) {
+    size_t open_paren = data.find('(');
+    size_t close_paren = data.rfind(')');
+    if (open_paren == std::string::npos || close_paren == std::string::npos || close_paren < open_paren) {
+        return false;
+    }
+    comm = data.substr(open_paren + 1, close_paren - open_paren - 1);
+    fields.clear();
+    size_t pos = close_paren + 2;
+    while (pos < data.size()) {
+        size_t end = data.find_first_of(" \n", pos);
+        if (end == std::string::npos) {
+            end = data.size();
+        }
+        fields.push_back(data.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return fields.size() > 22;
+}
+
+long perf_event_open(perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/**
+ * A group of software counters read with a single read().
+ */
+class PerfGroup {
+    std::vector<int> _fds;
+public:
+    PerfGroup(const std::vector<uint64_t> &configs, pid_t pid, int cpu) : _fds() {
+        for (uint64_t config : configs) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = config;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = perf_event_open(&attr, pid, cpu, _fds.empty() ? -1 : _fds[0], PERF_FLAG_FD_CLOEXEC);
+            if (fd < 0) {
+                close_all();
+                return;
+            }
+            _fds.push_back(fd);
+        }
+    }
+    PerfGroup(const PerfGroup &) = delete;
+    PerfGroup &operator=(const PerfGroup &) = delete;
+    ~PerfGroup() { close_all(); }
+    void close_all() {
+        for (int fd : _fds) {
+            close(fd);
+        }
+        _fds.clear();
+    }
+    bool valid() const { return !_fds.empty(); }
+    bool read(std::vector<uint64_t> &values) const {
+        uint64_t buf[16];
+        ssize_t expected = (1 + values.size()) * sizeof(uint64_t);
+        if (_fds.empty() || ::read(_fds[0], buf, sizeof(buf)) != expected || buf[0] != values.size()) {
+            return false;
+        }
+        std::copy(buf + 1, buf + 1 + values.size(), values.begin());
+        return true;
+    }
+};
+
+const std::vector<uint64_t> perf_cpu_configs{PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS,
+                                             PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_PAGE_FAULTS_MAJ};
+const std::vector<uint64_t> perf_thread_configs{PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS,
+                                                PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_TASK_CLOCK};
+
+struct Thread {
+    std::unique_ptr<ProcFile> stat;
+    std::unique_ptr<ProcFile> schedstat;
+    std::unique_ptr<PerfGroup> perf;
+    std::vector<uint64_t> perf_values;
+    bool seen = false;
+};
+
+struct Process {
+    pid_t pid;
+    std::string comm;
+    std::unique_ptr<ProcFile> stat;
+    std::map<pid_t, Thread> threads;
+    std::vector<uint64_t> retired; // perf counts of exited threads
+    bool perf;
+};
+
+class Sampler {
+    struct Series {
+        uint32_t id;
+        const Kind *kind;
+        std::vector<uint64_t> last;
+        bool seen;
+    };
+    Writer &_out;
+    bool _threads;
+    std::vector<regex_t> _patterns;
+    std::map<std::string, Series> _series;
+    uint32_t _next_id;
+    uint64_t _last_time;
+    std::string _entries;
+    uint32_t _num_entries;
+    ProcFile _stat;
+    ProcFile _vmstat;
+    ProcFile _diskstats;
+    ProcFile _netdev;
+    std::vector<std::unique_ptr<PerfGroup>> _perf_cpus;
+    std::map<pid_t, Process> _processes;
+    std::set<pid_t> _given_pids;
+    std::map<std::string, bool> _whole_disk;
+    uint64_t _last_scan;
+    std::string _data;
+    std::vector<std::string> _fields;
+    std::string _comm;
+
+    void add(const std::string &name, const Kind &kind, const std::vector<uint64_t> &values) {
+        auto it = _series.find(name);
+        if (it == _series.end()) {
+            it = _series.emplace(name, Series{_next_id++, &kind, std::vector<uint64_t>(kind.fields.size(), 0), false}).first;
+            _out.byte('D');
+            _out.varint(it->second.id);
+            _out.str(kind.name);
+            _out.str(name);
+            _out.varint(kind.fields.size());
+            for (size_t i = 0; i < kind.fields.size(); ++i) {
+                _out.str(kind.fields[i]);
+                _out.byte((i < kind.gauges.size() && kind.gauges[i]) ? 1 : 0);
+            }
+        }
+        Series &series = it->second;
+        series.seen = true;
+        if (values == series.last) {
+            return;
+        }
+        append_varint(_entries, series.id);
+        for (size_t i = 0; i < values.size(); ++i) {
+            uint64_t delta = values[i] - series.last[i];
+            append_varint(_entries, (delta << 1) ^ uint64_t(int64_t(delta) >> 63));
+        }
+        series.last = values;
+        ++_num_entries;
+    }
+
+    static void append_varint(std::string &s, uint64_t v) {
+        while (v >= 0x80) {
+            s += char(0x80 | (v & 0x7f));
+            v >>= 7;
+        }
+        s += char(v);
+    }
+
+    void sample_stat() {
+        if (!_stat.read(_data)) {
+            return;
+        }
+        std::vector<uint64_t> system(system_kind.fields.size(), 0);
+        size_t pos = 0;
+        while (pos < _data.size()) {
+            size_t end = _data.find('\n', pos);
+            if (end == std::string::npos) {
+                end = _data.size();
+            }
+            const char *line = _data.data() + pos;
+            size_t space = _data.find(' ', pos);
+            if (space < end) {
+                std::string key(line, space - pos);
+                std::vector<uint64_t> v = numbers(_data.data() + space, _data.data() + end);
+                if (key.compare(0, 3, "cpu") == 0) {
+                    v.resize(cpu_kind.fields.size(), 0);
+                    add(key, cpu_kind, v);
+                } else if (!v.empty()) {
+                    if (key == "ctxt") system[0] = v[0];
+                    else if (key == "processes") system[1] = v[0];
+                    else if (key == "procs_running") system[2] = v[0];
+                    else if (key == "procs_blocked") system[3] = v[0];
+                }
+            }
+            pos = end + 1;
+        }
+        if (_vmstat.read(_data)) {
+            pos = 0;
+            while (pos < _data.size()) {
+                size_t end = _data.find('\n', pos);
+                if (end == std::string::npos) {
+                    end = _data.size();
+                }
+                size_t space = _data.find(' ', pos);
+                if (space < end) {
+                    std::string key = _data.substr(pos, space - pos);
+                    uint64_t value = strtoull(_data.c_str() + space + 1, nullptr, 10);
+                    if (key == "pgfault") system[4] = value;
+                    else if (key == "pgmajfault") system[5] = value;
+                    else if (key == "pswpin") system[6] = value;
+                    else if (key == "pswpout") system[7] = value;
+                }
+                pos = end + 1;
+            }
+        }
+        add("system", system_kind, system);
+        std::vector<uint64_t> values(perf_cpu_configs.size());
+        for (size_t cpu = 0; cpu < _perf_cpus.size(); ++cpu) {
+            if (_perf_cpus[cpu] && _perf_cpus[cpu]->read(values)) {
+                add("perf_cpu" + std::to_string(cpu), perf_cpu_kind, values);
+            }
+        }
+    }
+
+    bool whole_disk(const std::string &dev) {
+        auto it = _whole_disk.find(dev);
+        if (it == _whole_disk.end()) {
+            // Partitions, and ram, loop and device mapper devices, are skipped as in lib/performance/stat.rb.
+            std::string path = "/sys/block/" + dev;
+            std::replace(path.begin() + 11, path.end(), '/', '!');
+            struct stat st;
+            bool whole = (stat(path.c_str(), &st) == 0) && dev.compare(0, 3, "ram") != 0 &&
+                         dev.compare(0, 4, "loop") != 0 && dev.compare(0, 3, "dm-") != 0;
+            it = _whole_disk.emplace(dev, whole).first;
+        }
+        return it->second;
+    }
+
+    void sample_devices() {
+        if (_diskstats.read(_data)) {
+            size_t pos = 0;
+            while (pos < _data.size()) {
+                size_t end = _data.find('\n', pos);
+                if (end == std::string::npos) {
+                    end = _data.size();
+                }
+                char dev[64];
+                int offset = 0;
+                if (sscanf(_data.c_str() + pos, "%*u %*u %63s%n", dev, &offset) == 1 && whole_disk(dev)) {
+                    // reads merged sectors ms writes merged sectors ms in_progress io_ms ...
+                    std::vector<uint64_t> v = numbers(_data.data() + pos + offset, _data.data() + end);
+                    if (v.size() >= 10) {
+                        add(std::string("disk_") + dev, disk_kind, {v[0], v[2], v[4], v[6], v[9], v[8]});
+                    }
+                }
+                pos = end + 1;
+            }
+        }
+        if (_netdev.read(_data)) {
+            size_t pos = 0;
+            while (pos < _data.size()) {
+                size_t end = _data.find('\n', pos);
+                if (end == std::string::npos) {
+                    end = _data.size();
+                }
+                size_t colon = _data.find(':', pos);
+                if (colon < end) {
+                    size_t start = _data.find_first_not_of(' ', pos);
+                    std::string dev = _data.substr(start, colon - start);
+                    // rx: bytes packets errs drop fifo frame compressed multicast, tx: bytes packets errs drop ...
+                    std::vector<uint64_t> v = numbers(_data.data() + colon + 1, _data.data() + end);
+                    if (v.size() >= 12) {
+                        add("net_" + dev, net_kind, {v[0], v[1], v[3], v[8], v[9], v[11]});
+                    }
+                }
+                pos = end + 1;
+            }
+        }
+    }
+
+    bool matches(pid_t pid) {
+        ProcFile cmdline("/proc/" + std::to_string(pid) + "/cmdline");
+        std::string data;
+        if (!cmdline.read(data)) {
+            return false;
+        }
+        std::replace(data.begin(), data.end(), '\0', ' ');
+        for (auto &pattern : _patterns) {
+            if (regexec(&pattern, data.c_str(), 0, nullptr, 0) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void add_process(pid_t pid) {
+        if (_processes.count(pid) != 0) {
+            return;
+        }
+        std::string path = "/proc/" + std::to_string(pid);
+        auto stat = std::make_unique<ProcFile>(path + "/stat");
+        if (!stat->read(_data) || !parse_task_stat(_data, _comm, _fields)) {
+            return;
+        }
+        Process &process = _processes[pid];
+        process.pid = pid;
+        process.comm = _comm;
+        process.stat = std::move(stat);
+        process.retired.assign(perf_thread_configs.size(), 0);
+        process.perf = true;
+        fprintf(stderr, "Sampling process %d (%s)\n", pid, _comm.c_str());
+    }
+
+    void scan_processes() {
+        for (pid_t pid : _given_pids) {
+            add_process(pid);
+        }
+        if (_patterns.empty()) {
+            return;
+        }
+        DIR *dir = opendir("/proc");
+        if (dir == nullptr) {
+            return;
+        }
+        pid_t self = getpid();
+        while (dirent *entry = readdir(dir)) {
+            pid_t pid = atoi(entry->d_name);
+            if (pid > 0 && pid != self && _processes.count(pid) == 0 && matches(pid)) {
+                add_process(pid);
+            }
+        }
+        closedir(dir);
+    }
+
+    void end_series(const std::string &name) {
+        auto it = _series.find(name);
+        if (it != _series.end()) {
+            _out.byte('E');
+            _out.varint(it->second.id);
+            _series.erase(it);
+        }
+    }
+
+    std::string process_name(const Process &process) const {
+        return process.comm + "." + std::to_string(process.pid);
+    }
+
+    void sample_threads(Process &process) {
+        std::string task_dir = "/proc/" + std::to_string(process.pid) + "/task";
+        for (auto &entry : process.threads) {
+            entry.second.seen = false;
+        }
+        if (DIR *dir = opendir(task_dir.c_str())) {
+            while (dirent *entry = readdir(dir)) {
+                pid_t tid = atoi(entry->d_name);
+                if (tid <= 0) {
+                    continue;
+                }
+                auto it = process.threads.find(tid);
+                if (it == process.threads.end()) {
+                    Thread thread;
+                    std::string path = task_dir + "/" + entry->d_name;
+                    if (_threads) {
+                        thread.stat = std::make_unique<ProcFile>(path + "/stat");
+                        thread.schedstat = std::make_unique<ProcFile>(path + "/schedstat");
+                    }
+                    if (process.perf) {
+                        thread.perf = std::make_unique<PerfGroup>(perf_thread_configs, tid, -1);
+                        if (!thread.perf->valid()) {
+                            fprintf(stderr, "No perf counters for process %d (%s), check perf_event_paranoid\n",
+                                    process.pid, strerror(errno));
+                            process.perf = false;
+                            thread.perf.reset();
+                        }
+                    }
+                    thread.perf_values.assign(perf_thread_configs.size(), 0);
+                    it = process.threads.emplace(tid, std::move(thread)).first;
+                }
+                it->second.seen = true;
+            }
+            closedir(dir);
+        }
+        std::vector<uint64_t> perf = process.retired;
+        std::vector<uint64_t> values(perf_thread_configs.size());
+        for (auto it = process.threads.begin(); it != process.threads.end();) {
+            Thread &thread = it->second;
+            if (thread.perf && thread.perf->read(values)) {
+                thread.perf_values = values;
+            }
+            std::string name = process_name(process) + "." + std::to_string(it->first);
+            bool alive = thread.seen;
+            if (alive && _threads) {
+                std::vector<uint64_t> v(thread_kind.fields.size(), 0);
+                if (thread.stat->read(_data) && parse_task_stat(_data, _comm, _fields)) {
+                    v[0] = strtoull(_fields[11].c_str(), nullptr, 10);
+                    v[1] = strtoull(_fields[12].c_str(), nullptr, 10);
+                    v[2] = strtoull(_fields[7].c_str(), nullptr, 10);
+                    v[3] = strtoull(_fields[9].c_str(), nullptr, 10);
+                    if (thread.schedstat->read(_data)) {
+                        std::vector<uint64_t> s = numbers(_data.data(), _data.data() + _data.size());
+                        std::copy(s.begin(), s.begin() + std::min<size_t>(s.size(), 3), v.begin() + 4);
+                    }
+                    add(name + "." + _comm, thread_kind, v);
+                } else {
+                    alive = false;
+                }
+            }
+            if (alive) {
+                for (size_t i = 0; i < perf.size(); ++i) {
+                    perf[i] += thread.perf_values[i];
+                }
+                ++it;
+            } else {
+                for (size_t i = 0; i < perf.size(); ++i) {
+                    process.retired[i] += thread.perf_values[i];
+                    perf[i] += thread.perf_values[i];
+                }
+                if (_threads) {
+                    for (auto s = _series.lower_bound(name + "."); s != _series.end() &&
+                             s->first.compare(0, name.size() + 1, name + ".") == 0;) {
+                        std::string ended = (s++)->first;
+                        end_series(ended);
+                    }
+                }
+                it = process.threads.erase(it);
+            }
+        }
+        if (process.perf) {
+            add(process_name(process) + ".perf", perf_process_kind, perf);
+        }
+    }
+
+    void sample_processes() {
+        for (auto it = _processes.begin(); it != _processes.end();) {
+            Process &process = it->second;
+            if (process.stat->read(_data) && parse_task_stat(_data, _comm, _fields)) {
+                // minflt(10) majflt(12) utime(14) stime(15) num_threads(20) rss(24), counting from 1 with state at 3
+                add(process_name(process), process_kind,
+                    {strtoull(_fields[11].c_str(), nullptr, 10), strtoull(_fields[12].c_str(), nullptr, 10),
+                     strtoull(_fields[7].c_str(), nullptr, 10), strtoull(_fields[9].c_str(), nullptr, 10),
+                     strtoull(_fields[17].c_str(), nullptr, 10), strtoull(_fields[21].c_str(), nullptr, 10)});
+                sample_threads(process);
+                ++it;
+            } else {
+                fprintf(stderr, "Process %d (%s) exited\n", process.pid, process.comm.c_str());
+                std::string name = process_name(process);
+                for (auto s = _series.lower_bound(name); s != _series.end() && s->first.compare(0, name.size(), name) == 0;) {
+                    std::string ended = (s++)->first;
+                    if (ended.size() == name.size() || ended[name.size()] == '.') {
+                        end_series(ended);
+                    }
+                }
+                _given_pids.erase(process.pid);
+                it = _processes.erase(it);
+            }
+        }
+    }
+
+public:
+    Sampler(Writer &out, bool threads, const std::vector<pid_t> &pids, const std::vector<std::string> &patterns)
+        : _out(out), _threads(threads), _patterns(), _series(), _next_id(0), _last_time(0), _entries(), _num_entries(0),
+          _stat("/proc/stat"), _vmstat("/proc/vmstat"), _diskstats("/proc/diskstats"), _netdev("/proc/net/dev"),
+          _perf_cpus(), _processes(), _given_pids(pids.begin(), pids.end()), _whole_disk(), _last_scan(0),
+          _data(), _fields(), _comm()
+    {
+        for (const auto &pattern : patterns) {
+            _patterns.emplace_back();
+            if (regcomp(&_patterns.back(), pattern.c_str(), REG_EXTENDED | REG_NOSUB) != 0) {
+                fprintf(stderr, "Invalid pattern: %s\n", pattern.c_str());
+                exit(1);
+            }
+        }
+        long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+        for (long cpu = 0; cpu < num_cpus; ++cpu) {
+            auto group = std::make_unique<PerfGroup>(perf_cpu_configs, -1, cpu);
+            if (!group->valid()) {
+                if (cpu == 0) {
+                    fprintf(stderr, "No per CPU perf counters (%s), using /proc only\n", strerror(errno));
+                    break;
+                }
+                group.reset();
+            }
+            _perf_cpus.push_back(std::move(group));
+        }
+    }
+    ~Sampler() {
+        for (auto &pattern : _patterns) {
+            regfree(&pattern);
+        }
+    }
+
+    void sample() {
+        uint64_t time = now_ns(CLOCK_REALTIME);
+        if (time >= _last_scan + 1000000000) {
+            scan_processes();
+            _last_scan = time;
+        }
+        _entries.clear();
+        _num_entries = 0;
+        sample_stat();
+        sample_devices();
+        sample_processes();
+        _out.byte('S');
+        _out.varint(time - _last_time);
+        _out.varint(_num_entries);
+        _out.raw(_entries.data(), _entries.size());
+        _out.flush(false);
+        _last_time = time;
+    }
+};
+
+int record(const char *file_name, uint32_t interval_ms, double duration, bool threads,
+           const std::vector<pid_t> &pids, const std::vector<std::string> &patterns)
+{
+    FILE *file = fopen(file_name, "wb");
+    if (file == nullptr) {
+        perror(file_name);
+        return 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    Writer out(file);
+    uint32_t header[3] = {1, interval_ms * 1000, uint32_t(sysconf(_SC_CLK_TCK))};
+    out.raw("SYSS", 4);
+    out.raw(header, sizeof(header));
+    Sampler sampler(out, threads, pids, patterns);
+    uint64_t interval = uint64_t(interval_ms) * 1000000;
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    uint64_t next = start;
+    uint64_t samples = 0;
+    uint64_t busy = 0;
+    uint64_t late = 0;
+    while (!stop_requested && (duration <= 0 || next - start < duration * 1e9)) {
+        uint64_t before = now_ns(CLOCK_MONOTONIC);
+        sampler.sample();
+        uint64_t after = now_ns(CLOCK_MONOTONIC);
+        busy += after - before;
+        ++samples;
+        next += interval;
+        if (next < after) {
+            // Sampling took longer than the interval: skip the missed samples rather than catching up.
+            late += (after - next) / interval + 1;
+            next += ((after - next) / interval + 1) * interval;
+        }
+        timespec ts{time_t(next / 1000000000), long(next % 1000000000)};
+        while (!stop_requested && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        }
+    }
+    out.flush(true);
+    fclose(file);
+    fprintf(stderr, "samples: %lu\n", samples);
+    fprintf(stderr, "missed samples: %lu\n", late);
+    fprintf(stderr, "mean sampling time ms: %.3f\n", samples > 0 ? busy / 1e6 / samples : 0.0);
+    return 0;
+}
+
+/**
+ * Samples read back from a file: values of each series at each sample where it is present.
+ */
+struct Recording {
+    struct Series {
+        std::string kind;
+        std::string name;
+        std::vector<std::string> fields;
+        std::vector<bool> gauges;
+        std::vector<uint32_t> samples;             // sample indexes, ascending
+        std::vector<std::vector<uint64_t>> values; // values at those samples
+        uint32_t ended;                            // first sample where the series is gone
+
+        size_t field(const char *name) const {
+            return std::find(fields.begin(), fields.end(), name) - fields.begin();
+        }
+        // Index into samples/values of the last entry at or before sample s, or -1 if not present at s.
+        ssize_t at(uint32_t s) const {
+            if (s >= ended || samples.empty() || samples[0] > s) {
+                return -1;
+            }
+            return std::upper_bound(samples.begin(), samples.end(), s) - samples.begin() - 1;
+        }
+    };
+    uint32_t interval_us;
+    uint32_t ticks_per_second;
+    std::vector<uint64_t> times;
+    std::vector<Series> series;
+};
+
+Recording load(const char *file_name) {
+    FILE *file = fopen(file_name, "rb");
+    if (file == nullptr) {
+        perror(file_name);
+        exit(1);
+    }
+    std::string data;
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.append(buf, n);
+    }
+    fclose(file);
+    Recording r;
+    uint32_t header[3];
+    if (data.size() < 16 || data.compare(0, 4, "SYSS") != 0 || (memcpy(header, data.data() + 4, 12), header[0]) != 1) {
+        fprintf(stderr, "Not a system sampler file: %s\n", file_name);
+        exit(1);
+    }
+    r.interval_us = header[1];
+    r.ticks_per_second = header[2];
+    size_t pos = 16;
+    bool truncated = false;
+    auto varint = [&]() {
+        uint64_t v = 0;
+        for (int shift = 0; pos < data.size(); shift += 7) {
+            uint8_t b = data[pos++];
+            v |= uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return v;
+            }
+        }
+        truncated = true;
+        return v;
+    };
+    auto str = [&]() {
+        size_t len = varint();
+        if (pos + len > data.size()) {
+            truncated = true;
+            return std::string();
+        }
+        std::string s = data.substr(pos, len);
+        pos += len;
+        return s;
+    };
+    std::vector<int64_t> index; // file series id -> index in r.series
+    uint64_t time = 0;
+    while (pos < data.size() && !truncated) {
+        char type = data[pos++];
+        if (type == 'D') {
+            uint64_t id = varint();
+            Recording::Series s;
+            s.kind = str();
+            s.name = str();
+            size_t num_fields = varint();
+            for (size_t i = 0; i < num_fields && pos < data.size(); ++i) {
+                s.fields.push_back(str());
+                s.gauges.push_back(data[pos++] != 0);
+            }
+            s.ended = UINT32_MAX;
+            if (index.size() <= id) {
+                index.resize(id + 1, -1);
+            }
+            index[id] = r.series.size();
+            r.series.push_back(std::move(s));
+        } else if (type == 'S') {
+            time += varint();
+            uint64_t entries = varint();
+            std::vector<std::pair<size_t, std::vector<uint64_t>>> sample;
+            for (uint64_t e = 0; e < entries && !truncated; ++e) {
+                uint64_t id = varint();
+                if (id >= index.size() || index[id] < 0) {
+                    truncated = true;
+                    break;
+                }
+                Recording::Series &s = r.series[index[id]];
+                std::vector<uint64_t> v = s.values.empty() ? std::vector<uint64_t>(s.fields.size(), 0) : s.values.back();
+                for (auto &value : v) {
+                    uint64_t z = varint();
+                    value += (z >> 1) ^ (~(z & 1) + 1);
+                }
+                sample.emplace_back(index[id], std::move(v));
+            }
+            if (truncated) {
+                break;
+            }
+            for (auto &entry : sample) {
+                r.series[entry.first].samples.push_back(r.times.size());
+                r.series[entry.first].values.push_back(std::move(entry.second));
+            }
+            r.times.push_back(time);
+        } else if (type == 'E') {
+            uint64_t id = varint();
+            if (id < index.size() && index[id] >= 0) {
+                r.series[index[id]].ended = r.times.size();
+                index[id] = -1;
+            }
+        } else {
+            truncated = true;
+        }
+    }
+    if (truncated) {
+        // The sampler may have been killed in the middle of a write; use the complete samples.
+        fprintf(stderr, "Ignoring truncated data at the end of %s\n", file_name);
+    }
+    return r;
+}
+
+/**
+ * A metric derived from one series: a value for the window between two samples, given the values at both.
+ */
+struct Metric {
+    std::string name;
+    size_t series;
+    std::function<double(const std::vector<uint64_t> &from, const std::vector<uint64_t> &to, double seconds)> value;
+};
+
+struct Phase {
+    std::string name;
+    uint64_t start;
+    uint64_t end;
+};
+
+std::vector<Phase> load_marks(const char *file_name) {
+    std::vector<Phase> phases;
+    if (file_name == nullptr) {
+        return phases;
+    }
+    FILE *file = fopen(file_name, "r");
+    if (file == nullptr) {
+        perror(file_name);
+        exit(1);
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        char *end;
+        double seconds = strtod(line, &end);
+        if (end == line) {
+            continue;
+        }
+        std::string name(end + strspn(end, " \t"));
+        name.erase(name.find_last_not_of(" \t\r\n") + 1);
+        uint64_t time = uint64_t(seconds * 1e9);
+        if (!phases.empty() && phases.back().end == UINT64_MAX) {
+            phases.back().end = time;
+        }
+        if (name != "end" && !name.empty()) {
+            phases.push_back({name, time, UINT64_MAX});
+        }
+    }
+    fclose(file);
+    return phases;
+}
+
+std::string metric_prefix(const Recording::Series &s) {
+    if (s.kind == "cpu") {
+        return s.name;
+    }
+    if (s.kind == "disk" || s.kind == "net") {
+        return s.kind + "." + s.name.substr(s.kind.size() + 1);
+    }
+    if (s.kind == "perf_process") {
+        return s.name.substr(0, s.name.size() - 5);
+    }
+    return s.name;
+}
+
+std::vector<Metric> make_metrics(const Recording &r, bool per_cpu) {
+    std::vector<Metric> metrics;
+    double ticks = r.ticks_per_second;
+    auto counter = [&](size_t s, const std::string &name, const char *field, double scale) {
+        size_t f = r.series[s].field(field);
+        metrics.push_back({name, s, [f, scale](const auto &from, const auto &to, double seconds) {
+            return (to[f] - from[f]) * scale / seconds;
+        }});
+    };
+    auto gauge = [&](size_t s, const std::string &name, const char *field, double scale) {
+        size_t f = r.series[s].field(field);
+        metrics.push_back({name, s, [f, scale](const auto &, const auto &to, double) { return to[f] * scale; }});
+    };
+    for (size_t s = 0; s < r.series.size(); ++s) {
+        const Recording::Series &series = r.series[s];
+        std::string prefix = metric_prefix(series);
+        if (series.kind == "cpu" && (series.name == "cpu" || per_cpu)) {
+            // Percent of the CPU time of the window, where 'cpu' is all CPUs, so 100% is all CPUs busy.
+            auto share = [](std::vector<size_t> fields, bool invert) {
+                return [fields, invert](const std::vector<uint64_t> &from, const std::vector<uint64_t> &to, double) {
+                    uint64_t total = 0;
+                    uint64_t part = 0;
+                    for (size_t i = 0; i < to.size(); ++i) {
+                        total += to[i] - from[i];
+                    }
+                    for (size_t i : fields) {
+                        part += to[i] - from[i];
+                    }
+                    return (total == 0) ? 0.0 : 100.0 * (invert ? total - part : part) / total;
+                };
+            };
+            metrics.push_back({prefix + ".util", s, share({3, 4}, true)});
+            metrics.push_back({prefix + ".system", s, share({2, 5, 6}, false)});
+            metrics.push_back({prefix + ".iowait", s, share({4}, false)});
+            metrics.push_back({prefix + ".steal", s, share({7}, false)});
+        } else if (series.kind == "system") {
+            counter(s, "context_switches", "context_switches", 1.0);
+            counter(s, "forks", "forks", 1.0);
+            gauge(s, "procs_running", "procs_running", 1.0);
+            gauge(s, "procs_blocked", "procs_blocked", 1.0);
+            counter(s, "page_faults", "page_faults", 1.0);
+            counter(s, "major_faults", "major_faults", 1.0);
+            counter(s, "swap_in", "swap_in", 1.0);
+            counter(s, "swap_out", "swap_out", 1.0);
+        } else if (series.kind == "perf_cpu" && per_cpu) {
+            counter(s, prefix + ".context_switches", "context_switches", 1.0);
+            counter(s, prefix + ".cpu_migrations", "cpu_migrations", 1.0);
+        } else if (series.kind == "process") {
+            // CPU in percent of one core, from clock ticks; see the perf task clock below for short windows.
+            size_t utime = series.field("utime");
+            size_t stime = series.field("stime");
+            metrics.push_back({prefix + ".cpu_ticks", s, [=](const auto &from, const auto &to, double seconds) {
+                return 100.0 * (to[utime] - from[utime] + to[stime] - from[stime]) / ticks / seconds;
+            }});
+            counter(s, prefix + ".page_faults", "page_faults", 1.0);
+            counter(s, prefix + ".major_faults", "major_faults", 1.0);
+            gauge(s, prefix + ".threads", "threads", 1.0);
+            gauge(s, prefix + ".rss_mb", "rss_pages", sysconf(_SC_PAGESIZE) / 1048576.0);
+        } else if (series.kind == "perf_process") {
+            counter(s, prefix + ".cpu", "task_clock_ns", 100.0 / 1e9);
+            counter(s, prefix + ".context_switches", "context_switches", 1.0);
+            counter(s, prefix + ".cpu_migrations", "cpu_migrations", 1.0);
+        } else if (series.kind == "thread") {
+            counter(s, prefix + ".cpu", "run_ns", 100.0 / 1e9);
+            counter(s, prefix + ".runqueue_wait", "wait_ns", 100.0 / 1e9);
+            counter(s, prefix + ".timeslices", "timeslices", 1.0);
+        } else if (series.kind == "disk") {
+            counter(s, prefix + ".reads", "reads", 1.0);
+            counter(s, prefix + ".read_kib", "sectors_read", 0.5);
+            counter(s, prefix + ".writes", "writes", 1.0);
+            counter(s, prefix + ".write_kib", "sectors_written", 0.5);
+            counter(s, prefix + ".util", "io_ms", 0.1);
+            gauge(s, prefix + ".in_progress", "in_progress", 1.0);
+        } else if (series.kind == "net") {
+            counter(s, prefix + ".rx_kib", "rx_bytes", 1.0 / 1024);
+            counter(s, prefix + ".rx_packets", "rx_packets", 1.0);
+            counter(s, prefix + ".tx_kib", "tx_bytes", 1.0 / 1024);
+            counter(s, prefix + ".tx_packets", "tx_packets", 1.0);
+            counter(s, prefix + ".drops", "rx_drop", 1.0);
+        }
+    }
+    return metrics;
+}
+
+struct Stats {
+    double weighted;
+    double seconds;
+    double min;
+    double max;
+    bool active; // some window had a non-zero value
+};
+
+/**
+ * Windows of at least 'window' ns between the samples of [first, last], where the series is present at both ends.
+ */
+Stats summarize(const Recording &r, const Metric &metric, uint32_t first, uint32_t last, uint64_t window) {
+    const Recording::Series &series = r.series[metric.series];
+    Stats stats{0.0, 0.0, INFINITY, -INFINITY, false};
+    ssize_t from = -1;
+    uint32_t from_sample = first;
+    for (uint32_t s = first; s <= last; ++s) {
+        ssize_t at = series.at(s);
+        if (at < 0) {
+            from = -1;
+            continue;
+        }
+        if (from < 0) {
+            from = at;
+            from_sample = s;
+            continue;
+        }
+        uint64_t ns = r.times[s] - r.times[from_sample];
+        if (ns < window && s < last) {
+            continue;
+        }
+        double seconds = ns / 1e9;
+        if (seconds > 0) {
+            double v = metric.value(series.values[from], series.values[at], seconds);
+            stats.weighted += v * seconds;
+            stats.seconds += seconds;
+            stats.min = std::min(stats.min, v);
+            stats.max = std::max(stats.max, v);
+            stats.active = stats.active || v != 0.0;
+        }
+        from = at;
+        from_sample = s;
+    }
+    return stats;
+}
+
+int summary(const char *file_name, const char *marks, uint64_t window, size_t top_threads, bool per_cpu) {
+    Recording r = load(file_name);
+    if (r.times.size() < 2) {
+        fprintf(stderr, "Too few samples in %s\n", file_name);
+        return 1;
+    }
+    std::vector<Phase> phases{{"all", r.times.front(), r.times.back()}};
+    for (auto &phase : load_marks(marks)) {
+        phases.push_back(phase);
+    }
+    std::vector<Metric> metrics = make_metrics(r, per_cpu);
+    printf("# phase\tmetric\tmean\tmin\tmax\n");
+    for (const auto &phase : phases) {
+        uint32_t first = std::lower_bound(r.times.begin(), r.times.end(), phase.start) - r.times.begin();
+        uint32_t last = std::upper_bound(r.times.begin(), r.times.end(), phase.end) - r.times.begin();
+        if (last < first + 2) {
+            fprintf(stderr, "No samples in phase %s\n", phase.name.c_str());
+            continue;
+        }
+        --last;
+        double seconds = (r.times[last] - r.times[first]) / 1e9;
+        double max_gap = 0.0;
+        double min_gap = INFINITY;
+        for (uint32_t s = first + 1; s <= last; ++s) {
+            double gap = (r.times[s] - r.times[s - 1]) / 1e6;
+            max_gap = std::max(max_gap, gap);
+            min_gap = std::min(min_gap, gap);
+        }
+        printf("%s\tsampler.seconds\t%.3f\t%.3f\t%.3f\n", phase.name.c_str(), seconds, seconds, seconds);
+        printf("%s\tsampler.interval_ms\t%.3f\t%.3f\t%.3f\n", phase.name.c_str(), seconds * 1e3 / (last - first),
+               min_gap, max_gap);
+        // Threads are ranked by mean CPU, and only the top ones are printed.
+        std::vector<std::pair<double, size_t>> threads;
+        std::vector<std::pair<size_t, Stats>> rows;
+        for (size_t m = 0; m < metrics.size(); ++m) {
+            Stats stats = summarize(r, metrics[m], first, last, window);
+            if (stats.seconds <= 0) {
+                continue;
+            }
+            // Idle devices and threads are left out.
+            const std::string &kind = r.series[metrics[m].series].kind;
+            if ((kind == "disk" || kind == "net" || kind == "thread") && !stats.active) {
+                continue;
+            }
+            if (kind == "thread" && metrics[m].name.size() > 4 &&
+                metrics[m].name.compare(metrics[m].name.size() - 4, 4, ".cpu") == 0)
+            {
+                threads.emplace_back(stats.weighted / stats.seconds, metrics[m].series);
+            }
+            rows.emplace_back(m, stats);
+        }
+        std::sort(threads.begin(), threads.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+        std::set<size_t> top;
+        for (size_t i = 0; i < std::min(top_threads, threads.size()); ++i) {
+            top.insert(threads[i].second);
+        }
+        for (const auto &row : rows) {
+            const Metric &metric = metrics[row.first];
+            if (r.series[metric.series].kind == "thread" && top.count(metric.series) == 0) {
+                continue;
+            }
+            const Stats &stats = row.second;
+            printf("%s\t%s\t%.3f\t%.3f\t%.3f\n", phase.name.c_str(), metric.name.c_str(),
+                   stats.weighted / stats.seconds, stats.min, stats.max);
+        }
+    }
+    return 0;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -o <file> [-i ms] [-d seconds] [-p pid] [-n pattern] [-t]\n"
+                    "       %s -s <file> [-m marks] [-w ms] [-k threads] [-c]\n"
+                    "  -o: record samples to the file until SIGINT or SIGTERM, or for -d seconds\n"
+                    "  -i: sampling interval in ms (default 50)\n"
+                    "  -p: sample this process, may be repeated\n"
+                    "  -n: sample processes with a command line matching this extended regex, may be repeated\n"
+                    "  -t: sample each thread of the sampled processes\n"
+                    "  -s: summarize a recording, with phases from the marks file given with -m\n"
+                    "  -w: window in ms for min and max (default 100)\n"
+                    "  -k: number of threads to summarize, by CPU use (default 10)\n"
+                    "  -c: summarize each CPU\n", prog, prog);
+}
+
+}
+
+int main(int argc, char **argv) {
+    const char *output = nullptr;
+    const char *input = nullptr;
+    const char *marks = nullptr;
+    uint32_t interval_ms = 50;
+    double duration = 0.0;
+    bool threads = false;
+    bool per_cpu = false;
+    uint64_t window_ms = 100;
+    size_t top_threads = 10;
+    std::vector<pid_t> pids;
+    std::vector<std::string> patterns;
+    int option;
+    while ((option = getopt(argc, argv, "o:i:d:p:n:ts:m:w:k:ch")) != -1) {
+        switch (option) {
+        case 'o': output = optarg; break;
+        case 'i': interval_ms = std::max(1, atoi(optarg)); break;
+        case 'd': duration = atof(optarg); break;
+        case 'p': pids.push_back(atoi(optarg)); break;
+        case 'n': patterns.emplace_back(optarg); break;
+        case 't': threads = true; break;
+        case 's': input = optarg; break;
+        case 'm': marks = optarg; break;
+        case 'w': window_ms = strtoull(optarg, nullptr, 0); break;
+        case 'k': top_threads = strtoul(optarg, nullptr, 0); break;
+        case 'c': per_cpu = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (input != nullptr) {
+        return summary(input, marks, window_ms * 1000000, top_threads, per_cpu);
+    }
+    if (output == nullptr) {
+        usage(argv[0]);
+        return 1;
+    }
+    return record(output, interval_ms, duration, threads, pids, patterns);
+}
@@ -0,0 +1,345 @@
+// Copyright Vespa.ai. All rights reserved.
+// Text generation for C++ feed generators, header only.
+//
+// Words are drawn from a vocabulary with realistic (Zipfian) term frequencies, normally the
+// word tally in gpt-2-webtext-tally.txt (also used by DataGenerator.java), using an alias table
+// so each word costs O(1). Document lengths follow a configurable distribution, and a set of
+// multi-word phrases can be mixed in to get term co-occurrence. Documents are formatted by
+// several threads with a per-document random state, so output does not depend on thread count.
+//
+// Compile generators using this with: g++ -std=c++17 -O3 -pthread -I<system-test>/lib ...
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace textgen {
+
+inline uint64_t mix(uint64_t x) {
+    // splitmix64
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * xoshiro256** random generator.
+ */
+class Rng {
+    uint64_t _s[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+public:
+    explicit Rng(uint64_t seed) {
+        for (auto &s : _s) {
+            seed = mix(seed);
+            s = seed;
+        }
+    }
+    uint64_t next() {
+        const uint64_t result = rotl(_s[1] * 5, 7) * 9;
+        const uint64_t t = _s[1] << 17;
+        _s[2] ^= _s[0];
+        _s[3] ^= _s[1];
+        _s[1] ^= _s[2];
+        _s[0] ^= _s[3];
+        _s[2] ^= t;
+        _s[3] = rotl(_s[3], 45);
+        return result;
+    }
+    // Uniform in [0, 1)
+    double next_double() { return (next() >> 11) * 0x1.0p-53; }
+    // Uniform in [0, n), n > 0
+    uint64_t below(uint64_t n) { return uint64_t((unsigned __int128)(next()) * n >> 64); }
+    bool chance(double p) { return next_double() < p; }
+};
+
+/**
+ * Vose's alias method: O(n) construction, O(1) sampling from a discrete distribution.
+ */
+class AliasTable {
+    std::vector<double> _prob;
+    std::vector<uint32_t> _alias;
+
+public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<double> &weights)
+        : _prob(weights.size()), _alias(weights.size(), 0)
+    {
+        size_t n = weights.size();
+        double sum = 0.0;
+        for (double w : weights) {
+            sum += w;
+        }
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small;
+        std::vector<uint32_t> large;
+        for (size_t i = 0; i < n; ++i) {
+            scaled[i] = weights[i] * n / sum;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back();
+            uint32_t l = large.back();
+            small.pop_back();
+            _prob[s] = scaled[s];
+            _alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        for (uint32_t i : large) {
+            _prob[i] = 1.0;
+        }
+        for (uint32_t i : small) {
+            _prob[i] = 1.0;
+        }
+    }
+    size_t size() const { return _prob.size(); }
+    size_t sample(Rng &rng) const {
+        size_t i = rng.below(_prob.size());
+        return (rng.next_double() < _prob[i]) ? i : _alias[i];
+    }
+};
+
+/**
+ * Words and their relative frequencies, most frequent first.
+ */
+class Vocabulary {
+    std::string _text;
+    std::vector<std::pair<uint32_t, uint32_t>> _words;  // offset and length in _text
+    std::vector<double> _weights;
+
+public:
+    void add(std::string_view word, double weight) {
+        _words.emplace_back(_text.size(), word.size());
+        _text.append(word);
+        _weights.push_back(weight);
+    }
+    size_t size() const { return _words.size(); }
+    std::string_view word(size_t i) const { return {_text.data() + _words[i].first, _words[i].second}; }
+    const std::vector<double> &weights() const { return _weights; }
+
+    /**
+     * Loads a tally file with lines '<count> <word>', as gpt-2-webtext-tally.txt. Only the
+     * 'max_words' most frequent words are kept unless it is 0. Words with characters that
+     * would need escaping in JSON are skipped.
+     */
+    static Vocabulary load_tally(const std::string &file_name, size_t max_words = 0) {
+        std::ifstream in(file_name);
+        if (!in) {
+            throw std::runtime_error("Could not open tally file '" + file_name + "'");
+        }
+        std::vector<std::pair<double, std::string>> entries;
+        double count;
+        std::string word;
+        while (in >> count >> word) {
+            if (std::all_of(word.begin(), word.end(), [](unsigned char c) { return c > 0x20 && c != '"' && c != '\\'; })) {
+                entries.emplace_back(count, word);
+            }
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+        if (max_words != 0 && entries.size() > max_words) {
+            entries.resize(max_words);
+        }
+        Vocabulary result;
+        for (const auto &entry : entries) {
+            result.add(entry.second, entry.first);
+        }
+        return result;
+    }
+
+    /**
+     * Synthetic vocabulary '<prefix><rank>' where the word of rank r has weight 1 / r^s.
+     */
+    static Vocabulary zipf(size_t num_words, double s, const std::string &prefix = "word") {
+        Vocabulary result;
+        for (size_t i = 0; i < num_words; ++i) {
+            result.add(prefix + std::to_string(i), std::pow(double(i + 1), -s));
+        }
+        return result;
+    }
+};
+
+/**
+ * Number of words in a generated field: 'fixed:<n>', 'uniform:<min>:<max>' or
+ * 'lognormal:<mean>:<sigma>' (mean of the resulting distribution, sigma of the underlying normal).
+ */
+class LengthDistribution {
+    enum class Kind { FIXED, UNIFORM, LOGNORMAL };
+    Kind _kind;
+    double _a;
+    double _b;
+
+    LengthDistribution(Kind kind, double a, double b) : _kind(kind), _a(a), _b(b) {}
+
+public:
+    static LengthDistribution fixed(size_t n) { return {Kind::FIXED, double(n), 0.0}; }
+    static LengthDistribution parse(const std::string &spec) {
+        double a = 0.0;
+        double b = 0.0;
+        if (sscanf(spec.c_str(), "fixed:%lf", &a) == 1) {
+            return {Kind::FIXED, a, 0.0};
+        }
+        if (sscanf(spec.c_str(), "uniform:%lf:%lf", &a, &b) == 2 && a <= b) {
+            return {Kind::UNIFORM, a, b};
+        }
+        if (sscanf(spec.c_str(), "lognormal:%lf:%lf", &a, &b) == 2 && a > 0.0) {
+            // Choose mu so that the mean is 'a'.
+            return {Kind::LOGNORMAL, std::log(a) - b * b / 2.0, b};
+        }
+        throw std::invalid_argument("Bad length distribution '" + spec + "'");
+    }
+    size_t sample(Rng &rng) const {
+        switch (_kind) {
+        case Kind::FIXED:
+            break;
+        case Kind::UNIFORM:
+            return size_t(_a) + rng.below(size_t(_b) - size_t(_a) + 1);
+        case Kind::LOGNORMAL: {
+            // Box-Muller
+            double u1 = 1.0 - rng.next_double();
+            double u2 = rng.next_double();
+            double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+            return std::max<size_t>(1, size_t(std::exp(_a + _b * z) + 0.5));
+        }
+        }
+        return size_t(_a);
+    }
+};
+
+/**
+ * Phrase co-occurrence: 'num_phrases' fixed word sequences of 'min_length' to 'max_length' words,
+ * drawn from the vocabulary. At each position a phrase is inserted with 'probability', choosing
+ * phrases with Zipf(1) popularity so some phrases are common and most are rare.
+ */
+struct PhraseConfig {
+    size_t num_phrases = 0;
+    size_t min_length = 2;
+    size_t max_length = 4;
+    double probability = 0.0;
+    uint64_t seed = 42;
+};
+
+class TextGenerator {
+    Vocabulary _vocabulary;
+    AliasTable _words;
+    PhraseConfig _phrase_config;
+    std::vector<std::vector<uint32_t>> _phrases;
+    AliasTable _phrase_table;
+
+public:
+    explicit TextGenerator(Vocabulary vocabulary, const PhraseConfig &phrase_config = PhraseConfig())
+        : _vocabulary(std::move(vocabulary)),
+          _words(_vocabulary.weights()),
+          _phrase_config(phrase_config),
+          _phrases(),
+          _phrase_table()
+    {
+        if (_vocabulary.size() == 0) {
+            throw std::invalid_argument("Empty vocabulary");
+        }
+        if (_phrase_config.num_phrases > 0 && _phrase_config.probability > 0.0) {
+            Rng rng(_phrase_config.seed);
+            std::vector<double> weights;
+            for (size_t i = 0; i < _phrase_config.num_phrases; ++i) {
+                size_t length = _phrase_config.min_length +
+                                rng.below(_phrase_config.max_length - _phrase_config.min_length + 1);
+                std::vector<uint32_t> phrase;
+                for (size_t j = 0; j < length; ++j) {
+                    phrase.push_back(_words.sample(rng));
+                }
+                _phrases.push_back(std::move(phrase));
+                weights.push_back(1.0 / double(i + 1));
+            }
+            _phrase_table = AliasTable(weights);
+        }
+    }
+    const Vocabulary &vocabulary() const { return _vocabulary; }
+    size_t num_phrases() const { return _phrases.size(); }
+    const std::vector<uint32_t> &phrase(size_t i) const { return _phrases[i]; }
+
+    size_t sample_word(Rng &rng) const { return _words.sample(rng); }
+
+    /**
+     * Appends 'num_words' space separated words to 'out'. If 'word_ids' is given, the id of
+     * each generated word is appended to it.
+     */
+    void append_words(std::string &out, Rng &rng, size_t num_words, std::vector<uint32_t> *word_ids = nullptr) const {
+        auto append = [&](uint32_t id) {
+            if (word_ids != nullptr) {
+                word_ids->push_back(id);
+            }
+            std::string_view word = _vocabulary.word(id);
+            out.push_back(' ');
+            out.append(word.data(), word.size());
+        };
+        size_t start = out.size();
+        size_t written = 0;
+        while (written < num_words) {
+            if (!_phrases.empty() && rng.chance(_phrase_config.probability)) {
+                const auto &phrase = _phrases[_phrase_table.sample(rng)];
+                for (size_t i = 0; i < phrase.size() && written < num_words; ++i, ++written) {
+                    append(phrase[i]);
+                }
+            } else {
+                append(_words.sample(rng));
+                ++written;
+            }
+        }
+        if (out.size() > start) {
+            out.erase(start, 1);  // leading space
+        }
+    }
+};
+
+/**
+ * Formats documents [first, last) with 'num_threads' threads and writes them in order to 'out'.
+ * 'format' is called as format(std::string &buffer, uint64_t doc_id, Rng &rng) and must append
+ * the document (including any separator) to the buffer. Each document gets its own random state
+ * derived from 'seed' and its id.
+ */
+template <typename Format>
+void write_documents(FILE *out, uint64_t first, uint64_t last, int num_threads, uint64_t seed, Format format) {
+    constexpr uint64_t block_size = 4096;
+    num_threads = std::max(1, num_threads);
+    std::vector<std::string> buffers(num_threads);
+    for (uint64_t round_begin = first; round_begin < last; round_begin += block_size * num_threads) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t) {
+            uint64_t begin = std::min(last, round_begin + t * block_size);
+            uint64_t end = std::min(last, begin + block_size);
+            threads.emplace_back([&, t, begin, end]() {
+                std::string &buffer = buffers[t];
+                buffer.clear();
+                for (uint64_t doc_id = begin; doc_id < end; ++doc_id) {
+                    Rng rng(seed ^ mix(doc_id));
+                    format(buffer, doc_id, rng);
+                }
+            });
+        }
+        for (int t = 0; t < num_threads; ++t) {
+            threads[t].join();
+            fwrite(buffers[t].data(), 1, buffers[t].size(), out);
+        }
+    }
+}
+
+}
@@ -5,6 +5,7 @@ require 'performance/fbench'
 require 'pp'
 require 'document_set'
 require 'document'
+require 'data_generator'
 
 class DocumentStoreTest < PerformanceTest
   def setup
@@ -16,7 +17,7 @@ class DocumentStoreTest < PerformanceTest
     container = (vespa.qrserver['0'] or vespa.container.values.first)
     tmp_bin_dir = container.create_tmp_bin_dir
     @feed_generator = "#{tmp_bin_dir}/feed_generator"
-    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -O3 -o #{@feed_generator} #{selfdir}feed_generator.cpp")
+    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -std=c++17 -O3 -pthread -I#{DataGenerator.lib_dir} -o #{@feed_generator} #{selfdir}feed_generator.cpp -ldl")
   end
 
   def compile_query_generator
@@ -24,7 +25,7 @@ class DocumentStoreTest < PerformanceTest
     container = (vespa.qrserver['0'] or vespa.container.values.first)
     tmp_bin_dir = container.create_tmp_bin_dir
     @query_generator = "#{tmp_bin_dir}/query_generator"
-    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -O3 -o #{@query_generator} #{selfdir}query_generator.cpp")
+    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -std=c++17 -O3 -I#{DataGenerator.lib_dir} -o #{@query_generator} #{selfdir}query_generator.cpp")
   end
 
   def warm_up
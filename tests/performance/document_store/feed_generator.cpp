@@ -1,43 +1,309 @@
 // Copyright Vespa.ai. All rights reserved.
 
+/**
+ * Generates documents with a string field 'content' for document store benchmarks.
+ *
+ * Usage: feed_generator [options] <num docs> <content length>
+ *
+ * By default content is random alphanumeric characters (as before), which compresses the same
+ * whatever the document store settings are. With -r <ratio> content is instead a mix of repeated
+ * dictionary phrases, words drawn from a tally file (-w) and random characters, where the mix is
+ * calibrated on the first documents so that chunks of documents compress with the given ratio
+ * (uncompressed / compressed) using zstd or lz4 (-c). The compressor is loaded at runtime and only
+ * needed for calibration. Ratios from about 1.4 (zstd) or 1.3 (lz4) up to about 15 are reachable.
+ *
+ * Options:
+ *   -r <ratio>           target compression ratio, e.g. 3.0
+ *   -c zstd[:level]|lz4  compressor to calibrate against (default zstd:3)
+ *   -k <bytes>           chunk size used when measuring the ratio (default 65536)
+ *   -w <tally file>      draw words from this tally file (e.g. lib/gpt-2-webtext-tally.txt)
+ *   -p <num phrases>     size of the phrase dictionary (default 1000)
+ *   -l <length>          content length in bytes per document, see textgen::LengthDistribution
+ *                        (default fixed:<content length>)
+ *   -s <seed>            random seed for generated content (default 7)
+ *   -t <threads>         number of threads formatting documents (default 1)
+ *
+ * Compile with: g++ -std=c++17 -O3 -pthread -I<system-test>/lib feed_generator.cpp -ldl
+ **/
+
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <dlfcn.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "text_generator.h"
+
+namespace {
+
+const char alnum[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+struct Params {
+    unsigned int num_docs = 0;
+    std::string length;
+    double ratio = 0.0;
+    std::string compressor = "zstd:3";
+    size_t chunk_size = 65536;
+    std::string tally_file;
+    size_t num_phrases = 1000;
+    uint64_t seed = 7;
+    int num_threads = 1;
+};
+
+/**
+ * zstd or lz4 one-shot compression, resolved with dlopen so the generator builds without their headers.
+ */
+class Compressor {
+    using ZstdBound = size_t (*)(size_t);
+    using ZstdCompress = size_t (*)(void *, size_t, const void *, size_t, int);
+    using ZstdIsError = unsigned (*)(size_t);
+    using Lz4Bound = int (*)(int);
+    using Lz4Compress = int (*)(const char *, char *, int, int);
+
+    void *_lib = nullptr;
+    bool _zstd = true;
+    int _level = 3;
+    ZstdBound _zstd_bound = nullptr;
+    ZstdCompress _zstd_compress = nullptr;
+    ZstdIsError _zstd_is_error = nullptr;
+    Lz4Bound _lz4_bound = nullptr;
+    Lz4Compress _lz4_compress = nullptr;
+
+public:
+    explicit Compressor(const std::string &spec) {
+        if (spec.compare(0, 4, "zstd") == 0) {
+            if (spec.size() > 5) {
+                _level = atoi(spec.c_str() + 5);
+            }
+            _lib = dlopen("libzstd.so.1", RTLD_NOW);
+            if (_lib != nullptr) {
+                _zstd_bound = reinterpret_cast<ZstdBound>(dlsym(_lib, "ZSTD_compressBound"));
+                _zstd_compress = reinterpret_cast<ZstdCompress>(dlsym(_lib, "ZSTD_compress"));
+                _zstd_is_error = reinterpret_cast<ZstdIsError>(dlsym(_lib, "ZSTD_isError"));
+            }
+        } else if (spec == "lz4") {
+            _zstd = false;
+            _lib = dlopen("liblz4.so.1", RTLD_NOW);
+            if (_lib != nullptr) {
+                _lz4_bound = reinterpret_cast<Lz4Bound>(dlsym(_lib, "LZ4_compressBound"));
+                _lz4_compress = reinterpret_cast<Lz4Compress>(dlsym(_lib, "LZ4_compress_default"));
+            }
+        } else {
+            fprintf(stderr, "Unknown compressor '%s'\n", spec.c_str());
+            exit(1);
+        }
+        if (_zstd ? (_zstd_compress == nullptr || _zstd_bound == nullptr || _zstd_is_error == nullptr)
+                  : (_lz4_compress == nullptr || _lz4_bound == nullptr)) {
+            fprintf(stderr, "Could not load %s: %s\n", spec.c_str(), dlerror());
+            exit(1);
+        }
+    }
+    ~Compressor() {
+        dlclose(_lib);
+    }
+    size_t compressed_size(const std::string &data) const {
+        std::vector<char> out;
+        if (_zstd) {
+            out.resize(_zstd_bound(data.size()));
+            size_t size = _zstd_compress(out.data(), out.size(), data.data(), data.size(), _level);
+            return _zstd_is_error(size) ? data.size() : size;
+        }
+        out.resize(_lz4_bound(data.size()));
+        return _lz4_compress(data.data(), out.data(), data.size(), out.size());
+    }
+};
+
+/**
+ * Content made of segments that are either random characters, a phrase from a fixed dictionary
+ * or, given a tally file, words with realistic frequencies. Random characters hardly compress,
+ * while phrases repeat across documents in a chunk. The mix is set by a single level in [0, 2]:
+ * up to 1 the share of random segments goes from 1 to 0, above 1 words are phased out and
+ * phrases are drawn from a shrinking part of the dictionary, so the compression ratio grows
+ * with the level.
+ */
+class ContentModel {
+    std::unique_ptr<textgen::TextGenerator> _words;
+    std::vector<std::string> _phrases;
+    textgen::AliasTable _phrase_table;
+    double _level = 0.0;
+    double _random_share = 1.0;
+    double _word_share = 0.5;
+    size_t _phrase_limit = 1;
+
+    static void append_random(std::string &out, textgen::Rng &rng, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            out.push_back(alnum[rng.below(62)]);
+        }
+    }
 
-void randomString(unsigned int stringSize) {
-    const char alnum[] =
-        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+public:
+    ContentModel(const Params &params) {
+        if (!params.tally_file.empty()) {
+            _words = std::make_unique<textgen::TextGenerator>(textgen::Vocabulary::load_tally(params.tally_file));
+        }
+        textgen::Rng rng(params.seed ^ 0x5eed);
+        std::vector<double> weights;
+        for (size_t i = 0; i < std::max<size_t>(1, params.num_phrases); ++i) {
+            std::string phrase;
+            if (_words) {
+                _words->append_words(phrase, rng, 3 + rng.below(8));
+            } else {
+                append_random(phrase, rng, 16 + rng.below(48));
+            }
+            _phrases.push_back(phrase + " ");
+            weights.push_back(1.0 / double(i + 1));
+        }
+        _phrase_table = textgen::AliasTable(weights);
+        set_level(0.0);
+    }
+    void set_level(double level) {
+        _level = level;
+        _random_share = std::max(0.0, 1.0 - level);
+        _word_share = _words ? 0.5 * std::min(1.0, 2.0 - level) : 0.0;
+        double exponent = std::min(1.0, 2.0 - level);
+        _phrase_limit = std::max<size_t>(1, size_t(std::pow(double(_phrases.size()), exponent) + 0.5));
+    }
+    double level() const { return _level; }
 
-    printf("\"");
-    for (unsigned int i = 0; i < stringSize; i++) {
-        printf("%c", alnum[rand() % 62]);
+    void append(std::string &out, textgen::Rng &rng, size_t length) const {
+        size_t end = out.size() + length;
+        std::string words;
+        while (out.size() < end) {
+            size_t left = end - out.size();
+            if (rng.chance(_random_share)) {
+                append_random(out, rng, std::min(left, size_t(8 + rng.below(57))));
+            } else if (rng.chance(_word_share)) {
+                words.clear();
+                _words->append_words(words, rng, 2 + rng.below(10));
+                words.push_back(' ');
+                out.append(words, 0, std::min(left, words.size()));
+            } else {
+                const std::string &phrase = _phrases[_phrase_table.sample(rng) % _phrase_limit];
+                out.append(phrase, 0, std::min(left, phrase.size()));
+            }
+        }
     }
-    printf("\"");
+};
+
+void format_doc(std::string &out, unsigned int id, unsigned int numDocs, const std::string &content) {
+    char buf[128];
+    out.append(buf, snprintf(buf, sizeof(buf), "{\"put\": \"id:doc:doc::%u\", \"fields\": { \"doc_id\": %u, \"content\": \"", id, id));
+    out += content;
+    out += "\" } }";
+    out += (id < numDocs) ? ",\n" : "\n";
 }
 
-void content(unsigned int contentLength) {
-    printf("\"content\": ");
-    randomString(contentLength);
+/**
+ * Compression ratio of the content of the first documents, compressed in chunks of 'chunk_size' bytes.
+ */
+double measure_ratio(const ContentModel &model, const textgen::LengthDistribution &length, const Compressor &compressor,
+                     const Params &params)
+{
+    constexpr size_t num_chunks = 16;
+    size_t uncompressed = 0;
+    size_t compressed = 0;
+    std::string chunk;
+    std::string content;
+    unsigned int id = 1;
+    for (size_t c = 0; c < num_chunks && id <= params.num_docs; ++c) {
+        chunk.clear();
+        while (chunk.size() < params.chunk_size && id <= params.num_docs) {
+            textgen::Rng rng(params.seed ^ textgen::mix(id));
+            content.clear();
+            model.append(content, rng, length.sample(rng));
+            format_doc(chunk, id, params.num_docs, content);
+            ++id;
+        }
+        uncompressed += chunk.size();
+        compressed += compressor.compressed_size(chunk);
+    }
+    return double(uncompressed) / std::max<size_t>(1, compressed);
 }
 
-void doc(unsigned int id, unsigned int contentLength) {
-    printf("{\"put\": \"id:doc:doc::%u\", \"fields\": { ", id);
-    printf("\"doc_id\": %u, ", id);
-    content(contentLength);
-    printf(" } }");
+/**
+ * Bisects the content level so the measured compression ratio matches the target.
+ */
+void calibrate(ContentModel &model, const textgen::LengthDistribution &length, const Params &params) {
+    Compressor compressor(params.compressor);
+    double lo = 0.0;
+    double hi = 2.0;
+    for (int i = 0; i < 30; ++i) {
+        model.set_level((lo + hi) / 2.0);
+        if (measure_ratio(model, length, compressor, params) < params.ratio) {
+            lo = model.level();
+        } else {
+            hi = model.level();
+        }
+    }
+    model.set_level((lo + hi) / 2.0);
+    double ratio = measure_ratio(model, length, compressor, params);
+    fprintf(stderr, "Content level %.4f gives %s ratio %.3f (target %.3f)\n",
+            model.level(), params.compressor.c_str(), ratio, params.ratio);
+    if (std::abs(ratio - params.ratio) > 0.02 * params.ratio) {
+        fprintf(stderr, "Warning: target ratio %.3f is out of reach for this content\n", params.ratio);
+    }
 }
 
-int main(int, char **argv) {
-    const unsigned int numDocs{static_cast<unsigned int>(atoi(argv[1]))};
-    const unsigned int contentLengths{static_cast<unsigned int>(atoi(argv[2]))};
+void usage() {
+    fprintf(stderr, "Usage: feed_generator [-r ratio] [-c zstd[:level]|lz4] [-k chunk size] [-w tally file] "
+            "[-p num phrases] [-l length] [-s seed] [-t threads] <num docs> <content length>\n");
+    exit(1);
+}
+
+}
+
+int main(int argc, char **argv) {
+    Params params;
+    int option;
+    while ((option = getopt(argc, argv, "r:c:k:w:p:l:s:t:")) != -1) {
+        switch (option) {
+        case 'r': params.ratio = atof(optarg); break;
+        case 'c': params.compressor = optarg; break;
+        case 'k': params.chunk_size = strtoul(optarg, nullptr, 0); break;
+        case 'w': params.tally_file = optarg; break;
+        case 'p': params.num_phrases = strtoul(optarg, nullptr, 0); break;
+        case 'l': params.length = optarg; break;
+        case 's': params.seed = strtoull(optarg, nullptr, 0); break;
+        case 't': params.num_threads = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+    }
+    params.num_docs = static_cast<unsigned int>(atoi(argv[optind]));
+    const unsigned int contentLengths{static_cast<unsigned int>(atoi(argv[optind + 1]))};
+    auto length = params.length.empty() ? textgen::LengthDistribution::fixed(contentLengths)
+                                        : textgen::LengthDistribution::parse(params.length);
 
-    srand(7);
     printf("[\n");
-    for (unsigned int i = 1; i < numDocs; i++) {
-        doc(i, contentLengths);
-        printf(",\n");
+    if (params.ratio <= 0.0) {
+        // Same content as always: rand() seeded with 7, so documents are formatted by one thread in order.
+        srand(7);
+        textgen::write_documents(stdout, 1, uint64_t(params.num_docs) + 1, 1, params.seed,
+                                 [&](std::string &out, uint64_t id, textgen::Rng &rng) {
+                                     std::string content;
+                                     size_t n = params.length.empty() ? contentLengths : length.sample(rng);
+                                     for (size_t i = 0; i < n; i++) {
+                                         content.push_back(alnum[rand() % 62]);
+                                     }
+                                     format_doc(out, id, params.num_docs, content);
+                                 });
+    } else {
+        ContentModel model(params);
+        calibrate(model, length, params);
+        textgen::write_documents(stdout, 1, uint64_t(params.num_docs) + 1, params.num_threads, params.seed,
+                                 [&](std::string &out, uint64_t id, textgen::Rng &rng) {
+                                     std::string content;
+                                     model.append(content, rng, length.sample(rng));
+                                     format_doc(out, id, params.num_docs, content);
+                                 });
     }
-    doc(numDocs, contentLengths);
-    printf("\n]\n");
+    printf("]\n");
     return 0;
 }
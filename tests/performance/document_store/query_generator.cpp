@@ -1,21 +1,286 @@
 // Copyright Vespa.ai. All rights reserved.
 
+/**
+ * Generates document lookups for document store benchmarks, either as document/v1 gets
+ * (query type 0) or as summary fetching searches on doc_id (query type 1).
+ *
+ * Usage: query_generator [options] <num docs> <query type>
+ *
+ * Options:
+ *   -p <pattern>   how document ids in [1, num docs] are chosen (default sequential):
+ *                  sequential            ids in feed order, wrapping around
+ *                  uniform               uniformly random ids
+ *                  zipf:<s>              Zipf popularity with exponent s, hot ids spread over the corpus
+ *                  recent:<window>[:<s>] ids among the <window> most recently fed documents, where feeding
+ *                                        progresses over the queries; with s > 0 newer documents are more
+ *                                        popular (Zipf over age)
+ *                  scan:<f>:<pattern>    with probability f the next id of a sequential scan, else an id
+ *                                        from <pattern>, to check that scans do not evict the hot set
+ *   -n <ids>       document ids per query (default 1). Searches look up all ids with one 'in' query,
+ *                  document/v1 gets are written as one line per id.
+ *   -q <queries>   number of queries (default num docs)
+ *   -s <seed>      random seed (default 1)
+ *   -b <bytes>     document size, to report the working set in bytes
+ *   -o <file>      write the working set report to this file instead of stderr
+ **/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "key_distribution.h"
+
+namespace {
+
+using Rng = std::mt19937_64;
+using keydist::Scatter;
+using keydist::Zipf;
+
+/**
+ * Chooses document ids in [1, num_docs]. 'progress' is the fraction of queries generated so far.
+ * 'working_set' is the number of ids that can be looked up at any one time.
+ */
+class IdPattern {
+public:
+    virtual ~IdPattern() = default;
+    virtual uint64_t next(Rng &rng, double progress) = 0;
+    virtual uint64_t working_set() const = 0;
+};
+
+class SequentialPattern : public IdPattern {
+    uint64_t _num_docs;
+    uint64_t _next;
+
+public:
+    explicit SequentialPattern(uint64_t num_docs) : _num_docs(num_docs), _next(0) {}
+    uint64_t next(Rng &, double) override {
+        uint64_t id = _next + 1;
+        _next = (_next + 1) % _num_docs;
+        return id;
+    }
+    uint64_t working_set() const override { return _num_docs; }
+};
+
+class UniformPattern : public IdPattern {
+    uint64_t _num_docs;
+
+public:
+    explicit UniformPattern(uint64_t num_docs) : _num_docs(num_docs) {}
+    uint64_t next(Rng &rng, double) override {
+        return std::uniform_int_distribution<uint64_t>(1, _num_docs)(rng);
+    }
+    uint64_t working_set() const override { return _num_docs; }
+};
+
+class ZipfPattern : public IdPattern {
+    uint64_t _num_docs;
+    Zipf _zipf;
+    Scatter _scatter;
+
+public:
+    ZipfPattern(uint64_t num_docs, double s) : _num_docs(num_docs), _zipf(num_docs, s), _scatter(num_docs) {}
+    uint64_t next(Rng &rng, double) override {
+        return _scatter(_zipf(rng) - 1) + 1;
+    }
+    uint64_t working_set() const override { return _num_docs; }
+};
+
+class RecentPattern : public IdPattern {
+    uint64_t _num_docs;
+    uint64_t _window;
+    std::unique_ptr<Zipf> _age;
+
+public:
+    RecentPattern(uint64_t num_docs, uint64_t window, double s)
+        : _num_docs(num_docs),
+          _window(std::clamp<uint64_t>(window, 1, num_docs)),
+          _age((s > 0.0) ? std::make_unique<Zipf>(_window, s) : nullptr)
+    {}
+    uint64_t next(Rng &rng, double progress) override {
+        // The newest document fed moves from the end of the first window to the last document.
+        uint64_t newest = _window + uint64_t(progress * (_num_docs - _window));
+        uint64_t age = _age ? (*_age)(rng) - 1 : std::uniform_int_distribution<uint64_t>(0, _window - 1)(rng);
+        return newest - age;
+    }
+    uint64_t working_set() const override { return _window; }
+};
+
+class ScanPattern : public IdPattern {
+    double _scan_fraction;
+    SequentialPattern _scan;
+    std::unique_ptr<IdPattern> _base;
+
+public:
+    ScanPattern(uint64_t num_docs, double scan_fraction, std::unique_ptr<IdPattern> base)
+        : _scan_fraction(scan_fraction), _scan(num_docs), _base(std::move(base))
+    {}
+    uint64_t next(Rng &rng, double progress) override {
+        if (std::bernoulli_distribution(_scan_fraction)(rng)) {
+            return _scan.next(rng, progress);
+        }
+        return _base->next(rng, progress);
+    }
+    uint64_t working_set() const override { return _base->working_set(); }
+};
+
+std::unique_ptr<IdPattern>
+make_pattern(const std::string &spec, uint64_t num_docs) {
+    double s = 0.0;
+    unsigned long window = 0;
+    int consumed = 0;
+    if (spec == "sequential") {
+        return std::make_unique<SequentialPattern>(num_docs);
+    }
+    if (spec == "uniform") {
+        return std::make_unique<UniformPattern>(num_docs);
+    }
+    if (sscanf(spec.c_str(), "zipf:%lf", &s) == 1) {
+        return std::make_unique<ZipfPattern>(num_docs, s);
+    }
+    if (sscanf(spec.c_str(), "recent:%lu", &window) == 1) {
+        sscanf(spec.c_str(), "recent:%lu:%lf", &window, &s);
+        return std::make_unique<RecentPattern>(num_docs, window, s);
+    }
+    if (sscanf(spec.c_str(), "scan:%lf:%n", &s, &consumed) == 1 && consumed > 0) {
+        return std::make_unique<ScanPattern>(num_docs, s, make_pattern(spec.substr(consumed), num_docs));
+    }
+    fprintf(stderr, "Unknown id pattern '%s'\n", spec.c_str());
+    exit(1);
+}
 
-int main(int, char **argv) {
-    const unsigned int numDocs{static_cast<unsigned int>(atoi(argv[1]))};
-    const unsigned int queryType{static_cast<unsigned int>(atoi(argv[2]))};
+struct Params {
+    std::string pattern = "sequential";
+    unsigned int ids_per_query = 1;
+    uint64_t num_queries = 0;
+    uint64_t seed = 1;
+    uint64_t doc_bytes = 0;
+    std::string report_file;
+};
 
-    if (queryType == 0) {
-        for (unsigned int i = 1; i <= numDocs; i++) {
-            printf("/document/v1/doc/doc/docid/%u\n", i);
+/**
+ * Reports the number of distinct ids looked up, and how many of the most popular ids are needed
+ * to cover a given share of the lookups, which is the cache size needed for that hit rate.
+ */
+void
+report_working_set(const Params &params, const IdPattern &pattern, const std::vector<uint32_t> &counts, uint64_t lookups) {
+    FILE *out = params.report_file.empty() ? stderr : fopen(params.report_file.c_str(), "w");
+    if (out == nullptr) {
+        perror(params.report_file.c_str());
+        exit(1);
+    }
+    std::vector<uint32_t> sorted;
+    for (uint32_t count : counts) {
+        if (count > 0) {
+            sorted.push_back(count);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), std::greater<>());
+    fprintf(out, "pattern\t%s\nqueries\t%lu\nlookups\t%lu\nworking_set_ids\t%lu\ndistinct_ids\t%zu\n",
+            params.pattern.c_str(), params.num_queries, lookups, pattern.working_set(), sorted.size());
+    if (params.doc_bytes > 0) {
+        fprintf(out, "working_set_bytes\t%lu\ndistinct_bytes\t%lu\n",
+                pattern.working_set() * params.doc_bytes, sorted.size() * params.doc_bytes);
+    }
+    uint64_t covered = 0;
+    size_t i = 0;
+    for (double share : {0.5, 0.8, 0.9, 0.95, 0.99}) {
+        while (i < sorted.size() && covered < share * lookups) {
+            covered += sorted[i++];
         }
-    } else if (queryType == 1) {
-        for (unsigned int i = 1; i <= numDocs; i++) {
-            printf("/search/?query=doc_id:%u\n", i);
+        fprintf(out, "ids_for_%g_percent\t%zu\n", share * 100, i);
+        if (params.doc_bytes > 0) {
+            fprintf(out, "bytes_for_%g_percent\t%lu\n", share * 100, i * params.doc_bytes);
         }
     }
+    if (out != stderr) {
+        fclose(out);
+    }
+}
+
+void
+usage() {
+    fprintf(stderr, "Usage: query_generator [-p pattern] [-n ids per query] [-q num queries] [-s seed] "
+            "[-b doc bytes] [-o report file] <num docs> <query type>\n");
+    exit(1);
+}
+
+}
+
+int main(int argc, char **argv) {
+    Params params;
+    int option;
+    while ((option = getopt(argc, argv, "p:n:q:s:b:o:")) != -1) {
+        switch (option) {
+        case 'p': params.pattern = optarg; break;
+        case 'n': params.ids_per_query = std::max(1, atoi(optarg)); break;
+        case 'q': params.num_queries = strtoull(optarg, nullptr, 0); break;
+        case 's': params.seed = strtoull(optarg, nullptr, 0); break;
+        case 'b': params.doc_bytes = strtoull(optarg, nullptr, 0); break;
+        case 'o': params.report_file = optarg; break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+    }
+    const unsigned int numDocs{static_cast<unsigned int>(atoi(argv[optind]))};
+    const unsigned int queryType{static_cast<unsigned int>(atoi(argv[optind + 1]))};
+    if (numDocs == 0) {
+        return 0;
+    }
+    if (params.num_queries == 0) {
+        params.num_queries = numDocs;
+    }
+    params.ids_per_query = std::min(params.ids_per_query, numDocs);
+
+    auto pattern = make_pattern(params.pattern, numDocs);
+    Rng rng(params.seed);
+    std::vector<uint32_t> counts(uint64_t(numDocs) + 1, 0);
+    std::vector<uint64_t> ids;
+    std::string in_list;
+    uint64_t lookups = 0;
+    for (uint64_t q = 0; q < params.num_queries; q++) {
+        double progress = double(q) / params.num_queries;
+        ids.clear();
+        // Duplicates collapse in an 'in' query, so redraw a bounded number of times.
+        for (unsigned int attempts = 0; ids.size() < params.ids_per_query && attempts < 16 * params.ids_per_query; ++attempts) {
+            uint64_t id = pattern->next(rng, progress);
+            if (std::find(ids.begin(), ids.end(), id) == ids.end()) {
+                ids.push_back(id);
+            }
+        }
+        for (uint64_t id : ids) {
+            ++counts[id];
+        }
+        lookups += ids.size();
+        if (queryType == 0) {
+            for (uint64_t id : ids) {
+                printf("/document/v1/doc/doc/docid/%lu\n", id);
+            }
+        } else if (queryType == 1) {
+            if (ids.size() == 1) {
+                printf("/search/?query=doc_id:%lu\n", ids[0]);
+            } else {
+                in_list.clear();
+                for (uint64_t id : ids) {
+                    in_list += (in_list.empty() ? "" : ",") + std::to_string(id);
+                }
+                printf("/search/?yql=select%%20*%%20from%%20doc%%20where%%20doc_id%%20in%%20(%s)&hits=%zu\n",
+                       in_list.c_str(), ids.size());
+            }
+        }
+    }
+    if (params.pattern != "sequential" || !params.report_file.empty()) {
+        report_working_set(params, *pattern, counts, lookups);
+    }
 
     return 0;
 }
@@ -1,42 +1,267 @@
 // Copyright Vespa.ai. All rights reserved.
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include "text_generator.h"
+
+namespace {
+
+// Set when words are drawn from a tally file or a Zipf vocabulary instead of uniformly from word0..word<numUniq-1>.
+std::unique_ptr<textgen::TextGenerator> text;
+std::unique_ptr<textgen::Rng> rng;
+
+std::string out;
+std::vector<uint32_t> ids;
+
+/**
+ * Per field document and occurrence counts of each word, written as a binary sidecar file
+ * so the recovery test can check term counts against the engine without reading the feed.
+ *
+ * Sidecar format (little endian):
+ *   "FRTS" u32:version(1) u32:batch_len batch u64:num_docs u32:num_words (u16:len word)*
+ *   u32:num_fields (u32:name_len name u64:occurrences u32:num_entries (u32:word u32:docs u64:occurrences)*)*
+ * where entries are only written for words present in the field.
+ */
+class TermStats {
+    struct Field {
+        std::string name;
+        std::vector<uint32_t> docs;
+        std::vector<uint64_t> occurrences;
+        std::vector<uint32_t> last_doc;
+    };
+    std::vector<std::string> _words;
+    std::vector<Field> _fields;
+    uint64_t _num_docs;
+
+public:
+    TermStats(std::vector<std::string> words, const std::vector<std::string> &fields)
+        : _words(std::move(words)), _fields(), _num_docs(0)
+    {
+        for (const auto &name : fields) {
+            _fields.push_back({name, std::vector<uint32_t>(_words.size(), 0), std::vector<uint64_t>(_words.size(), 0),
+                               std::vector<uint32_t>(_words.size(), UINT32_MAX)});
+        }
+    }
+    void add(size_t field, uint32_t doc, const std::vector<uint32_t> &word_ids) {
+        Field &f = _fields[field];
+        for (uint32_t id : word_ids) {
+            ++f.occurrences[id];
+            if (f.last_doc[id] != doc) {
+                f.last_doc[id] = doc;
+                ++f.docs[id];
+            }
+        }
+        _num_docs = std::max<uint64_t>(_num_docs, uint64_t(doc) + 1);
+    }
+    void write(const char *file_name, const char *batch) const {
+        FILE *file = fopen(file_name, "wb");
+        if (file == nullptr) {
+            perror(file_name);
+            exit(1);
+        }
+        auto u16 = [file](uint16_t v) { fwrite(&v, sizeof(v), 1, file); };
+        auto u32 = [file](uint32_t v) { fwrite(&v, sizeof(v), 1, file); };
+        auto u64 = [file](uint64_t v) { fwrite(&v, sizeof(v), 1, file); };
+        auto str32 = [&](const std::string &s) { u32(s.size()); fwrite(s.data(), 1, s.size(), file); };
+        fwrite("FRTS", 1, 4, file);
+        u32(1);
+        str32(batch);
+        u64(_num_docs);
+        u32(_words.size());
+        for (const auto &word : _words) {
+            u16(word.size());
+            fwrite(word.data(), 1, word.size(), file);
+        }
+        u32(_fields.size());
+        for (const auto &f : _fields) {
+            str32(f.name);
+            uint64_t total = 0;
+            uint32_t entries = 0;
+            for (size_t i = 0; i < _words.size(); ++i) {
+                total += f.occurrences[i];
+                entries += (f.docs[i] > 0) ? 1 : 0;
+            }
+            u64(total);
+            u32(entries);
+            for (size_t i = 0; i < _words.size(); ++i) {
+                if (f.docs[i] > 0) {
+                    u32(i);
+                    u32(f.docs[i]);
+                    u64(f.occurrences[i]);
+                }
+            }
+        }
+        fclose(file);
+    }
+};
+
+std::unique_ptr<TermStats> stats;
 
 void
-words(const char * name, uint32_t numElem, uint32_t numUniq) {
-    printf("\"%s\":\"", name);
-    for (uint32_t i(0); i < numElem; i++) {
-        printf("word%u ", random() % numUniq);
+words(const char * name, size_t field, uint32_t doc, uint32_t numElem, uint32_t numUniq) {
+    out += "\"";
+    out += name;
+    out += "\":\"";
+    ids.clear();
+    if (text) {
+        text->append_words(out, *rng, numElem, &ids);
+    } else {
+        char buf[32];
+        for (uint32_t i(0); i < numElem; i++) {
+            uint32_t id = random() % numUniq;
+            ids.push_back(id);
+            out.append(buf, snprintf(buf, sizeof(buf), "word%u ", id));
+        }
     }
-    printf("\",");
+    if (stats) {
+        stats->add(field, doc, ids);
+    }
+    out += "\",";
 }
 
 void
 doc(const char * batch, uint32_t num, uint32_t numElem, uint32_t numUniq) {
-    printf("{\"id\":\"id:ns:genfeed::%s%u\", \"fields\":{ ", batch, num);
-    words("title", 5, numUniq);
-    words("body", numElem, numUniq);
-    printf("\"tag\":\"%s\",", batch);
-    printf("\"seqno\":\"%u\",", num);
-    printf("\"id\":\"%s%u\"", batch, num);
-    printf(" } }");
+    char buf[128];
+    out.append(buf, snprintf(buf, sizeof(buf), "{\"id\":\"id:ns:genfeed::%s%u\", \"fields\":{ ", batch, num));
+    words("title", 0, num, 5, numUniq);
+    words("body", 1, num, numElem, numUniq);
+    out.append(buf, snprintf(buf, sizeof(buf), "\"tag\":\"%s\",", batch));
+    out.append(buf, snprintf(buf, sizeof(buf), "\"seqno\":\"%u\",", num));
+    out.append(buf, snprintf(buf, sizeof(buf), "\"id\":\"%s%u\"", batch, num));
+    out += " } }";
+}
+
+void
+flush(bool force) {
+    if (force || out.size() >= (1 << 20)) {
+        fwrite(out.data(), 1, out.size(), stdout);
+        out.clear();
+    }
 }
 
+/**
+ * Prints the batch, and the 'top' words with the highest document frequency per field, from a sidecar file.
+ * Output lines are '#batch <name> <docs>' followed by '<field>\t<word>\t<docs>\t<occurrences>'.
+ */
+int
+dump(const char *file_name, size_t top) {
+    FILE *file = fopen(file_name, "rb");
+    if (file == nullptr) {
+        perror(file_name);
+        return 1;
+    }
+    auto read = [file](void *dst, size_t n) {
+        if (fread(dst, 1, n, file) != n) {
+            fprintf(stderr, "Truncated sidecar file\n");
+            exit(1);
+        }
+    };
+    auto u32 = [&]() { uint32_t v; read(&v, sizeof(v)); return v; };
+    auto u64 = [&]() { uint64_t v; read(&v, sizeof(v)); return v; };
+    auto str = [&](size_t n) { std::string s(n, '\0'); read(s.data(), n); return s; };
+    if (str(4) != "FRTS" || u32() != 1) {
+        fprintf(stderr, "Not a term stats sidecar file: %s\n", file_name);
+        return 1;
+    }
+    std::string batch = str(u32());
+    uint64_t num_docs = u64();
+    std::vector<std::string> vocabulary(u32());
+    for (auto &word : vocabulary) {
+        uint16_t len;
+        read(&len, sizeof(len));
+        word = str(len);
+    }
+    printf("#batch %s %lu\n", batch.c_str(), num_docs);
+    uint32_t num_fields = u32();
+    for (uint32_t f = 0; f < num_fields; ++f) {
+        std::string field = str(u32());
+        u64();
+        std::vector<std::tuple<uint32_t, uint32_t, uint64_t>> entries(u32());
+        for (auto &entry : entries) {
+            uint32_t word = u32();
+            uint32_t docs = u32();
+            entry = {docs, word, u64()};
+        }
+        std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+            return (std::get<0>(a) != std::get<0>(b)) ? std::get<0>(a) > std::get<0>(b) : std::get<1>(a) < std::get<1>(b);
+        });
+        for (size_t i = 0; i < std::min(top, entries.size()); ++i) {
+            printf("%s\t%s\t%u\t%lu\n", field.c_str(), vocabulary[std::get<1>(entries[i])].c_str(),
+                   std::get<0>(entries[i]), std::get<2>(entries[i]));
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+}
+
+// Usage: docs [-z zipf exponent] [-o sidecar file] <batch> <num docs> <words in body> <unique words> [tally file]
+//        docs -d <sidecar file> [-k top words]
+// With a tally file, words are the <unique words> most frequent words of the tally, drawn with their frequencies.
+// With -z, words are word0..word<unique words - 1> where word i is drawn with weight 1 / (i + 1)^s.
+// -o writes per field document frequencies of each word (see TermStats) to the sidecar file,
+// and -d prints the most frequent words from such a file.
 int
 main(int argc, char **argv) {
+    double zipf = 0.0;
+    const char *sidecar = nullptr;
+    const char *dump_file = nullptr;
+    size_t top = 20;
+    int option;
+    while ((option = getopt(argc, argv, "z:o:d:k:")) != -1) {
+        switch (option) {
+        case 'z': zipf = atof(optarg); break;
+        case 'o': sidecar = optarg; break;
+        case 'd': dump_file = optarg; break;
+        case 'k': top = strtoul(optarg, nullptr, 0); break;
+        default: return 1;
+        }
+    }
+    if (dump_file != nullptr) {
+        return dump(dump_file, top);
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
     uint32_t i(0);
     const char * batch = argv[1];
     uint32_t numDocs = atoi(argv[2]);
     uint32_t numElem = atoi(argv[3]);
     uint32_t numUniq = atoi(argv[4]);
-    printf("[\n");
+    if (argc > 5) {
+        text = std::make_unique<textgen::TextGenerator>(textgen::Vocabulary::load_tally(argv[5], numUniq));
+        rng = std::make_unique<textgen::Rng>(1);
+    } else if (zipf > 0.0) {
+        text = std::make_unique<textgen::TextGenerator>(textgen::Vocabulary::zipf(numUniq, zipf));
+        rng = std::make_unique<textgen::Rng>(1);
+    }
+    if (sidecar != nullptr) {
+        std::vector<std::string> vocabulary;
+        for (uint32_t w(0); w < (text ? text->vocabulary().size() : numUniq); w++) {
+            vocabulary.emplace_back(text ? std::string(text->vocabulary().word(w)) : "word" + std::to_string(w));
+        }
+        stats = std::make_unique<TermStats>(std::move(vocabulary), std::vector<std::string>{"title", "body"});
+    }
+    out += "[\n";
     for (; (i+1) < numDocs; i++) {
         doc(batch, i, numElem, numUniq);
-        printf(",\n");
+        out += ",\n";
+        flush(false);
     }
     doc(batch, i, numElem, numUniq);
-    printf("\n]\n");
+    out += "\n]\n";
+    flush(true);
+    if (stats) {
+        stats->write(sidecar, batch);
+    }
     return 0;
 }
@@ -3,6 +3,7 @@
 require 'performance_test'
 require 'app_generator/search_app'
 require 'environment'
+require 'data_generator'
 
 class FeedingAndRecoveryTest < PerformanceTest
 
@@ -203,12 +204,14 @@ class FeedingAndRecoveryTest < PerformanceTest
     container = (vespa.qrserver["0"] or vespa.container.values.first)
     tmp_bin_dir = container.create_tmp_bin_dir
     @data_generator = "#{tmp_bin_dir}/docs"
-    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -o #{@data_generator} #{selfdir}/docs.cpp")
+    @container = container
+    @feed0_terms = "#{tmp_bin_dir}/feed0.terms"
+    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -std=c++17 -g -O3 -pthread -I#{DataGenerator.lib_dir} -o #{@data_generator} #{selfdir}/docs.cpp")
 
     profile(["#{Environment.instance.vespa_home}/sbin64/vespa-proton-bin",
              "#{Environment.instance.vespa_home}/sbin64/vespa-storaged-bin",
              "#{Environment.instance.vespa_home}/sbin64/vespa-distributord-bin"]) do
-      run_stream_feeder("#{@data_generator} feed0 #{@test_params.feed0_docs} 100 100",
+      run_stream_feeder("#{@data_generator} -o #{@feed0_terms} feed0 #{@test_params.feed0_docs} 100 100",
                  [parameter_filler("tag", "feeding"),
                   parameter_filler("cluster_setup", "elastic_#{nodes}")] + fillers,
                  :timeout => 3600,
@@ -292,6 +295,16 @@ class FeedingAndRecoveryTest < PerformanceTest
                     metric_filler("throughput", moves / time)])
     end
     assert_hitcount("sddocname:genfeed&hits=0&nocache", @test_params.feed0_docs)
+    assert_term_counts(@feed0_terms)
+  end
+
+  # Checks that the most frequent title words match as many documents as when they were generated.
+  def assert_term_counts(sidecar, top = 10)
+    @container.execute("#{@data_generator} -d #{sidecar} -k #{top}").each_line do |line|
+      field, word, docs = line.chomp.split("\t")
+      next unless field == 'title'
+      assert_hitcount("#{field}:#{word}&hits=0&nocache", docs.to_i)
+    end
   end
 
   def collect_metrics(nodes, name)
@@ -4,23 +4,113 @@
 #include <iostream>
 #include <random>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 #include <unistd.h>
 
-void gen_put(uint32_t user_id, size_t doc_id) {
-    printf("{\"put\":\"id:test:test:g=%u:%zu\",\"fields\":{\"id\":%zu}}", user_id, doc_id, doc_id);
+#include "bucket_id.h"
+
+void gen_put(const std::string &id, size_t doc_id) {
+    printf("{\"put\":\"%s\",\"fields\":{\"id\":%zu}}", id.c_str(), doc_id);
+}
+
+std::string location_id(uint32_t user_id, size_t doc_id) {
+    return "id:test:test:g=" + std::to_string(user_id) + ":" + std::to_string(doc_id);
+}
+
+void usage(const char *prog) {
+    std::cerr << prog << " -s (shuffle) -h (help) -r (report buckets) -n <location count> -d <docs per location>" << std::endl;
+    std::cerr << prog << " -s -r -t <total docs> -k <hot buckets>:<hot share> [-b <bits>] [-l <locations per hot bucket>] [-i g|n|plain]" << std::endl;
+    std::cerr << "  -t: place exactly <hot share> of the documents in <hot buckets> buckets using <bits> bits" << std::endl;
+    std::cerr << "      (default 16, the distribution bits, i.e. superbuckets; at most 32) and the rest in other buckets." << std::endl;
+    std::cerr << "      Ids use g= groups (default), n= numbers or no location (plain). Hot plain ids cost about" << std::endl;
+    std::cerr << "      2^<bits> / <hot buckets> md5 computations each." << std::endl;
+}
+
+struct Target {
+    uint64_t total_docs = 0;
+    uint64_t hot_buckets = 0;
+    double hot_share = 0.0;
+    uint32_t bits = 16;
+    uint64_t locations_per_hot_bucket = 1;
+    std::string scheme = "g";
+};
+
+/**
+ * Document ids for the targeted distribution. The bucket of each id is chosen through its
+ * location (n= or g=) or, for plain ids, by trying suffixes until the md5 of the id matches.
+ */
+std::vector<std::pair<std::string, size_t>> targeted_docs(const Target &target, int seed) {
+    bucketid::BucketSkew skew(target.bits, target.hot_buckets, target.hot_share, seed);
+    const auto &hot = skew.hot_buckets();
+    // Locations (n= numbers or g= groups) of each hot bucket, used round robin.
+    std::vector<std::vector<std::string>> hot_locations(hot.size());
+    std::vector<uint64_t> next_location(hot.size(), 0);
+    if (target.scheme != "plain") {
+        for (size_t h = 0; h < hot.size(); ++h) {
+            uint64_t start = 0;
+            for (uint64_t l = 0; l < target.locations_per_hot_bucket; ++l) {
+                if (target.scheme == "n") {
+                    hot_locations[h].push_back("n=" + std::to_string(bucketid::find_location(hot[h], skew.used_bits(), l + 1)));
+                } else {
+                    std::string prefix = "hot" + std::to_string(hot[h]) + "_";
+                    std::string group = bucketid::find_group(hot[h], skew.used_bits(), prefix, start);
+                    start = std::stoull(group.substr(prefix.size())) + 1;
+                    hot_locations[h].push_back("g=" + group);
+                }
+            }
+        }
+    }
+    std::vector<std::pair<std::string, size_t>> docs;
+    docs.reserve(target.total_docs);
+    for (uint64_t doc_id = 0; doc_id < target.total_docs; ++doc_id) {
+        std::string suffix = std::to_string(doc_id);
+        if (skew.hot(doc_id)) {
+            size_t h = skew.next_hot();
+            if (target.scheme == "plain") {
+                std::string id;
+                for (uint64_t salt = 0;; ++salt) {
+                    id = "id:test:test::" + suffix + "_" + std::to_string(salt);
+                    if (bucketid::bucket(id, skew.used_bits()) == hot[h]) {
+                        break;
+                    }
+                }
+                docs.emplace_back(id, doc_id);
+            } else {
+                const auto &locations = hot_locations[h];
+                docs.emplace_back("id:test:test:" + locations[next_location[h]++ % locations.size()] + ":" + suffix, doc_id);
+            }
+        } else if (target.scheme == "n") {
+            uint64_t cold = skew.cold(doc_id);
+            docs.emplace_back("id:test:test:n=" + std::to_string(bucketid::find_location(cold, skew.used_bits(), doc_id)) + ":" + suffix, doc_id);
+        } else {
+            // Any id or group outside the hot buckets, redrawn in the rare case it is hot.
+            std::string id;
+            for (uint64_t salt = 0;; ++salt) {
+                std::string name = "cold" + suffix + (salt > 0 ? "_" + std::to_string(salt) : "");
+                id = (target.scheme == "plain") ? "id:test:test::" + name : "id:test:test:g=" + name + ":" + suffix;
+                if (!skew.is_hot_location(bucketid::location(id))) {
+                    break;
+                }
+            }
+            docs.emplace_back(id, doc_id);
+        }
+    }
+    return docs;
 }
 
 int main(int argc, char* argv[]) {
     int seed = 1234;
     bool shuffle = false;
+    bool report = false;
     uint32_t locations = 0;
     uint32_t docs_per_location = 0;
+    Target target;
 
     int option;
     // Note: opt parsing has signed-ness mismatch, but we trust the input to be non-negative.
-    while ((option = getopt(argc, argv, "n:d:sh")) != -1) {
+    while ((option = getopt(argc, argv, "n:d:t:k:b:l:i:srh")) != -1) {
         switch (option) {
         case 'n':
             locations = std::stoi(optarg);
@@ -28,27 +118,57 @@ int main(int argc, char* argv[]) {
         case 'd':
             docs_per_location = std::stoi(optarg);
             break;
+        case 't':
+            target.total_docs = std::stoull(optarg);
+            break;
+        case 'k':
+            if (sscanf(optarg, "%lu:%lf", &target.hot_buckets, &target.hot_share) != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            target.bits = std::min(bucketid::location_bits, uint32_t(std::stoul(optarg)));
+            break;
+        case 'l':
+            target.locations_per_hot_bucket = std::max(1ul, std::stoul(optarg));
+            break;
+        case 'i':
+            target.scheme = optarg;
+            break;
         case 's':
             shuffle = true;
             break;
+        case 'r':
+            report = true;
+            break;
         case 'h':
-            std::cerr << argv[0] << " -s (shuffle) -h (help) -n <location count> -d <docs per location>" << std::endl;
+            usage(argv[0]);
             return 1;
         default:
             return 1;
         }
     }
-    if (locations == 0 || docs_per_location == 0) {
-        std::cerr << "Must specify at least 1 location with 1 document" << std::endl;
-        return 1;
-    }
-    using LocationAndDocId = std::pair<uint32_t, size_t>;
-    std::vector<LocationAndDocId> docs;
-    docs.reserve(locations * docs_per_location);
-    for (uint32_t loc = 0; loc < locations; ++loc) {
-        for (uint32_t doc = 0; doc < docs_per_location; ++doc) {
-            // Let doc ID itself be distinct also _across_ locations
-            docs.emplace_back(loc, (loc * docs_per_location) + doc);
+    using IdAndDocId = std::pair<std::string, size_t>;
+    std::vector<IdAndDocId> docs;
+    if (target.total_docs > 0) {
+        if (target.scheme != "g" && target.scheme != "n" && target.scheme != "plain") {
+            usage(argv[0]);
+            return 1;
+        }
+        docs = targeted_docs(target, seed);
+    } else {
+        if (locations == 0 || docs_per_location == 0) {
+            std::cerr << "Must specify at least 1 location with 1 document" << std::endl;
+            return 1;
+        }
+        docs.reserve(locations * docs_per_location);
+        for (uint32_t loc = 0; loc < locations; ++loc) {
+            for (uint32_t doc = 0; doc < docs_per_location; ++doc) {
+                // Let doc ID itself be distinct also _across_ locations
+                size_t doc_id = (loc * docs_per_location) + doc;
+                docs.emplace_back(location_id(loc, doc_id), doc_id);
+            }
         }
     }
     if (shuffle) {
@@ -63,6 +183,12 @@ int main(int argc, char* argv[]) {
         gen_put(docs[i].first, docs[i].second);
     }
     printf("\n]\n");
+    if (report) {
+        bucketid::BucketHistogram histogram(target.bits);
+        for (const auto &doc : docs) {
+            histogram.add(doc.first);
+        }
+        histogram.report(stderr);
+    }
     return 0;
 }
-
@@ -3,6 +3,7 @@
 require 'performance_test'
 require 'app_generator/search_app'
 require 'uri'
+require 'data_generator'
 
 class FeedingWithBucketContentionTest < PerformanceTest
 
@@ -65,7 +66,7 @@ class FeedingWithBucketContentionTest < PerformanceTest
     tmp_bin_dir = @container.create_tmp_bin_dir
     @create_docs = "#{tmp_bin_dir}/create_docs"
     src_path = "#{selfdir}create_docs.cpp"
-    @container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -o #{@create_docs} #{src_path}")
+    @container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -std=c++17 -g -O3 -I#{DataGenerator.lib_dir} -o #{@create_docs} #{src_path}")
   end
 
 end
@@ -0,0 +1,133 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'performance_test'
+require 'app_generator/search_app'
+require 'data_generator'
+require 'environment'
+
+# Throughput of the C++ feed and query generators of the performance tests, as several tests spend more
+# time generating feed than feeding it. Every generator runs on fixed parameters, once with its output
+# counted and discarded, and once written to disk, and each run is reported with docs/s, MB/s, peak RSS
+# and CPU seconds, so generator regressions show up like engine regressions.
+class GeneratorThroughputTest < PerformanceTest
+
+  # Generator sources relative to tests/performance, with extra compile flags.
+  GENERATORS = {
+    'collection_feed_docs' => ['collection_feed/docs.cpp', ''],
+    'dispatch_docs' => ['dispatch/docs.cpp', ''],
+    'document_store_feed_generator' => ['document_store/feed_generator.cpp', '-ldl'],
+    'document_store_query_generator' => ['document_store/query_generator.cpp', ''],
+    'feeding_and_recovery_docs' => ['feeding_and_recovery/docs.cpp', ''],
+    'feeding_bucket_contention_create_docs' => ['feeding_bucket_contention/create_docs.cpp', ''],
+    'lid_space_compaction_docs' => ['lid_space_compaction/docs.cpp', ''],
+    'lookup_docs' => ['lookup/docs.cpp', ''],
+    'lookup_query' => ['lookup/query.cpp', ''],
+    'mixed_tensors_data_gen' => ['mixed_tensors/data_gen.cpp', ''],
+    'nearest_neighbor_make_docs' => ['nearest_neighbor/make_docs.cpp', '-std=c++20'],
+    'nearest_neighbor_make_queries' => ['nearest_neighbor/make_queries.cpp', '-std=c++20'],
+    'nearest_neighbor_make_rq_docs' => ['nearest_neighbor/make_rq_docs.cpp', '-std=c++20'],
+    'nearest_neighbor_make_rq_queries' => ['nearest_neighbor/make_rq_queries.cpp', '-std=c++20'],
+    'nearest_neighbor_streaming_create_docs' => ['nearest_neighbor_streaming/create_docs.cpp', ''],
+    'range_search_create_docs' => ['range_search/create_docs.cpp', ''],
+    'range_search_create_queries' => ['range_search/create_queries.cpp', ''],
+    'ranking_doc_generator' => ['ranking/doc_generator.cpp', ''],
+    'struct_and_map_docs' => ['struct_and_map/docs.cpp', ''],
+    'tensor_eval_docs' => ['tensor_eval/docs.cpp', ''],
+    'tensor_eval_docs_sparse_dot' => ['tensor_eval/docs_sparse_dot.cpp', ''],
+    'tensor_eval_gen_unstable' => ['tensor_eval/gen-unstable.cpp', ''],
+    'tensor_unbound_string_labels_feed_data_generator' => ['tensor_unbound_string_labels_feed/data_generator.cpp', ''],
+    'tensor_update_data_generator' => ['tensor_update/data_generator.cpp', '']
+  }
+
+  # Vectors in the synthetic fvecs files of the nearest neighbor generators, per dimension count.
+  FVECS = { 128 => 1_000_000, 960 => 100_000 }
+
+  # [generator, label, arguments, documents (or queries) generated]. Parameters must stay fixed for the
+  # results to be comparable over time; %{tally}, %{tmp} and %{fvecs<dims>} are replaced before running.
+  CASES = [
+    ['collection_feed_docs', 'wset100', '1000000 100 wset_int', 1_000_000],
+    ['dispatch_docs', 'default', '1000000', 1_000_000],
+    ['document_store_feed_generator', '1k', '1000000 1024', 1_000_000],
+    ['document_store_feed_generator', '1k_zstd_ratio3', '-r 3 -c zstd 1000000 1024', 1_000_000],
+    ['document_store_query_generator', 'get', '-q 1000000 1000000 0', 1_000_000],
+    ['feeding_and_recovery_docs', 'uniform', 'feed0 1000000 100 100', 1_000_000],
+    ['feeding_and_recovery_docs', 'tally', 'feed0 1000000 100 10000 %{tally}', 1_000_000],
+    ['feeding_bucket_contention_create_docs', 'locations', '-n 3000 -d 1000', 3_000_000],
+    ['feeding_bucket_contention_create_docs', 'shuffled', '-s -n 3000 -d 1000', 3_000_000],
+    ['lid_space_compaction_docs', 'put', 'put 2000000', 2_000_000],
+    ['lookup_docs', 'payload400', '1000000 10 400', 1_000_000],
+    ['lookup_query', 'uniform', '1000000 100 400000000', 1_000_000],
+    ['lookup_query', 'zipf', '-d zipf:1.1 1000000 100 400000000', 1_000_000],
+    ['mixed_tensors_data_gen', 'model_puts', '-d 3 -o 240000 -f model puts', 240_000],
+    ['mixed_tensors_data_gen', 'models_puts', '-d 3 -o 30000 -f models puts', 30_000],
+    ['mixed_tensors_data_gen', 'model_updates_assign', '-d 3 -o 240000 -f model updates assign', 240_000],
+    ['nearest_neighbor_make_docs', 'sift', '%{fvecs128} 128 put 0 0 1000000 [] [0,-1] [0,-1] false vec_m16', 1_000_000],
+    ['nearest_neighbor_make_docs', 'gist', '%{fvecs960} 960 put 0 0 100000 [] [0,-1] [0,-1] false vec_m16', 100_000],
+    ['nearest_neighbor_make_queries', 'gist', '%{fvecs960} 960 100000 vec_m16 true 100 0 0', 100_000],
+    ['nearest_neighbor_make_rq_docs', 'gist', '%{fvecs960} 960 put 0 0 100000 42 vec_rq_euclidean', 100_000],
+    ['nearest_neighbor_make_rq_queries', 'gist', '%{fvecs960} 960 100000 42 vec_rq_euclidean q_rq true 100 0 0', 100_000],
+    ['nearest_neighbor_streaming_create_docs', 'users', '-d 0 10 10000 100 1000 1000 100 10000 10 100000 1', 500_000],
+    ['range_search_create_docs', '10M', '-d 10000000 -t 4', 10_000_000],
+    ['range_search_create_queries', '10M', '-d 10000000 -t 4 -e %{tmp}/expected', nil],
+    ['ranking_doc_generator', 'tally', '-w %{tally} -t 4 1000000', 1_000_000],
+    ['struct_and_map_docs', 'elems10000', '100 10000', 100],
+    ['tensor_eval_docs', 'default', '10000', 60_000], # 6 tensor sizes per count
+    ['tensor_eval_docs_sparse_dot', 'default', '100000', 300_000], # 3 tensor sizes per count
+    ['tensor_eval_gen_unstable', 'default', '100000 %{tmp}', 100_000],
+    ['tensor_unbound_string_labels_feed_data_generator', 'size100', '100000 100', 100_000],
+    ['tensor_unbound_string_labels_feed_data_generator', 'card10000', '-c 10000 -r 0.5 100000 100', 100_000],
+    ['tensor_update_data_generator', 'put', 'put 100000', 100_000],
+    ['tensor_update_data_generator', 'assign', 'assign 100000 1 1000', 100_000]
+  ]
+
+  def setup
+    super
+    set_owner('balder')
+  end
+
+  def timeout_seconds
+    7200
+  end
+
+  def test_generator_throughput
+    set_description('Test throughput of the C++ feed and query generators, writing to /dev/null and to disk')
+    deploy_app(SearchApp.new.sd(selfdir + 'test.sd'))
+    @node = vespa.search['search'].first
+    @bin_dir = @node.create_tmp_bin_dir
+    @measure = "#{@bin_dir}/measure_generator"
+    @node.execute("g++ -std=c++17 -O3 -o #{@measure} #{selfdir}measure_generator.cpp")
+    GENERATORS.each do |name, (source, flags)|
+      @node.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -std=c++17 -O3 -pthread " +
+                    "-I#{DataGenerator.lib_dir} #{flags} -o #{@bin_dir}/#{name} #{selfdir}../#{source}")
+    end
+    @replacements = { :tally => DataGenerator.tally_file, :tmp => dirs.tmpdir.chomp('/') }
+    FVECS.each do |dims, vectors|
+      file = "#{dirs.tmpdir}vectors_#{dims}.fvecs"
+      @node.execute("#{@measure} -v #{file} #{dims} #{vectors}")
+      @replacements[:"fvecs#{dims}"] = file
+    end
+    CASES.each do |generator, label, args, docs|
+      ['devnull', 'disk'].each do |output|
+        run_case(generator, label, args % @replacements, docs, output)
+      end
+    end
+  end
+
+  def run_case(generator, label, args, docs, output)
+    output_file = "#{dirs.tmpdir}generator_output"
+    command = "#{@measure} #{output == 'disk' ? "-o #{output_file} " : ''}'#{@bin_dir}/#{generator} #{args}'"
+    wall, user, sys, rss_kb, bytes = @node.execute(command).split("\t").map(&:to_f)
+    @node.execute("rm -f #{output_file}")
+    fillers = [parameter_filler('generator', generator),
+               parameter_filler('case', label),
+               parameter_filler('output', output),
+               metric_filler('wall_s', wall),
+               metric_filler('cpu_s', user + sys),
+               metric_filler('peak_rss_mb', rss_kb / 1024),
+               metric_filler('mb_per_s', bytes / wall / (1024 * 1024)),
+               metric_filler('output_mb', bytes / (1024 * 1024))]
+    fillers << metric_filler('docs_per_s', docs / wall) if docs
+    write_report(fillers)
+  end
+
+end
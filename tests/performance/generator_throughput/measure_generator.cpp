@@ -0,0 +1,134 @@
+// Copyright Vespa.ai. All rights reserved.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+void usage(const char *prog) {
+    std::cerr << prog << " [-o <output file>] <command>" << std::endl;
+    std::cerr << prog << " -v <fvecs file> <dimensions> <vectors>" << std::endl;
+    std::cerr << "Runs a feed or query generator command (with /bin/sh) and reports, tab separated:" << std::endl;
+    std::cerr << "  wall seconds, user CPU seconds, system CPU seconds, peak RSS in KiB, and bytes written to stdout." << std::endl;
+    std::cerr << "Stdout is counted and discarded, or with -o written to the file and synced to disk before the clock stops." << std::endl;
+    std::cerr << "With -v, writes an fvecs file of random vectors for the nearest neighbor generators instead." << std::endl;
+}
+
+double now_s() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int write_fvecs(const char *file, int32_t dims, size_t count) {
+    FILE *out = fopen(file, "wb");
+    if (out == nullptr) {
+        std::cerr << "Could not open " << file << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+    std::vector<float> vector(dims);
+    for (size_t i = 0; i < count; ++i) {
+        for (auto &v : vector) {
+            v = value(rng);
+        }
+        fwrite(&dims, sizeof(dims), 1, out);
+        fwrite(vector.data(), sizeof(float), dims, out);
+    }
+    return fclose(out) == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = nullptr;
+    int option;
+    while ((option = getopt(argc, argv, "+o:vh")) != -1) {
+        switch (option) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'v':
+                if (argc - optind != 3) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                return write_fvecs(argv[optind], atoi(argv[optind + 1]), strtoul(argv[optind + 2], nullptr, 0));
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string command = std::string("exec ") + argv[optind];
+
+    int fd = -1;
+    int pipe_fds[2] = {-1, -1};
+    if (output != nullptr) {
+        fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "Could not open " << output << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+    } else if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        std::cerr << "pipe: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    double start = now_s();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(output != nullptr ? fd : pipe_fds[1], STDOUT_FILENO);
+        execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char *>(nullptr));
+        _exit(127);
+    }
+    if (pid < 0) {
+        std::cerr << "fork: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    uint64_t bytes = 0;
+    if (output == nullptr) {
+        close(pipe_fds[1]);
+        std::vector<char> buf(1 << 20);
+        ssize_t n;
+        while ((n = read(pipe_fds[0], buf.data(), buf.size())) > 0 || (n < 0 && errno == EINTR)) {
+            bytes += (n > 0) ? n : 0;
+        }
+        close(pipe_fds[0]);
+    }
+    int status = 0;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        std::cerr << "wait4: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    if (output != nullptr) {
+        fdatasync(fd);
+        struct stat st{};
+        fstat(fd, &st);
+        bytes = st.st_size;
+        close(fd);
+    }
+    double wall = now_s() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Command failed with status " << status << ": " << argv[optind] << std::endl;
+        return 1;
+    }
+    printf("%.3f\t%.3f\t%.3f\t%ld\t%lu\n", wall,
+           usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+           usage.ru_maxrss, bytes);
+    return 0;
+}
@@ -43,11 +43,11 @@ class InOperatorPerfTest < PerformanceTest
   def compile_create_docs
     tmp_bin_dir = @container.create_tmp_bin_dir
     @create_docs = "#{tmp_bin_dir}/create_docs"
-    @container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -o #{@create_docs} #{selfdir}../range_search/create_docs.cpp")
+    @container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -pthread -o #{@create_docs} #{selfdir}../range_search/create_docs.cpp")
   end
 
   def feed_docs
-    command = "#{@create_docs} -d #{@num_docs}"
+    command = "#{@create_docs} -d #{@num_docs} -t 4"
     run_stream_feeder(command, [])
   end
 
@@ -1,45 +1,115 @@
 // Copyright Vespa.ai. All rights reserved.
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <random>
 #include <string>
 #include <vector>
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-bool verify_usage(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::cerr << argv[0] << "<put|remove> <num docs>" << std::endl;
-        return false;
-    }
-    return true;
+#include "bucket_id.h"
+
+void usage(const char *prog) {
+    std::cerr << prog << " [-p pattern] [-n total docs] [-r reput fraction[:lag]] [-e expected file] [-w id width] [-s seed] <put|remove> <num docs>" << std::endl;
+    std::cerr << "  remove: removes <num docs> of the <total docs> (default 2 * <num docs>) fed documents." << std::endl;
+    std::cerr << "  -p random       : uniformly random (default)" << std::endl;
+    std::cerr << "     tail         : the newest documents" << std::endl;
+    std::cerr << "     head         : the oldest documents" << std::endl;
+    std::cerr << "     range:<first>: a contiguous range starting at id <first>" << std::endl;
+    std::cerr << "     stripe:<w>   : stripes of <w> consecutive ids spread evenly over all ids" << std::endl;
+    std::cerr << "     bucket:<bits>: all documents in randomly chosen buckets using <bits> bits" << std::endl;
+    std::cerr << "  -r f[:lag]      : re-put the fraction f of removed documents, <lag> (default 1000) removes later" << std::endl;
+    std::cerr << "  -e file         : write the ids of the documents surviving the removes, one per line" << std::endl;
 }
 
-void produce_puts(size_t numDocs);
-void produce_removes(size_t numDocs, size_t cap);
+struct Params {
+    std::string pattern = "random";
+    size_t total_docs = 0;
+    double reput_fraction = 0.0;
+    size_t reput_lag = 1000;
+    std::string expected_file;
+    int id_width = 5;
+    unsigned int seed = 0;
+    bool has_seed = false;
+};
+
+void produce_puts(size_t numDocs, const Params &params);
+void produce_removes(size_t numDocs, const Params &params);
 
 /**
  * Generate puts/removes to use in lidspace compaction test
  **/
 
 int main (int argc, char *argv[]) {
-    if ( ! verify_usage(argc, argv) ) { return 1; }
-    const size_t numDocs = strtoul(argv[2], nullptr, 0);
-    if (std::string(argv[1]) == "remove") {
-        produce_removes(numDocs, 2*numDocs);
+    Params params;
+    int option;
+    while ((option = getopt(argc, argv, "p:n:r:e:w:s:")) != -1) {
+        switch (option) {
+        case 'p':
+            params.pattern = optarg;
+            break;
+        case 'n':
+            params.total_docs = strtoul(optarg, nullptr, 0);
+            break;
+        case 'r':
+            if (sscanf(optarg, "%lf:%zu", &params.reput_fraction, &params.reput_lag) < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'e':
+            params.expected_file = optarg;
+            break;
+        case 'w':
+            params.id_width = atoi(optarg);
+            break;
+        case 's':
+            params.seed = strtoul(optarg, nullptr, 0);
+            params.has_seed = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (params.has_seed) {
+        srand(params.seed);
+    }
+    const size_t numDocs = strtoul(argv[optind + 1], nullptr, 0);
+    if (std::string(argv[optind]) == "remove") {
+        if (params.total_docs == 0) {
+            params.total_docs = 2*numDocs;
+        }
+        if (numDocs > params.total_docs) {
+            std::cerr << "Cannot remove " << numDocs << " of " << params.total_docs << " documents" << std::endl;
+            return 1;
+        }
+        produce_removes(numDocs, params);
     } else {
-        produce_puts(numDocs);
+        produce_puts(numDocs, params);
     }
     return 0;
 }
 
-void produce_puts(size_t numDocs) {
-    constexpr size_t num_unique = 100;
-    constexpr size_t hits_per_query = 1000;
-    constexpr size_t average_body_length = 500;
-    const size_t num_unique_keys = numDocs/hits_per_query;
+constexpr size_t num_unique = 100;
+constexpr size_t hits_per_query = 1000;
+constexpr size_t average_body_length = 500;
+
+std::string format_id(size_t i, const Params &params) {
+    char id[128];
+    sprintf(id, "id:test:test::%0*zu", params.id_width, i);
+    return id;
+}
 
+std::vector<std::string> make_bodies() {
     std::vector<std::string> data;
     for (size_t i(0); i < num_unique; i++) {
         std::string s;
@@ -48,19 +118,27 @@ void produce_puts(size_t numDocs) {
         }
         data.push_back(s);
     }
+    return data;
+}
+
+void print_put(size_t i, size_t key, const std::string &body, const Params &params) {
+    std::cout << "{ \"put\": \"" << format_id(i, params) << "\",\n \"fields\": {";
+    std::cout << " \"body\": \"" << body << "\",";
+    std::cout << " \"id\": "  << i << ",";
+    std::cout << " \"key\": " << key << ",";
+    std::cout << " \"slowkey\": " << key;
+    std::cout << " }" << std::endl;
+    std::cout << "}";
+}
+
+void produce_puts(size_t numDocs, const Params &params) {
+    const size_t num_unique_keys = numDocs/hits_per_query;
+    std::vector<std::string> data = make_bodies();
 
     std::cout << "[" << std::endl;
     for (size_t i(0); i < numDocs; i++) {
         size_t key = i % num_unique_keys;
-        char id[128];
-        sprintf(id, "{ \"put\": \"id:test:test::%05ld\",\n \"fields\": {", i);
-        std::cout << id;
-        std::cout << " \"body\": \"" << data[rand()%num_unique] << "\",";
-        std::cout << " \"id\": "  << i << ",";
-        std::cout << " \"key\": " << key << ",";
-        std::cout << " \"slowkey\": " << key;
-        std::cout << " }" << std::endl;
-        std::cout << "}";
+        print_put(i, key, data[rand()%num_unique], params);
         if (i < numDocs - 1) {
           std::cout << "," << std::endl;
         }
@@ -68,29 +146,152 @@ void produce_puts(size_t numDocs) {
     std::cout << std::endl << "]" << std::endl;
 }
 
-void produce_removes(size_t numDocs, size_t cap) {
+/**
+ * Selects which of the ids [0, total) to remove, in the order they are to be removed.
+ **/
+std::vector<size_t> select_removes(size_t numRemoves, size_t total, const Params &params, std::mt19937_64 &rng) {
     std::vector<size_t> ids;
-    ids.reserve(cap);
-    for (size_t i(0); i < cap; i++) {
-        ids.push_back(i);
+    ids.reserve(numRemoves);
+    const std::string &pattern = params.pattern;
+    if (pattern == "random") {
+        // Kept as before: the ids remaining after removing (total - numRemoves) random ids.
+        std::vector<size_t> all;
+        all.reserve(total);
+        for (size_t i(0); i < total; i++) {
+            all.push_back(i);
+        }
+        for (size_t i(0); i < total - numRemoves; i++) {
+            size_t index = rand() % all.size();
+            all[index] = all.back();
+            all.resize(all.size() - 1);
+        }
+        ids = std::move(all);
+    } else if (pattern == "tail") {
+        for (size_t i(0); i < numRemoves; i++) {
+            ids.push_back(total - 1 - i);
+        }
+    } else if (pattern == "head") {
+        for (size_t i(0); i < numRemoves; i++) {
+            ids.push_back(i);
+        }
+    } else if (pattern.compare(0, 6, "range:") == 0) {
+        size_t first = std::min(strtoul(pattern.c_str() + 6, nullptr, 0), total - numRemoves);
+        for (size_t i(0); i < numRemoves; i++) {
+            ids.push_back(first + i);
+        }
+    } else if (pattern.compare(0, 7, "stripe:") == 0) {
+        size_t width = std::max(1ul, strtoul(pattern.c_str() + 7, nullptr, 0));
+        size_t numStripes = (numRemoves + width - 1) / width;
+        size_t gap = total - numRemoves;
+        // Stripe s starts after s full stripes and floor(s * gap / numStripes) kept ids, so the stripes are
+        // evenly spaced, never overlap, and the last one ends at the latest at the last id.
+        for (size_t s(0); s < numStripes; s++) {
+            size_t start = s * width + s * gap / numStripes;
+            for (size_t i(start); i < start + width && ids.size() < numRemoves; i++) {
+                ids.push_back(i);
+            }
+        }
+    } else if (pattern.compare(0, 7, "bucket:") == 0) {
+        uint32_t bits = std::min(bucketid::max_used_bits, uint32_t(strtoul(pattern.c_str() + 7, nullptr, 0)));
+        std::vector<std::pair<uint64_t, size_t>> buckets;
+        buckets.reserve(total);
+        for (size_t i(0); i < total; i++) {
+            buckets.emplace_back(bucketid::bucket(format_id(i, params), bits), i);
+        }
+        // Order buckets randomly, keeping the documents of each bucket together.
+        std::vector<uint64_t> order;
+        for (const auto &entry : buckets) {
+            order.push_back(entry.first);
+        }
+        std::sort(order.begin(), order.end());
+        order.erase(std::unique(order.begin(), order.end()), order.end());
+        std::vector<uint64_t> rank(order.size());
+        for (size_t i(0); i < rank.size(); i++) {
+            rank[i] = rng();
+        }
+        auto bucket_rank = [&](uint64_t bucket) {
+            return rank[std::lower_bound(order.begin(), order.end(), bucket) - order.begin()];
+        };
+        std::sort(buckets.begin(), buckets.end(), [&](const auto &a, const auto &b) {
+            uint64_t ra = bucket_rank(a.first);
+            uint64_t rb = bucket_rank(b.first);
+            return (ra != rb) ? ra < rb : a.second < b.second;
+        });
+        for (size_t i(0); i < numRemoves; i++) {
+            ids.push_back(buckets[i].second);
+        }
+    } else {
+        std::cerr << "Unknown remove pattern '" << pattern << "'" << std::endl;
+        exit(1);
     }
-    for (size_t i(0); i < numDocs; i++) {
-        size_t index = rand() % ids.size();
-        ids[index] = ids.back();
-        ids.resize(ids.size() - 1);
+    assert(ids.size() == numRemoves);
+    std::vector<bool> selected(total, false);
+    for (size_t id : ids) {
+        assert(id < total && !selected[id]);
+        selected[id] = true;
     }
-    std::cout << "[" << std::endl;
+    return ids;
+}
+
+void produce_removes(size_t numRemoves, const Params &params) {
+    const size_t total = params.total_docs;
+    const size_t num_unique_keys = std::max(1ul, total/hits_per_query);
+    std::mt19937_64 rng(params.seed);
+    std::vector<size_t> ids = select_removes(numRemoves, total, params, rng);
+    std::vector<std::string> data;
+    if (params.reput_fraction > 0.0) {
+        data = make_bodies();
+    }
+    std::vector<bool> alive(total, true);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<size_t> pending;
+    size_t pending_pos = 0;
+    size_t numReputs = 0;
     bool first = true;
-    for (size_t i : ids) {
-        char id[128];
+    auto separator = [&first]() {
         if (first) {
            first = false;
         } else {
             std::cout << "," << std::endl;
         }
-        sprintf(id, "{ \"remove\": \"id:test:test::%05ld\" }", i);
-        std::cout << id;
+    };
+    auto reput = [&](size_t i) {
+        separator();
+        print_put(i, i % num_unique_keys, data[i % num_unique], params);
+        alive[i] = true;
+        numReputs++;
+    };
+    std::cout << "[" << std::endl;
+    for (size_t n(0); n < ids.size(); n++) {
+        size_t i = ids[n];
+        separator();
+        std::cout << "{ \"remove\": \"" << format_id(i, params) << "\" }";
+        alive[i] = false;
+        if (params.reput_fraction > 0.0 && uniform(rng) < params.reput_fraction) {
+            pending.push_back(i);
+        }
+        while (pending_pos < pending.size() && pending.size() - pending_pos > params.reput_lag) {
+            reput(pending[pending_pos++]);
+        }
+    }
+    while (pending_pos < pending.size()) {
+        reput(pending[pending_pos++]);
     }
     std::cout << std::endl << "]" << std::endl;
-}
 
+    size_t numSurviving = 0;
+    std::ofstream expected;
+    if ( ! params.expected_file.empty()) {
+        expected.open(params.expected_file);
+    }
+    for (size_t i(0); i < total; i++) {
+        if (alive[i]) {
+            numSurviving++;
+            if (expected.is_open()) {
+                expected << i << "\n";
+            }
+        }
+    }
+    std::cerr << "Pattern " << params.pattern << ": removed " << numRemoves << ", re-put " << numReputs
+              << ", surviving " << numSurviving << " of " << total << " documents" << std::endl;
+}
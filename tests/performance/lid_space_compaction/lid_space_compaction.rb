@@ -3,6 +3,7 @@ require 'performance_test'
 require 'app_generator/search_app'
 require 'performance/fbench'
 require 'environment'
+require 'data_generator'
 
 class LidSpaceCompactionPerfTest < PerformanceTest
 
@@ -78,8 +79,8 @@ class LidSpaceCompactionPerfTest < PerformanceTest
     deploy_app(get_app(2.0)) # no compaction will happen
     container = (vespa.qrserver["0"] or vespa.container.values.first)
     @tmp_bin_dir = container.create_tmp_bin_dir
-    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -o #{@tmp_bin_dir}/verify_results #{selfdir}/verify_results.cpp")
-    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -o #{@tmp_bin_dir}/docs #{selfdir}/docs.cpp")
+    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -std=c++17 -g -O3 -pthread -o #{@tmp_bin_dir}/verify_results #{selfdir}/verify_results.cpp")
+    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -std=c++17 -g -O3 -I#{DataGenerator.lib_dir} -o #{@tmp_bin_dir}/docs #{selfdir}/docs.cpp")
     queries = create_query_file("query.txt")
     container.copy(queries, "#{dirs.tmpdir}")
     queries = "#{dirs.tmpdir}/query.txt"
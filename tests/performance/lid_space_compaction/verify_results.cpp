@@ -1,70 +1,338 @@
 // Copyright Vespa.ai. All rights reserved.
 
-#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
-#include <unordered_map>
-#include <string.h>
-#include <assert.h>
-#include <stdlib.h>
-
-bool verify_usage(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::cerr << argv[0] << "<expected fbench resultfile> <actual fbench result file>" << std::endl;
-        std::cerr << "This program will verify that summaries produced are identical to the expected ones." << std::endl;
-        std::cerr << "The order of the expected is identical to the 'key' in the actual." << std::endl;
-        return false;
-    }
-    return true;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void usage(const char *prog) {
+    std::cerr << prog << " [-i <volatile field>]... [-t <threads>] [-m <max diffs>] <expected fbench resultfile> <actual fbench result file>" << std::endl;
+    std::cerr << "This program will verify that summaries produced are identical to the expected ones." << std::endl;
+    std::cerr << "The order of the expected is identical to the 'key' in the actual." << std::endl;
+    std::cerr << "Values of volatile fields given with -i (e.g. relevance) are ignored when comparing." << std::endl;
 }
 
-constexpr const char *KEY = "\"key\":";
-size_t KEYLEN = strlen(KEY);
+constexpr std::string_view KEY = "\"key\":";
+
+/**
+ * Read-only memory mapping of a whole file.
+ */
+class MappedFile {
+    const char *_data;
+    size_t _size;
+
+public:
+    explicit MappedFile(const char *name) : _data(nullptr), _size(0) {
+        int fd = open(name, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            perror(name);
+            exit(2);
+        }
+        _size = st.st_size;
+        if (_size > 0) {
+            void *p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                perror(name);
+                exit(2);
+            }
+            madvise(p, _size, MADV_SEQUENTIAL);
+            _data = static_cast<const char *>(p);
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (_data != nullptr) {
+            munmap(const_cast<char *>(_data), _size);
+        }
+    }
+    std::string_view view() const { return {_data, _size}; }
+    std::string_view line(uint64_t offset, uint32_t len) const { return {_data + offset, len}; }
+};
+
+struct Hash128 {
+    uint64_t lo;
+    uint64_t hi;
+    bool operator==(const Hash128 &rhs) const { return lo == rhs.lo && hi == rhs.hi; }
+    bool operator!=(const Hash128 &rhs) const { return !(*this == rhs); }
+};
+
+// MurmurHash3 x64 128
+Hash128 hash128(std::string_view data, uint64_t seed = 0) {
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto fmix = [](uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        return k ^ (k >> 33);
+    };
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const size_t nblocks = data.size() / 16;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    const char *p = data.data();
+    for (size_t i = 0; i < nblocks; ++i, p += 16) {
+        uint64_t k1;
+        uint64_t k2;
+        memcpy(&k1, p, 8);
+        memcpy(&k2, p + 8, 8);
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    size_t tail = data.size() & 15;
+    for (size_t i = tail; i > 8; --i) {
+        k2 ^= uint64_t((unsigned char)p[i - 1]) << ((i - 9) * 8);
+    }
+    for (size_t i = std::min<size_t>(tail, 8); i > 0; --i) {
+        k1 ^= uint64_t((unsigned char)p[i - 1]) << ((i - 1) * 8);
+    }
+    if (tail > 8) {
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    if (tail > 0) {
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+    h1 ^= data.size();
+    h2 ^= data.size();
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    return {h1, h2};
+}
+
+/**
+ * Copies 'line' to 'out' with the values of the volatile fields replaced by '?'.
+ * A value ends at the first ',' or '}' outside of a string.
+ */
+std::string_view mask_volatile(std::string_view line, const std::vector<std::string> &fields, std::string &out) {
+    if (fields.empty()) {
+        return line;
+    }
+    out.clear();
+    size_t i = 0;
+    while (i < line.size()) {
+        size_t next = std::string_view::npos;
+        size_t name_len = 0;
+        for (const auto &field : fields) {
+            size_t pos = line.find(field, i);
+            if (pos < next) {
+                next = pos;
+                name_len = field.size();
+            }
+        }
+        if (next == std::string_view::npos) {
+            break;
+        }
+        size_t value = next + name_len;
+        out.append(line.substr(i, value - i));
+        out.push_back('?');
+        bool in_string = false;
+        while (value < line.size()) {
+            char c = line[value];
+            if (in_string) {
+                if (c == '\\') {
+                    ++value;
+                } else if (c == '"') {
+                    in_string = false;
+                }
+            } else if (c == '"') {
+                in_string = true;
+            } else if (c == ',' || c == '}') {
+                break;
+            }
+            ++value;
+        }
+        i = value;
+    }
+    out.append(line.substr(i));
+    return out;
+}
+
+struct Entry {
+    uint64_t key;
+    Hash128 hash;
+    uint64_t offset;
+    uint32_t len;
+};
+
+struct ParseResult {
+    std::vector<Entry> entries;
+    std::vector<std::string> errors;
+};
+
+/**
+ * Hashes all result lines (lines containing "root") of the file in parallel. Each thread parses
+ * the lines starting in its slice of the file.
+ */
+ParseResult parse(const MappedFile &file, const std::vector<std::string> &volatile_fields, int num_threads) {
+    std::string_view data = file.view();
+    std::vector<ParseResult> partial(num_threads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            size_t begin = data.size() * t / num_threads;
+            size_t end = data.size() * (t + 1) / num_threads;
+            // Lines are owned by the thread whose slice holds their first character.
+            if (begin > 0 && data[begin - 1] != '\n') {
+                size_t nl = data.find('\n', begin);
+                begin = (nl == std::string_view::npos) ? data.size() : nl + 1;
+            }
+            std::string masked;
+            ParseResult &result = partial[t];
+            while (begin < end) {
+                size_t nl = data.find('\n', begin);
+                size_t line_end = (nl == std::string_view::npos) ? data.size() : nl;
+                std::string_view line = data.substr(begin, line_end - begin);
+                if (!line.empty() && line.find("root") != std::string_view::npos) {
+                    size_t key_pos = line.find(KEY);
+                    if (key_pos != std::string_view::npos) {
+                        uint64_t key = strtoull(line.data() + key_pos + KEY.size(), nullptr, 0);
+                        result.entries.push_back({key, hash128(mask_volatile(line, volatile_fields, masked)),
+                                                  begin, uint32_t(line.size())});
+                    } else {
+                        result.errors.emplace_back(line);
+                    }
+                }
+                begin = line_end + 1;
+            }
+        });
+    }
+    ParseResult result;
+    for (int t = 0; t < num_threads; ++t) {
+        threads[t].join();
+        result.entries.insert(result.entries.end(), partial[t].entries.begin(), partial[t].entries.end());
+        result.errors.insert(result.errors.end(), partial[t].errors.begin(), partial[t].errors.end());
+    }
+    std::sort(result.entries.begin(), result.entries.end(), [](const Entry &a, const Entry &b) {
+        return (a.key != b.key) ? a.key < b.key : a.offset < b.offset;
+    });
+    return result;
+}
+
+void print_diff(uint64_t key, std::string_view expected, std::string_view actual) {
+    size_t pos = 0;
+    while (pos < expected.size() && pos < actual.size() && expected[pos] == actual[pos]) {
+        ++pos;
+    }
+    size_t from = (pos > 40) ? pos - 40 : 0;
+    std::cout << "Failed key " << key << " at offset " << pos << std::endl
+              << "  expected: ..." << expected.substr(from, 120) << std::endl
+              << "  actual:   ..." << actual.substr(from, 120) << std::endl;
+}
 
 int main (int argc, char *argv[]) {
-    if ( !verify_usage(argc, argv) ) { return 2; }
-    std::ifstream expected(argv[1]);
+    std::vector<std::string> volatile_fields;
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t max_diffs = 10;
+    int option;
+    while ((option = getopt(argc, argv, "i:t:m:h")) != -1) {
+        switch (option) {
+        case 'i':
+            volatile_fields.push_back("\"" + std::string(optarg) + "\":");
+            break;
+        case 't':
+            num_threads = std::max(1, atoi(optarg));
+            break;
+        case 'm':
+            max_diffs = strtoul(optarg, nullptr, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *expected_name = argv[optind];
+    const char *actual_name = argv[optind + 1];
+    MappedFile expected_file(expected_name);
+    MappedFile actual_file(actual_name);
+    ParseResult expected = parse(expected_file, volatile_fields, num_threads);
+    ParseResult actual = parse(actual_file, volatile_fields, num_threads);
+
     size_t sum(0);
-    std::unordered_map<size_t, std::string> lines;
-    while (expected && !expected.eof()) {
-        std::string line;
-        std::getline(expected, line);
-        if ( ! line.empty() && (line.find("root") != std::string::npos)) {
-            size_t key_pos = line.find(KEY);
-            if (key_pos != std::string::npos) {
-                const char * start = strstr(line.c_str(), KEY) + KEYLEN;
-                char * e;
-                size_t key = strtoul(start, &e, 0);
-                assert(e[0] == '}');
-                lines[key] = line;
-                sum += line.size();
+    for (const auto &e : expected.entries) {
+        sum += e.len;
+    }
+    std::cout << expected.entries.size() << " " << sum << std::endl;
+
+    // Expected entries are unique per key unless the expected file itself is inconsistent.
+    size_t numExpectedConflicts(0);
+    std::vector<Entry> unique;
+    for (const auto &e : expected.entries) {
+        if (!unique.empty() && unique.back().key == e.key) {
+            if (unique.back().hash != e.hash) {
+                std::cout << "Conflicting expected results for key " << e.key << std::endl;
+                ++numExpectedConflicts;
             }
+            continue;
         }
+        unique.push_back(e);
     }
-    std::cout << lines.size() << " " << sum << std::endl;
-    std::ifstream results(argv[2]);
-    size_t numFailures(0);
-    while (results && !results.eof()) {
-        std::string line;
-        std::getline(results, line);
-        if ( ! line.empty() && (line.find("root") != std::string::npos)) {
-            size_t key_pos = line.find(KEY);
-            if (key_pos != std::string::npos) {
-                const char * start = strstr(line.c_str(), KEY) + KEYLEN;
-                char * e;
-                size_t key = strtoul(start, &e, 0);
-                assert(e[0] == '}');
-                if (line != lines[key]) {
-                    std::cout << "Failed key " << key << std::endl;
-                    numFailures++;
-                }
-            } else {
-               std::cerr << "Found no key in line : " << line << std::endl;
-               numFailures++;
+
+    size_t numFailures(actual.errors.size());
+    for (const auto &line : actual.errors) {
+        std::cerr << "Found no key in line : " << line << std::endl;
+    }
+    size_t numUnexpected(0), numDuplicates(0), numMissing(0), numVerified(0), numDiffsPrinted(0);
+    std::string masked_expected, masked_actual;
+    auto exp_it = unique.begin();
+    for (size_t i = 0; i < actual.entries.size(); ++i) {
+        const Entry &a = actual.entries[i];
+        bool duplicate = (i > 0 && actual.entries[i - 1].key == a.key);
+        numDuplicates += duplicate ? 1 : 0;
+        while (exp_it != unique.end() && exp_it->key < a.key) {
+            ++exp_it;
+            numMissing++;
+        }
+        if (exp_it == unique.end() || exp_it->key != a.key) {
+            std::cout << "Unexpected key " << a.key << std::endl;
+            ++numUnexpected;
+            ++numFailures;
+            continue;
+        }
+        if (a.hash != exp_it->hash) {
+            ++numFailures;
+            if (numDiffsPrinted++ < max_diffs) {
+                print_diff(a.key,
+                           mask_volatile(expected_file.line(exp_it->offset, exp_it->len), volatile_fields, masked_expected),
+                           mask_volatile(actual_file.line(a.offset, a.len), volatile_fields, masked_actual));
+            } else if (numDiffsPrinted == max_diffs + 1) {
+                std::cout << "(more failures not shown)" << std::endl;
             }
+        } else {
+            ++numVerified;
+        }
+        bool last_for_key = (i + 1 == actual.entries.size() || actual.entries[i + 1].key != a.key);
+        if (last_for_key) {
+            ++exp_it;
         }
     }
-    std::cout << "Verification produced " << numFailures << " failures in file " << argv[2] << " compared to expected file " << argv[1] << std::endl;
+    numMissing += unique.end() - exp_it;
+    std::cout << "Verified " << numVerified << " results, " << numDuplicates << " duplicate keys, "
+              << numMissing << " expected keys missing, " << numUnexpected << " unexpected keys, "
+              << numExpectedConflicts << " conflicting expected keys" << std::endl;
+    std::cout << "Verification produced " << numFailures << " failures in file " << actual_name << " compared to expected file " << expected_name << std::endl;
     return numFailures == 0 ? 0 : 1;
 }
@@ -1,11 +1,15 @@
 // Copyright Vespa.ai. All rights reserved.
 
+#include <charconv>
 #include <cstdlib>
 #include <cstdio>
 #include <cstdint>
-#include <sstream>
+#include <cstring>
+#include <string>
 #include <vector>
-#include <cassert>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace {
 
@@ -13,140 +17,259 @@ const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                            "abcdefghijklmnopqrstuvwxyz"
                            "0123456789+/=";
 
-int
-getMaximumEncodeLength(int sourcelen) {
-    return std::max(6, 2 * sourcelen + 2);
+/**
+ * xoshiro256** seeded through splitmix64. Produces 8 random bytes per step,
+ * which is what makes filling multi-MB raw fields cheap.
+ */
+class Xoshiro256 {
+    uint64_t _s[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+public:
+    explicit Xoshiro256(uint64_t seed) {
+        for (auto &s : _s) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            s = z ^ (z >> 31);
+        }
+    }
+    uint64_t next() {
+        const uint64_t result = rotl(_s[1] * 5, 7) * 9;
+        const uint64_t t = _s[1] << 17;
+        _s[2] ^= _s[0];
+        _s[3] ^= _s[1];
+        _s[1] ^= _s[2];
+        _s[0] ^= _s[3];
+        _s[2] ^= t;
+        _s[3] = rotl(_s[3], 45);
+        return result;
+    }
+    // Same range as random(), to keep the generated values comparable.
+    long next_long() { return long(next() >> 33); }
+    void fill(char *dst, size_t len) {
+        while (len >= sizeof(uint64_t)) {
+            uint64_t v = next();
+            memcpy(dst, &v, sizeof(v));
+            dst += sizeof(v);
+            len -= sizeof(v);
+        }
+        if (len > 0) {
+            uint64_t v = next();
+            memcpy(dst, &v, len);
+        }
+    }
+};
+
+size_t
+getEncodeLength(size_t sourcelen) {
+    return ((sourcelen + 2) / 3) * 4;
 }
 
-int
-encode(const char *inBuffer, int inLen, char *outBuffer, int outBufLen)
+// Encodes 'inLen' bytes from 'in' into 'out'; returns number of chars written.
+size_t
+encode_scalar(const unsigned char *in, size_t inLen, char *out)
 {
-    int i;
-    int outLen = 0;
-    for (i = 0; inLen >= 3; inLen -= 3) {
-        if (outBufLen - outLen < 4) {
-            return -1;
-        }
-        // Do this to keep chars > 127
-        unsigned char a = inBuffer[i];
-        unsigned char b = inBuffer[i+1];
-        unsigned char c = inBuffer[i+2];
-        i += 3;
+    size_t outLen = 0;
+    for (; inLen >= 3; inLen -= 3, in += 3) {
+        unsigned char a = in[0];
+        unsigned char b = in[1];
+        unsigned char c = in[2];
 
-        outBuffer[outLen    ] = base64Chars[ a >> 2 ];
-        outBuffer[outLen + 1] = base64Chars[ (a << 4 & 0x30) | (b >> 4) ];
-        outBuffer[outLen + 2] = base64Chars[ (b << 2 & 0x3c) | (c >> 6) ];
-        outBuffer[outLen + 3] = base64Chars[ c & 0x3f  ];
+        out[outLen    ] = base64Chars[ a >> 2 ];
+        out[outLen + 1] = base64Chars[ (a << 4 & 0x30) | (b >> 4) ];
+        out[outLen + 2] = base64Chars[ (b << 2 & 0x3c) | (c >> 6) ];
+        out[outLen + 3] = base64Chars[ c & 0x3f  ];
 
         outLen += 4;
     }
 
     if (inLen) {
-        if (outBufLen - outLen < 4) {
-            return -1;
-        }
-        // Do this to keep chars with value>127
-        unsigned char a = inBuffer[i];
+        unsigned char a = in[0];
 
-        outBuffer[outLen] = base64Chars[ a >> 2 ];
+        out[outLen] = base64Chars[ a >> 2 ];
 
         if (inLen == 1) {
-            outBuffer[outLen + 1] = base64Chars[ (a << 4 & 0x30) ];
-            outBuffer[outLen + 2] = '=';
+            out[outLen + 1] = base64Chars[ (a << 4 & 0x30) ];
+            out[outLen + 2] = '=';
         } else {
-            unsigned char b = inBuffer[i + 1];
-            outBuffer[outLen + 1] = base64Chars[ (a << 4 & 0x30) | (b >> 4) ];
-            outBuffer[outLen + 2] = base64Chars[ b << 2 & 0x3c ];
+            unsigned char b = in[1];
+            out[outLen + 1] = base64Chars[ (a << 4 & 0x30) | (b >> 4) ];
+            out[outLen + 2] = base64Chars[ b << 2 & 0x3c ];
         }
 
-        outBuffer[outLen + 3] = '=';
+        out[outLen + 3] = '=';
 
         outLen += 4;
     }
-
-    if (outLen >= outBufLen)
-        return -1;
-
-    outBuffer[outLen] = '\0';
-
     return outLen;
 }
 
-
-std::string
-encode(const char* source, int len)
+#if defined(__x86_64__)
+/**
+ * SSSE3 encoder after Muła and Lemire: 12 input bytes become 16 output chars
+ * per iteration. Reads 16 bytes, so the last < 16 bytes go through the scalar path.
+ */
+__attribute__((target("ssse3")))
+size_t
+encode_ssse3(const unsigned char *in, size_t inLen, char *out)
 {
-    // Assign a string that we know is long enough
-    std::string result(getMaximumEncodeLength(len), '\0');
-    int outlen = encode(source, len, &result[0], result.size());
-    assert(outlen >= 0); // Make sure buffer was big enough.
-    result.resize(outlen);
-    return result;
+    const __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                            '/' - 63, 'A', 0, 0);
+    size_t outLen = 0;
+    while (inLen >= 16) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)), shuf);
+        // Split each 24-bit group into four 6-bit indices, one per byte.
+        const __m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        const __m128i indices = _mm_or_si128(t1, t3);
+        // Map 6-bit indices to the base64 alphabet.
+        __m128i lut_idx = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        lut_idx = _mm_or_si128(lut_idx, _mm_and_si128(less, _mm_set1_epi8(13)));
+        const __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, lut_idx), indices);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + outLen), chars);
+        in += 12;
+        inLen -= 12;
+        outLen += 16;
+    }
+    return outLen + encode_scalar(in, inLen, out + outLen);
 }
+#endif
 
-}
+using EncodeFunc = size_t (*)(const unsigned char *, size_t, char *);
 
-std::string
-create_keys(unsigned long offset, unsigned long numKeys) {
-    std::stringstream os;
-    os << '"' << offset << "\":" << 1;
-    for (unsigned long i(1); i < numKeys; i++) {
-      os << ",\"" << (offset + i) << "\":" << 1;
+EncodeFunc
+select_encoder()
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("ssse3")) {
+        return encode_ssse3;
     }
-    return os.str();
+#endif
+    return encode_scalar;
 }
 
-template<typename T>
-std::string
-create_values(unsigned long numValues) {
-    std::stringstream os;
-    os << long(T(random()));
-    for (unsigned long i(1); i < numValues; i++) {
-      os << ',' << long(T(random()));
-    }
-    return os.str();
+const EncodeFunc encode = select_encoder();
+
+/**
+ * Collects output in a large buffer and writes it to stdout with fwrite,
+ * avoiding per-field printf/stringstream formatting.
+ */
+class Output {
+    std::vector<char> _buf;
+    size_t _used;
+
+    void flush_if_needed(size_t needed) {
+        if (_used + needed > _buf.size()) {
+            flush();
+            if (needed > _buf.size()) {
+                _buf.resize(needed);
+            }
+        }
+    }
+
+public:
+    Output() : _buf(4 << 20), _used(0) {}
+    ~Output() { flush(); }
+    void flush() {
+        fwrite(_buf.data(), 1, _used, stdout);
+        _used = 0;
+    }
+    // Reserve space for 'len' chars; must be followed by commit().
+    char *reserve(size_t len) {
+        flush_if_needed(len);
+        return _buf.data() + _used;
+    }
+    void commit(size_t len) { _used += len; }
+    void put(const char *s, size_t len) {
+        memcpy(reserve(len), s, len);
+        commit(len);
+    }
+    void put(const char *s) { put(s, strlen(s)); }
+    void put(char c) { put(&c, 1); }
+    void put(long v) {
+        char *dst = reserve(24);
+        commit(std::to_chars(dst, dst + 24, v).ptr - dst);
+    }
+};
+
+void
+create_keys(Output &out, unsigned long offset, unsigned long numKeys) {
+    for (unsigned long i(0); i < numKeys; i++) {
+        out.put(i == 0 ? "\"" : ",\"");
+        out.put(long(offset + i));
+        out.put("\":1");
+    }
 }
 
-std::string
-create_raw(unsigned long numValues) {
-    std::vector<char> bytes;
-    bytes.reserve(numValues);
+template<typename T>
+void
+create_values(Output &out, Xoshiro256 &rng, unsigned long numValues) {
     for (unsigned long i(0); i < numValues; i++) {
-        bytes.push_back(random());
+        if (i != 0) {
+            out.put(',');
+        }
+        out.put(long(T(rng.next_long())));
     }
-    return encode(bytes.data(), bytes.size());
 }
 
 void
-doc(unsigned long num, unsigned long numKeys, unsigned long numBytes) {
-    std::string keys = create_keys(num * numKeys, numKeys);
-    std::string bytes = create_values<int8_t>(numBytes);
-    std::string longs = create_values<int64_t>((numBytes + (sizeof(long) - 1))/sizeof(long));
-    std::string raw = create_raw(numBytes);
-
-    printf("{\"id\":\"id:test:test::%d\", \"fields\":{"
-           "    \"id\":%lu,"
-           "    \"f1\":{%s},"
-           "    \"s1\":{%s},"
-           "    \"payload_raw\":\"%s\","
-           "    \"payload_array_byte\":[%s],"
-           "    \"payload_array_long\":[%s]"
-           " } }",
-           num, num, keys.c_str(), keys.c_str(), raw.c_str(), bytes.c_str(), longs.c_str());
+create_raw(Output &out, Xoshiro256 &rng, std::vector<char> &bytes, unsigned long numValues) {
+    bytes.resize(numValues);
+    rng.fill(bytes.data(), bytes.size());
+    size_t len = getEncodeLength(bytes.size());
+    char *dst = out.reserve(len);
+    out.commit(encode(reinterpret_cast<const unsigned char *>(bytes.data()), bytes.size(), dst));
+}
+
+void
+doc(Output &out, Xoshiro256 &rng, std::vector<char> &scratch, unsigned long num, unsigned long numKeys, unsigned long numBytes) {
+    out.put("{\"id\":\"id:test:test::");
+    out.put(long(num));
+    out.put("\", \"fields\":{    \"id\":");
+    out.put(long(num));
+    out.put(",    \"f1\":{");
+    create_keys(out, num * numKeys, numKeys);
+    out.put("},    \"s1\":{");
+    create_keys(out, num * numKeys, numKeys);
+    out.put("},    \"payload_raw\":\"");
+    create_raw(out, rng, scratch, numBytes);
+    out.put("\",    \"payload_array_byte\":[");
+    create_values<int8_t>(out, rng, numBytes);
+    out.put("],    \"payload_array_long\":[");
+    create_values<int64_t>(out, rng, (numBytes + (sizeof(long) - 1))/sizeof(long));
+    out.put("] } }");
+}
+
 }
 
 int
 main(int argc, char **argv) {
-    int i;
-    int numDocs = atoi(argv[1]);
-    int numKeys = atoi(argv[2]);
-    int numBytes = atoi(argv[3]);
-    printf("[\n");
-    for (i = 0; i < (numDocs-1); i++) {
-        doc(i, numKeys, numBytes);
-        printf(",\n");
-    }
-    doc(i, numKeys, numBytes);
-    printf("\n]\n");
+    if (argc < 4) {
+        fprintf(stderr, "%s <num docs> <num keys> <num payload bytes> [seed]\n", argv[0]);
+        return 1;
+    }
+    unsigned long numDocs = strtoul(argv[1], nullptr, 10);
+    unsigned long numKeys = strtoul(argv[2], nullptr, 10);
+    unsigned long numBytes = strtoul(argv[3], nullptr, 10);
+    uint64_t seed = (argc > 4) ? strtoull(argv[4], nullptr, 10) : 1;
+    Xoshiro256 rng(seed);
+    std::vector<char> scratch;
+    Output out;
+    out.put("[\n");
+    for (unsigned long i = 0; i < numDocs; i++) {
+        if (i != 0) {
+            out.put(",\n");
+        }
+        doc(out, rng, scratch, i, numKeys, numBytes);
+    }
+    out.put("\n]\n");
     return 0;
 }
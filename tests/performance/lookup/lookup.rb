@@ -41,7 +41,7 @@ class LookupPerformance < PerformanceTest
     container = (vespa.qrserver["0"] or vespa.container.values.first)
     tmp_bin_dir = container.create_tmp_bin_dir
     container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -o #{tmp_bin_dir}/docs #{selfdir}/docs.cpp")
-    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -o #{tmp_bin_dir}/query #{selfdir}/query.cpp")
+    container.execute("g++ -Wl,-rpath,#{Environment.instance.vespa_home}/lib64/ -g -O3 -I#{DataGenerator.lib_dir} -o #{tmp_bin_dir}/query #{selfdir}/query.cpp")
     start
     container.execute("#{tmp_bin_dir}/docs #{num_docs} #{num_values_per_doc} #{num_payload_bytes_per_doc}| vespa-feeder")
     assert_hitcount("sddocname:test", num_docs)
@@ -1,28 +1,262 @@
 // Copyright Vespa.ai. All rights reserved.
 
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <cstdio>
 #include <cstdint>
+#include <numeric>
+#include <random>
 #include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include "key_distribution.h"
+
+namespace {
+
+using Rng = std::mt19937_64;
+using keydist::Scatter;
+using keydist::Zipf;
+
+enum class KeyDist { UNIFORM, ZIPF, HOTSET, SEQUENTIAL };
+enum class CountDist { FIXED, UNIFORM, POISSON };
+
+struct Params {
+    KeyDist key_dist = KeyDist::UNIFORM;
+    double zipf_s = 1.0;
+    double hot_traffic = 0.9;   // fraction of draws hitting the hot set
+    double hot_keys = 0.1;      // fraction of the key space in the hot set
+    CountDist count_dist = CountDist::FIXED;
+    unsigned int min_keys = 1;
+    unsigned int max_keys = 1;
+    uint64_t seed = 1;
+    std::string histogram_file;
+    size_t top_keys = 100;
+};
+
+class KeyGenerator {
+    const Params &_params;
+    uint64_t _upper_limit;
+    Scatter _scatter;
+    Zipf _zipf;
+    uint64_t _hot_size;
+    uint64_t _next_sequential;
+
+public:
+    KeyGenerator(const Params &params, uint64_t upper_limit)
+        : _params(params),
+          _upper_limit(upper_limit),
+          _scatter(upper_limit),
+          _zipf(upper_limit, params.zipf_s),
+          _hot_size(std::clamp<uint64_t>(uint64_t(params.hot_keys * upper_limit), 1, upper_limit)),
+          _next_sequential(0)
+    {}
+    uint64_t operator()(Rng &rng) {
+        switch (_params.key_dist) {
+        case KeyDist::UNIFORM:
+            return std::uniform_int_distribution<uint64_t>(0, _upper_limit - 1)(rng);
+        case KeyDist::ZIPF:
+            return _scatter(_zipf(rng) - 1);
+        case KeyDist::HOTSET:
+            if (_hot_size == _upper_limit || std::bernoulli_distribution(_params.hot_traffic)(rng)) {
+                return _scatter(std::uniform_int_distribution<uint64_t>(0, _hot_size - 1)(rng));
+            }
+            return _scatter(std::uniform_int_distribution<uint64_t>(_hot_size, _upper_limit - 1)(rng));
+        case KeyDist::SEQUENTIAL:
+            break;
+        }
+        uint64_t key = _next_sequential;
+        _next_sequential = (_next_sequential + 1) % _upper_limit;
+        return key;
+    }
+};
+
+unsigned int
+keys_in_query(const Params &params, Rng &rng) {
+    switch (params.count_dist) {
+    case CountDist::FIXED:
+        break;
+    case CountDist::UNIFORM:
+        return std::uniform_int_distribution<unsigned int>(params.min_keys, params.max_keys)(rng);
+    case CountDist::POISSON:
+        return std::max(1u, std::poisson_distribution<unsigned int>(params.min_keys)(rng));
+    }
+    return params.min_keys;
+}
 
 void
-query(unsigned int keys_per_query, unsigned long upper_limit) {
-    std::ostringstream keys;
-    keys << (rand()%upper_limit) << "%3A1";
-    for (unsigned int i(1); i < keys_per_query; i++) {
-        keys << "," << (rand()%upper_limit) << "%3A1";
+query(const Params &params, KeyGenerator &gen, Rng &rng, uint64_t upper_limit,
+      std::vector<uint64_t> &keys, std::unordered_map<uint64_t, uint64_t> *histogram) {
+    unsigned int num_keys = std::min<uint64_t>(keys_in_query(params, rng), upper_limit);
+    keys.clear();
+    // Duplicate tokens collapse in the query, so redraw (a bounded number of times) to
+    // keep the requested number of distinct keys.
+    for (unsigned int attempts = 0; keys.size() < num_keys && attempts < 16 * num_keys; ++attempts) {
+        uint64_t key = gen(rng);
+        if (std::find(keys.begin(), keys.end(), key) == keys.end()) {
+            keys.push_back(key);
+        }
+    }
+    std::ostringstream os;
+    for (size_t i(0); i < keys.size(); i++) {
+        if (i != 0) {
+            os << ",";
+        }
+        os << keys[i] << "%3A1";
+        if (histogram != nullptr) {
+            ++(*histogram)[keys[i]];
+        }
     }
-    printf("/search/?wand.tokens=%7B%s%7D\n", keys.str().c_str());
+    printf("/search/?wand.tokens=%%7B%s%%7D\n", os.str().c_str());
+}
+
+/**
+ * Writes the realized key frequencies: totals, the most frequent keys and
+ * how many keys were drawn exactly n times.
+ */
+void
+write_histogram(const Params &params, const std::unordered_map<uint64_t, uint64_t> &histogram,
+                uint64_t upper_limit) {
+    FILE *out = fopen(params.histogram_file.c_str(), "w");
+    if (out == nullptr) {
+        perror(params.histogram_file.c_str());
+        exit(1);
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> by_count(histogram.begin(), histogram.end());
+    std::sort(by_count.begin(), by_count.end(), [](const auto &a, const auto &b) {
+        return (a.second != b.second) ? (a.second > b.second) : (a.first < b.first);
+    });
+    uint64_t total = 0;
+    for (const auto &entry : by_count) {
+        total += entry.second;
+    }
+    fprintf(out, "# key_space %lu\n# draws %lu\n# distinct_keys %lu\n", upper_limit, total, by_count.size());
+    fprintf(out, "# top keys: key count cumulative_fraction\n");
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < std::min(params.top_keys, by_count.size()); ++i) {
+        cumulative += by_count[i].second;
+        fprintf(out, "top\t%lu\t%lu\t%.6f\n", by_count[i].first, by_count[i].second, double(cumulative) / total);
+    }
+    fprintf(out, "# frequency of frequencies: times_drawn num_keys\n");
+    for (size_t i = 0; i < by_count.size();) {
+        size_t j = i;
+        while (j < by_count.size() && by_count[j].second == by_count[i].second) {
+            ++j;
+        }
+        fprintf(out, "freq\t%lu\t%lu\n", by_count[i].second, j - i);
+        i = j;
+    }
+    fclose(out);
+}
+
+void
+usage(const char *prog) {
+    fprintf(stderr,
+            "%s [options] <num queries> <keys per query> <upper limit>\n"
+            "  -d <dist>  key distribution: uniform (default), zipf:<s>, hotset:<traffic%%>:<keys%%>, sequential\n"
+            "  -k <dist>  keys per query: fixed (default), uniform:<min>:<max>, poisson (mean <keys per query>)\n"
+            "  -s <seed>  random seed (default 1)\n"
+            "  -o <file>  write realized key frequency histogram\n"
+            "  -t <n>     number of most frequent keys in histogram (default 100)\n",
+            prog);
+}
+
+bool
+parse_key_dist(const std::string &arg, Params &params) {
+    if (arg == "uniform") {
+        params.key_dist = KeyDist::UNIFORM;
+    } else if (arg == "sequential") {
+        params.key_dist = KeyDist::SEQUENTIAL;
+    } else if (arg.rfind("zipf", 0) == 0) {
+        params.key_dist = KeyDist::ZIPF;
+        if (arg.size() > 5) {
+            params.zipf_s = atof(arg.c_str() + 5);
+        }
+        return params.zipf_s > 0.0;
+    } else if (sscanf(arg.c_str(), "hotset:%lf:%lf", &params.hot_traffic, &params.hot_keys) == 2) {
+        params.key_dist = KeyDist::HOTSET;
+        params.hot_traffic /= 100.0;
+        params.hot_keys /= 100.0;
+        return params.hot_keys > 0.0 && params.hot_keys <= 1.0 && params.hot_traffic >= 0.0 && params.hot_traffic <= 1.0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool
+parse_count_dist(const std::string &arg, Params &params) {
+    if (arg == "fixed") {
+        params.count_dist = CountDist::FIXED;
+    } else if (arg == "poisson") {
+        params.count_dist = CountDist::POISSON;
+    } else if (sscanf(arg.c_str(), "uniform:%u:%u", &params.min_keys, &params.max_keys) == 2) {
+        params.count_dist = CountDist::UNIFORM;
+        return params.min_keys > 0 && params.min_keys <= params.max_keys;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 }
 
 int
 main(int argc, char **argv) {
-    long numQueries = atoi(argv[1]);
-    long keys_per_query = atoi(argv[2]);
-    long upper_limit = atoi(argv[3]);
-    srand(1);
+    Params params;
+    int option;
+    while ((option = getopt(argc, argv, "d:k:s:o:t:h")) != -1) {
+        bool ok = true;
+        switch (option) {
+        case 'd':
+            ok = parse_key_dist(optarg, params);
+            break;
+        case 'k':
+            ok = parse_count_dist(optarg, params);
+            break;
+        case 's':
+            params.seed = strtoull(optarg, nullptr, 10);
+            break;
+        case 'o':
+            params.histogram_file = optarg;
+            break;
+        case 't':
+            params.top_keys = strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    long numQueries = atol(argv[optind]);
+    long keys_per_query = atol(argv[optind + 1]);
+    uint64_t upper_limit = strtoull(argv[optind + 2], nullptr, 10);
+    if (keys_per_query <= 0 || upper_limit == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (params.count_dist != CountDist::UNIFORM) {
+        params.min_keys = params.max_keys = keys_per_query;
+    }
+    Rng rng(params.seed);
+    KeyGenerator gen(params, upper_limit);
+    std::unordered_map<uint64_t, uint64_t> histogram;
+    std::vector<uint64_t> keys;
     for (long i = 0; i < numQueries; i++) {
-        query(keys_per_query, upper_limit);
+        query(params, gen, rng, upper_limit, keys, params.histogram_file.empty() ? nullptr : &histogram);
+    }
+    if (!params.histogram_file.empty()) {
+        write_histogram(params, histogram, upper_limit);
     }
     return 0;
 }
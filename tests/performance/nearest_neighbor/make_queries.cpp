@@ -1,7 +1,10 @@
 // Copyright Vespa.ai. All rights reserved.
 
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -31,6 +34,18 @@ print_vector(std::ostream& os, const FloatVector& vector)
     os << "]";
 }
 
+void
+print_hex_vector(std::ostream& os, const FloatVector& vector)
+{
+    os << "\"" << std::hex << std::uppercase << std::setfill('0');
+    for (auto val : vector) {
+        uint32_t bits;
+        std::memcpy(&bits, &val, sizeof(bits));
+        os << std::setw(8) << bits;
+    }
+    os << std::dec << std::nouppercase << std::setfill(' ') << "\"";
+}
+
 void
 print_random_location(std::ostream& os, const Interval &latitude, const Interval &longitude)
 {
@@ -85,6 +100,33 @@ print_query(std::ostream& os, bool approximate, int target_hits, int explore_hit
     os << std::endl;
 }
 
+/*
+ * POST variant of print_query, for fbench -P: the url line, then a JSON body with the YQL and the query
+ * vector as an array or hex string, so large vectors are neither URL encoded nor decoded.
+ */
+void
+print_post_query(std::ostream& os, bool approximate, int target_hits, int explore_hits, int filter_percent, float radius, const Interval &latitude, const Interval &longitude, const std::string& doc_tensor, const FloatVector& vector, bool hex)
+{
+    os << "/search/?" << std::endl;
+    os << "{\"yql\": \"select * from sources * where [{\\\"targetNumHits\\\":" << target_hits
+       << ",\\\"hnsw.exploreAdditionalHits\\\":" << explore_hits
+       << ",\\\"approximate\\\":" << (approximate ? "true" : "false")
+       << ",\\\"label\\\":\\\"nns\\\"}]nearestNeighbor(" << doc_tensor << ",q_vec)";
+    if (filter_percent > 0) {
+        os << " and filter=" << filter_percent;
+    }
+    if (radius > 0.0f && latitude.non_empty() && longitude.non_empty()) {
+        os << " and geoLocation(latlng," << latitude.random() << "," << longitude.random() << ",\\\"" << radius << " km\\\")";
+    }
+    os << "\", \"input.query(q_vec)\": ";
+    if (hex) {
+        print_hex_vector(os, vector);
+    } else {
+        print_vector(os, vector);
+    }
+    os << "}" << std::endl;
+}
+
 int
 print_only_locations(int argc, char **argv) {
     Interval latitude;
@@ -122,7 +164,11 @@ print_only_locations(int argc, char **argv) {
  *   tar -xf gist.tar.gz
  *
  * To run:
- *   ./make_queries <vector-file> <num-dimensions> <num-queries> <doc-tensor> <approximate> <target-hits> <explore-hits> <filter-percent> <radius> <latitude-interval> <longitude-interval>
+ *   ./make_queries <vector-file> <num-dimensions> <num-queries> <doc-tensor> <approximate> <target-hits> <explore-hits> <filter-percent> <radius> <latitude-interval> <longitude-interval> [--post | --post-hex]
+ *
+ * With --post, queries are written for fbench -P (or open_loop_bench -P) as a url line and a JSON body line,
+ * with the query vector as a JSON array, or with --post-hex as a hex string of the float cells. The flag may
+ * be given anywhere. h2load is not supported, as h2load --data sends the same body with every request.
  */ 
 int
 main(int argc, char **argv)
@@ -140,6 +186,20 @@ main(int argc, char **argv)
     Interval latitude;
     Interval longitude;
     bool only_vectors = true;
+    bool post = false;
+    bool hex = false;
+    // Check for --post(-hex) anywhere in arguments, and keep only the positional ones in argv
+    int num_args = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--post" || arg == "--post-hex") {
+            post = true;
+            hex = (arg == "--post-hex");
+        } else {
+            argv[num_args++] = argv[i];
+        }
+    }
+    argc = num_args;
     if (argc > 1) {
         vector_file = std::string(argv[1]);
 
@@ -193,6 +253,8 @@ main(int argc, char **argv)
         if (only_vectors) {
             print_vector(std::cout, vector);
             std::cout << std::endl;
+        } else if (post) {
+            print_post_query(std::cout, approximate, target_hits, explore_hits, filter_percent, radius, latitude, longitude, doc_tensor, vector, hex);
         } else {
             print_query(std::cout, approximate, target_hits, explore_hits, filter_percent, radius, latitude, longitude, doc_tensor, vector);
         }
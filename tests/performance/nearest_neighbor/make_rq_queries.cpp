@@ -3,6 +3,7 @@
 // Based on tests/performance/nearest_neighbor/make_queries.cpp
 
 #include <cassert>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -58,6 +59,16 @@ void print_int8_vector(std::ostream& os, const std::vector<int8_t>& vec) {
     os << "]";
 }
 
+void print_hex_int8_vector(std::ostream& os, const std::vector<int8_t>& vec) {
+    static const char digits[] = "0123456789ABCDEF";
+    os << "\"";
+    for (int8_t v : vec) {
+        uint8_t bits = static_cast<uint8_t>(v);
+        os << digits[bits >> 4] << digits[bits & 15];
+    }
+    os << "\"";
+}
+
 void print_float_vector(std::ostream& os, const std::vector<float>& vec) {
     os << "[";
     for (size_t i = 0; i < vec.size(); ++i) {
@@ -113,6 +124,34 @@ void print_rq_query(std::ostream& os, bool approximate, int target_hits, int exp
     os << std::endl;
 }
 
+// POST variant for fbench -P: the url line, then a JSON body with the YQL and the RQ encoded query
+// vector as a JSON array or hex string, so the request is neither URL encoded nor decoded.
+void print_rq_post_query(std::ostream& os, bool approximate, int target_hits, int explore_hits,
+                         int filter_percent, float radius,
+                         const Interval& latitude, const Interval& longitude,
+                         const std::string& doc_tensor, const std::string& query_tensor,
+                         const std::vector<int8_t>& rq_encoded, bool hex) {
+    os << "/search/?" << std::endl;
+    os << "{\"yql\": \"select * from sources * where [{\\\"targetNumHits\\\":" << target_hits
+       << ",\\\"hnsw.exploreAdditionalHits\\\":" << explore_hits
+       << ",\\\"approximate\\\":" << (approximate ? "true" : "false")
+       << ",\\\"label\\\":\\\"nns\\\"}]nearestNeighbor(" << doc_tensor << "," << query_tensor << ")";
+    if (filter_percent > 0) {
+        os << " and filter=" << filter_percent;
+    }
+    if (radius > 0.0f && latitude.non_empty() && longitude.non_empty()) {
+        os << " and geoLocation(latlng," << latitude.random() << "," << longitude.random()
+           << ",\\\"" << radius << " km\\\")";
+    }
+    os << "\", \"input.query(" << query_tensor << ")\": ";
+    if (hex) {
+        print_hex_int8_vector(os, rq_encoded);
+    } else {
+        print_int8_vector(os, rq_encoded);
+    }
+    os << "}" << std::endl;
+}
+
 // ============== FVECS file reading ==============
 
 std::vector<float> read_fvecs_vector(std::ifstream& is, size_t expected_dim) {
@@ -132,7 +171,7 @@ std::vector<float> read_fvecs_vector(std::ifstream& is, size_t expected_dim) {
 void print_usage(const char* prog) {
     std::cerr << "Usage: " << prog << " <vector-file> <num-dims> <num-queries> <seed> "
               << "<doc-tensor> <query-tensor> [approximate] [target-hits] [explore-hits] "
-              << "[filter-percent] [radius] [latitude] [longitude] [--no-rotation]" << std::endl;
+              << "[filter-percent] [radius] [latitude] [longitude] [--no-rotation] [--post | --post-hex]" << std::endl;
     std::cerr << std::endl;
     std::cerr << "Example: " << prog << " sift_query.fvecs 128 10000 42 vec_rq q_rq true 100 0" << std::endl;
     std::cerr << std::endl;
@@ -146,8 +185,11 @@ void print_usage(const char* prog) {
     std::cerr << "  target-hits:   Target number of hits" << std::endl;
     std::cerr << "  explore-hits:  Additional HNSW exploration" << std::endl;
     std::cerr << "  --no-rotation: Skip random rotation step (for benchmarking)" << std::endl;
+    std::cerr << "  --post:        POST queries: url and JSON body lines, vector as JSON array" << std::endl;
+    std::cerr << "  --post-hex:    POST queries with the vector as a hex string" << std::endl;
     std::cerr << std::endl;
-    std::cerr << "Output: URL-encoded queries for fbench, one per line" << std::endl;
+    std::cerr << "Output: URL-encoded queries for fbench, one per line, or url and body lines for fbench -P" << std::endl;
+    std::cerr << "        (not h2load, whose --data sends the same body with every request)" << std::endl;
 }
 
 void print_only_vectors(std::ifstream& is, rq::RQEncoder& encoder, size_t dim_size, size_t num_queries) {
@@ -210,12 +252,17 @@ int main(int argc, char **argv) {
     if (argc > 12 && !is_flag(argv[12])) latitude = parse_interval(argv[12]);
     if (argc > 13 && !is_flag(argv[13])) longitude = parse_interval(argv[13]);
 
-    // Check for --no-rotation flag anywhere in arguments
+    // Check for --no-rotation and --post(-hex) flags anywhere in arguments
     bool skip_rotation = false;
+    bool post = false;
+    bool hex = false;
     for (int i = 1; i < argc; ++i) {
-        if (std::string(argv[i]) == "--no-rotation") {
+        std::string arg(argv[i]);
+        if (arg == "--no-rotation") {
             skip_rotation = true;
-            break;
+        } else if (arg == "--post" || arg == "--post-hex") {
+            post = true;
+            hex = (arg == "--post-hex");
         }
     }
 
@@ -254,9 +301,15 @@ int main(int argc, char **argv) {
         if (vec.empty()) break;
 
         std::vector<int8_t> rq_encoded = encoder.encode_as_int8(vec);
-        print_rq_query(std::cout, approximate, target_hits, explore_hits,
-                       filter_percent, radius, latitude, longitude,
-                       doc_tensor, query_tensor, rq_encoded);
+        if (post) {
+            print_rq_post_query(std::cout, approximate, target_hits, explore_hits,
+                                filter_percent, radius, latitude, longitude,
+                                doc_tensor, query_tensor, rq_encoded, hex);
+        } else {
+            print_rq_query(std::cout, approximate, target_hits, explore_hits,
+                           filter_percent, radius, latitude, longitude,
+                           doc_tensor, query_tensor, rq_encoded);
+        }
     }
 
     is.close();
@@ -1,88 +1,54 @@
 // Copyright Vespa.ai. All rights reserved.
 
 #include <algorithm>
-#include <cassert>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
-#include <numeric>
-#include <random>
+#include <string>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
-using IntVector = std::vector<int>;
+#include "range_layout.h"
 
-const IntVector hits_ratios = {1, 2, 4, 5, 6, 8, 10, 20, 40, 50, 60, 80, 100, 150, 200};
-
-/*
- * Generates the set of values to be inserted into a field.
- *
- * When searching for range(my_field, LOWER, UPPER) this will match 'values_in_range'
- * unique values (or posting lists) and return a number of hits given by the 'hits_ratio'.
- *
- * LOWER = hits_ratio * 10000000 + values_in_range
- * UPPER = LOWER + values_in_range
- */
-IntVector make_range_values(int num_docs, int values_in_range) {
-    IntVector result(num_docs, 0);
-    int i = 0;
-    for (int hits_ratio : hits_ratios) {
-        int hits = ((size_t)num_docs * (size_t)hits_ratio) / 1000;
-        if (hits >= values_in_range) {
-            int hits_per_value = hits / values_in_range;
-            int value = hits_ratio * 10000000 + values_in_range;
-            for (int j = 0; j < hits; ++j) {
-                result[i++] = value;
-                if ((j + 1) % hits_per_value == 0) {
-                    ++value;
-                }
-            }
-        }
+void format_doc(std::string &out, uint64_t doc_id, const RangeValuesData& values, const FieldLayout& filter) {
+    char buf[64];
+    out.append(buf, snprintf(buf, sizeof(buf), "{\"put\":\"id:test:test::%lu\",\"fields\":{", doc_id));
+    for (const auto& elem : values) {
+        out.append(buf, snprintf(buf, sizeof(buf), "\"v_%d\":%d,", elem.first, elem.second.value(doc_id)));
     }
-    assert(i <= num_docs);
-    return result;
-}
-
-IntVector make_filter(int num_docs) {
-    IntVector result(num_docs, 0);
-    int i = 0;
-    for (int hits_ratio : hits_ratios) {
-        int hits = ((size_t)num_docs * (size_t)hits_ratio) / 1000;
-        for (int j = 0; j < hits; ++j) {
-            result[i++] = hits_ratio;
-        }
-    }
-    assert(i <= num_docs);
-    return result;
-}
-
-void shuffle(IntVector& vector, int seed) {
-    std::default_random_engine engine(seed);
-    std::shuffle(vector.begin(), vector.end(), engine);
+    out.append(buf, snprintf(buf, sizeof(buf), "\"filter\":%d", filter.value(doc_id)));
+    out.append("}}");
 }
 
-using RangeValuesData = std::vector<std::pair<int, IntVector>>;
-
-RangeValuesData make_range_values_data(int num_docs) {
-    RangeValuesData result;
-    for (int values_in_range : {1, 10, 100, 1000, 10000, 100000, 1000000}) {
-        auto values = make_range_values(num_docs, values_in_range);
-        shuffle(values, 1234);
-        result.emplace_back(values_in_range, std::move(values));
-    }
-    return result;
-}
-
-void print_docs(int num_docs, const RangeValuesData& values, const IntVector& filter) {
+/*
+ * Prints documents [first, last) in order. Documents are formatted in blocks by
+ * 'num_threads' threads, and the blocks of each round are written in order.
+ */
+void print_docs(uint64_t first, uint64_t last, const RangeValuesData& values, const FieldLayout& filter, int num_threads) {
+    constexpr uint64_t block_size = 16384;
+    std::vector<std::string> buffers(num_threads);
     printf("[\n");
-    for (int doc_id = 0; doc_id < num_docs; ++doc_id) {
-        if (doc_id > 0) {
-            printf(",\n");
+    for (uint64_t round_begin = first; round_begin < last; round_begin += block_size * num_threads) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t) {
+            uint64_t begin = std::min(last, round_begin + t * block_size);
+            uint64_t end = std::min(last, begin + block_size);
+            threads.emplace_back([&, t, begin, end]() {
+                std::string &out = buffers[t];
+                out.clear();
+                for (uint64_t doc_id = begin; doc_id < end; ++doc_id) {
+                    if (doc_id > first) {
+                        out.append(",\n");
+                    }
+                    format_doc(out, doc_id, values, filter);
+                }
+            });
         }
-        printf("{\"put\":\"id:test:test::%d\",\"fields\":{", doc_id);
-        for (const auto& elem : values) {
-            printf("\"v_%d\":%d,", elem.first, elem.second[doc_id]);
+        for (int t = 0; t < num_threads; ++t) {
+            threads[t].join();
+            fwrite(buffers[t].data(), 1, buffers[t].size(), stdout);
         }
-        printf("\"filter\":%d", filter[doc_id]);
-        printf("}}");
     }
     printf("\n]\n");
 }
@@ -106,24 +72,39 @@ void print_docs(int num_docs, const RangeValuesData& values, const IntVector& fi
  *
  * The 'filter' field is populated such that a query filter term returns a subset of the corpus (filter_hits_ratio):
  * 0.1%, 0.2%, 0.4%, 0.5%, 0.6%, 0.8%, 1%, 2%, 4%, 5%, 6%, 8%, 10%, 15%, 20%.
+ *
+ * The values of a document are computed from its id alone (see Permutation), so memory usage is
+ * independent of the number of documents. Use -p <part>:<parts> to only print a contiguous slice of
+ * the corpus, e.g. to generate it on several hosts, and -t to format documents with several threads.
  */
 int main(int argc, char *argv[]) {
-    int num_docs = 10000;
+    uint64_t num_docs = 10000;
+    uint64_t part = 0;
+    uint64_t parts = 1;
+    int num_threads = 1;
 
     int option;
-    while ((option = getopt(argc, argv, "d:")) != -1) {
+    while ((option = getopt(argc, argv, "d:p:t:")) != -1) {
         switch (option) {
             case 'd':
-                num_docs = std::stoi(optarg);
+                num_docs = std::stoull(optarg);
+                break;
+            case 'p':
+                if (sscanf(optarg, "%lu:%lu", &part, &parts) != 2 || parts == 0 || part >= parts) {
+                    std::cerr << "Part must be given as <part>:<parts>, with part < parts" << std::endl;
+                    return 1;
+                }
+                break;
+            case 't':
+                num_threads = std::max(1, std::stoi(optarg));
                 break;
             default:
+                std::cerr << argv[0] << " -d <num docs> -p <part>:<parts> -t <num threads>" << std::endl;
                 return 1;
         }
     }
     auto values = make_range_values_data(num_docs);
-    auto filter = make_filter(num_docs);
-    shuffle(filter, 5678);
-    print_docs(num_docs, values, filter);
+    FieldLayout filter(make_filter(num_docs), num_docs, 5678);
+    print_docs(num_docs * part / parts, num_docs * (part + 1) / parts, values, filter, num_threads);
     return 0;
 }
-
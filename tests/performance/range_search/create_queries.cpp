@@ -0,0 +1,334 @@
+// Copyright Vespa.ai. All rights reserved.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "range_layout.h"
+
+struct Params {
+    uint64_t num_docs = 10000;
+    std::vector<int> token_counts;  // empty means 'values_in_range' tokens
+    bool range = true;
+    bool in = true;
+    bool not_in = false;
+    bool fast_search = false;
+    bool in_builder = false;
+    int num_threads = 1;
+    std::string query_file;
+    std::string expected_file;
+};
+
+/*
+ * Exact hit counts for all queries, computed with one pass over the corpus using the same
+ * value layout as create_docs.cpp.
+ *
+ * Counts are kept per (field, range block, slot, filter block). Slot 0 counts documents in
+ * range(LOWER, UPPER), slot k > 0 documents matching the k'th IN token count of the field.
+ * Filter block 0 is documents without filter value, filter block j > 0 is hits_ratios[j-1].
+ */
+class HitCounts {
+    size_t _num_slots;
+    size_t _num_filters;
+    std::vector<uint64_t> _counts;
+
+public:
+    static constexpr size_t max_blocks = 16;
+
+    HitCounts(size_t num_fields, size_t num_slots, size_t num_filters)
+        : _num_slots(num_slots), _num_filters(num_filters),
+          _counts(num_fields * max_blocks * num_slots * num_filters, 0)
+    {}
+    uint64_t &at(size_t field, size_t block, size_t slot, size_t filter) {
+        return _counts[((field * max_blocks + block) * _num_slots + slot) * _num_filters + filter];
+    }
+    void merge(const HitCounts &rhs) {
+        for (size_t i = 0; i < _counts.size(); ++i) {
+            _counts[i] += rhs._counts[i];
+        }
+    }
+    uint64_t total(size_t field, size_t block, size_t slot) {
+        uint64_t sum = 0;
+        for (size_t filter = 0; filter < _num_filters; ++filter) {
+            sum += at(field, block, slot, filter);
+        }
+        return sum;
+    }
+};
+
+std::vector<int> token_counts_for(const Params &params, int values_in_range) {
+    if (params.token_counts.empty()) {
+        return {values_in_range};
+    }
+    std::vector<int> result;
+    for (int tokens : params.token_counts) {
+        if (tokens <= values_in_range) {
+            result.push_back(tokens);
+        }
+    }
+    return result;
+}
+
+HitCounts count_hits(const Params &params, const RangeValuesData &values, const FieldLayout &filter, size_t num_slots) {
+    size_t num_filters = filter.blocks().size() + 1;
+    std::vector<HitCounts> partial(params.num_threads, HitCounts(values.size(), num_slots, num_filters));
+    std::vector<std::vector<int>> tokens;
+    for (const auto &elem : values) {
+        tokens.push_back(token_counts_for(params, elem.first));
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < params.num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            HitCounts &counts = partial[t];
+            uint64_t begin = params.num_docs * t / params.num_threads;
+            uint64_t end = params.num_docs * (t + 1) / params.num_threads;
+            for (uint64_t doc_id = begin; doc_id < end; ++doc_id) {
+                uint64_t unused = 0;
+                size_t filter_idx = filter.block_index(doc_id, unused) + 1;
+                for (size_t field = 0; field < values.size(); ++field) {
+                    uint64_t offset = 0;
+                    int block = values[field].second.block_index(doc_id, offset);
+                    if (block < 0) {
+                        continue;
+                    }
+                    // range() is inclusive in both ends, i.e. 'values_in_range' + 1 values.
+                    if (offset <= uint64_t(values[field].first)) {
+                        ++counts.at(field, block, 0, filter_idx);
+                    }
+                    for (size_t k = 0; k < tokens[field].size(); ++k) {
+                        if (offset < uint64_t(tokens[field][k])) {
+                            ++counts.at(field, block, k + 1, filter_idx);
+                        }
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (int t = 1; t < params.num_threads; ++t) {
+        partial[0].merge(partial[t]);
+    }
+    return std::move(partial[0]);
+}
+
+// Same encoding as Ruby's URI.encode_www_form, used by range_search.rb and in_operator.rb.
+std::string url_encode(const std::string &str) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string result;
+    for (unsigned char c : str) {
+        if (isalnum(c) || c == '*' || c == '-' || c == '.' || c == '_') {
+            result.push_back(c);
+        } else if (c == ' ') {
+            result.push_back('+');
+        } else {
+            result.push_back('%');
+            result.push_back(hex[c >> 4]);
+            result.push_back(hex[c & 0xf]);
+        }
+    }
+    return result;
+}
+
+std::string filter_term(int filter_hits_ratio) {
+    return (filter_hits_ratio > 0) ? " and filter = " + std::to_string(filter_hits_ratio) : "";
+}
+
+std::string make_range_query(const std::string &field, int lower, int upper, int filter_hits_ratio) {
+    std::ostringstream yql;
+    yql << "select * from sources * where range(" << field << ", " << lower << ", " << upper << ")"
+        << filter_term(filter_hits_ratio);
+    return "/search/?yql=" + url_encode(yql.str()) + "&hits=0";
+}
+
+/*
+ * The IN operator matches tokens [LOWER, LOWER + tokens). With 'in_builder' the tokens are
+ * added by InItemBuilder (see ../in_operator) to keep the query line short.
+ */
+std::string make_in_query(const std::string &field, int lower, int tokens, bool not_in, int filter_hits_ratio, bool in_builder) {
+    std::ostringstream yql;
+    yql << "select * from sources * where " << (not_in ? "!" : "") << "(" << field << " in (";
+    int inline_tokens = in_builder ? 1 : tokens;
+    for (int i = 0; i < inline_tokens; ++i) {
+        yql << (i > 0 ? ", " : "") << (lower + i);
+    }
+    yql << "))" << filter_term(filter_hits_ratio);
+    std::string result = "/search/?yql=" + url_encode(yql.str());
+    if (in_builder) {
+        result += "&inbuilder.lower=" + std::to_string(lower + 1) + "&inbuilder.upper=" + std::to_string(lower + tokens);
+    }
+    return result + "&hits=0";
+}
+
+class Writer {
+    std::ostream &_queries;
+    std::ostream *_expected;
+
+public:
+    Writer(std::ostream &queries, std::ostream *expected)
+        : _queries(queries), _expected(expected)
+    {
+        if (_expected != nullptr) {
+            *_expected << "#label\ttype\tfield\thits_ratio\tvalues_in_range\ttokens\tfilter_hits_ratio\ttotal_count" << std::endl;
+        }
+    }
+    void write(const std::string &label, const std::string &type, const std::string &field, int hits_ratio,
+               int values_in_range, int tokens, int filter_hits_ratio, uint64_t total_count, const std::string &query) {
+        _queries << query << "\n";
+        if (_expected != nullptr) {
+            *_expected << label << "\t" << type << "\t" << field << "\t" << hits_ratio << "\t" << values_in_range << "\t"
+                       << tokens << "\t" << filter_hits_ratio << "\t" << total_count << "\n";
+        }
+    }
+};
+
+void write_queries(const Params &params, const RangeValuesData &values, const FieldLayout &filter,
+                   HitCounts &counts, Writer &writer) {
+    // Filter block index (see HitCounts) of each filter hits ratio with documents, 0 meaning no filter.
+    std::vector<size_t> filter_idxs = {0};
+    for (size_t i = 0; i < filter.blocks().size(); ++i) {
+        if (filter.blocks()[i].end > filter.blocks()[i].begin) {
+            filter_idxs.push_back(i + 1);
+        }
+    }
+    for (size_t field = 0; field < values.size(); ++field) {
+        int values_in_range = values[field].first;
+        auto tokens = token_counts_for(params, values_in_range);
+        const auto &blocks = values[field].second.blocks();
+        for (size_t block = 0; block < blocks.size(); ++block) {
+            int hits_ratio = blocks[block].hits_ratio;
+            int lower = blocks[block].first_value;
+            for (size_t f : filter_idxs) {
+                int filter_hits_ratio = (f == 0) ? 0 : filter.blocks()[f - 1].hits_ratio;
+                auto count = [&](size_t slot) {
+                    return (f == 0) ? counts.total(field, block, slot) : counts.at(field, block, slot, f);
+                };
+                // Documents with the filter value (or all documents), used for NOT IN.
+                uint64_t candidates = (f == 0) ? params.num_docs : (filter.blocks()[f - 1].end - filter.blocks()[f - 1].begin);
+                std::string suffix = "_f" + std::to_string(filter_hits_ratio);
+                if (params.range) {
+                    for (bool fs : {false, true}) {
+                        if (fs && !params.fast_search) {
+                            continue;
+                        }
+                        std::string name = "v_" + std::to_string(values_in_range) + (fs ? "_fs" : "");
+                        std::string label = "query_r" + std::to_string(hits_ratio) + "_v" + std::to_string(values_in_range) +
+                                            "_fs" + (fs ? "true" : "false") + suffix;
+                        writer.write(label, "range", name, hits_ratio, values_in_range, values_in_range + 1, filter_hits_ratio,
+                                     count(0), make_range_query(name, lower, lower + values_in_range, filter_hits_ratio));
+                    }
+                }
+                std::string name = "v_" + std::to_string(values_in_range);
+                for (size_t k = 0; k < tokens.size(); ++k) {
+                    std::string label = "query_o" + std::to_string(hits_ratio) + "_v" + std::to_string(values_in_range) +
+                                        "_t" + std::to_string(tokens[k]) + suffix;
+                    if (params.in) {
+                        writer.write(label, "in", name, hits_ratio, values_in_range, tokens[k], filter_hits_ratio, count(k + 1),
+                                     make_in_query(name, lower, tokens[k], false, filter_hits_ratio, params.in_builder));
+                    }
+                    if (params.not_in) {
+                        writer.write(label + "_not", "not_in", name, hits_ratio, values_in_range, tokens[k], filter_hits_ratio,
+                                     candidates - count(k + 1),
+                                     make_in_query(name, lower, tokens[k], true, filter_hits_ratio, params.in_builder));
+                    }
+                }
+            }
+        }
+    }
+}
+
+std::vector<int> parse_list(const std::string &str) {
+    std::vector<int> result;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        result.push_back(std::stoi(item));
+    }
+    return result;
+}
+
+void usage(const char *prog) {
+    std::cerr << prog << " [options]" << std::endl
+              << "  -d <num docs>          (must match create_docs.cpp, default 10000)" << std::endl
+              << "  -o <types>             (comma separated query types: range,in,not_in; default range,in)" << std::endl
+              << "  -k <token counts>      (comma separated IN token counts, default values_in_range of the field)" << std::endl
+              << "  -f                     (also emit range queries against the v_%d_fs fields)" << std::endl
+              << "  -b                     (let InItemBuilder add IN tokens via inbuilder.lower/upper)" << std::endl
+              << "  -q <query file>        (default stdout)" << std::endl
+              << "  -e <expected file>     (expected totalCount per query, same line order as the queries)" << std::endl
+              << "  -t <num threads>       (threads used for counting hits, default 1)" << std::endl;
+}
+
+/**
+ * This program generates range() and IN operator queries for the corpus generated by create_docs.cpp.
+ *
+ * Every valid combination of values_in_range, range hits_ratio and filter_hits_ratio (0 meaning no
+ * filter) for the given number of documents is emitted, together with the exact expected totalCount
+ * of each query. The counts are computed from the document value layout rather than from the
+ * nominal hits ratio, so they also hold when the number of hits is not a multiple of values_in_range.
+ */
+int main(int argc, char *argv[]) {
+    Params params;
+    int option;
+    while ((option = getopt(argc, argv, "d:o:k:fbq:e:t:h")) != -1) {
+        switch (option) {
+            case 'd':
+                params.num_docs = std::stoull(optarg);
+                break;
+            case 'o': {
+                std::string types = std::string(",") + optarg + ",";
+                params.range = (types.find(",range,") != std::string::npos);
+                params.in = (types.find(",in,") != std::string::npos);
+                params.not_in = (types.find(",not_in,") != std::string::npos);
+                break;
+            }
+            case 'k':
+                params.token_counts = parse_list(optarg);
+                break;
+            case 'f':
+                params.fast_search = true;
+                break;
+            case 'b':
+                params.in_builder = true;
+                break;
+            case 'q':
+                params.query_file = optarg;
+                break;
+            case 'e':
+                params.expected_file = optarg;
+                break;
+            case 't':
+                params.num_threads = std::max(1, std::stoi(optarg));
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    auto values = make_range_values_data(params.num_docs);
+    FieldLayout filter(make_filter(params.num_docs), params.num_docs, 5678);
+    size_t num_slots = 1 + std::max<size_t>(1, params.token_counts.size());
+    HitCounts counts = count_hits(params, values, filter, num_slots);
+
+    std::ofstream query_file;
+    if (!params.query_file.empty()) {
+        query_file.open(params.query_file);
+    }
+    std::ofstream expected_file;
+    if (!params.expected_file.empty()) {
+        expected_file.open(params.expected_file);
+    }
+    Writer writer(params.query_file.empty() ? std::cout : query_file,
+                  params.expected_file.empty() ? nullptr : &expected_file);
+    write_queries(params, values, filter, counts, writer);
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Copyright Vespa.ai. All rights reserved.
+// Value layout shared by create_docs.cpp and create_queries.cpp.
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+using IntVector = std::vector<int>;
+
+const IntVector hits_ratios = {1, 2, 4, 5, 6, 8, 10, 20, 40, 50, 60, 80, 100, 150, 200};
+
+/*
+ * Keyed bijection over [0, n) used to place documents in a field's value layout.
+ *
+ * A balanced Feistel network permutes the smallest even-bit power of two >= n, and
+ * cycle walking maps values outside [0, n) back into it. This gives a random-looking
+ * permutation in O(1) memory, so any document's values can be computed independently.
+ */
+class Permutation {
+    uint64_t _n;
+    uint64_t _key;
+    int _half_bits;
+    uint64_t _half_mask;
+
+    static uint64_t mix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+    uint64_t feistel(uint64_t x) const {
+        uint64_t left = x >> _half_bits;
+        uint64_t right = x & _half_mask;
+        for (uint64_t round = 0; round < 4; ++round) {
+            uint64_t next = left ^ (mix(_key ^ (round << 56) ^ right) & _half_mask);
+            left = right;
+            right = next;
+        }
+        return (left << _half_bits) | right;
+    }
+
+public:
+    Permutation(uint64_t n, uint64_t key)
+        : _n(n), _key(mix(key)), _half_bits(1), _half_mask(0)
+    {
+        while ((uint64_t(1) << (2 * _half_bits)) < n) {
+            ++_half_bits;
+        }
+        _half_mask = (uint64_t(1) << _half_bits) - 1;
+    }
+    uint64_t operator()(uint64_t x) const {
+        do {
+            x = feistel(x);
+        } while (x >= _n);
+        return x;
+    }
+};
+
+/*
+ * The value layout of a field before permutation: consecutive blocks of positions,
+ * one per hits ratio, followed by positions with value 0.
+ */
+struct Block {
+    uint64_t begin;
+    uint64_t end;
+    int hits_ratio;
+    int first_value;
+    uint64_t hits_per_value;
+};
+
+class FieldLayout {
+    std::vector<Block> _blocks;
+    Permutation _permutation;
+
+public:
+    FieldLayout(std::vector<Block> blocks, uint64_t num_docs, uint64_t key)
+        : _blocks(std::move(blocks)), _permutation(num_docs, key)
+    {}
+    const std::vector<Block> &blocks() const { return _blocks; }
+    // Returns the index of the block the document is placed in, or -1 if its value is 0.
+    int block_index(uint64_t doc_id, uint64_t &value_offset) const {
+        uint64_t pos = _permutation(doc_id);
+        for (size_t i = 0; i < _blocks.size(); ++i) {
+            if (pos < _blocks[i].end) {
+                value_offset = (pos - _blocks[i].begin) / _blocks[i].hits_per_value;
+                return i;
+            }
+        }
+        return -1;
+    }
+    int value(uint64_t doc_id) const {
+        uint64_t value_offset = 0;
+        int i = block_index(doc_id, value_offset);
+        return (i < 0) ? 0 : _blocks[i].first_value + int(value_offset);
+    }
+};
+
+/*
+ * Generates the layout of the values to be inserted into a field.
+ *
+ * When searching for range(my_field, LOWER, UPPER) this will match 'values_in_range'
+ * unique values (or posting lists) and return a number of hits given by the 'hits_ratio'.
+ *
+ * LOWER = hits_ratio * 10000000 + values_in_range
+ * UPPER = LOWER + values_in_range
+ */
+std::vector<Block> make_range_values(uint64_t num_docs, int values_in_range) {
+    std::vector<Block> result;
+    uint64_t i = 0;
+    for (int hits_ratio : hits_ratios) {
+        uint64_t hits = (num_docs * hits_ratio) / 1000;
+        if (hits >= uint64_t(values_in_range)) {
+            result.push_back({i, i + hits, hits_ratio, hits_ratio * 10000000 + values_in_range, hits / values_in_range});
+            i += hits;
+        }
+    }
+    assert(i <= num_docs);
+    return result;
+}
+
+std::vector<Block> make_filter(uint64_t num_docs) {
+    std::vector<Block> result;
+    uint64_t i = 0;
+    for (int hits_ratio : hits_ratios) {
+        uint64_t hits = (num_docs * hits_ratio) / 1000;
+        // All positions in the block get the same value.
+        result.push_back({i, i + hits, hits_ratio, hits_ratio, std::max(hits, uint64_t(1))});
+        i += hits;
+    }
+    assert(i <= num_docs);
+    return result;
+}
+
+using RangeValuesData = std::vector<std::pair<int, FieldLayout>>;
+
+RangeValuesData make_range_values_data(uint64_t num_docs) {
+    RangeValuesData result;
+    for (int values_in_range : {1, 10, 100, 1000, 10000, 100000, 1000000}) {
+        result.emplace_back(values_in_range, FieldLayout(make_range_values(num_docs, values_in_range), num_docs, 1234));
+    }
+    return result;
+}
@@ -4,18 +4,29 @@
  * Utility program to generate json documents for testing ranking performance.
  *
  * Compile program:
- * g++ -std=c++0x doc_generator.cpp -o doc_generator
+ * g++ -std=c++17 -O3 -pthread -I<system-test>/lib doc_generator.cpp -o doc_generator
  *
  * Run program:
  * ./doc_generator 1000
  *
+ * By default title and body contain only the fixed term pattern from gen_field_content().
+ * With -w <tally file> (e.g. lib/gpt-2-webtext-tally.txt) the body also gets text with realistic
+ * term frequencies, with length given by -l (see textgen::LengthDistribution) and optional phrase
+ * co-occurrence (-p <num phrases>:<probability>), so posting list lengths and field lengths are skewed
+ * like in real corpora while the pattern terms used by the queries are still present.
+ *
  **/
 
+#include <cstdio>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unistd.h>
 #include <vector>
 
+#include "text_generator.h"
+
 using namespace std;
 
 string
@@ -24,7 +35,7 @@ gen_field_content()
     vector<int> terms = {64, 32, 16, 8, 4, 2, 1};
     ostringstream oss;
     for (int i = 1; !terms.empty(); ++i) {
-        for (int j = 0; j < terms.size(); ++j) {
+        for (size_t j = 0; j < terms.size(); ++j) {
             oss << terms[j] << " ";
         }
         if (i >= terms.back()) {
@@ -48,49 +59,107 @@ gen_selection_content(int id)
     return oss.str();
 }
 
-double
-gen_random_score()
+/**
+ * The score values of all documents, drawn in document order from rand() seeded with 123456789 as this
+ * generator always has, so they do not change with threads or -w. Each document drew score_2 before
+ * score_1, so score_1 is the second value of its pair.
+ */
+vector<double>
+gen_random_scores(int num_docs)
 {
-    return static_cast<double>(rand()) / static_cast<double>(RAND_MAX);
+    srand(123456789);
+    vector<double> scores(2 * size_t(num_docs));
+    for (double &score : scores) {
+        score = static_cast<double>(rand()) / static_cast<double>(RAND_MAX);
+    }
+    return scores;
 }
 
+struct Params {
+    int num_docs = 0;
+    string tally_file;
+    string body_length = "lognormal:400:0.8";
+    textgen::PhraseConfig phrases;
+    int num_threads = 1;
+};
+
 void
-write_document(int id, const string &field_content, const string &selection_content, double score_1, double score_2)
+write_document(string &out, uint64_t id, const string &field_content, const double *scores,
+               const textgen::TextGenerator *text, const textgen::LengthDistribution &body_length, textgen::Rng &rng)
 {
-    cout << "  {" << endl;
-    cout << "    \"put\": \"id:test:test::" << id << "\"," << endl;
-    cout << "    \"fields\": {" << endl;
-    cout << "      \"title\": \"" << field_content << "\"," << endl;
-    cout << "      \"body\": \"" << field_content << "\"," << endl;
-    cout << "      \"selection\": \"" << selection_content << "\"," << endl;
-    cout << "      \"score_1\": " << score_1 << "," << endl;
-    cout << "      \"score_2\": " << score_2 << endl;
-    cout << "    }" << endl;
-    cout << "  }";
+    char buf[64];
+    if (id > 0) {
+        out += ",\n";
+    }
+    out += "  {\n";
+    out += "    \"put\": \"id:test:test::" + to_string(id) + "\",\n";
+    out += "    \"fields\": {\n";
+    out += "      \"title\": \"" + field_content + "\",\n";
+    out += "      \"body\": \"" + field_content;
+    if (text != nullptr) {
+        text->append_words(out, rng, body_length.sample(rng));
+    }
+    out += "\",\n";
+    out += "      \"selection\": \"" + gen_selection_content(id) + "\",\n";
+    out.append(buf, snprintf(buf, sizeof(buf), "      \"score_1\": %g,\n", scores[1]));
+    out.append(buf, snprintf(buf, sizeof(buf), "      \"score_2\": %g\n", scores[0]));
+    out += "    }\n";
+    out += "  }";
 }
 
 void
-write_documents(int num_docs)
+write_documents(const Params &params)
 {
     string field_content = gen_field_content();
-    cout << "[" << endl;
-    for (int i = 0; i < num_docs; ++i) {
-        if (i > 0) {
-            cout << "," << endl;
-        }
-        write_document(i, field_content, gen_selection_content(i), gen_random_score(), gen_random_score());
+    unique_ptr<textgen::TextGenerator> text;
+    if (!params.tally_file.empty()) {
+        text = make_unique<textgen::TextGenerator>(textgen::Vocabulary::load_tally(params.tally_file), params.phrases);
     }
-    cout << endl << "]" << endl;
+    auto body_length = textgen::LengthDistribution::parse(params.body_length);
+    vector<double> scores = gen_random_scores(params.num_docs);
+    printf("[\n");
+    textgen::write_documents(stdout, 0, params.num_docs, params.num_threads, 123456789,
+                             [&](string &out, uint64_t id, textgen::Rng &rng) {
+                                 write_document(out, id, field_content, &scores[2 * id], text.get(), body_length, rng);
+                             });
+    printf("\n]\n");
+}
+
+void
+usage()
+{
+    cerr << "Usage: doc_generator [-w tally_file] [-l body_length] [-p num_phrases:probability] [-t threads] num_docs" << endl;
+    exit(1);
 }
 
 int
 main(int argc, char **argv)
 {
-    if (argc != 2) {
-        cout << "Usage: doc_generator num_docs" << endl;
-        exit(1);
+    Params params;
+    int option;
+    while ((option = getopt(argc, argv, "w:l:p:t:")) != -1) {
+        switch (option) {
+        case 'w':
+            params.tally_file = optarg;
+            break;
+        case 'l':
+            params.body_length = optarg;
+            break;
+        case 'p':
+            if (sscanf(optarg, "%zu:%lf", &params.phrases.num_phrases, &params.phrases.probability) != 2) {
+                usage();
+            }
+            break;
+        case 't':
+            params.num_threads = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
     }
-    int num_docs = atoi(argv[1]);
-    srand(123456789);
-    write_documents(num_docs);
+    if (argc - optind != 1) {
+        usage();
+    }
+    params.num_docs = atoi(argv[optind]);
+    write_documents(params);
 }
@@ -4,6 +4,8 @@ require 'performance_test'
 require 'app_generator/search_app'
 require 'performance/fbench'
 require 'pp'
+require 'bm25_oracle'
+require 'data_generator'
 
 
 class TwoPhaseRankingTest < PerformanceTest
@@ -16,6 +18,10 @@ class TwoPhaseRankingTest < PerformanceTest
   RANK_PROFILE = "rank_profile"
   BASIC_TWO_PHASE = "basic_two_phase"
   FBENCH_RUNTIME = 20
+  # Title and body are the same in all documents, so these mix selection terms, whose field length
+  # varies, with title and body terms matching every document.
+  BM25_QUERIES = ['selection:2 selection:50', 'selection:10 title:64', 'selection:1 selection:20 body:4',
+                  'title:1 body:2 selection:5']
   
   def initialize(*args)
     super(*args)
@@ -29,7 +35,7 @@ class TwoPhaseRankingTest < PerformanceTest
   def create_doc(num_docs, path)
     container = vespa.container.values.first
     tmp_bin_dir = container.create_tmp_bin_dir
-    container.execute( "g++ -std=c++0x #{selfdir}doc_generator.cpp -o #{tmp_bin_dir}/doc_generator")
+    container.execute("g++ -std=c++17 -O3 -pthread -I#{DataGenerator.lib_dir} #{selfdir}doc_generator.cpp -o #{tmp_bin_dir}/doc_generator")
     container.execute("#{tmp_bin_dir}/doc_generator #{num_docs} > #{path}")
     return path
   end
@@ -44,6 +50,7 @@ class TwoPhaseRankingTest < PerformanceTest
     docs_file = docs_file_1M
     run_feeder(docs_file, [], {localfile: true})
     vespa.search["search"].first.trigger_flush
+    verify_bm25_top_hits(docs_file)
 
     # warmup
     run_fbench_helper(100, 8, 8, BASIC_TWO_PHASE, false)
@@ -61,6 +68,24 @@ class TwoPhaseRankingTest < PerformanceTest
     end
   end
 
+  # Checks totalCount and the top hit scores of BM25 queries against Bm25Oracle. Many documents tie,
+  # so the hit order among them is arbitrary and only the scores at each position are compared.
+  def verify_bm25_top_hits(docs_file)
+    query_file = dirs.tmpdir + "bm25_queries.txt"
+    File.write(query_file, BM25_QUERIES.join("\n") + "\n")
+    @container.copy(query_file, File.dirname(query_file))
+    oracle = Bm25Oracle.new(@container)
+    output = oracle.compute(feed: docs_file, query_file: query_file, fields: ['title', 'body', 'selection'],
+                            output: dirs.tmpdir + "bm25_expected.jsonl", total_count: true)
+    Bm25Oracle.parse(@container.execute("cat #{output}", :noecho => true)).each do |expected|
+      result = search("/search/?query=#{URI.encode_www_form_component(expected['query'])}&type=any&ranking=bm25&hits=10")
+      assert_hitcount(result, expected['totalCount'])
+      expected['hits'].each_with_index do |hit, i|
+        assert_relevancy(result, hit['relevance'], i, 1e-4)
+      end
+    end
+  end
+
   def run_fbench_helper(selection, body_positions, body_terms, rank_profile, run_profiler=true)
     query_file = write_query_file(selection, body_positions, body_terms, 1, 1)
     fillers = [parameter_filler(SELECTION, selection),
@@ -1,48 +1,170 @@
 // Copyright Vespa.ai. All rights reserved.
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <numeric>
 #include <string>
+#include <unordered_set>
 #include <vector>
 #include <random>
-#include <ctime>
+#include <unistd.h>
 
 // To compile on rhel6
 // g++ -Wl,-rpath,$vespa_home/lib64/ -Wall -g -O3 -o data_generator data_generator.cpp
 
+namespace {
+
+struct Params {
+    uint64_t seed = 1234;
+    // Number of distinct labels that may ever be generated, 0 means unbounded.
+    uint64_t label_cardinality = 0;
+    // Probability that a cell reuses a label that has already been generated.
+    double reuse_probability = 0.0;
+    size_t min_label_length = 0;
+    size_t max_label_length = 0;
+    std::string sidecar_file;
+    int sidecar_interval = 1000;
+
+    // Without label options, every cell gets a new label in the original doc_<d>_label_<i>_value_<v> format,
+    // so baseline results stay comparable.
+    bool default_labels() const {
+        return label_cardinality == 0 && reuse_probability == 0.0 && max_label_length == 0;
+    }
+};
+
+uint64_t
+mix(uint64_t x)
+{
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Hands out label ids from a global dictionary. New ids are allocated in
+ * increasing order, so the set of labels seen so far is always [0, num_issued).
+ */
+class LabelSource {
+    const Params &_params;
+    std::mt19937_64 &_rng;
+    uint64_t _num_issued;
+    std::unordered_set<uint64_t> _in_doc;
+
+    uint64_t draw_seen() {
+        return std::uniform_int_distribution<uint64_t>(0, _num_issued - 1)(_rng);
+    }
+    bool exhausted() const {
+        return (_params.label_cardinality != 0) && (_num_issued >= _params.label_cardinality);
+    }
+    uint64_t draw() {
+        if (_num_issued > 0) {
+            if (exhausted() || std::bernoulli_distribution(_params.reuse_probability)(_rng)) {
+                return draw_seen();
+            }
+        }
+        return _num_issued++;
+    }
+
+public:
+    LabelSource(const Params &params, std::mt19937_64 &rng)
+        : _params(params), _rng(rng), _num_issued(0), _in_doc()
+    {}
+    void start_doc() { _in_doc.clear(); }
+    uint64_t next() {
+        // Labels must be unique within a tensor; fall back to a new label after a few collisions.
+        for (int attempt = 0; attempt < 8; ++attempt) {
+            uint64_t id = draw();
+            if (_in_doc.insert(id).second) {
+                return id;
+            }
+        }
+        while (!exhausted()) {
+            uint64_t id = _num_issued++;
+            if (_in_doc.insert(id).second) {
+                return id;
+            }
+        }
+        for (uint64_t id = 0; id < _num_issued; ++id) {
+            if (_in_doc.insert(id).second) {
+                return id;
+            }
+        }
+        std::cerr << "Label cardinality too small for tensor size" << std::endl;
+        std::exit(1);
+    }
+    uint64_t num_issued() const { return _num_issued; }
+};
+
+/**
+ * The text of a label is a pure function of its id and the seed, so a reused
+ * label always has the same spelling (and length) as when it was first issued.
+ */
+void
+append_label(std::string &out, const Params &params, uint64_t id)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    size_t start = out.size();
+    out.append("label_");
+    out.append(std::to_string(id));
+    if (params.max_label_length == 0) {
+        return;
+    }
+    uint64_t h = mix(params.seed ^ mix(id));
+    size_t span = params.max_label_length - params.min_label_length + 1;
+    size_t length = params.min_label_length + (h % span);
+    if (out.size() - start >= length) {
+        return;
+    }
+    out.push_back('_');
+    while (out.size() - start < length) {
+        h = mix(h);
+        out.push_back(chars[h % (sizeof(chars) - 1)]);
+    }
+}
+
 std::ostream &
-generate_tensor(std::ostream &os, int doc_id, int tensor_size)
+generate_tensor(std::ostream &os, const Params &params, LabelSource &labels, std::mt19937_64 &rng, int doc_id, int tensor_size)
 {
+    std::string label;
+    labels.start_doc();
     os << "\"cells\":{";
     for (int i = 0; i < tensor_size; ++i) {
         if (i != 0) {
             os << ",";
         }
-
-        const int value = std::rand();
-        // Adding random part to avoid cache hits
-        os << "\"" << "doc_" << doc_id << "_label_" << i << "_value_" << value << "\":" << value;
+        if (params.default_labels()) {
+            const uint64_t value = rng() & 0x7fffffff;
+            // Adding random part to avoid cache hits
+            os << "\"" << "doc_" << doc_id << "_label_" << i << "_value_" << value << "\":" << value;
+            continue;
+        }
+        label.clear();
+        append_label(label, params, labels.next());
+        os << "\"" << label << "\":" << (rng() & 0x7fffffff);
     }
     return os << "}";
 }
 
 void
-generate_put(std::ostream &os, int doc_id, int tensor_size)
+generate_put(std::ostream &os, const Params &params, LabelSource &labels, std::mt19937_64 &rng, int doc_id, int tensor_size)
 {
     os << "{" << "\"put\":\"id:test:test::" << doc_id << "\",\"fields\":{" << std::endl;
-    os << "\"tensor\"" << ":{"; generate_tensor(os, doc_id, tensor_size) << "}";
+    os << "\"tensor\"" << ":{"; generate_tensor(os, params, labels, rng, doc_id, tensor_size) << "}";
     os << "}}";
 }
 
 std::vector<int>
-generate_doc_ids(int num_docs, bool shuffle)
+generate_doc_ids(int num_docs, bool shuffle, std::mt19937_64 &rng)
 {
     std::vector<int> result(num_docs);
     std::iota(result.begin(), result.end(), 0);
 
     if (shuffle) {
-        std::mt19937 rng(static_cast<unsigned>(std::time(nullptr)));
         std::shuffle(result.begin(), result.end(), rng);
     }
 
@@ -50,19 +172,35 @@ generate_doc_ids(int num_docs, bool shuffle)
 }
 
 void
-generate_puts(std::ostream &os, int num_docs, int tensor_size)
+generate_puts(std::ostream &os, const Params &params, int num_docs, int tensor_size)
 {
-    auto doc_ids = generate_doc_ids(num_docs, true);
+    std::mt19937_64 rng(params.seed);
+    LabelSource labels(params, rng);
+    auto doc_ids = generate_doc_ids(num_docs, true, rng);
+
+    std::ofstream sidecar;
+    if (!params.sidecar_file.empty()) {
+        sidecar.open(params.sidecar_file);
+        sidecar << "docs\tcells\tunique_labels" << std::endl;
+    }
 
     os << "[" << std::endl;
     bool first = true;
+    uint64_t num_docs_written = 0;
 
     for (int doc_id : doc_ids) {
         if (!first) {
             os << "," << std::endl;
         }
-        generate_put(os, doc_id, tensor_size);
+        generate_put(os, params, labels, rng, doc_id, tensor_size);
         first = false;
+        ++num_docs_written;
+        if (sidecar.is_open() &&
+            ((num_docs_written % params.sidecar_interval) == 0 || num_docs_written == doc_ids.size()))
+        {
+            sidecar << num_docs_written << "\t" << (num_docs_written * tensor_size) << "\t"
+                    << (params.default_labels() ? num_docs_written * tensor_size : labels.num_issued()) << std::endl;
+        }
     }
 
     os << std::endl << "]" << std::endl;
@@ -71,31 +209,74 @@ generate_puts(std::ostream &os, int num_docs, int tensor_size)
 void
 usage(char *argv[])
 {
-    std::cerr << argv[0] << " <num-docs> <tensor-size>" << std::endl;
+    std::cerr << argv[0] << " [options] <num-docs> <tensor-size>" << std::endl
+              << "  -s <seed>              (default 1234)" << std::endl
+              << "  -c <label cardinality> (distinct labels in total, default 0 = unbounded)" << std::endl
+              << "  -r <reuse probability> (chance a cell reuses an already generated label, default 0)" << std::endl
+              << "  -l <min>[:<max>]       (label length, uniformly distributed, default doc_<d>_label_<i>_value_<v>)" << std::endl
+              << "  -o <sidecar file>      (write docs/cells/unique label counts over time)" << std::endl
+              << "  -i <interval>          (docs between sidecar lines, default 1000)" << std::endl;
 }
 
 bool
-verify_usage(int argc, char *argv[])
+parse_length(const std::string &arg, Params &params)
 {
-    if (argc != 3) {
-        usage(argv);
-        return false;
-    }
-    return true;
+    auto colon = arg.find(':');
+    params.min_label_length = std::stoul(arg.substr(0, colon));
+    params.max_label_length = (colon == std::string::npos)
+                              ? params.min_label_length
+                              : std::stoul(arg.substr(colon + 1));
+    return params.min_label_length <= params.max_label_length;
+}
+
 }
 
 int
 main(int argc, char *argv[])
 {
-    if (!verify_usage(argc, argv)) {
+    Params params;
+    int option;
+    while ((option = getopt(argc, argv, "s:c:r:l:o:i:h")) != -1) {
+        switch (option) {
+        case 's':
+            params.seed = std::stoull(optarg);
+            break;
+        case 'c':
+            params.label_cardinality = std::stoull(optarg);
+            break;
+        case 'r':
+            params.reuse_probability = std::stod(optarg);
+            break;
+        case 'l':
+            if (!parse_length(optarg, params)) {
+                usage(argv);
+                return 1;
+            }
+            break;
+        case 'o':
+            params.sidecar_file = optarg;
+            break;
+        case 'i':
+            params.sidecar_interval = std::max(1, std::stoi(optarg));
+            break;
+        default:
+            usage(argv);
+            return 1;
+        }
+    }
+    if (argc - optind != 2 || params.reuse_probability < 0.0 || params.reuse_probability > 1.0) {
+        usage(argv);
         return 1;
     }
 
-    int num_docs = std::stoi(argv[1]);
-    int tensor_size = std::stoi(argv[2]);
+    int num_docs = std::stoi(argv[optind]);
+    int tensor_size = std::stoi(argv[optind + 1]);
+    if (params.label_cardinality != 0 && params.label_cardinality < uint64_t(tensor_size)) {
+        std::cerr << "Label cardinality must be at least the tensor size" << std::endl;
+        return 1;
+    }
 
-    generate_puts(std::cout, num_docs, tensor_size);
+    generate_puts(std::cout, params, num_docs, tensor_size);
 
     return 0;
 }
-
@@ -0,0 +1,429 @@
+// Copyright Vespa.ai. All rights reserved.
+
+// Benchmark of ICU collation as used by sort=uca(field,locale,strength), extending
+// search/bugs/6581037/small_icu.cpp from a single compare to generated multilingual corpora.
+//
+// For each locale and strength it measures, using several threads (each with its own clone of the collator):
+//   compare    - Collator::compareUTF8 on random pairs of strings
+//   sortkey    - Collator::getSortKey for all strings (UTF-8 converted to UTF-16 first, as the engine does),
+//                and the average key length
+//   sort       - sorting all strings with compareUTF8 as comparator
+//   key sort   - sorting all strings by their cached sort keys (memcmp), i.e. the benefit of caching keys
+// and checks that compare and sort keys order the sampled pairs the same way.
+//
+// Compile with: g++ -std=c++17 -O3 -pthread -I<system-test>/lib -o collation_benchmark collation_benchmark.cpp -licui18n -licuuc -licudata
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <unicode/coll.h>
+#include <unicode/stringpiece.h>
+#include <unicode/unistr.h>
+
+#include "text_generator.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> result;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            result.push_back(item);
+        }
+    }
+    return result;
+}
+
+// Runs fn(thread, begin, end) on 'threads' threads, splitting [0, n) evenly.
+template <typename Fn>
+void parallel_for(size_t threads, size_t n, Fn fn) {
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&fn, t, threads, n] { fn(t, n * t / threads, n * (t + 1) / threads); });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+}
+
+// Sorts slices on separate threads, then merges pairs of slices in parallel rounds.
+// 'make_less(thread)' returns the comparator used by a thread.
+template <typename MakeLess>
+void parallel_sort(std::vector<uint32_t> &v, size_t threads, MakeLess make_less) {
+    std::vector<size_t> bounds;
+    for (size_t t = 0; t <= threads; ++t) {
+        bounds.push_back(v.size() * t / threads);
+    }
+    parallel_for(threads, threads, [&](size_t t, size_t, size_t) {
+        std::sort(v.begin() + bounds[t], v.begin() + bounds[t + 1], make_less(t));
+    });
+    while (bounds.size() > 2) {
+        size_t merges = (bounds.size() - 1) / 2;
+        parallel_for(merges, merges, [&](size_t t, size_t, size_t) {
+            std::inplace_merge(v.begin() + bounds[2 * t], v.begin() + bounds[2 * t + 1], v.begin() + bounds[2 * t + 2],
+                               make_less(t));
+        });
+        std::vector<size_t> next;
+        for (size_t i = 0; i < bounds.size(); i += 2) {
+            next.push_back(bounds[i]);
+        }
+        if (next.back() != bounds.back()) {
+            next.push_back(bounds.back());
+        }
+        bounds.swap(next);
+    }
+}
+
+/**
+ * UTF-8 strings stored back to back.
+ */
+class Corpus {
+    std::string _text;
+    std::vector<uint64_t> _offsets;
+
+public:
+    Corpus() : _text(), _offsets(1, 0) {}
+    void add(std::string_view s) {
+        _text.append(s);
+        _offsets.push_back(_text.size());
+    }
+    void append(const Corpus &other) {
+        uint64_t base = _text.size();
+        _text.append(other._text);
+        for (size_t i = 1; i < other._offsets.size(); ++i) {
+            _offsets.push_back(base + other._offsets[i]);
+        }
+    }
+    size_t size() const { return _offsets.size() - 1; }
+    size_t bytes() const { return _text.size(); }
+    icu::StringPiece get(size_t i) const {
+        return icu::StringPiece(_text.data() + _offsets[i], int32_t(_offsets[i + 1] - _offsets[i]));
+    }
+};
+
+struct Script {
+    const char *name;
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    uint32_t min_word;
+    uint32_t max_word;
+};
+
+// Letters of each script; Latin includes accented letters so secondary and tertiary strength differ from primary.
+const std::vector<Script> scripts = {
+    {"latin",    {{'a', 'z'}, {'a', 'z'}, {'a', 'z'}, {0xe0, 0xf6}, {0xf8, 0xff}}, 2, 10},
+    {"cyrillic", {{0x430, 0x44f}}, 2, 10},
+    {"arabic",   {{0x621, 0x63a}, {0x641, 0x64a}}, 2, 8},
+    {"cjk",      {{0x4e00, 0x62ff}}, 1, 4},
+    {"kana",     {{0x3041, 0x3096}, {0x30a1, 0x30fa}}, 2, 6},
+};
+
+void append_utf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += char(cp);
+    } else if (cp < 0x800) {
+        out += char(0xc0 | (cp >> 6));
+        out += char(0x80 | (cp & 0x3f));
+    } else {
+        out += char(0xe0 | (cp >> 12));
+        out += char(0x80 | ((cp >> 6) & 0x3f));
+        out += char(0x80 | (cp & 0x3f));
+    }
+}
+
+/**
+ * Generates strings of 1-3 words. With 'mixed', each string is in a random script
+ * (and a quarter of them mix in a word from another), otherwise all are in 'script'.
+ * Words are capitalized and numbers are added at random.
+ */
+void generate(Corpus &corpus, const std::string &script, size_t first, size_t last, uint64_t seed) {
+    std::string s;
+    for (size_t i = first; i < last; ++i) {
+        textgen::Rng rng(seed ^ textgen::mix(i));
+        size_t main = 0;
+        if (script == "mixed") {
+            main = rng.below(scripts.size());
+        } else {
+            while (main < scripts.size() && script != scripts[main].name) {
+                ++main;
+            }
+        }
+        s.clear();
+        size_t words = 1 + rng.below(3);
+        for (size_t w = 0; w < words; ++w) {
+            const Script &sc = scripts[(script == "mixed" && rng.chance(0.25)) ? rng.below(scripts.size()) : main];
+            if (w > 0) {
+                s += ' ';
+            }
+            if (rng.chance(0.05)) {
+                s += std::to_string(rng.below(10000));
+                continue;
+            }
+            size_t len = sc.min_word + rng.below(sc.max_word - sc.min_word + 1);
+            for (size_t c = 0; c < len; ++c) {
+                const auto &range = sc.ranges[rng.below(sc.ranges.size())];
+                uint32_t cp = range.first + rng.below(range.second - range.first + 1);
+                if (c == 0 && cp < 0x100 && cp != 0xf7 && cp != 0xff && rng.chance(0.3)) {
+                    cp -= 0x20; // capitalize Latin
+                }
+                append_utf8(s, cp);
+            }
+        }
+        corpus.add(s);
+    }
+}
+
+Corpus make_corpus(const std::string &script, const std::string &input, size_t n, size_t threads, uint64_t seed) {
+    Corpus corpus;
+    if (!input.empty()) {
+        // Strings are the lines of the input file, repeated up to n strings.
+        std::ifstream in(input);
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(in, line);) {
+            if (!line.empty()) {
+                lines.push_back(line);
+            }
+        }
+        if (lines.empty()) {
+            fprintf(stderr, "No strings in %s\n", input.c_str());
+            exit(1);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            corpus.add(lines[i % lines.size()]);
+        }
+        return corpus;
+    }
+    std::vector<Corpus> parts(threads);
+    parallel_for(threads, n, [&](size_t t, size_t first, size_t last) { generate(parts[t], script, first, last, seed); });
+    for (const auto &part : parts) {
+        corpus.append(part);
+    }
+    return corpus;
+}
+
+icu::Collator::ECollationStrength parse_strength(const std::string &name) {
+    if (name == "primary") return icu::Collator::PRIMARY;
+    if (name == "secondary") return icu::Collator::SECONDARY;
+    if (name == "tertiary") return icu::Collator::TERTIARY;
+    if (name == "quaternary") return icu::Collator::QUATERNARY;
+    if (name == "identical") return icu::Collator::IDENTICAL;
+    fprintf(stderr, "Unknown strength: %s\n", name.c_str());
+    exit(1);
+}
+
+struct SortKey {
+    const uint8_t *data;
+    uint32_t len;
+};
+
+bool key_less(const SortKey &a, const SortKey &b) {
+    int r = memcmp(a.data, b.data, std::min(a.len, b.len));
+    return (r != 0) ? (r < 0) : (a.len < b.len);
+}
+
+int sign(int v) { return (v > 0) - (v < 0); }
+
+struct Result {
+    double compares_per_s = 0.0;
+    double keys_per_s = 0.0;
+    double avg_key_bytes = 0.0;
+    double key_gen_s = 0.0;
+    double sort_s = 0.0;
+    double key_sort_s = 0.0;
+    uint64_t mismatches = 0;
+};
+
+Result run(const Corpus &corpus, const icu::Collator &prototype, size_t threads, size_t pairs, bool compare_sort, uint64_t seed) {
+    Result result;
+    size_t n = corpus.size();
+    std::vector<std::unique_ptr<icu::Collator>> colls;
+    for (size_t t = 0; t < threads; ++t) {
+        colls.emplace_back(prototype.clone());
+    }
+    std::vector<std::pair<uint32_t, uint32_t>> sample(pairs);
+    textgen::Rng rng(seed);
+    for (auto &p : sample) {
+        p = {uint32_t(rng.below(n)), uint32_t(rng.below(n))};
+    }
+    std::vector<int> compare_sign(pairs);
+
+    auto start = Clock::now();
+    parallel_for(threads, pairs, [&](size_t t, size_t first, size_t last) {
+        UErrorCode status = U_ZERO_ERROR;
+        for (size_t i = first; i < last; ++i) {
+            compare_sign[i] = colls[t]->compareUTF8(corpus.get(sample[i].first), corpus.get(sample[i].second), status);
+        }
+    });
+    result.compares_per_s = pairs / seconds_since(start);
+
+    std::vector<SortKey> keys(n);
+    std::vector<std::vector<uint8_t>> buffers(threads);
+    start = Clock::now();
+    parallel_for(threads, n, [&](size_t t, size_t first, size_t last) {
+        auto &buf = buffers[t];
+        std::vector<uint64_t> offsets;
+        offsets.reserve(last - first);
+        icu::UnicodeString str;
+        for (size_t i = first; i < last; ++i) {
+            str = icu::UnicodeString::fromUTF8(corpus.get(i));
+            size_t offset = buf.size();
+            buf.resize(offset + 64);
+            int32_t len = colls[t]->getSortKey(str, buf.data() + offset, 64);
+            if (len > 64) {
+                buf.resize(offset + len);
+                colls[t]->getSortKey(str, buf.data() + offset, len);
+            }
+            buf.resize(offset + len);
+            offsets.push_back(offset);
+            keys[i].len = len;
+        }
+        // The buffer is final, so keys can point into it.
+        for (size_t i = first; i < last; ++i) {
+            keys[i].data = buf.data() + offsets[i - first];
+        }
+    });
+    result.key_gen_s = seconds_since(start);
+    result.keys_per_s = n / result.key_gen_s;
+    uint64_t key_bytes = 0;
+    for (const auto &buf : buffers) {
+        key_bytes += buf.size();
+    }
+    result.avg_key_bytes = double(key_bytes) / n;
+
+    for (size_t i = 0; i < pairs; ++i) {
+        const SortKey &a = keys[sample[i].first];
+        const SortKey &b = keys[sample[i].second];
+        int key_sign = key_less(a, b) ? -1 : (key_less(b, a) ? 1 : 0);
+        result.mismatches += (key_sign != sign(compare_sign[i])) ? 1 : 0;
+    }
+
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    start = Clock::now();
+    parallel_sort(order, threads, [&keys](size_t) {
+        return [&keys](uint32_t a, uint32_t b) { return key_less(keys[a], keys[b]); };
+    });
+    result.key_sort_s = seconds_since(start);
+
+    if (compare_sort) {
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = i;
+        }
+        start = Clock::now();
+        parallel_sort(order, threads, [&corpus, &colls](size_t t) {
+            const icu::Collator *coll = colls[t].get();
+            return [&corpus, coll](uint32_t a, uint32_t b) {
+                UErrorCode status = U_ZERO_ERROR;
+                return coll->compareUTF8(corpus.get(a), corpus.get(b), status) == UCOL_LESS;
+            };
+        });
+        result.sort_s = seconds_since(start);
+    }
+    return result;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n strings] [-t threads] [-l locales] [-s strengths] [-c script] [-i input file]\n"
+                    "       [-p pairs] [-r seed] [-x]\n"
+                    "  -n: number of strings (default 1000000)\n"
+                    "  -t: comma separated thread counts (default 1)\n"
+                    "  -l: comma separated locales (default en,de,sv,ar,ru,zh,ja)\n"
+                    "  -s: comma separated strengths: primary,secondary,tertiary,quaternary,identical (default primary,tertiary)\n"
+                    "  -c: script of generated strings: latin, cyrillic, arabic, cjk, kana or mixed (default)\n"
+                    "  -i: use the lines of a file (e.g. search/bugs/6581037/input-ar.txt) instead of generated strings\n"
+                    "  -p: number of random pairs compared (default: number of strings)\n"
+                    "  -x: skip sorting with compare, which takes long for large corpora\n"
+                    "Prints a tab separated line per locale, strength and thread count.\n", prog);
+}
+
+}
+
+int main(int argc, char **argv) {
+    size_t n = 1000000;
+    std::vector<std::string> thread_counts = {"1"};
+    std::vector<std::string> locales = split("en,de,sv,ar,ru,zh,ja");
+    std::vector<std::string> strengths = split("primary,tertiary");
+    std::string script = "mixed";
+    std::string input;
+    size_t pairs = 0;
+    uint64_t seed = 1;
+    bool compare_sort = true;
+    int option;
+    while ((option = getopt(argc, argv, "n:t:l:s:c:i:p:r:xh")) != -1) {
+        switch (option) {
+        case 'n': n = strtoull(optarg, nullptr, 0); break;
+        case 't': thread_counts = split(optarg); break;
+        case 'l': locales = split(optarg); break;
+        case 's': strengths = split(optarg); break;
+        case 'c': script = optarg; break;
+        case 'i': input = optarg; break;
+        case 'p': pairs = strtoull(optarg, nullptr, 0); break;
+        case 'r': seed = strtoull(optarg, nullptr, 0); break;
+        case 'x': compare_sort = false; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (n == 0 || n > UINT32_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (script != "mixed" && std::none_of(scripts.begin(), scripts.end(), [&](const Script &s) { return script == s.name; })) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (pairs == 0) {
+        pairs = n;
+    }
+    size_t max_threads = 1;
+    for (const auto &t : thread_counts) {
+        max_threads = std::max(max_threads, size_t(std::stoul(t)));
+    }
+    auto start = Clock::now();
+    Corpus corpus = make_corpus(script, input, n, max_threads, seed);
+    fprintf(stderr, "Corpus of %zu strings (%zu bytes, %s) made in %.2f s\n", corpus.size(), corpus.bytes(),
+            input.empty() ? script.c_str() : input.c_str(), seconds_since(start));
+
+    printf("locale\tstrength\tstrings\tthreads\tcompares_per_s\tkeys_per_s\tavg_key_bytes\tkey_gen_s\tkey_sort_s\tsort_s\tmismatches\n");
+    for (const auto &locale : locales) {
+        for (const auto &strength : strengths) {
+            UErrorCode status = U_ZERO_ERROR;
+            std::unique_ptr<icu::Collator> coll(icu::Collator::createInstance(icu::Locale(locale.c_str()), status));
+            if (U_FAILURE(status)) {
+                fprintf(stderr, "Failed to create collator for '%s': %s\n", locale.c_str(), u_errorName(status));
+                return 1;
+            }
+            coll->setStrength(parse_strength(strength));
+            for (const auto &t : thread_counts) {
+                size_t threads = std::max(1ul, std::stoul(t));
+                Result r = run(corpus, *coll, threads, pairs, compare_sort, seed);
+                printf("%s\t%s\t%zu\t%zu\t%.0f\t%.0f\t%.2f\t%.3f\t%.3f\t%.3f\t%lu\n", locale.c_str(), strength.c_str(),
+                       n, threads, r.compares_per_s, r.keys_per_s, r.avg_key_bytes, r.key_gen_s, r.key_sort_s,
+                       r.sort_s, r.mismatches);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
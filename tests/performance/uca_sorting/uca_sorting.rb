@@ -0,0 +1,65 @@
+# Copyright Vespa.ai. All rights reserved.
+
+require 'performance_test'
+require 'app_generator/search_app'
+require 'data_generator'
+require 'environment'
+
+# Cost of locale aware sorting (sort=uca(field,locale,strength)) measured with ICU directly:
+# compare and sort key throughput, sort key length, and sorting with compare versus cached sort keys.
+class UcaSortingBenchmarkTest < PerformanceTest
+
+  LOCALES = 'en,de,sv,ar,ru,zh,ja'
+  STRENGTHS = 'primary,tertiary'
+
+  def setup
+    super
+    set_owner('balder')
+  end
+
+  def timeout_seconds
+    5400
+  end
+
+  def test_uca_sorting
+    set_description('Test throughput of ICU collation compare and sort keys, and sorting with and without cached sort keys')
+    deploy_app(SearchApp.new.sd(selfdir + 'test.sd'))
+    @node = vespa.search['search'].first
+    @benchmark = "#{@node.create_tmp_bin_dir}/collation_benchmark"
+    @node.execute("g++ -std=c++17 -O3 -pthread -I#{DataGenerator.lib_dir} -o #{@benchmark} #{selfdir}/collation_benchmark.cpp " +
+                  "-licui18n -licuuc -licudata")
+    run_benchmark(1_000_000, '1,8', 'mixed')
+    run_benchmark(1_000_000, '8', 'latin')
+    run_benchmark(1_000_000, '8', 'cjk')
+    # Sorting 10M strings with compare takes minutes, so only sort keys are measured at these sizes.
+    run_benchmark(10_000_000, '8', 'mixed', '-x')
+    # Corpus sizes of a large content node, about 13 GB of strings and sort keys. Compares and
+    # mismatches are sampled from 10M pairs.
+    run_benchmark(100_000_000, '8', 'mixed', '-x -p 10000000')
+  end
+
+  def run_benchmark(strings, threads, script, extra = '')
+    output = @node.execute("#{@benchmark} -n #{strings} -t #{threads} -c #{script} -l #{LOCALES} -s #{STRENGTHS} #{extra}")
+    columns = nil
+    output.each_line do |line|
+      values = line.chomp.split("\t")
+      if values.first == 'locale'
+        columns = values
+      elsif columns && values.size == columns.size
+        row = Hash[columns.zip(values)]
+        assert_equal('0', row['mismatches'], "Sort keys and compare disagree for #{row['locale']} #{row['strength']}")
+        fillers = [parameter_filler('script', script),
+                   parameter_filler('locale', row['locale']),
+                   parameter_filler('strength', row['strength']),
+                   parameter_filler('strings', row['strings']),
+                   parameter_filler('threads', row['threads'])]
+        ['compares_per_s', 'keys_per_s', 'avg_key_bytes', 'key_gen_s', 'key_sort_s'].each do |metric|
+          fillers << metric_filler(metric, row[metric].to_f)
+        end
+        fillers << metric_filler('sort_s', row['sort_s'].to_f) if extra.empty?
+        write_report(fillers)
+      end
+    end
+  end
+
+end
@@ -5,18 +5,37 @@
 #include <cassert>
 
 /**
- * Generate puts/removes to use in lidspace compaction test
+ * Generate puts of <docs per user> documents for each of <num users> users (n= locations).
+ *
+ * By default user i has location i. Given <bits> and <buckets>, users are instead placed so that
+ * their documents land in exactly <buckets> of the 2^<bits> buckets using <bits> bits (e.g. the
+ * distribution bits), spread evenly over the bucket space, with users assigned round robin.
+ * Locations are 32 bits, so at most <buckets> * 2^(32 - <bits>) users get distinct locations.
  **/
 
 int main (int argc, char *argv[]) {
-    assert(argc == 3);
+    assert(argc == 3 || argc == 5);
     const size_t num_users = strtoul(argv[1], nullptr, 0);
     const size_t num_docs_per_user = strtoul(argv[2], nullptr, 0);
+    size_t bits = 0;
+    size_t num_buckets = 0;
+    if (argc == 5) {
+        bits = strtoul(argv[3], nullptr, 0);
+        num_buckets = strtoul(argv[4], nullptr, 0);
+        assert(bits > 0 && bits < 32 && num_buckets > 0 && num_buckets <= (size_t(1) << bits));
+        assert(num_users <= (num_buckets << (32 - bits)));
+    }
     printf("[\n");
     bool first = true;
     for (size_t i(0); i < num_users; i++) {
+        size_t location = i;
+        if (num_buckets > 0) {
+            // The lower <bits> bits of an n= location select the bucket.
+            size_t bucket = (i % num_buckets) * ((size_t(1) << bits) / num_buckets);
+            location = ((i / num_buckets) << bits) | bucket;
+        }
         for (size_t j(0); j < num_docs_per_user; j++) {
-            printf("%s{\"id\":\"id:storage_test:music:n=%d:%d\", \"fields\":{\"title\": \"title%d\"}}\n", first ? "" : ",\n", i, j, i);
+            printf("%s{\"id\":\"id:storage_test:music:n=%zu:%zu\", \"fields\":{\"title\": \"title%zu\"}}\n", first ? "" : ",\n", location, j, i);
             first = false;
         }
     }